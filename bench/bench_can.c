@@ -0,0 +1,923 @@
+/*!
+	@file   bench_can.c
+	@brief  Host benchmark of the bxCAN driver against the emulated peripheral
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define BENCH_CALLBACKS		16U
+#define BENCH_CALLBACKS_LARGE	160U
+#define BENCH_BURST		30U
+#define BENCH_TEMPLATES		40U
+#define BENCH_AUTO_EXACT	70U
+#define BENCH_SLOW_WORK		400U
+#define BENCH_AUTO_EXT		12U
+#define BENCH_RCU_NODES		8U
+#define BENCH_RCU_ID		0x1C0U
+#define BENCH_PROFILE_ID	0x1B0U
+#define BENCH_PROFILE_BUDGET	2000U
+#define BENCH_BUS_OFF_STORM	16U
+#define BENCH_IDLE_POLLS	1000000U
+#define BENCH_BULK_ID		0x700U
+#define BENCH_URGENT_ID		0x010U
+#define BENCH_URGENT_EVERY	16U
+#define BENCH_COALESCE_BURST	32U
+#define BENCH_ISOTP_SESSIONS	2U
+#define BENCH_ISOTP_SIZE	4096U
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "bench_common.h"
+#include <pthread.h>
+#include "drv_canbus.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+static CAN_FilterTypeDef bench_filters[] =
+{
+	{
+		.FilterIdHigh = 0x100 << 5,
+		.FilterIdLow = 0x0000,
+		.FilterMaskIdHigh = 0x700 << 5,
+		.FilterMaskIdLow = 0x0000,
+		.FilterFIFOAssignment = CAN_FILTER_FIFO0,
+		.FilterBank = 0,
+		.FilterMode = CAN_FILTERMODE_IDMASK,
+		.FilterScale = CAN_FILTERSCALE_32BIT,
+		.FilterActivation = CAN_FILTER_ENABLE,
+		.SlaveStartFilterBank = 14
+	},
+	{
+		.FilterIdHigh = 0x050 << 5,
+		.FilterIdLow = 0x0000,
+		.FilterMaskIdHigh = 0x7FC << 5,
+		.FilterMaskIdLow = 0x0000,
+		.FilterFIFOAssignment = CAN_FILTER_FIFO1,
+		.FilterBank = 1,
+		.FilterMode = CAN_FILTERMODE_IDMASK,
+		.FilterScale = CAN_FILTERSCALE_32BIT,
+		.FilterActivation = CAN_FILTER_ENABLE,
+		.SlaveStartFilterBank = 14
+	}
+};
+
+/* FIFO full (3 frames), the tail left to canbus_process, optionally 2 frames per entry */
+static const canbus_rx_coalesce_t bench_coalesce = {.watermark = 3, .timeout = 0, .budget = 0};
+static const canbus_rx_coalesce_t bench_coalesce_budget = {.watermark = 3, .timeout = 0, .budget = 2};
+
+static canbus_t bench_bus =
+{
+	.mx_init = MX_CAN1_Init,
+	.hcan = &hcan1,
+	.filters = bench_filters,
+	.filters_cnt = 2,
+	.callbacks = NULL
+};
+
+/* No filters: derived from the callbacks by canbus_initialize */
+static canbus_t bench_auto_bus =
+{
+	.mx_init = MX_CAN2_Init,
+	.hcan = &hcan2,
+	.filters = NULL,
+	.filters_cnt = 0,
+	.callbacks = NULL
+};
+
+static volatile uint64_t bench_hits = 0;
+static volatile uint64_t bench_auto_hits = 0;
+static volatile uint64_t bench_slow_hits = 0;
+static volatile uint64_t bench_lane_hits = 0;
+
+static canbus_callback_t bench_rcu_nodes[BENCH_RCU_NODES];
+static volatile uint32_t bench_rcu_stop = 0;
+static volatile uint64_t bench_rcu_hits = 0;
+static volatile uint64_t bench_rcu_stale = 0;
+static volatile uint32_t bench_rcu_waits = 0;
+static volatile uint32_t bench_rcu_failed = 0;
+static volatile uint32_t bench_spike_calls = 0;
+static volatile uint32_t bench_budget_hits = 0;
+static volatile uint32_t bench_tx_events = 0;
+static volatile uint32_t bench_tx_disorder = 0;
+static volatile uint8_t bench_tx_marker = 0;
+static uint64_t bench_urgent_queued = 0;
+static uint64_t bench_urgent_wait_sum = 0;
+static uint64_t bench_urgent_wait_max = 0;
+static uint64_t bench_urgent_cnt = 0;
+static uint64_t bench_bulk_cnt = 0;
+
+static canbus_isotp_t bench_tp_ecu[BENCH_ISOTP_SESSIONS];
+static canbus_isotp_t bench_tp_tester[BENCH_ISOTP_SESSIONS];
+static uint8_t bench_tp_tx[BENCH_ISOTP_SESSIONS][BENCH_ISOTP_SIZE];
+static uint8_t bench_tp_rx[BENCH_ISOTP_SESSIONS][BENCH_ISOTP_SIZE];
+static volatile uint32_t bench_tp_sent = 0;
+static volatile uint32_t bench_tp_received = 0;
+static volatile uint32_t bench_tp_errors = 0;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void bench_callback(canbus_frame_t *frame);
+static void bench_auto_callback(canbus_frame_t *frame);
+static void bench_slow_callback(canbus_frame_t *frame);
+static void bench_lane_callback(canbus_frame_t *frame);
+static void bench_rcu_callback(canbus_frame_t *frame);
+static void bench_rcu_stale_callback(canbus_frame_t *frame);
+static void bench_spike_callback(canbus_frame_t *frame);
+static void bench_budget_hook(canbus_callback_t *node, canbus_frame_t *frame, uint32_t cycles);
+static void bench_tx_done(canbus_tx_event_t *event);
+static void bench_isotp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status);
+static void bench_isotp_tx_done(canbus_isotp_t *tp, i_status status);
+static void *bench_rcu_writer(void *arg);
+static void bench_send(const char *name, uint32_t iterations, uint16_t dlc);
+static void bench_urgent_hook(CAN_TypeDef *src, const CAN_TxMailBox_TypeDef *mailbox);
+static void bench_send_priority(uint32_t iterations);
+static void bench_send_marked(uint32_t iterations);
+static void bench_send_burst(uint32_t iterations);
+static void bench_send_template(uint32_t iterations);
+static void bench_rx_dispatch(const char *name, uint32_t iterations, uint32_t callbacks);
+static void bench_callback_churn(uint32_t iterations);
+static void bench_rx_deferred(uint32_t iterations);
+static void bench_rx_lanes(uint32_t iterations);
+static void bench_bus_off(uint32_t iterations);
+static void bench_filters_auto(uint32_t iterations);
+static void bench_callback_threads(uint32_t iterations);
+static void bench_callback_profile(uint32_t iterations);
+static void bench_stats_snapshot(uint32_t iterations);
+static void bench_rx_coalesce(const char *name, uint32_t iterations, const canbus_rx_coalesce_t *coalesce);
+static void bench_isotp(uint32_t transfers);
+static void bench_stats_report(void);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static void bench_callback(canbus_frame_t *frame)
+{
+	bench_hits += frame->dlc;
+}
+
+static void bench_auto_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	bench_auto_hits++;
+}
+
+/* Stands in for a callback that does real work on the frame */
+static void bench_slow_callback(canbus_frame_t *frame)
+{
+	volatile uint32_t sum = 0;
+
+	for(uint32_t i=0;i<BENCH_SLOW_WORK;i++)
+		sum += frame->dt[i & 7U];
+	bench_slow_hits++;
+}
+
+static void bench_lane_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	bench_lane_hits++;
+}
+
+/* Slow enough for the writer to get ahead of the dispatch on the chain */
+static void bench_rcu_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	for(volatile uint32_t k=0;k<64U;k++);
+	bench_rcu_hits++;
+}
+
+/* Set on nodes the driver handed back: a dispatch must never get here */
+static void bench_rcu_stale_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	bench_rcu_stale++;
+}
+
+/* Cheap most of the time, every 64th call takes well over the budget */
+static void bench_spike_callback(canbus_frame_t *frame)
+{
+	volatile uint32_t sum = 0;
+	uint32_t work = (bench_spike_calls++ & 63U) == 63U ? BENCH_SLOW_WORK * 32U : 8U;
+
+	for(uint32_t i=0;i<work;i++)
+		sum += frame->dt[i & 7U];
+}
+
+static void bench_budget_hook(canbus_callback_t *node, canbus_frame_t *frame, uint32_t cycles)
+{
+	(void)node;
+	(void)frame;
+	(void)cycles;
+	bench_budget_hits++;
+}
+
+/* Markers go out 1..255 and come back in the same order */
+static void bench_tx_done(canbus_tx_event_t *event)
+{
+	bench_tx_marker = bench_tx_marker == 255U ? 1U : bench_tx_marker + 1U;
+	if(event->marker != bench_tx_marker)
+		bench_tx_disorder++;
+	bench_tx_events++;
+}
+
+static void bench_isotp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status)
+{
+	if(status != I_OK || len != BENCH_ISOTP_SIZE || memcmp(tp->rx_buf, bench_tp_tx[tp - bench_tp_tester], len) != 0)
+		bench_tp_errors++;
+	bench_tp_received++;
+}
+
+static void bench_isotp_tx_done(canbus_isotp_t *tp, i_status status)
+{
+	(void)tp;
+	if(status != I_OK)
+		bench_tp_errors++;
+	bench_tp_sent++;
+}
+
+/* Plays the task opening and closing subscriptions while the main thread
+   takes the RX interrupts */
+static void *bench_rcu_writer(void *arg)
+{
+	uint32_t iterations = *(uint32_t *)arg;
+	canbus_callback_t *node;
+
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		node = &bench_rcu_nodes[i % BENCH_RCU_NODES];
+		if(canbus_callback_exists(&bench_bus, node) == I_EXISTS)
+		{
+			if(canbus_callback_remove(&bench_bus, node) != I_OK)
+				bench_rcu_failed++;
+			continue;
+		}
+		while(canbus_callback_reclaim(&bench_bus) != I_OK)
+			bench_rcu_waits++;
+		/* Unreachable now, poison it for a while before reusing it */
+		node->callback = bench_rcu_stale_callback;
+		for(volatile uint32_t k=0;k<32U;k++);
+		if(canbus_callback_register(&bench_bus, node, BENCH_RCU_ID, 0, CBUS_ID_T_STANDARD, bench_rcu_callback, CBUS_CB_ISR) != I_OK)
+			bench_rcu_failed++;
+	}
+	for(uint32_t i=0;i<BENCH_RCU_NODES;i++)
+		(void)canbus_callback_remove(&bench_bus, &bench_rcu_nodes[i]);
+	bench_rcu_stop = 1;
+	return NULL;
+}
+
+static void bench_send(const char *name, uint32_t iterations, uint16_t dlc)
+{
+	canbus_frame_t frame = {.id = 0x123, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = dlc};
+	uint64_t frames = mock_can_bus_frames();
+	uint32_t failed = 0;
+	uint64_t start = bench_now_ns();
+
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		frame.dt[0] = (uint8_t)i;
+		if(canbus_send(&bench_bus, &frame) != I_OK)
+			failed++;
+	}
+
+	bench_report(name, iterations, bench_now_ns() - start);
+	if(failed != 0 || mock_can_bus_frames() - frames != iterations)
+		bench_fail("%" PRIu32 " failed, %" PRIu64 " frames on the bus\n", failed, mock_can_bus_frames() - frames);
+}
+
+static void bench_urgent_hook(CAN_TypeDef *src, const CAN_TxMailBox_TypeDef *mailbox)
+{
+	uint64_t wait;
+
+	(void)src;
+	if((mailbox->TIR >> CAN_TI0R_STID_Pos) == BENCH_BULK_ID)
+		bench_bulk_cnt++;
+	if((mailbox->TIR >> CAN_TI0R_STID_Pos) != BENCH_URGENT_ID)
+		return;
+	wait = mock_can_bus_frames() - bench_urgent_queued - 1U;
+	bench_urgent_wait_sum += wait;
+	bench_urgent_wait_max = wait > bench_urgent_wait_max ? wait : bench_urgent_wait_max;
+	bench_urgent_cnt++;
+}
+
+/* Bulk traffic keeps every mailbox and the queue busy while an urgent frame
+   is sent every BENCH_URGENT_EVERY frames. The wait is counted in frames that
+   went on the bus between canbus_send accepting the urgent frame and the
+   urgent frame itself. Preempted bulk frames must all go out in the end. */
+static void bench_send_priority(uint32_t iterations)
+{
+	canbus_frame_t bulk = {.id = BENCH_BULK_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	canbus_frame_t urgent = {.id = BENCH_URGENT_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 2};
+	uint64_t start;
+
+	bench_bulk_cnt = 0;
+	mock_can_set_auto_transmit(0);
+	mock_can_bus_hook(bench_urgent_hook);
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		while(canbus_send(&bench_bus, &bulk) == I_FULL)
+			mock_can_bus_run(1);
+		if((i % BENCH_URGENT_EVERY) == 0)
+		{
+			bench_urgent_queued = mock_can_bus_frames();
+			while(canbus_send(&bench_bus, &urgent) == I_FULL)
+			{
+				mock_can_bus_run(1);
+				bench_urgent_queued = mock_can_bus_frames();
+			}
+			mock_can_bus_run(1);
+		}
+	}
+	while(mock_can_bus_run(0xFFFFFFFFU) != 0);
+	bench_report("canbus_send bulk + urgent, bus paced", iterations, bench_now_ns() - start);
+	mock_can_bus_hook(NULL);
+	mock_can_set_auto_transmit(1);
+
+	printf("  frames ahead of an urgent one: avg %.2f max %" PRIu64 " (%" PRIu64 " sent)\n",
+		bench_urgent_cnt != 0 ? (double)bench_urgent_wait_sum / (double)bench_urgent_cnt : 0.0, bench_urgent_wait_max, bench_urgent_cnt);
+	if(bench_bulk_cnt != iterations)
+		bench_fail("%" PRIu64 " of %" PRIu32 " bulk frames on the bus\n", bench_bulk_cnt, iterations);
+}
+
+/* Every frame asks for its completion: cost of the TX event path on top of
+   a plain send, all of them have to come back. */
+static void bench_send_marked(uint32_t iterations)
+{
+	canbus_frame_t frame = {.id = 0x124, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	uint64_t frames = mock_can_bus_frames();
+	uint32_t failed = 0;
+	uint64_t start;
+
+	bench_bus.tx_done = bench_tx_done;
+	bench_tx_events = 0;
+	bench_tx_disorder = 0;
+	bench_tx_marker = 0;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		frame.dt[0] = (uint8_t)i;
+		if(canbus_send_marked(&bench_bus, &frame, (uint8_t)(1U + (i % 255U))) != I_OK)
+			failed++;
+	}
+	bench_report("canbus_send_marked 8B, completions", iterations, bench_now_ns() - start);
+	bench_bus.tx_done = NULL;
+	if(failed != 0 || bench_tx_events != mock_can_bus_frames() - frames || bench_tx_disorder != 0)
+		bench_fail("%" PRIu32 " failed, %" PRIu32 " completions for %" PRIu64 " frames, %" PRIu32 " out of order\n", failed, bench_tx_events, mock_can_bus_frames() - frames, bench_tx_disorder);
+}
+
+static void bench_send_burst(uint32_t iterations)
+{
+	static canbus_frame_t frames[BENCH_BURST];
+	uint32_t bursts = iterations / BENCH_BURST;
+	uint64_t frames_before = mock_can_bus_frames();
+	uint64_t accepted = 0;
+	uint64_t start;
+
+	for(uint32_t i=0;i<BENCH_BURST;i++)
+		frames[i] = (canbus_frame_t){.id = 0x200 + i, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<bursts;i++)
+		accepted += canbus_send_burst(&bench_bus, frames, BENCH_BURST);
+	bench_report("canbus_send_burst, 30 frames/call", accepted, bench_now_ns() - start);
+	if(accepted != (uint64_t)bursts * BENCH_BURST || mock_can_bus_frames() - frames_before != accepted)
+		bench_fail("%" PRIu64 " accepted, %" PRIu64 " frames on the bus\n", accepted, mock_can_bus_frames() - frames_before);
+}
+
+static void bench_send_template(uint32_t iterations)
+{
+	static canbus_tx_template_t templates[BENCH_TEMPLATES];
+	uint8_t data[64] = {0};
+	uint64_t frames = mock_can_bus_frames();
+	uint32_t failed = 0;
+	uint64_t start;
+
+	for(uint32_t i=0;i<BENCH_TEMPLATES;i++)
+		canbus_tx_template_init(&templates[i], CBUS_FR_FRM_STD, CBUS_ID_T_STANDARD, 0x300 + i, 8);
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		data[0] = (uint8_t)i;
+		if(canbus_send_template(&bench_bus, &templates[i % BENCH_TEMPLATES], data) != I_OK)
+			failed++;
+	}
+	bench_report("canbus_send_template classic 8B", iterations, bench_now_ns() - start);
+	if(failed != 0 || mock_can_bus_frames() - frames != iterations)
+		bench_fail("%" PRIu32 " failed, %" PRIu64 " frames on the bus\n", failed, mock_can_bus_frames() - frames);
+}
+
+static void bench_rx_dispatch(const char *name, uint32_t iterations, uint32_t callbacks)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	uint64_t start;
+
+	bench_hits = 0;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		header.StdId = 0x100 + (i % callbacks);
+		mock_can_inject(&header, data);
+	}
+	bench_report(name, iterations, bench_now_ns() - start);
+	if(bench_hits != (uint64_t)iterations * 8U)
+		bench_fail("%" PRIu64 " callback bytes, expected %" PRIu64 "\n", bench_hits, (uint64_t)iterations * 8U);
+}
+
+/* Adds and removes with the large callback set registered, once from the
+   driver pool and once on a node the caller owns */
+static void bench_callback_churn(uint32_t iterations)
+{
+	static canbus_callback_t node;
+	uint32_t failed = 0;
+	uint64_t start;
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		if(canbus_callback_add(&bench_bus, 0x7F0, 0, CBUS_ID_T_STANDARD, bench_callback) != I_OK)
+			failed++;
+		if(canbus_callback_remove(&bench_bus, bench_bus.callbacks) != I_OK)
+			failed++;
+	}
+	bench_report("callback add + remove, pool", iterations, bench_now_ns() - start);
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		if(canbus_callback_register(&bench_bus, &node, 0x7F0, 0, CBUS_ID_T_STANDARD, bench_callback, CBUS_CB_ISR) != I_OK)
+			failed++;
+		if(canbus_callback_remove(&bench_bus, &node) != I_OK)
+			failed++;
+	}
+	bench_report("callback register + remove, caller node", iterations, bench_now_ns() - start);
+	if(failed != 0)
+		bench_fail("%" PRIu32 " add/remove calls failed\n", failed);
+}
+
+/* Same slow callback once in the RX ISR and once deferred: the ISR cost of
+   the deferred one no longer depends on the callback. */
+static void bench_rx_deferred(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	uint64_t isr_ns = 0;
+	uint64_t process_ns = 0;
+	uint64_t start;
+
+	canbus_callback_add(&bench_bus, 0x1A0, 0, CBUS_ID_T_STANDARD, bench_slow_callback);
+	canbus_callback_add_deferred(&bench_bus, 0x1A1, 0, CBUS_ID_T_STANDARD, bench_slow_callback);
+
+	bench_slow_hits = 0;
+	header.StdId = 0x1A0;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+		mock_can_inject(&header, data);
+	bench_report("rx isr, slow callback in ISR", iterations, bench_now_ns() - start);
+
+	header.StdId = 0x1A1;
+	for(uint32_t i=0;i<iterations;i+=CANBUS_RX_RING_SIZE)
+	{
+		start = bench_now_ns();
+		for(uint32_t k=0;k<CANBUS_RX_RING_SIZE && (i + k)<iterations;k++)
+			mock_can_inject(&header, data);
+		isr_ns += bench_now_ns() - start;
+		start = bench_now_ns();
+		canbus_process(&bench_bus);
+		process_ns += bench_now_ns() - start;
+	}
+	bench_report("rx isr, slow callback deferred", iterations, isr_ns);
+	bench_report("canbus_process, slow callback", iterations, process_ns);
+	if(bench_slow_hits != (uint64_t)iterations * 2U || bench_bus.rx_ring[0].dropped != 0)
+		bench_fail("%" PRIu64 " callbacks ran, %" PRIu32 " frames dropped\n", bench_slow_hits, bench_bus.rx_ring[0].dropped);
+}
+
+/* Bulk ids on FIFO0 and urgent ids on FIFO1 arrive while interrupts are
+   masked: each lane buffers its own frames, none of the six is lost. */
+static void bench_rx_lanes(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	uint64_t start;
+
+	canbus_callback_add_ex(&bench_bus, 0x050, 0x7FC, CBUS_ID_T_STANDARD, bench_lane_callback, CBUS_CB_FIFO1);
+
+	bench_hits = 0;
+	bench_lane_hits = 0;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		__disable_irq();
+		for(uint32_t k=0;k<3U;k++)
+		{
+			header.StdId = 0x100 + k;
+			mock_can_inject(&header, data);
+			header.StdId = 0x050 + k;
+			mock_can_inject(&header, data);
+		}
+		__enable_irq();
+	}
+	bench_report("rx 3 bulk + 3 urgent, IRQs masked", iterations * 6U, bench_now_ns() - start);
+	if(bench_hits != (uint64_t)iterations * 3U * 8U || bench_lane_hits != (uint64_t)iterations * 3U)
+		bench_fail("%" PRIu64 " bulk and %" PRIu64 " urgent frames delivered of %" PRIu64 " each\n", bench_hits / 8U, bench_lane_hits, (uint64_t)iterations * 3U);
+}
+
+/* A bus-off storm: the bus goes off again as soon as it is back. The ISR
+   only arms the backoff, the restart runs from the polling loop and a frame
+   sent while the bus is off has to make it out once it is back. */
+static void bench_bus_off(uint32_t iterations)
+{
+	canbus_frame_t frame = {.id = 0x126, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	uint64_t frames = mock_can_bus_frames();
+	uint32_t isr_cycles = bench_bus.stats.isr_cycles[2];
+	uint64_t polls = 0;
+	uint64_t start = bench_now_ns();
+
+	for(uint32_t i=0;i<iterations;i++)
+	{
+		mock_can_inject_bus_off(bench_bus.hcan);
+		(void)canbus_send(&bench_bus, &frame);
+		do
+		{
+			canbus_recover_if_needs(&bench_bus);
+			polls++;
+		}while(bench_bus.recovery.state != CBUS_RC_IDLE);
+	}
+	bench_report("bus-off storm, backoff + restart", iterations, bench_now_ns() - start);
+	printf("  %" PRIu32 " cycles in the bus-off ISR, %" PRIu64 " polls, backoff up to %" PRIu32 " ticks, recovery %" PRIu32 " ticks last, %" PRIu32 " longest\n",
+		(bench_bus.stats.isr_cycles[2] - isr_cycles) / iterations, polls, bench_bus.recovery.backoff,
+		bench_bus.stats.recovery_ticks[0], bench_bus.stats.recovery_ticks[1]);
+	if((bench_bus.hcan->Instance->ESR & CAN_ESR_BOFF) != 0)
+		bench_fail("interface did not come back\n");
+	if(mock_can_bus_frames() - frames != iterations)
+		bench_fail("%" PRIu64 " of %" PRIu32 " frames sent while off made it out\n", mock_can_bus_frames() - frames, iterations);
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<BENCH_IDLE_POLLS;i++)
+		canbus_recover_if_needs(&bench_bus);
+	bench_report("canbus_recover_if_needs, bus up", BENCH_IDLE_POLLS, bench_now_ns() - start);
+}
+
+/* Scattered exact ids, a few extended ids and one masked range, more than the
+   hardware can hold one to one. Every standard id is then put on the bus to
+   check that none of the wanted ones got lost in the merge. */
+static void bench_filters_auto(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	canbus_filter_report_t *report = &bench_auto_bus.filter_report;
+	uint32_t rounds = iterations / 2048U + 1U;
+	uint64_t start;
+
+	for(uint32_t i=0;i<BENCH_AUTO_EXACT;i++)
+		canbus_callback_add(&bench_auto_bus, 0x200 + i * 13U, 0, CBUS_ID_T_STANDARD, bench_auto_callback);
+	for(uint32_t i=0;i<BENCH_AUTO_EXT;i++)
+		canbus_callback_add(&bench_auto_bus, 0x18FF0000 + i * 0x101U, 0, CBUS_ID_T_EXTENDED, bench_auto_callback);
+	canbus_callback_add_ex(&bench_auto_bus, 0x600, 0x7F0, CBUS_ID_T_STANDARD, bench_auto_callback, CBUS_CB_FIFO1);
+	if(canbus_initialize(&bench_auto_bus) != I_OK)
+	{
+		bench_fail("canbus_initialize with derived filters failed\n");
+		return;
+	}
+
+	bench_auto_hits = 0;
+	start = bench_now_ns();
+	for(uint32_t r=0;r<rounds;r++)
+	{
+		for(uint32_t id=0;id<0x800U;id++)
+		{
+			header.StdId = id;
+			mock_can_inject(&header, data);
+		}
+	}
+	bench_report("rx sweep 2048 ids, derived filters", rounds * 2048U, bench_now_ns() - start);
+	printf("  %" PRIu32 " callbacks -> %u banks, over-acceptance %" PRIu32 ".%03" PRIu32 "\n",
+		BENCH_AUTO_EXACT + BENCH_AUTO_EXT + 1U, report->banks, report->ratio / 1000U, report->ratio % 1000U);
+	if(bench_auto_hits != (uint64_t)rounds * (BENCH_AUTO_EXACT + 16U))
+		bench_fail("%" PRIu64 " callbacks ran, expected %" PRIu64 "\n", bench_auto_hits, (uint64_t)rounds * (BENCH_AUTO_EXACT + 16U));
+}
+
+/* A second thread adds and removes callbacks on one id while its frames
+   keep arriving: dispatch never waits, and nodes are only reused once no
+   dispatch can still be walking them. */
+static void bench_callback_threads(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	pthread_t writer;
+	uint64_t frames = 0;
+	uint64_t start;
+
+	header.StdId = BENCH_RCU_ID;
+	mock_irq_bind();
+	start = bench_now_ns();
+	if(pthread_create(&writer, NULL, bench_rcu_writer, &iterations) != 0)
+	{
+		bench_fail("no writer thread\n");
+		return;
+	}
+	while(!bench_rcu_stop)
+	{
+		mock_can_inject(&header, data);
+		frames++;
+	}
+	pthread_join(writer, NULL);
+	bench_report("callback add/remove against rx, 2 threads", iterations, bench_now_ns() - start);
+	printf("  %" PRIu64 " frames, %" PRIu64 " dispatched, %" PRIu32 " reclaims waited on a reader\n", frames, bench_rcu_hits, bench_rcu_waits);
+	if(bench_rcu_stale != 0 || bench_rcu_failed != 0 || canbus_callback_reclaim(&bench_bus) != I_OK)
+		bench_fail("%" PRIu64 " dispatches on reclaimed nodes, %" PRIu32 " add/remove calls failed\n", bench_rcu_stale, bench_rcu_failed);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+/* One subscription with a budget: the histogram shows the spikes apart from
+   the common case and every spike reaches the hook. */
+static void bench_callback_profile(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	static canbus_callback_t node;
+	uint8_t data[64] = {0};
+	uint64_t start;
+
+	node.budget = BENCH_PROFILE_BUDGET;
+	bench_bus.budget_hook = bench_budget_hook;
+	if(canbus_callback_register(&bench_bus, &node, BENCH_PROFILE_ID, 0, CBUS_ID_T_STANDARD, bench_spike_callback, CBUS_CB_ISR) != I_OK)
+	{
+		bench_fail("profiled callback not registered\n");
+		return;
+	}
+
+	bench_spike_calls = 0;
+	bench_budget_hits = 0;
+	header.StdId = BENCH_PROFILE_ID;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+		mock_can_inject(&header, data);
+	bench_report("rx isr, profiled callback", iterations, bench_now_ns() - start);
+
+	printf("  cycles:");
+	for(uint32_t bin=0;bin<CANBUS_PROFILE_BINS;bin++)
+		if(node.hist[bin] != 0)
+			printf(" <2^%" PRIu32 " %" PRIu32 ",", bin, node.hist[bin]);
+	printf(" max %" PRIu32 ", %" PRIu32 " over %u\n", node.max, node.over, BENCH_PROFILE_BUDGET);
+	if(node.over != bench_budget_hits || node.over < iterations / 64U)
+		bench_fail("%" PRIu32 " calls over budget, %" PRIu32 " hooks, %" PRIu32 " spikes\n", node.over, bench_budget_hits, iterations / 64U);
+
+	(void)canbus_callback_remove(&bench_bus, &node);
+	bench_bus.budget_hook = NULL;
+}
+
+/* Snapshot cost, then one more frame than the RX FIFO holds arrives while
+   interrupts are masked: the loss shows up as one overrun. */
+static void bench_stats_snapshot(uint32_t iterations)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[64] = {0};
+	canbus_stats_t before;
+	canbus_stats_t after;
+	uint32_t retried = 0;
+	uint64_t start;
+
+	start = bench_now_ns();
+	for(uint32_t i=0;i<iterations;i++)
+		if(canbus_stats_snapshot(&bench_bus, &after) != I_OK)
+			retried++;
+	bench_report("canbus_stats_snapshot", iterations, bench_now_ns() - start);
+
+	(void)canbus_stats_snapshot(&bench_bus, &before);
+	header.StdId = 0x100;
+	__disable_irq();
+	for(uint32_t k=0;k<MOCK_CAN_RX_FIFO_DEPTH + 1U;k++)
+		mock_can_inject(&header, data);
+	__enable_irq();
+	(void)canbus_stats_snapshot(&bench_bus, &after);
+	if(retried != 0 || after.rx_overruns[0] - before.rx_overruns[0] != 1U || after.rx_frames[0] - before.rx_frames[0] != MOCK_CAN_RX_FIFO_DEPTH)
+		bench_fail("%" PRIu32 " snapshots gave up, %" PRIu32 " overruns and %" PRIu32 " frames counted\n", retried, after.rx_overruns[0] - before.rx_overruns[0], after.rx_frames[0] - before.rx_frames[0]);
+}
+
+/* Bursts of back to back frames into FIFO0, canbus_process after each one
+   reads the tail */
+static void bench_rx_coalesce(const char *name, uint32_t iterations, const canbus_rx_coalesce_t *coalesce)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.StdId = 0x100,
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	canbus_stats_t before;
+	canbus_stats_t after;
+	uint32_t frames = (iterations / BENCH_COALESCE_BURST + 1U) * BENCH_COALESCE_BURST;
+	uint32_t irqs;
+	uint64_t hits;
+	uint64_t start;
+
+	bench_bus.rx_coalesce = coalesce;
+	if(canbus_initialize(&bench_bus) != I_OK)
+	{
+		bench_fail("canbus_initialize with coalescing failed\n");
+		return;
+	}
+	(void)canbus_stats_snapshot(&bench_bus, &before);
+	hits = bench_hits;
+	start = bench_now_ns();
+	for(uint32_t i=0;i<frames;i+=BENCH_COALESCE_BURST)
+	{
+		for(uint32_t k=0;k<BENCH_COALESCE_BURST;k++)
+			mock_can_inject(&header, data);
+		(void)canbus_process(&bench_bus);
+	}
+	bench_report(name, frames, bench_now_ns() - start);
+	(void)canbus_stats_snapshot(&bench_bus, &after);
+	irqs = after.rx_irqs[0] - before.rx_irqs[0];
+	printf("  %.2f interrupts and %.0f ISR cycles per frame, %" PRIu32 " entries over budget\n",
+		(double)irqs / frames, (double)(after.isr_cycles[0] - before.isr_cycles[0]) / frames, after.rx_deferred[0] - before.rx_deferred[0]);
+	if(bench_hits - hits != (uint64_t)frames * 8U || after.rx_overruns[0] != before.rx_overruns[0])
+		bench_fail("%" PRIu64 " of %" PRIu32 " frames reached the callback, %" PRIu32 " overruns\n",
+			(bench_hits - hits) / 8U, frames, after.rx_overruns[0] - before.rx_overruns[0]);
+
+	bench_bus.rx_coalesce = NULL;
+	(void)canbus_initialize(&bench_bus);
+}
+
+/* 4 KB messages ECU -> tester over concurrent sessions, classic 8B frames
+   from bench_bus, bench_auto_bus answering with flow control every 8 */
+static void bench_isotp(uint32_t transfers)
+{
+	uint64_t frames = mock_can_bus_frames();
+	uint32_t queued = 0;
+	uint64_t start;
+
+	for(uint32_t i=0;i<BENCH_ISOTP_SESSIONS;i++)
+	{
+		for(uint32_t k=0;k<BENCH_ISOTP_SIZE;k++)
+			bench_tp_tx[i][k] = (uint8_t)(k * 7U + i);
+		bench_tp_ecu[i] = (canbus_isotp_t){.canbus = &bench_bus, .tx_id = 0x2F1 + i, .rx_id = 0x1F1 + i,
+			.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .tx_done = bench_isotp_tx_done};
+		bench_tp_tester[i] = (canbus_isotp_t){.canbus = &bench_auto_bus, .tx_id = 0x1F1 + i, .rx_id = 0x2F1 + i,
+			.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .block_size = 8, .st_min = 0,
+			.rx_buf = bench_tp_rx[i], .rx_size = BENCH_ISOTP_SIZE, .rx_done = bench_isotp_rx_done};
+		if(canbus_isotp_open(&bench_tp_ecu[i], CBUS_CB_ISR) != I_OK || canbus_isotp_open(&bench_tp_tester[i], CBUS_CB_ISR) != I_OK)
+		{
+			bench_fail("canbus_isotp_open failed\n");
+			return;
+		}
+	}
+
+	bench_tp_sent = 0;
+	bench_tp_received = 0;
+	bench_tp_errors = 0;
+	start = bench_now_ns();
+	while(bench_tp_received < transfers && bench_tp_errors == 0)
+	{
+		for(uint32_t i=0;i<BENCH_ISOTP_SESSIONS && queued < transfers;i++)
+			if(canbus_isotp_send(&bench_tp_ecu[i], bench_tp_tx[i], BENCH_ISOTP_SIZE) == I_OK)
+				queued++;
+		(void)canbus_isotp_process();
+	}
+	bench_report("isotp 4 KB transfer, 2 sessions", transfers, bench_now_ns() - start);
+	frames = mock_can_bus_frames() - frames;
+	if(bench_tp_errors != 0 || bench_tp_sent != transfers)
+		bench_fail("%" PRIu32 " errors, %" PRIu32 " of %" PRIu32 " transfers sent\n", bench_tp_errors, bench_tp_sent, transfers);
+	else
+		printf("  %" PRIu64 " frames, %.1f per transfer\n", frames, (double)frames / (double)transfers);
+
+	for(uint32_t i=0;i<BENCH_ISOTP_SESSIONS;i++)
+	{
+		(void)canbus_isotp_close(&bench_tp_ecu[i]);
+		(void)canbus_isotp_close(&bench_tp_tester[i]);
+	}
+}
+
+static void bench_stats_report(void)
+{
+	canbus_stats_t stats;
+
+	(void)canbus_stats_snapshot(&bench_bus, &stats);
+	printf("stats rx   %10" PRIu32 " + %" PRIu32 " frames, %" PRIu32 " + %" PRIu32 " unmatched, %" PRIu32 " + %" PRIu32 " overruns\n",
+		stats.rx_frames[0], stats.rx_frames[1], stats.rx_unmatched[0], stats.rx_unmatched[1], stats.rx_overruns[0], stats.rx_overruns[1]);
+	printf("stats tx   %10" PRIu32 " frames, %" PRIu32 " full, %" PRIu32 " errors, %" PRIu32 " bus-off\n",
+		stats.tx_frames, stats.tx_full, stats.tx_errors, stats.bus_off);
+	printf("stats isr  %10" PRIu32 " + %" PRIu32 " + %" PRIu32 " cycles\n", stats.isr_cycles[0], stats.isr_cycles[1], stats.isr_cycles[2]);
+	printf("stats bus  %10" PRIu32 " ticks last recovery, %" PRIu32 " longest\n", stats.recovery_ticks[0], stats.recovery_ticks[1]);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = bench_iterations(argc, argv);
+
+	mock_can_reset();
+	if(canbus_initialize(&bench_bus) != I_OK)
+	{
+		printf("canbus_initialize failed\n");
+		return 1;
+	}
+	for(uint32_t i=0;i<BENCH_CALLBACKS;i++)
+		canbus_callback_add(&bench_bus, 0x100 + i, 0, CBUS_ID_T_STANDARD, bench_callback);
+
+	bench_send("canbus_send classic 8B", iterations, 8);
+	bench_send_priority(iterations);
+	bench_send_marked(iterations);
+	bench_send_burst(iterations);
+	bench_send_template(iterations);
+	bench_rx_dispatch("rx dispatch, 16 callbacks, 8B", iterations, BENCH_CALLBACKS);
+	for(uint32_t i=BENCH_CALLBACKS;i<BENCH_CALLBACKS_LARGE;i++)
+		canbus_callback_add(&bench_bus, 0x100 + i, 0, CBUS_ID_T_STANDARD, bench_callback);
+	bench_rx_dispatch("rx dispatch, 160 callbacks, 8B", iterations, BENCH_CALLBACKS_LARGE);
+	bench_callback_churn(iterations);
+	bench_callback_threads(iterations);
+	bench_rx_deferred(iterations / 10U);
+	bench_rx_lanes(iterations / 10U);
+	bench_callback_profile(iterations / 10U);
+	bench_stats_snapshot(iterations);
+	bench_rx_coalesce("rx burst, interrupt per frame", iterations, NULL);
+	bench_rx_coalesce("rx burst, coalesced", iterations, &bench_coalesce);
+	bench_rx_coalesce("rx burst, coalesced, budget 2", iterations, &bench_coalesce_budget);
+	bench_bus_off(BENCH_BUS_OFF_STORM);
+	bench_filters_auto(iterations);
+	bench_isotp(iterations / 200U + 1U);
+	bench_stats_report();
+
+	return bench_exit();
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
@@ -0,0 +1,100 @@
+/*!
+	@file   bench_common.h
+	@brief  Timing & reporting helpers shared by the host benchmarks
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef BENCH_COMMON_H_
+#define BENCH_COMMON_H_
+
+#define _POSIX_C_SOURCE 200112L
+
+#define BENCH_ITERATIONS_DEFAULT	1000000UL
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+static uint32_t bench_failures = 0;
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint32_t bench_iterations(int argc, char **argv)
+{
+	if(argc > 1)
+		return (uint32_t)strtoul(argv[1], NULL, 0);
+	return BENCH_ITERATIONS_DEFAULT;
+}
+
+static inline void bench_report(const char *name, uint64_t count, uint64_t elapsed_ns)
+{
+	printf("%-40s %10" PRIu64 " ops %10.1f ns/op\n", name, count, count != 0 ? (double)elapsed_ns / (double)count : 0.0);
+}
+
+/* A check of the bench that went wrong, main exits non-zero after a run
+   with any of them */
+static inline void bench_fail(const char *fmt, ...)
+{
+	va_list args;
+
+	printf("  ! ");
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	bench_failures++;
+}
+
+static inline int bench_exit(void)
+{
+	if(bench_failures != 0)
+		printf("%" PRIu32 " failed checks\n", bench_failures);
+	return bench_failures == 0 ? 0 : 1;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,396 @@
+/*!
+	@file   _cyclic.c
+	@brief  Periodic TX table driven by one timer tick
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifdef CANBUS_IRQ_PRIORITY
+#define CANBUS_CYCLIC_LOCK_LEVEL	((CANBUS_IRQ_PRIORITY) << (8U - __NVIC_PRIO_BITS))
+#endif
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "drv_canbus.h"
+
+#ifdef DRV_CANBUS_ENABLED
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+static canbus_cyclic_t canbus_cyclic_table[CANBUS_CYCLIC_MAX];
+static volatile uint32_t canbus_cyclic_used = 0;	/* Slots the tick walks */
+static volatile uint32_t canbus_cyclic_now = 0;
+static uint8_t canbus_cyclic_writer = 0;		/* An add or remove is running */
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static uint32_t canbus_cyclic_lock(void);
+static void canbus_cyclic_unlock(uint32_t state);
+static inline uint32_t canbus_cyclic_cycles(void);
+static uint32_t canbus_cyclic_gcd(uint32_t a, uint32_t b);
+static i_status canbus_cyclic_write_begin(void);
+static void canbus_cyclic_write_end(void);
+static canbus_cyclic_t* canbus_cyclic_find(canbus_t* canbus, canbus_tx_template_t* tpl);
+static canbus_cyclic_t* canbus_cyclic_get(canbus_t* canbus, canbus_tx_template_t* tpl);
+static uint32_t canbus_cyclic_spread(canbus_t* canbus, uint32_t period);
+static uint32_t canbus_cyclic_send(canbus_cyclic_t* msg, uint32_t now);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+/* The timer interrupt calling canbus_cyclic_tick must not preempt the CAN
+   ones, so masking up to them keeps it out too */
+static uint32_t canbus_cyclic_lock(void)
+{
+	uint32_t state;
+#ifdef CANBUS_CYCLIC_LOCK_LEVEL
+	state = __get_BASEPRI();
+	__set_BASEPRI_MAX(CANBUS_CYCLIC_LOCK_LEVEL);
+#else
+	state = __get_PRIMASK();
+	__disable_irq();
+#endif
+	return state;
+}
+
+static void canbus_cyclic_unlock(uint32_t state)
+{
+#ifdef CANBUS_CYCLIC_LOCK_LEVEL
+	__set_BASEPRI(state);
+#else
+	__set_PRIMASK(state);
+#endif
+}
+
+static inline uint32_t canbus_cyclic_cycles(void)
+{
+#if defined(CANBUS_CYCLES)
+	return CANBUS_CYCLES();
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+static uint32_t canbus_cyclic_gcd(uint32_t a, uint32_t b)
+{
+	uint32_t r;
+
+	while(b != 0)
+	{
+		r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/* One add or remove at a time, a second one gets I_LOCKED and does not wait */
+static i_status canbus_cyclic_write_begin(void)
+{
+	uint32_t lock = canbus_cyclic_lock();
+	uint8_t busy = canbus_cyclic_writer;
+
+	canbus_cyclic_writer = 1;
+	canbus_cyclic_unlock(lock);
+	return busy ? I_LOCKED : I_OK;
+}
+
+static void canbus_cyclic_write_end(void)
+{
+	uint32_t lock = canbus_cyclic_lock();
+
+	canbus_cyclic_writer = 0;
+	canbus_cyclic_unlock(lock);
+}
+
+static canbus_cyclic_t* canbus_cyclic_find(canbus_t* canbus, canbus_tx_template_t* tpl)
+{
+	for(register uint32_t i=0;i<canbus_cyclic_used;i++)
+		if(canbus_cyclic_table[i].canbus == canbus && canbus_cyclic_table[i].tpl == tpl)
+			return &canbus_cyclic_table[i];
+	return NULL;
+}
+
+static canbus_cyclic_t* canbus_cyclic_get(canbus_t* canbus, canbus_tx_template_t* tpl)
+{
+	canbus_cyclic_t* msg;
+	uint32_t lock = canbus_cyclic_lock();
+
+	msg = canbus_cyclic_find(canbus, tpl);
+	canbus_cyclic_unlock(lock);
+	return msg;
+}
+
+/* Offset where a new message meets the fewest frames of the interface. Two
+   messages share a tick when their offsets agree modulo the gcd of their
+   periods, and then on g/p of the other one's sends. */
+static uint32_t canbus_cyclic_spread(canbus_t* canbus, uint32_t period)
+{
+	uint32_t gcd[CANBUS_CYCLIC_MAX];
+	uint32_t phase[CANBUS_CYCLIC_MAX];
+	uint32_t weight[CANBUS_CYCLIC_MAX];
+	uint32_t cnt = 0;
+	uint32_t best = 0;
+	uint32_t best_cost = 0xFFFFFFFFU;
+	uint32_t cost;
+
+	for(register uint32_t i=0;i<canbus_cyclic_used;i++)
+	{
+		canbus_cyclic_t* msg = &canbus_cyclic_table[i];
+
+		if(msg->canbus != canbus)
+			continue;
+		gcd[cnt] = canbus_cyclic_gcd(period, msg->period);
+		phase[cnt] = msg->offset % gcd[cnt];
+		weight[cnt] = (gcd[cnt] << 16) / msg->period;
+		cnt++;
+	}
+
+	for(uint32_t offset=0;offset<period && best_cost != 0;offset++)
+	{
+		cost = 0;
+		for(register uint32_t i=0;i<cnt;i++)
+			if(offset % gcd[i] == phase[i])
+				cost += weight[i];
+		if(cost < best_cost)
+		{
+			best_cost = cost;
+			best = offset;
+		}
+	}
+	return best;
+}
+
+static uint32_t canbus_cyclic_send(canbus_cyclic_t* msg, uint32_t now)
+{
+	canbus_cyclic_stats_t* stats = &msg->stats;
+	i_status status;
+	uint32_t sent = 0;
+	uint32_t cycles;
+	uint32_t ideal;
+	uint32_t jitter;
+
+	status = canbus_send_template(msg->canbus, msg->tpl, msg->data[msg->front]);
+	if(status == I_FULL)
+	{
+		stats->full++;
+		if(now - msg->due + 1U < msg->period)
+			return 0;
+		stats->skipped++;
+	}
+	else if(status != I_OK)
+		stats->errors++;
+	else
+	{
+		cycles = canbus_cyclic_cycles();
+		if(stats->sent != 0)
+		{
+			ideal = (msg->due - msg->released) * CANBUS_CYCLIC_TICK_CYCLES;
+			jitter = cycles - msg->cycles - ideal;
+			if((int32_t)jitter < 0)
+				jitter = 0U - jitter;
+			stats->jitter_last = jitter;
+			if(jitter > stats->jitter_max)
+				stats->jitter_max = jitter;
+			stats->jitter_sum += jitter;
+		}
+		if(now - msg->due > stats->late_max)
+			stats->late_max = now - msg->due;
+		stats->sent++;
+		sent = 1;
+		msg->cycles = cycles;
+		msg->released = msg->due;
+	}
+
+	msg->due += msg->period;
+	while((int32_t)(now - msg->due) >= 0)
+	{
+		msg->due += msg->period;
+		stats->skipped++;
+	}
+	return sent;
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+/* Sends `tpl` on `canbus` every `period` ticks of canbus_cyclic_tick, on the
+   tick of the period given by `offset`, or the least loaded one with
+   CANBUS_CYCLIC_AUTO. The payload is zero until canbus_cyclic_update. Thread
+   context, I_LOCKED while another add or remove runs. */
+i_status canbus_cyclic_add(canbus_t* canbus, canbus_tx_template_t* tpl, uint32_t period, uint32_t offset)
+{
+	canbus_cyclic_t* msg = NULL;
+	i_status status = I_EXISTS;
+	uint32_t index = 0;
+	uint32_t lock;
+	uint32_t now;
+
+	if(canbus == NULL || tpl == NULL || period == 0 || period > 0x7FFFFFFFU)
+		return I_INVALID;
+	if(offset != CANBUS_CYCLIC_AUTO && offset >= period)
+		return I_INVALID;
+	if(canbus_cyclic_write_begin() != I_OK)
+		return I_LOCKED;
+
+	/* Only this writer changes the table, the tick just reads it */
+	if(canbus_cyclic_find(canbus, tpl) != NULL)
+		goto canbus_cyclic_add_error;
+	for(;index<CANBUS_CYCLIC_MAX;index++)
+	{
+		if(canbus_cyclic_table[index].canbus == NULL)
+		{
+			msg = &canbus_cyclic_table[index];
+			break;
+		}
+	}
+	status = I_FULL;
+	if(msg == NULL)
+		goto canbus_cyclic_add_error;
+	if(offset == CANBUS_CYCLIC_AUTO)
+		offset = canbus_cyclic_spread(canbus, period);
+
+	lock = canbus_cyclic_lock();
+	now = canbus_cyclic_now;
+	memset(msg, 0, sizeof(canbus_cyclic_t));
+	msg->tpl = tpl;
+	msg->period = period;
+	msg->offset = offset;
+	msg->due = now + 1U + (offset + period - (now + 1U) % period) % period;
+	msg->canbus = canbus;
+	if(index >= canbus_cyclic_used)
+		canbus_cyclic_used = index + 1U;
+	canbus_cyclic_unlock(lock);
+	canbus_cyclic_write_end();
+	return I_OK;
+
+	canbus_cyclic_add_error:
+	canbus_cyclic_write_end();
+	return status;
+}
+
+/* Once it returns the tick no longer touches `tpl`. I_LOCKED while an add or
+   another remove runs. */
+i_status canbus_cyclic_remove(canbus_t* canbus, canbus_tx_template_t* tpl)
+{
+	canbus_cyclic_t* msg;
+	uint32_t lock;
+
+	if(canbus_cyclic_write_begin() != I_OK)
+		return I_LOCKED;
+	lock = canbus_cyclic_lock();
+	msg = canbus_cyclic_find(canbus, tpl);
+	if(msg != NULL)
+	{
+		msg->canbus = NULL;
+		while(canbus_cyclic_used != 0 && canbus_cyclic_table[canbus_cyclic_used - 1U].canbus == NULL)
+			canbus_cyclic_used--;
+	}
+	canbus_cyclic_unlock(lock);
+	canbus_cyclic_write_end();
+	return msg != NULL ? I_OK : I_NOTEXISTS;
+}
+
+/* Writes the buffer the tick is not sending from and swaps them, without
+   masking interrupts. Bytes past `len` keep the payload sent so far. One
+   writer per message, which must not race its removal. */
+i_status canbus_cyclic_update(canbus_t* canbus, canbus_tx_template_t* tpl, const uint8_t* data, uint32_t len)
+{
+	canbus_cyclic_t* msg = canbus_cyclic_get(canbus, tpl);
+	uint8_t front;
+	uint8_t back;
+
+	if(msg == NULL)
+		return I_NOTEXISTS;
+	if(len > CANBUS_CYCLIC_DATA)
+		return I_INVALID;
+
+	front = msg->front;
+	back = front ^ 1U;
+	memcpy(msg->data[back], data, len);
+	memcpy(&msg->data[back][len], &msg->data[front][len], CANBUS_CYCLIC_DATA - len);
+	__DMB();
+	msg->front = back;
+	return I_OK;
+}
+
+/* Copy of the message statistics, I_WAIT when the tick kept changing them */
+i_status canbus_cyclic_stats(canbus_t* canbus, canbus_tx_template_t* tpl, canbus_cyclic_stats_t* stats)
+{
+	canbus_cyclic_t* msg = canbus_cyclic_get(canbus, tpl);
+
+	if(msg == NULL)
+		return I_NOTEXISTS;
+	for(uint32_t i=0;i<4U;i++)
+	{
+		__DMB();
+		memcpy(stats, &msg->stats, sizeof(canbus_cyclic_stats_t));
+		__DMB();
+		if(memcmp(stats, &msg->stats, sizeof(canbus_cyclic_stats_t)) == 0)
+			return I_OK;
+	}
+	return I_WAIT;
+}
+
+/* Offset the message runs on, CANBUS_CYCLIC_AUTO when it is not scheduled */
+uint32_t canbus_cyclic_offset(canbus_t* canbus, canbus_tx_template_t* tpl)
+{
+	canbus_cyclic_t* msg = canbus_cyclic_get(canbus, tpl);
+
+	return msg != NULL ? msg->offset : CANBUS_CYCLIC_AUTO;
+}
+
+/* Call it from the interrupt of one hardware timer, e.g.
+   HAL_TIM_PeriodElapsedCallback. Sends the messages due on this tick and
+   returns how many it handed to the driver. */
+uint32_t canbus_cyclic_tick(void)
+{
+	uint32_t now = canbus_cyclic_now + 1U;
+	uint32_t sent = 0;
+
+	canbus_cyclic_now = now;
+	for(register uint32_t i=0;i<canbus_cyclic_used;i++)
+	{
+		canbus_cyclic_t* msg = &canbus_cyclic_table[i];
+
+		if(msg->canbus == NULL || (int32_t)(now - msg->due) < 0)
+			continue;
+		sent += canbus_cyclic_send(msg, now);
+	}
+	return sent;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
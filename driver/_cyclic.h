@@ -0,0 +1,104 @@
+/*!
+	@file   _cyclic.h
+	@brief  Periodic TX table driven by one timer tick
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef DRV_CANBUS_CYCLIC_H_
+#define DRV_CANBUS_CYCLIC_H_
+
+#ifndef CANBUS_CYCLIC_MAX
+#define CANBUS_CYCLIC_MAX	16U	/* Periodic messages of all interfaces */
+#endif
+
+#ifndef CANBUS_CYCLIC_TICK_CYCLES
+#define CANBUS_CYCLIC_TICK_CYCLES	(SystemCoreClock / 1000U)	/* CANBUS_CYCLES() per tick, jitter reference */
+#endif
+
+#define CANBUS_CYCLIC_AUTO	0xFFFFFFFFU	/* Offset: least loaded tick of the period */
+
+#ifdef CANBUS_HAL_FDCAN
+#define CANBUS_CYCLIC_DATA	64U
+#else
+#define CANBUS_CYCLIC_DATA	8U
+#endif
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#ifdef DRV_CANBUS_ENABLED
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* --- Cyclic Message Statistics ------------------------------------------- */
+
+typedef struct
+{
+	uint32_t sent;
+	uint32_t full;			/* Ticks the TX queue had no room, tried again on the next one */
+	uint32_t errors;		/* Sends the driver refused otherwise, the period is not retried */
+	uint32_t skipped;		/* Periods dropped, the frame went out more than a period late */
+	uint32_t late_max;		/* Ticks from the due tick to the send, worst case */
+	uint32_t jitter_last;		/* Cycles the last interval between two sends was off its ticks */
+	uint32_t jitter_max;
+	uint64_t jitter_sum;		/* Over sent - 1 intervals */
+}canbus_cyclic_stats_t;
+
+/* --- Cyclic Message ------------------------------------------------------ */
+
+typedef struct
+{
+	canbus_t* volatile canbus;	/* NULL: free slot */
+	canbus_tx_template_t* tpl;	/* Key of the message, the caller keeps it */
+	uint32_t period;		/* Ticks */
+	uint32_t offset;		/* Tick of the period it goes out on, counted from tick 0 */
+	uint32_t due;
+	uint32_t released;		/* Due tick of the last send */
+	uint32_t cycles;		/* CANBUS_CYCLES() at the last send */
+	volatile uint8_t front;		/* Buffer the tick sends */
+	uint8_t data[2][CANBUS_CYCLIC_DATA];
+	canbus_cyclic_stats_t stats;
+}canbus_cyclic_t;
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+i_status canbus_cyclic_add(canbus_t* canbus, canbus_tx_template_t* tpl, uint32_t period, uint32_t offset);
+i_status canbus_cyclic_remove(canbus_t* canbus, canbus_tx_template_t* tpl);
+i_status canbus_cyclic_update(canbus_t* canbus, canbus_tx_template_t* tpl, const uint8_t* data, uint32_t len);
+i_status canbus_cyclic_stats(canbus_t* canbus, canbus_tx_template_t* tpl, canbus_cyclic_stats_t* stats);
+uint32_t canbus_cyclic_offset(canbus_t* canbus, canbus_tx_template_t* tpl);
+uint32_t canbus_cyclic_tick(void);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
+#endif
@@ -0,0 +1,516 @@
+/*!
+	@file   _isotp.c
+	@brief  ISO 15765-2 transport on top of the canbus driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifdef CANBUS_IRQ_PRIORITY
+#define CANBUS_ISOTP_LOCK_LEVEL	((CANBUS_IRQ_PRIORITY) << (8U - __NVIC_PRIO_BITS))
+#endif
+
+#define CANBUS_ISOTP_FF_DL_MAX	4095U	/* Longest message the 12 bit first frame length holds */
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <stddef.h>
+#include "drv_canbus.h"
+
+#ifdef DRV_CANBUS_ENABLED
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+static canbus_isotp_t* canbus_isotp_sessions = NULL;
+
+static const uint8_t canbus_isotp_fd_dl[7] = {12, 16, 20, 24, 32, 48, 64};
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static uint32_t canbus_isotp_lock(void);
+static void canbus_isotp_unlock(uint32_t state);
+static uint32_t canbus_isotp_dl(uint32_t len);
+static uint32_t canbus_isotp_stmin(uint8_t st_min);
+static void canbus_isotp_unlink(canbus_isotp_t* tp);
+static void canbus_isotp_fc_send(canbus_isotp_t* tp, uint8_t status);
+static void canbus_isotp_rx_finish(canbus_isotp_t* tp, uint32_t len, i_status status);
+static void canbus_isotp_tx_finish(canbus_isotp_t* tp, i_status status);
+static uint32_t canbus_isotp_tx_next(canbus_isotp_t* tp, uint32_t now);
+static void canbus_isotp_rx(canbus_callback_t* node, canbus_frame_t* frame);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+/* Same masking as the driver: the CAN interrupts through BASEPRI when the
+   config sets their priority, all of them otherwise */
+static uint32_t canbus_isotp_lock(void)
+{
+	uint32_t state;
+#ifdef CANBUS_ISOTP_LOCK_LEVEL
+	state = __get_BASEPRI();
+	__set_BASEPRI_MAX(CANBUS_ISOTP_LOCK_LEVEL);
+#else
+	state = __get_PRIMASK();
+	__disable_irq();
+#endif
+	return state;
+}
+
+static void canbus_isotp_unlock(uint32_t state)
+{
+#ifdef CANBUS_ISOTP_LOCK_LEVEL
+	__set_BASEPRI(state);
+#else
+	__set_PRIMASK(state);
+#endif
+}
+
+/* Frame length holding `len` bytes: 8 padded on classic CAN, the next valid
+   FD length above 8 */
+static uint32_t canbus_isotp_dl(uint32_t len)
+{
+	if(len <= 8U)
+		return 8U;
+	for(register uint32_t i=0;i<sizeof(canbus_isotp_fd_dl);i++)
+		if(len <= canbus_isotp_fd_dl[i])
+			return canbus_isotp_fd_dl[i];
+	return 64U;
+}
+
+/* STmin in HAL ticks (ms). 100-900 us round up to one tick, reserved values
+   count as the longest 127 ms. */
+static uint32_t canbus_isotp_stmin(uint8_t st_min)
+{
+	if(st_min <= 0x7FU)
+		return st_min;
+	if(st_min >= 0xF1U && st_min <= 0xF9U)
+		return 1U;
+	return 0x7FU;
+}
+
+static void canbus_isotp_unlink(canbus_isotp_t* tp)
+{
+	canbus_isotp_t** pp;
+	uint32_t lock = canbus_isotp_lock();
+
+	for(pp = &canbus_isotp_sessions;*pp != NULL;pp = &(*pp)->link)
+	{
+		if(*pp == tp)
+		{
+			*pp = tp->link;
+			break;
+		}
+	}
+	canbus_isotp_unlock(lock);
+}
+
+/* From the RX callback. A flow control the TX queue refuses is not retried,
+   the sender runs into N_Bs. */
+static void canbus_isotp_fc_send(canbus_isotp_t* tp, uint8_t status)
+{
+	uint8_t fc[8];
+
+	memset(fc, CANBUS_ISOTP_PADDING, sizeof(fc));
+	fc[0] = CBUS_TP_PCI_FC | status;
+	fc[1] = tp->block_size;
+	fc[2] = tp->st_min;
+	(void)canbus_send_plain(tp->canbus, tp->fr_format, tp->id_type, tp->tx_id, sizeof(fc), fc);
+}
+
+static void canbus_isotp_rx_finish(canbus_isotp_t* tp, uint32_t len, i_status status)
+{
+	if(tp->rx_done != NULL)
+		tp->rx_done(tp, len, status);
+}
+
+static void canbus_isotp_tx_finish(canbus_isotp_t* tp, i_status status)
+{
+	tp->tx_buf = NULL;
+	tp->tx_state = CBUS_TP_IDLE;
+	if(tp->tx_done != NULL)
+		tp->tx_done(tp, status);
+}
+
+/* Consecutive frames until the block, STmin or the TX queue says stop. Each
+   one is the PCI and the next slice of the caller's buffer. */
+static uint32_t canbus_isotp_tx_next(canbus_isotp_t* tp, uint32_t now)
+{
+	uint32_t room = tp->tx_dl - 1U;
+	uint32_t sent = 0;
+	uint32_t cnt;
+	i_status status;
+
+	while(tp->tx_state == CBUS_TP_SEND)
+	{
+		if(tp->tx_stmin != 0 && now - tp->tx_time <= tp->tx_stmin)
+			break;
+
+		cnt = tp->tx_len - tp->tx_pos;
+		if(cnt > room)
+			cnt = room;
+		tp->tx_data[0] = CBUS_TP_PCI_CF | tp->tx_sn;
+		memcpy(&tp->tx_data[1], &tp->tx_buf[tp->tx_pos], cnt);
+		if(cnt < room)
+			memset(&tp->tx_data[1U + cnt], CANBUS_ISOTP_PADDING, room - cnt);
+
+		/* Flow control answering this frame counts, anything older does not */
+		tp->fc_seen = tp->fc_seq;
+		status = canbus_send_template(tp->canbus, &tp->tpl, tp->tx_data);
+		if(status == I_FULL)
+			break;
+		if(status != I_OK)
+		{
+			canbus_isotp_tx_finish(tp, I_FAILED);
+			break;
+		}
+		sent++;
+		tp->tx_pos += cnt;
+		tp->tx_sn = (tp->tx_sn + 1U) & 0x0FU;
+		tp->tx_time = now;
+
+		if(tp->tx_pos == tp->tx_len)
+			canbus_isotp_tx_finish(tp, I_OK);
+		else if(tp->tx_bs != 0 && --tp->tx_bs == 0)
+			tp->tx_state = CBUS_TP_WAIT_FC;
+		else if(tp->tx_stmin != 0)
+			break;
+	}
+	return sent;
+}
+
+/* Registered on every session's rx_id through the session's own node, so
+   sessions on the same id of other interfaces never see each other's
+   frames. Runs where the session's callback flags put it, reassembles
+   straight into rx_buf. */
+static void canbus_isotp_rx(canbus_callback_t* node, canbus_frame_t* frame)
+{
+	canbus_isotp_t* tp = (canbus_isotp_t*)(void*)((uint8_t*)node - offsetof(canbus_isotp_t, node));
+	uint8_t* dt = frame->dt;
+	uint32_t len;
+	uint32_t off;
+	uint32_t cnt;
+
+	if(frame->dlc == 0)
+		return;
+
+	switch(dt[0] & 0xF0U)
+	{
+	case CBUS_TP_PCI_SF:
+		len = dt[0] & 0x0FU;
+		off = 1;
+		if(len == 0 && frame->dlc > 8U)
+		{
+			len = dt[1];
+			off = 2;
+		}
+		if(len == 0 || len + off > frame->dlc)
+			return;
+		/* Ends whatever reception was in progress */
+		tp->rx_state = CBUS_TP_IDLE;
+		if(tp->rx_buf == NULL || len > tp->rx_size)
+		{
+			canbus_isotp_rx_finish(tp, len, I_OVERFLOW);
+			return;
+		}
+		memcpy(tp->rx_buf, &dt[off], len);
+		canbus_isotp_rx_finish(tp, len, I_OK);
+		break;
+
+	case CBUS_TP_PCI_FF:
+		if(frame->dlc < 8U)
+			return;
+		len = ((uint32_t)(dt[0] & 0x0FU) << 8) | dt[1];
+		off = 2;
+		if(len == 0)
+		{
+			len = ((uint32_t)dt[2] << 24) | ((uint32_t)dt[3] << 16) | ((uint32_t)dt[4] << 8) | dt[5];
+			off = 6;
+		}
+		tp->rx_state = CBUS_TP_IDLE;
+		if(tp->rx_buf == NULL || len > tp->rx_size)
+		{
+			canbus_isotp_fc_send(tp, CBUS_TP_FS_OVFLW);
+			canbus_isotp_rx_finish(tp, len, I_OVERFLOW);
+			return;
+		}
+		cnt = frame->dlc - off;
+		if(cnt > len)
+			cnt = len;
+		memcpy(tp->rx_buf, &dt[off], cnt);
+		tp->rx_len = len;
+		tp->rx_pos = cnt;
+		tp->rx_sn = 1;
+		tp->rx_bs = tp->block_size;
+		tp->rx_time = HAL_GetTick();
+		tp->rx_state = CBUS_TP_RECEIVE;
+		canbus_isotp_fc_send(tp, CBUS_TP_FS_CTS);
+		break;
+
+	case CBUS_TP_PCI_CF:
+		if(tp->rx_state != CBUS_TP_RECEIVE)
+			return;
+		if((dt[0] & 0x0FU) != tp->rx_sn)
+		{
+			tp->rx_state = CBUS_TP_IDLE;
+			canbus_isotp_rx_finish(tp, tp->rx_pos, I_INVALID);
+			return;
+		}
+		cnt = frame->dlc - 1U;
+		if(cnt > tp->rx_len - tp->rx_pos)
+			cnt = tp->rx_len - tp->rx_pos;
+		memcpy(&tp->rx_buf[tp->rx_pos], &dt[1], cnt);
+		tp->rx_pos += cnt;
+		tp->rx_sn = (tp->rx_sn + 1U) & 0x0FU;
+		tp->rx_time = HAL_GetTick();
+
+		if(tp->rx_pos == tp->rx_len)
+		{
+			tp->rx_state = CBUS_TP_IDLE;
+			canbus_isotp_rx_finish(tp, tp->rx_len, I_OK);
+		}
+		else if(tp->block_size != 0 && --tp->rx_bs == 0)
+		{
+			tp->rx_bs = tp->block_size;
+			canbus_isotp_fc_send(tp, CBUS_TP_FS_CTS);
+		}
+		break;
+
+	case CBUS_TP_PCI_FC:
+		if(frame->dlc < 3U)
+			return;
+		tp->fc_status = dt[0] & 0x0FU;
+		tp->fc_bs = dt[1];
+		tp->fc_st = dt[2];
+		__DMB();
+		tp->fc_seq++;
+		break;
+
+	default:
+		break;
+	}
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+/* Fill in canbus, the ids, fr_format, block_size, st_min, rx_buf/rx_size and
+   the done callbacks first. `flags` are the callback flags of the RX side,
+   CBUS_CB_DEFERRED moves reassembly out of the RX interrupt. I_EXISTS when
+   another session already receives rx_id on the same interface. Call it from
+   the task that runs canbus_isotp_process. */
+i_status canbus_isotp_open(canbus_isotp_t* tp, uint32_t flags)
+{
+	canbus_isotp_t* it;
+	i_status status;
+	uint32_t lock;
+
+	if(tp == NULL || tp->canbus == NULL)
+		return I_INVALID;
+
+	tp->tx_dl = tp->fr_format == CBUS_FR_FRM_STD ? 8U : 64U;
+	if(canbus_tx_template_init(&tp->tpl, tp->fr_format, tp->id_type, tp->tx_id, tp->tx_dl) != I_OK)
+		return I_INVALID;
+	tp->tx_state = CBUS_TP_IDLE;
+	tp->rx_state = CBUS_TP_IDLE;
+	tp->tx_buf = NULL;
+	tp->fc_seen = tp->fc_seq;
+
+	lock = canbus_isotp_lock();
+	for(it = canbus_isotp_sessions;it != NULL;it = it->link)
+	{
+		if(it == tp || (it->canbus == tp->canbus && it->rx_id == tp->rx_id && it->id_type == tp->id_type))
+		{
+			canbus_isotp_unlock(lock);
+			return I_EXISTS;
+		}
+	}
+	tp->link = canbus_isotp_sessions;
+	canbus_isotp_sessions = tp;
+	canbus_isotp_unlock(lock);
+
+	status = canbus_callback_register_handler(tp->canbus, &tp->node, tp->rx_id, 0, tp->id_type, canbus_isotp_rx, flags);
+	if(status != I_OK)
+		canbus_isotp_unlink(tp);
+	return status;
+}
+
+/* The session may be opened again once canbus_callback_reclaim gives I_OK.
+   Call it from the task that runs canbus_isotp_process. */
+i_status canbus_isotp_close(canbus_isotp_t* tp)
+{
+	i_status status = canbus_callback_remove(tp->canbus, &tp->node);
+
+	if(status != I_OK && status != I_NOTEXISTS)
+		return status;
+	canbus_isotp_unlink(tp);
+	tp->tx_buf = NULL;
+	tp->tx_state = CBUS_TP_IDLE;
+	tp->rx_state = CBUS_TP_IDLE;
+	return I_OK;
+}
+
+/* Single frames go out right away. Longer messages send the first frame
+   here, the rest follows from canbus_isotp_process; `data` has to stay put
+   until tx_done. Call it from the task that runs canbus_isotp_process. */
+i_status canbus_isotp_send(canbus_isotp_t* tp, const uint8_t* data, uint32_t len)
+{
+	uint32_t sf_max = tp->tx_dl == 8U ? 7U : tp->tx_dl - 2U;
+	uint32_t off;
+	uint32_t dlc;
+	i_status status;
+
+	if(data == NULL || len == 0)
+		return I_INVALID;
+	if(tp->tx_state != CBUS_TP_IDLE)
+		return I_INPROGRESS;
+
+	if(len <= sf_max)
+	{
+		off = len <= 7U ? 1U : 2U;
+		tp->tx_data[0] = off == 1U ? (uint8_t)len : 0U;
+		tp->tx_data[1] = (uint8_t)len;
+		memcpy(&tp->tx_data[off], data, len);
+		dlc = canbus_isotp_dl(off + len);
+		memset(&tp->tx_data[off + len], CANBUS_ISOTP_PADDING, dlc - off - len);
+		status = canbus_send_plain(tp->canbus, tp->fr_format, tp->id_type, tp->tx_id, (uint8_t)dlc, tp->tx_data);
+		if(status == I_OK && tp->tx_done != NULL)
+			tp->tx_done(tp, I_OK);
+		return status;
+	}
+
+	if(len > CANBUS_ISOTP_FF_DL_MAX)
+	{
+		/* Escape sequence: 32 bit length after a zero 12 bit one */
+		tp->tx_data[0] = CBUS_TP_PCI_FF;
+		tp->tx_data[1] = 0;
+		tp->tx_data[2] = (uint8_t)(len >> 24);
+		tp->tx_data[3] = (uint8_t)(len >> 16);
+		tp->tx_data[4] = (uint8_t)(len >> 8);
+		tp->tx_data[5] = (uint8_t)len;
+		off = 6;
+	}
+	else
+	{
+		tp->tx_data[0] = CBUS_TP_PCI_FF | (uint8_t)(len >> 8);
+		tp->tx_data[1] = (uint8_t)len;
+		off = 2;
+	}
+	memcpy(&tp->tx_data[off], data, tp->tx_dl - off);
+
+	tp->tx_buf = data;
+	tp->tx_len = len;
+	tp->tx_pos = tp->tx_dl - off;
+	tp->tx_sn = 1;
+	tp->tx_time = HAL_GetTick();
+	tp->fc_seen = tp->fc_seq;
+	tp->tx_state = CBUS_TP_WAIT_FC;
+	status = canbus_send_template(tp->canbus, &tp->tpl, tp->tx_data);
+	if(status != I_OK)
+	{
+		tp->tx_buf = NULL;
+		tp->tx_state = CBUS_TP_IDLE;
+	}
+	return status;
+}
+
+/* Moves every open session on: flow control answers, consecutive frames as
+   far as BS, STmin and the TX queue allow, N_Bs and N_Cr timeouts. Call it
+   periodically from one task, the same one that opens and closes sessions:
+   it walks the session list without masking interrupts. Returns the frames
+   it sent. */
+uint32_t canbus_isotp_process(void)
+{
+	canbus_isotp_t* tp;
+	uint32_t now = HAL_GetTick();
+	uint32_t sent = 0;
+	uint32_t lock;
+	uint32_t seq;
+	uint32_t len = 0;
+	uint8_t expired;
+
+	for(tp = canbus_isotp_sessions;tp != NULL;tp = tp->link)
+	{
+		if(tp->tx_state == CBUS_TP_WAIT_FC)
+		{
+			seq = tp->fc_seq;
+			if(seq != tp->fc_seen)
+			{
+				__DMB();
+				tp->fc_seen = seq;
+				switch(tp->fc_status)
+				{
+				case CBUS_TP_FS_CTS:
+					tp->tx_bs = tp->fc_bs;
+					tp->tx_stmin = canbus_isotp_stmin(tp->fc_st);
+					/* STmin only spaces consecutive frames, the first goes now */
+					tp->tx_time = now - tp->tx_stmin - 1U;
+					tp->tx_state = CBUS_TP_SEND;
+					break;
+				case CBUS_TP_FS_WAIT:
+					tp->tx_time = now;
+					break;
+				case CBUS_TP_FS_OVFLW:
+					canbus_isotp_tx_finish(tp, I_OVERFLOW);
+					break;
+				default:
+					canbus_isotp_tx_finish(tp, I_INVALID);
+					break;
+				}
+			}
+			else if(now - tp->tx_time >= CANBUS_ISOTP_TIMEOUT)
+				canbus_isotp_tx_finish(tp, I_EXPIRED);
+		}
+		if(tp->tx_state == CBUS_TP_SEND)
+			sent += canbus_isotp_tx_next(tp, now);
+
+		if(tp->rx_state == CBUS_TP_RECEIVE)
+		{
+			expired = 0;
+			lock = canbus_isotp_lock();
+			if(tp->rx_state == CBUS_TP_RECEIVE && HAL_GetTick() - tp->rx_time >= CANBUS_ISOTP_TIMEOUT)
+			{
+				tp->rx_state = CBUS_TP_IDLE;
+				len = tp->rx_pos;
+				expired = 1;
+			}
+			canbus_isotp_unlock(lock);
+			if(expired)
+				canbus_isotp_rx_finish(tp, len, I_EXPIRED);
+		}
+	}
+	return sent;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,134 @@
+/*!
+	@file   _isotp.h
+	@brief  ISO 15765-2 transport on top of the canbus driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef DRV_CANBUS_ISOTP_H_
+#define DRV_CANBUS_ISOTP_H_
+
+#ifndef CANBUS_ISOTP_TIMEOUT
+#define CANBUS_ISOTP_TIMEOUT	1000U	/* HAL ticks for N_Bs and N_Cr: flow control and next consecutive frame */
+#endif
+
+#ifndef CANBUS_ISOTP_PADDING
+#define CANBUS_ISOTP_PADDING	0xCCU	/* Fills frames up to their DLC */
+#endif
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#ifdef DRV_CANBUS_ENABLED
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* --- ISO-TP Protocol Control Information (ref: iso15765-2) ---------------- */
+
+typedef enum
+{
+	CBUS_TP_PCI_SF = 0x00U,		/* Single frame */
+	CBUS_TP_PCI_FF = 0x10U,		/* First frame */
+	CBUS_TP_PCI_CF = 0x20U,		/* Consecutive frame */
+	CBUS_TP_PCI_FC = 0x30U		/* Flow control */
+}cbus_tp_pci;
+
+typedef enum
+{
+	CBUS_TP_FS_CTS   = 0x00U,	/* Continue to send */
+	CBUS_TP_FS_WAIT  = 0x01U,	/* Wait for the next flow control */
+	CBUS_TP_FS_OVFLW = 0x02U	/* Message does not fit, abort */
+}cbus_tp_fs;
+
+typedef enum
+{
+	CBUS_TP_IDLE    = 0x00U,
+	CBUS_TP_WAIT_FC = 0x01U,	/* TX: first frame or block sent, flow control pending */
+	CBUS_TP_SEND    = 0x02U,	/* TX: consecutive frames going out */
+	CBUS_TP_RECEIVE = 0x03U		/* RX: first frame taken, consecutive frames coming */
+}cbus_tp_state;
+
+/* --- ISO-TP Session ------------------------------------------------------- */
+
+typedef struct canbus_isotp canbus_isotp_t;
+
+struct canbus_isotp
+{
+	canbus_t* canbus;
+	uint32_t tx_id;			/* Data and flow control this end sends */
+	uint32_t rx_id;			/* Data and flow control the peer sends */
+	uint32_t id_type;		/* `cbus_id_type` of both ids */
+	uint16_t fr_format;		/* `cbus_fr_format`, FD formats carry up to 64 bytes per frame */
+	uint8_t block_size;		/* BS handed to the sender, 0: one flow control per message */
+	uint8_t st_min;			/* STmin handed to the sender, ISO 15765-2 encoding */
+	uint8_t* rx_buf;		/* Messages are reassembled straight into it */
+	uint32_t rx_size;
+	void (*rx_done)(canbus_isotp_t* tp, uint32_t len, i_status status);	/* From the RX callback, or canbus_isotp_process on N_Cr */
+	void (*tx_done)(canbus_isotp_t* tp, i_status status);	/* From canbus_isotp_send or canbus_isotp_process */
+
+	/* Owned by the engine */
+	canbus_callback_t node;
+	canbus_tx_template_t tpl;	/* First and consecutive frames, full TX_DL */
+	struct canbus_isotp* link;	/* Next open session */
+	volatile uint8_t tx_state;	/* cbus_tp_state */
+	uint8_t tx_sn;
+	uint8_t tx_bs;			/* Frames left in the block, 0: no limit */
+	uint8_t tx_dl;			/* TX_DL: 8, or 64 on FD */
+	uint8_t fc_status;		/* Last flow control, written by the RX callback */
+	uint8_t fc_bs;
+	uint8_t fc_st;
+	volatile uint32_t fc_seq;	/* Bumped per flow control, after the fields above */
+	uint32_t fc_seen;
+	const uint8_t* tx_buf;
+	uint32_t tx_len;
+	uint32_t tx_pos;
+	uint32_t tx_stmin;		/* HAL ticks between consecutive frames */
+	uint32_t tx_time;		/* HAL tick of the last frame or flow control */
+	uint8_t tx_data[64];		/* PCI and the next slice of tx_buf */
+	volatile uint8_t rx_state;	/* cbus_tp_state */
+	uint8_t rx_sn;
+	uint8_t rx_bs;
+	uint32_t rx_len;
+	uint32_t rx_pos;
+	uint32_t rx_time;		/* HAL tick of the last first or consecutive frame */
+};
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+i_status canbus_isotp_open(canbus_isotp_t* tp, uint32_t flags);
+i_status canbus_isotp_close(canbus_isotp_t* tp);
+i_status canbus_isotp_send(canbus_isotp_t* tp, const uint8_t* data, uint32_t len);
+uint32_t canbus_isotp_process(void);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
+#endif
@@ -27,6 +27,14 @@
 * Preprocessor Definitions & Macros
 ******************************************************************************/
 
+#define CANBUS_RX_KEY_EXT	0x80000000U	/* Id type folded into the top bit of the key */
+#define CANBUS_TX_REQUEUE_ABORTED	2U	/* canbus_tx_release: only when canbus_tx_preempt aborted it */
+#define CANBUS_RX_KEY_NONE	0xFFFFFFFFU	/* Id type the driver does not know, never matches */
+#define CANBUS_RX_SLOT(key)	((((key) * 0x9E3779B1U) >> 16) & (CANBUS_RX_INDEX_SIZE - 1U))
+#ifdef CANBUS_IRQ_PRIORITY
+#define CANBUS_LOCK_LEVEL	((CANBUS_IRQ_PRIORITY) << (8U - __NVIC_PRIO_BITS))
+#endif
+#define CANBUS_HANDLE_SLOT(h)	(((((uint32_t)(uintptr_t)(h)) * 0x9E3779B1U) >> 16) & (CANBUS_INTERFACES_MAX - 1U))
 
 /******************************************************************************
 * Includes
@@ -40,314 +48,1693 @@
 * Enumerations, structures & Variables
 ******************************************************************************/
 
-static CAN_TxHeaderTypeDef TxHeader;
-static canbus_t* canbus_interfaces[8] = {NULL,NULL,NULL,NULL,NULL,NULL,NULL,NULL};
-static uint32_t canbus_interfaces_cnt = 0;
+static canbus_t* canbus_interfaces[CANBUS_INTERFACES_MAX];	/* Hashed on the HAL handle */
+
+typedef struct
+{
+	uint32_t id;
+	uint32_t mask;		/* Compared bits, every id bit for an exact id */
+	uint8_t ext;
+	uint8_t fifo;
+	uint8_t merged;		/* Lets through ids no callback asked for */
+}canbus_filter_entry_t;
+
+static canbus_callback_t canbus_callback_pool[CANBUS_CALLBACK_POOL_SIZE];
+static canbus_callback_t* canbus_callback_free = NULL;
+static uint32_t canbus_callback_pool_used = 0;
+static uint32_t canbus_rx_orphaned = 0;
 
 /******************************************************************************
 * Declaration | Static Functions
 ******************************************************************************/
 
 static void canbus_remove_callbacks(canbus_t* canbus);
+static uint32_t canbus_lock(void);
+static void canbus_unlock(uint32_t state);
+static uint32_t canbus_cycles(void);
+static uint32_t canbus_rx_key(uint32_t type, uint32_t id);
+static void canbus_rx_index_insert(canbus_t* canbus, canbus_callback_t* node);
+static void canbus_rx_index_remove(canbus_callback_t* node);
+static void canbus_rx_index_build(canbus_t* canbus);
+static i_status canbus_rcu_write_begin(canbus_t* canbus);
+static void canbus_rcu_write_end(canbus_t* canbus);
+static uint32_t canbus_rcu_read_begin(canbus_t* canbus);
+static void canbus_rcu_read_end(canbus_t* canbus, uint32_t epoch);
+static void canbus_rcu_retire(canbus_t* canbus, canbus_callback_t* node);
+static uint32_t canbus_rcu_reclaim(canbus_t* canbus);
+static uint32_t canbus_rx_dispatch(canbus_t* canbus, canbus_frame_t* frame, uint32_t key, uint8_t deferred, uint32_t* called);
+static void canbus_rx_call(canbus_t* canbus, canbus_callback_t* item, canbus_frame_t* frame);
+static void canbus_rx_invoke(canbus_callback_t* item, canbus_frame_t* frame);
+static canbus_frame_t* canbus_rx_slot(canbus_rx_ring_t* ring, canbus_frame_t* spare);
+static uint32_t canbus_rx_publish(canbus_rx_ring_t* ring, canbus_frame_t* frame);
+static void canbus_rx_notify(canbus_t* canbus);
+static void canbus_rx_drain(CAN_HandleTypeDef* hcan, uint32_t fifo, uint8_t isr);
+static uint32_t canbus_rx_its(canbus_t* canbus, uint32_t lane);
+static void canbus_rx_flush(canbus_t* canbus, uint32_t lane);
+static canbus_callback_t* canbus_callback_alloc(void);
+static void canbus_callback_release(canbus_callback_t* node);
+static i_status canbus_callback_insert(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), void(*view)(const canbus_frame_view_t*), void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags);
+static uint32_t canbus_filter_full(uint8_t ext);
+static uint64_t canbus_filter_size(const canbus_filter_entry_t* entry);
+static uint32_t canbus_filter_covers(const canbus_filter_entry_t* a, const canbus_filter_entry_t* b);
+static uint32_t canbus_filter_absorb(canbus_filter_entry_t* work, uint32_t cnt, uint32_t keep);
+static uint32_t canbus_filter_reduce(canbus_filter_entry_t* work, uint32_t cnt, uint32_t ext);
+static uint32_t canbus_filter_collect(canbus_t* canbus, canbus_filter_entry_t* work);
+static uint32_t canbus_filter_kind(const canbus_filter_entry_t* entry);
+static uint32_t canbus_filter_banks(const canbus_filter_entry_t* work, uint32_t cnt);
+static HAL_StatusTypeDef canbus_filter_bank(canbus_t* canbus, uint32_t bank, uint32_t kind, uint32_t fifo, const uint32_t* id, const uint32_t* mask);
+static void canbus_filters_refresh(canbus_t* canbus);
+static canbus_t* canbus_from_handle(CAN_HandleTypeDef* hcan);
+static i_status canbus_register(canbus_t* canbus);
+#ifdef CANBUS_IRQ_PRIORITY
+static i_status canbus_irq_check(canbus_t* canbus);
+#endif
+static uint32_t canbus_tx_before(const canbus_tx_item_t* a, const canbus_tx_item_t* b);
+static void canbus_tx_push(canbus_tx_queue_t* queue, const canbus_tx_item_t* item);
+static void canbus_tx_pop(canbus_tx_queue_t* queue, canbus_tx_item_t* item);
+static void canbus_tx_header(CAN_TxHeaderTypeDef* header, uint32_t id_type, uint32_t id, uint16_t dlc);
+static uint32_t canbus_tx_key(const CAN_TxHeaderTypeDef* header);
+static i_status canbus_tx_enqueue(canbus_t* canbus, CAN_TxHeaderTypeDef* header, uint32_t key, uint8_t* data, uint8_t marker);
+static void canbus_tx_preempt(canbus_t* canbus, uint32_t key);
+static void canbus_tx_refill(canbus_t* canbus);
+static void canbus_tx_release(canbus_t* canbus, uint32_t mailbox, uint32_t requeue);
+static void canbus_tx_done(canbus_t* canbus, uint32_t mailbox);
+static void canbus_tx_notify(canbus_t* canbus, canbus_tx_event_t* event);
+static void canbus_bus_off(canbus_t* canbus);
 
 /******************************************************************************
 * Definition  | Static Functions
 ******************************************************************************/
 
-static void canbus_remove_callbacks(canbus_t* canbus)
+/* Masks what the driver shares state with: the interrupts up to
+   CANBUS_IRQ_PRIORITY through BASEPRI when the config sets it, all of them
+   otherwise. Restores the previous level, so it nests. */
+static uint32_t canbus_lock(void)
 {
-	if(canbus->callbacks == NULL)
-		return;
+	uint32_t state;
+#ifdef CANBUS_LOCK_LEVEL
+	state = __get_BASEPRI();
+	__set_BASEPRI_MAX(CANBUS_LOCK_LEVEL);
+#else
+	state = __get_PRIMASK();
 	__disable_irq();
+#endif
+	return state;
+}
+
+static void canbus_unlock(uint32_t state)
+{
+#ifdef CANBUS_LOCK_LEVEL
+	__set_BASEPRI(state);
+#else
+	__set_PRIMASK(state);
+#endif
+}
+
+/* CANBUS_CYCLES() when the config gives one, the DWT cycle counter otherwise */
+static uint32_t canbus_cycles(void)
+{
+#if defined(CANBUS_CYCLES)
+	return CANBUS_CYCLES();
+#elif defined(DWT)
+	return DWT->CYCCNT;
+#else
+	return 0;
+#endif
+}
 
+static void canbus_remove_callbacks(canbus_t* canbus)
+{
 	canbus_callback_t* next = NULL;
 	canbus_callback_t *current = canbus->callbacks;
 
+	if(current == NULL || canbus_rcu_write_begin(canbus) != I_OK)
+		return;
+
 	while (current != NULL)
 	{
 		next = current->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
+		canbus_rx_index_remove(current);
+		canbus_rcu_retire(canbus, current);
 		current = next;
 	}
 
 	canbus->callbacks = NULL;
-	__enable_irq();
+	(void)canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
 }
 
-/******************************************************************************
-* Definition  | Public Functions
-******************************************************************************/
-
-i_status canbus_initialize(canbus_t* canbus)
+/* Probes from the hashed slot, first hit on a single interface per slot */
+static canbus_t* canbus_from_handle(CAN_HandleTypeDef* hcan)
 {
-	__disable_irq();
+	uint32_t slot = CANBUS_HANDLE_SLOT(hcan);
+	canbus_t* canbus;
 
-	(void)HAL_CAN_DeactivateNotification(canbus->hcan, CAN_IT_RX_FIFO0_FULL);
-	(void)HAL_CAN_DeInit(canbus->hcan);
+	for(uint32_t i=0;i<CANBUS_INTERFACES_MAX;i++)
+	{
+		canbus = canbus_interfaces[(slot + i) & (CANBUS_INTERFACES_MAX - 1U)];
+		if(canbus == NULL || canbus->hcan == hcan)
+			return canbus;
+	}
+	return NULL;
+}
 
-	__enable_irq();
-	canbus->mx_init();
+/* Called with IRQs disabled, I_OK the first time an interface is seen */
+static i_status canbus_register(canbus_t* canbus)
+{
+	uint32_t slot = CANBUS_HANDLE_SLOT(canbus->hcan);
+	canbus_t** entry;
 
-	if(canbus->filters_cnt != 0)
+	for(uint32_t i=0;i<CANBUS_INTERFACES_MAX;i++)
 	{
-		for(int i=0;i<canbus->filters_cnt;i++)
-			if (HAL_CAN_ConfigFilter(canbus->hcan, &canbus->filters[i] ) != HAL_OK) goto canbus_initialize_error;
+		entry = &canbus_interfaces[(slot + i) & (CANBUS_INTERFACES_MAX - 1U)];
+		if(*entry == canbus)
+			return I_EXISTS;
+		if(*entry != NULL && (*entry)->hcan != canbus->hcan)
+			continue;
+		*entry = canbus;
+		return I_OK;
 	}
+	return I_FULL;
+}
 
+#ifdef CANBUS_IRQ_PRIORITY
+/* canbus_lock masks up to CANBUS_IRQ_PRIORITY only: a line set more urgent,
+   e.g. RX1, would get into the locked sections. F1 parts share TX and RX0
+   with USB, only RX1 and SCE are checked there; lines of families the driver
+   does not know are not checked. */
+static i_status canbus_irq_check(canbus_t* canbus)
+{
+	int32_t lines[4] = {-1, -1, -1, -1};
 
-	if (HAL_CAN_Start(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_RX_FIFO0_MSG_PENDING) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_RX_FIFO0_FULL) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_BUSOFF) != HAL_OK) goto canbus_initialize_error;
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i] == canbus)
-			return I_OK;
+#if defined(STM32F2) || defined(STM32F4) || defined(STM32F7) || defined(STM32L4)
+	if(canbus->hcan->Instance == CAN1)
+	{
+		lines[0] = CAN1_TX_IRQn;
+		lines[1] = CAN1_RX0_IRQn;
+		lines[2] = CAN1_RX1_IRQn;
+		lines[3] = CAN1_SCE_IRQn;
+	}
+#ifdef CAN2
+	if(canbus->hcan->Instance == CAN2)
+	{
+		lines[0] = CAN2_TX_IRQn;
+		lines[1] = CAN2_RX0_IRQn;
+		lines[2] = CAN2_RX1_IRQn;
+		lines[3] = CAN2_SCE_IRQn;
+	}
+#endif
+#ifdef CAN3
+	if(canbus->hcan->Instance == CAN3)
+	{
+		lines[0] = CAN3_TX_IRQn;
+		lines[1] = CAN3_RX0_IRQn;
+		lines[2] = CAN3_RX1_IRQn;
+		lines[3] = CAN3_SCE_IRQn;
+	}
+#endif
+#elif defined(STM32F1)
+	if(canbus->hcan->Instance == CAN1)
+	{
+		lines[2] = CAN1_RX1_IRQn;
+		lines[3] = CAN1_SCE_IRQn;
+	}
+#ifdef CAN2
+	if(canbus->hcan->Instance == CAN2)
+	{
+		lines[2] = CAN2_RX1_IRQn;
+		lines[3] = CAN2_SCE_IRQn;
+	}
+#endif
+#else
+	(void)canbus;
+#endif
+	for(uint32_t i=0;i<4U;i++)
+		if(lines[i] >= 0 && NVIC_GetPriority((IRQn_Type)lines[i]) < (CANBUS_IRQ_PRIORITY))
+			return I_INVALID;
+	return I_OK;
+}
+#endif
 
-	canbus_interfaces[canbus_interfaces_cnt] = canbus;
-	canbus_interfaces_cnt++;
+static uint32_t canbus_tx_before(const canbus_tx_item_t* a, const canbus_tx_item_t* b)
+{
+	if(a->key != b->key)
+		return a->key < b->key;
+	return (int32_t)(a->seq - b->seq) < 0;
+}
 
-	return I_OK;
-	canbus_initialize_error:
-		return I_ERROR;
+static void canbus_tx_push(canbus_tx_queue_t* queue, const canbus_tx_item_t* item)
+{
+	uint32_t i = queue->count++;
+	uint32_t parent;
+
+	while(i > 0)
+	{
+		parent = (i - 1) / 2;
+		if(!canbus_tx_before(item, &queue->items[parent]))
+			break;
+		queue->items[i] = queue->items[parent];
+		i = parent;
+	}
+	queue->items[i] = *item;
 }
 
-i_status canbus_send_plain(canbus_t* canbus, uint16_t fr_format, uint32_t id_type, uint32_t id, uint8_t dlc, uint8_t* data)
+static void canbus_tx_pop(canbus_tx_queue_t* queue, canbus_tx_item_t* item)
 {
-	uint32_t timeout = HAL_GetTick();
-	uint8_t iterrations = 0;
-	uint32_t       TxMailbox;
-	__disable_irq();
+	canbus_tx_item_t* last = &queue->items[--queue->count];
+	uint32_t i = 0;
+	uint32_t child;
 
+	*item = queue->items[0];
+	while((child = 2 * i + 1) < queue->count)
+	{
+		if(child + 1 < queue->count && canbus_tx_before(&queue->items[child + 1], &queue->items[child]))
+			child++;
+		if(!canbus_tx_before(&queue->items[child], last))
+			break;
+		queue->items[i] = queue->items[child];
+		i = child;
+	}
+	queue->items[i] = *last;
+}
+
+static void canbus_tx_header(CAN_TxHeaderTypeDef* header, uint32_t id_type, uint32_t id, uint16_t dlc)
+{
 	if(id_type == CBUS_ID_T_EXTENDED)
 	{
-		TxHeader.ExtId = id;
-		TxHeader.IDE = CAN_ID_EXT;
+		header->ExtId = id;
+		header->IDE = CAN_ID_EXT;
 	}
 	else
 	{
-		TxHeader.StdId = id;
-		TxHeader.IDE = CAN_ID_STD;
+		header->StdId = id;
+		header->IDE = CAN_ID_STD;
 	}
+	header->RTR = CAN_RTR_DATA;
+	header->TransmitGlobalTime = DISABLE;
+	header->DLC = dlc;
+}
+
+/* Standard ids are placed on the extended id scale and win ties with
+   extended ids, like the bus arbitration does. */
+static uint32_t canbus_tx_key(const CAN_TxHeaderTypeDef* header)
+{
+	return header->IDE == CAN_ID_EXT ? (header->ExtId << 1) | 1U : header->StdId << 19;
+}
+
+/* Called with interrupts disabled */
+static i_status canbus_tx_enqueue(canbus_t* canbus, CAN_TxHeaderTypeDef* header, uint32_t key, uint8_t* data, uint8_t marker)
+{
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	canbus_tx_item_t item;
+	uint32_t mailbox;
 
-	TxHeader.RTR = CAN_RTR_DATA;
-	TxHeader.TransmitGlobalTime = DISABLE;
-	TxHeader.DLC = dlc;
+	item.header = *header;
+	memset(item.dt, 0, sizeof(item.dt));
+	memcpy(item.dt, data, header->DLC);
+	item.key = key;
+	item.seq = queue->seq++;
+	item.marker = marker;
 
-	if(dlc>8)
+	if(queue->count == 0 && HAL_CAN_GetTxMailboxesFreeLevel(canbus->hcan) != 0)
 	{
-		return I_ERROR;
+		if(HAL_CAN_AddTxMessage(canbus->hcan, &item.header, item.dt, &mailbox) != HAL_OK)
+		{
+			canbus->stats.tx_errors++;
+			return I_ERROR;
+		}
+		queue->mailbox[mailbox >> 1] = item;
+		queue->mailbox_busy |= mailbox;
+		canbus->stats.tx_frames++;
+		return I_OK;
+	}
+
+	if(queue->count >= CANBUS_TX_QUEUE_SIZE)
+	{
+		canbus->stats.tx_full++;
+		return I_FULL;
 	}
 
-	HAL_StatusTypeDef result;
-	do
+	canbus_tx_push(queue, &item);
+	canbus_tx_preempt(canbus, item.key);
+	canbus->stats.tx_frames++;
+	return I_OK;
+}
+
+/* Aborts the least urgent mailbox when it would lose arbitration against the
+   new frame. The abort interrupt puts it back into the queue. */
+static void canbus_tx_preempt(canbus_t* canbus, uint32_t key)
+{
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	uint32_t victim = 0;
+
+	for(register uint32_t i=0;i<3;i++)
 	{
-		result = HAL_CAN_AddTxMessage(canbus->hcan, &TxHeader, data,&TxMailbox);
-		iterrations++;
-		if(iterrations == 0xFF)
+		if((queue->mailbox_busy & ~queue->mailbox_abort & (1U << i)) != 0 && queue->mailbox[i].key > key)
 		{
-			__enable_irq();
-			return I_ERROR;
+			key = queue->mailbox[i].key;
+			victim = 1U << i;
 		}
 	}
-	while(result != HAL_OK);
-	__enable_irq();
 
-	return result == HAL_OK ? I_OK :I_ERROR;
+	if(victim != 0 && HAL_CAN_AbortTxRequest(canbus->hcan, victim) == HAL_OK)
+		queue->mailbox_abort |= victim;
 }
 
-i_status canbus_send(canbus_t* canbus,canbus_frame_t* frame)
+static void canbus_tx_refill(canbus_t* canbus)
 {
-	uint32_t timeout = HAL_GetTick();
-	uint8_t iterrations = 0;
-	uint32_t       TxMailbox;
-	__disable_irq();
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	uint32_t mailbox;
 
-	if(frame->id_type == CBUS_ID_T_EXTENDED)
+	while(queue->count != 0 && HAL_CAN_GetTxMailboxesFreeLevel(canbus->hcan) != 0)
 	{
-		TxHeader.ExtId = frame->id;
-		TxHeader.IDE = CAN_ID_EXT;
+		if(HAL_CAN_AddTxMessage(canbus->hcan, &queue->items[0].header, queue->items[0].dt, &mailbox) != HAL_OK)
+			break;
+		canbus_tx_pop(queue, &queue->mailbox[mailbox >> 1]);
+		queue->mailbox_busy |= mailbox;
 	}
-	else
+}
+
+/* Shared by the TX and error interrupts, counts their cycles. The RX
+   interrupts may send and preempt them, so the queue is worked on locked. */
+static void canbus_tx_release(canbus_t* canbus, uint32_t mailbox, uint32_t requeue)
+{
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	uint32_t start = canbus_cycles();
+	uint32_t lock = canbus_lock();
+
+	if(requeue == CANBUS_TX_REQUEUE_ABORTED)
+		requeue = (queue->mailbox_abort & mailbox) != 0;
+	if(requeue && (queue->mailbox_busy & mailbox) != 0)
+		canbus_tx_push(queue, &queue->mailbox[mailbox >> 1]);
+	queue->mailbox_busy &= ~mailbox;
+	queue->mailbox_abort &= ~mailbox;
+	canbus_tx_refill(canbus);
+	canbus_unlock(lock);
+	canbus->stats.isr_cycles[2] += canbus_cycles() - start;
+}
+
+/* Mailbox complete: the frame left with its start of frame time stamped.
+   The event is taken before the refill reuses the mailbox slot. */
+static void canbus_tx_done(canbus_t* canbus, uint32_t mailbox)
+{
+	canbus_tx_item_t* item = &canbus->tx_queue.mailbox[mailbox >> 1];
+	canbus_tx_event_t event = {.marker = 0};
+	uint32_t lock = canbus_lock();
+
+	if((canbus->tx_queue.mailbox_busy & mailbox) != 0 && item->marker != 0)
 	{
-		TxHeader.StdId = frame->id;
-		TxHeader.IDE = CAN_ID_STD;
+		event.id = item->header.IDE == CAN_ID_EXT ? item->header.ExtId : item->header.StdId;
+		event.id_type = item->header.IDE == CAN_ID_EXT ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
+		event.timestamp = HAL_CAN_GetTxTimestamp(canbus->hcan, mailbox);
+		event.marker = item->marker;
 	}
-	TxHeader.RTR = CAN_RTR_DATA;
-	TxHeader.TransmitGlobalTime = DISABLE;
-	TxHeader.DLC = frame->dlc;
+	canbus_tx_release(canbus, mailbox, 0);
+	canbus_unlock(lock);
+	if(event.marker != 0)
+		canbus_tx_notify(canbus, &event);
+}
+
+/* From the error ISR: the controller stays off the bus until it leaves init
+   mode again, only the backoff is armed here and canbus_recover_if_needs does
+   the restart */
+static void canbus_bus_off(canbus_t* canbus)
+{
+	canbus_recovery_t* recovery = &canbus->recovery;
+	uint32_t now = HAL_GetTick();
+	uint32_t backoff;
+
+	if(recovery->state == CBUS_RC_IDLE && now - recovery->done >= CANBUS_RECOVERY_BACKOFF_MAX)
+		recovery->attempts = 0;
+	backoff = recovery->attempts < 16U ? CANBUS_RECOVERY_BACKOFF_MIN << recovery->attempts : CANBUS_RECOVERY_BACKOFF_MAX;
+	if(backoff > CANBUS_RECOVERY_BACKOFF_MAX)
+		backoff = CANBUS_RECOVERY_BACKOFF_MAX;
+	if(recovery->attempts < 0xFFU)
+		recovery->attempts++;
+
+	recovery->since = now;
+	recovery->backoff = backoff;
+	recovery->state = CBUS_RC_BACKOFF;
+	canbus->stats.bus_off++;
+}
+
+/* From the TX interrupts, once the frame made it onto the bus */
+static void canbus_tx_notify(canbus_t* canbus, canbus_tx_event_t* event)
+{
+#if __has_include("task.h")
+	BaseType_t woken = pdFALSE;
+#endif
+
+	if(canbus->tx_done != NULL)
+		canbus->tx_done(event);
+#if __has_include("task.h")
+	if(canbus->tx_task == NULL)
+		return;
+	xTaskNotifyFromISR(canbus->tx_task, ((uint32_t)event->marker << 16) | event->timestamp, eSetValueWithOverwrite, &woken);
+	portYIELD_FROM_ISR(woken);
+#endif
+}
+
+static uint32_t canbus_rx_key(uint32_t type, uint32_t id)
+{
+	if(type == CBUS_ID_T_EXTENDED)
+		return id | CANBUS_RX_KEY_EXT;
+	if(type == CBUS_ID_T_STANDARD)
+		return id & ~CANBUS_RX_KEY_EXT;
+	return CANBUS_RX_KEY_NONE;
+}
+
+/* Called with interrupts disabled. Exact ids land in a hash slot, masked
+   entries in one list ordered on mask so each mask is applied once per frame. */
+static void canbus_rx_index_insert(canbus_t* canbus, canbus_callback_t* node)
+{
+	canbus_callback_t** slot;
 
-	HAL_StatusTypeDef result;
-	do
+	node->link = NULL;
+	node->pprev = NULL;
+	node->key = canbus_rx_key(node->type, node->id);
+	if(node->key == CANBUS_RX_KEY_NONE)
+		return;
+
+	if(node->mask == 0)
 	{
-		result = HAL_CAN_AddTxMessage(canbus->hcan, &TxHeader, frame->dt,&TxMailbox);
-		iterrations++;
-		if(iterrations == 0xFF)
-		{
-			 __enable_irq();
-			return I_ERROR;
-		}
+		slot = &canbus->rx_index.exact[CANBUS_RX_SLOT(node->key)];
+	}
+	else
+	{
+		node->key &= node->mask | CANBUS_RX_KEY_EXT;
+		slot = &canbus->rx_index.masked;
+		while(*slot != NULL && (*slot)->mask < node->mask)
+			slot = &(*slot)->link;
 	}
-	while(result != HAL_OK);
-	__enable_irq();
 
+	/* Readers see the node complete or not at all */
+	node->link = *slot;
+	node->pprev = slot;
+	if(*slot != NULL)
+		(*slot)->pprev = &node->link;
+	__DMB();
+	*slot = node;
+}
 
-	return result == HAL_OK ? I_OK :I_ERROR;
+static void canbus_rx_index_remove(canbus_callback_t* node)
+{
+	if(node->pprev == NULL)
+		return;
+	/* `link` stays, a dispatch standing on the node carries on past it */
+	*node->pprev = node->link;
+	if(node->link != NULL)
+		node->link->pprev = node->pprev;
+	node->pprev = NULL;
 }
 
-i_status canbus_callback_add(canbus_t* canbus,uint32_t id,uint32_t mask,uint32_t type, void(*cb)(canbus_frame_t*))
+/* Picks up lists handed over in `callbacks` before the first initialize */
+static void canbus_rx_index_build(canbus_t* canbus)
 {
-	__disable_irq();
-	canbus_callback_t* node = (canbus_callback_t*)malloc(sizeof(canbus_callback_t));
+	canbus_callback_t* prev = NULL;
 
-	#if __has_include("FreeRTOS.h")
-	if(node == NULL)
-			node = (canbus_callback_t*)pvPortMalloc(sizeof(canbus_callback_t));
-	#else
-	if(node == NULL)
-				node = (canbus_callback_t*)malloc(sizeof(canbus_callback_t));
-	#endif
+	memset(&canbus->rx_index, 0, sizeof(canbus->rx_index));
+	for(canbus_callback_t* node = canbus->callbacks;node != NULL;node = node->next)
+	{
+		node->prev = prev;
+		node->bus = canbus;
+		canbus_rx_index_insert(canbus, node);
+		prev = node;
+	}
+}
 
-	if(node == NULL)
-		goto canbus_callback_add_error;
-	node->id = id;
-	node->mask = mask;
-	node->type = type;
-	node->callback = cb;
-	node->next = canbus->callbacks;
-	canbus->callbacks = node;
-	__enable_irq();
-	return I_OK;
-	canbus_callback_add_error:
-	__enable_irq();
-	return I_ERROR;
+/* Writers run in thread context, one at a time per interface; a second one
+   gets I_LOCKED instead of waiting. The RX ISR never waits on them. */
+static i_status canbus_rcu_write_begin(canbus_t* canbus)
+{
+	uint32_t lock = canbus_lock();
+	uint8_t busy = canbus->rcu.writer;
+
+	canbus->rcu.writer = 1;
+	canbus_unlock(lock);
+	return busy ? I_LOCKED : I_OK;
 }
 
-i_status canbus_callback_remove(canbus_t* canbus,canbus_callback_t* clb)
+static void canbus_rcu_write_end(canbus_t* canbus)
 {
-	if(canbus->callbacks == NULL)
-		return I_NOTEXISTS;
-	__disable_irq();
+	__DMB();
+	canbus->rcu.writer = 0;
+}
 
-	canbus_callback_t *current;
-	canbus_callback_t *to_remove;
+/* Counts the dispatch in the current epoch. Nested ISRs restore the counter
+   before they return, so a plain increment is enough on one core. */
+static uint32_t canbus_rcu_read_begin(canbus_t* canbus)
+{
+	uint32_t epoch;
 
-	if(canbus->callbacks == clb)
+	while(1)
 	{
-		current = canbus->callbacks;
-		canbus->callbacks = current->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
-		__enable_irq();
-		return I_OK;
+		epoch = canbus->rcu.epoch & 1U;
+		canbus->rcu.readers[epoch]++;
+		__DMB();
+		if((canbus->rcu.epoch & 1U) == epoch)
+			return epoch;
+		canbus->rcu.readers[epoch]--;
 	}
+}
+
+static void canbus_rcu_read_end(canbus_t* canbus, uint32_t epoch)
+{
+	__DMB();
+	canbus->rcu.readers[epoch]--;
+}
+
+/* Node already unlinked from the list and the index */
+static void canbus_rcu_retire(canbus_t* canbus, canbus_callback_t* node)
+{
+	node->retired = 1;
+	node->next = canbus->rcu.retired;
+	canbus->rcu.retired = node;
+}
 
-	current = canbus->callbacks;
+/* Hands back the nodes no dispatch can reach any more and returns how many
+   still wait. Never blocks: a grace period with readers left is checked
+   again by the next writer. */
+static uint32_t canbus_rcu_reclaim(canbus_t* canbus)
+{
+	canbus_rcu_t* rcu = &canbus->rcu;
+	canbus_callback_t* node;
+	uint32_t waiting = 0;
+	uint32_t lock;
 
-	while (current != NULL)
+	for(uint32_t pass=0;pass<2U;pass++)
 	{
-		if(current->next == clb)
+		if(rcu->grace == NULL)
 		{
-			to_remove = current->next;
-			current->next = to_remove->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
-			__enable_irq();
-			return I_OK;
+			if(rcu->retired == NULL)
+				break;
+			rcu->grace = rcu->retired;
+			rcu->retired = NULL;
+			rcu->epoch++;
+			__DMB();
 		}
-		current = current->next;
+		if(rcu->readers[(rcu->epoch - 1U) & 1U] != 0)
+			break;
+
+		lock = canbus_lock();
+		while(rcu->grace != NULL)
+		{
+			node = rcu->grace;
+			rcu->grace = node->next;
+			canbus_callback_release(node);
+		}
+		canbus_unlock(lock);
 	}
-	__enable_irq();
-	return I_NOTEXISTS;
+
+	for(node = rcu->grace;node != NULL;node = node->next)
+		waiting++;
+	for(node = rcu->retired;node != NULL;node = node->next)
+		waiting++;
+	return waiting;
 }
 
-i_status canbus_callback_exists(canbus_t* canbus,canbus_callback_t* clb)
+/* Runs the matching callbacks of one delivery kind, returns how many of the
+   other kind matched. `called` takes how many ran. */
+static uint32_t canbus_rx_dispatch(canbus_t* canbus, canbus_frame_t* frame, uint32_t key, uint8_t deferred, uint32_t* called)
 {
-	if(canbus->callbacks == NULL)
-		return I_NOTEXISTS;
-	__disable_irq();
+	canbus_callback_t* item = canbus->rx_index.exact[CANBUS_RX_SLOT(key)];
+	canbus_callback_t* next;
+	uint32_t mask = 0;
+	uint32_t masked = 0;
+	uint32_t other = 0;
 
-	canbus_callback_t *current = canbus->callbacks;
-
-	while (current != NULL)
+	*called = 0;
+	for(;item != NULL;item = next)
 	{
-		if(current == clb)
+		next = item->link;
+		if(item->key != key)
+			continue;
+		if(item->deferred != deferred)
 		{
-			__enable_irq();
-			return I_EXISTS;
+			other++;
+			continue;
 		}
-		current = current->next;
+		(*called)++;
+		canbus_rx_call(canbus, item, frame);
 	}
 
-	__enable_irq();
-	return I_NOTEXISTS;
+	for(item = canbus->rx_index.masked;item != NULL;item = next)
+	{
+		next = item->link;
+		if(item->mask != mask)
+		{
+			mask = item->mask;
+			masked = key & (mask | CANBUS_RX_KEY_EXT);
+		}
+		if(item->key != masked)
+			continue;
+		if(item->deferred != deferred)
+		{
+			other++;
+			continue;
+		}
+		(*called)++;
+		canbus_rx_call(canbus, item, frame);
+	}
+	return other;
 }
 
-void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
+/* With CANBUS_PROFILE the call is timed into the histogram of the node. Two
+   RX FIFO ISRs running the same node may lose a count. */
+static void canbus_rx_call(canbus_t* canbus, canbus_callback_t* item, canbus_frame_t* frame)
 {
-	static canbus_t* current_canbus = NULL;
-	static CAN_RxHeaderTypeDef pRxHeader;
-	static canbus_frame_t frame;
-	static canbus_callback_t* callback_item = NULL;
+#if CANBUS_PROFILE
+	uint32_t start = canbus_cycles();
+	uint32_t cycles;
+	uint32_t bin;
+	uint32_t budget;
 
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i]->hcan == hcan)
-			current_canbus = canbus_interfaces[i];
+	canbus_rx_invoke(item, frame);
+	cycles = canbus_cycles() - start;
+	bin = 32U - __CLZ(cycles);
+	item->hist[bin < CANBUS_PROFILE_BINS ? bin : CANBUS_PROFILE_BINS - 1U]++;
+	if(cycles > item->max)
+		item->max = cycles;
 
-	if(current_canbus == NULL)
+	budget = item->budget != 0 ? item->budget : CANBUS_PROFILE_BUDGET;
+	if(budget == 0 || cycles <= budget)
+		return;
+	item->over++;
+	if(canbus->budget_hook != NULL)
+		canbus->budget_hook(item, frame, cycles);
+#else
+	(void)canbus;
+	canbus_rx_invoke(item, frame);
+#endif
+}
+
+/* The mailbox is read out in one go, views point at the copy */
+static void canbus_rx_invoke(canbus_callback_t* item, canbus_frame_t* frame)
+{
+	canbus_frame_view_t view;
+
+	if(item->handler != NULL)
 	{
-		while(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK);
+		item->handler(item, frame);
 		return;
 	}
-	if(current_canbus->callbacks == NULL)
+	if(item->view == NULL)
 	{
-		while(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK);
+		item->callback(frame);
 		return;
 	}
-	while(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK)
+	view.id = frame->id;
+	view.id_type = frame->id_type;
+	view.fr_format = frame->fr_format;
+	view.dlc = frame->dlc;
+	view.data = (const volatile uint32_t*)(const void*)frame->dt;
+	view.timestamp = frame->timestamp;
+	item->view(&view);
+}
+
+/* Frames are read straight into the next ring slot, `spare` takes them while
+   the ring is full. */
+static canbus_frame_t* canbus_rx_slot(canbus_rx_ring_t* ring, canbus_frame_t* spare)
+{
+	if((ring->head - ring->tail) == CANBUS_RX_RING_SIZE)
+		return spare;
+	return &ring->items[ring->head & (CANBUS_RX_RING_SIZE - 1U)];
+}
+
+static uint32_t canbus_rx_publish(canbus_rx_ring_t* ring, canbus_frame_t* frame)
+{
+	if(frame != &ring->items[ring->head & (CANBUS_RX_RING_SIZE - 1U)] || (ring->head - ring->tail) == CANBUS_RX_RING_SIZE)
+	{
+		ring->dropped++;
+		return 0;
+	}
+	__DMB();
+	ring->head++;
+	return 1;
+}
+
+static void canbus_rx_notify(canbus_t* canbus)
+{
+#if __has_include("task.h")
+	BaseType_t woken = pdFALSE;
+
+	if(canbus->rx_task == NULL)
+		return;
+	vTaskNotifyGiveFromISR(canbus->rx_task, &woken);
+	portYIELD_FROM_ISR(woken);
+#else
+	(void)canbus;
+#endif
+}
+
+static uint32_t canbus_filter_full(uint8_t ext)
+{
+	return ext ? 0x1FFFFFFFU : 0x7FFU;
+}
+
+static uint64_t canbus_filter_size(const canbus_filter_entry_t* entry)
+{
+	uint32_t free = entry->ext ? 29U : 11U;
+
+	for(uint32_t m = entry->mask & canbus_filter_full(entry->ext);m != 0;m &= m - 1U)
+		free--;
+	return (uint64_t)1U << free;
+}
+
+/* a lets through every id b does */
+static uint32_t canbus_filter_covers(const canbus_filter_entry_t* a, const canbus_filter_entry_t* b)
+{
+	return a->ext == b->ext && a->fifo == b->fifo && (a->mask & ~b->mask) == 0 && ((a->id ^ b->id) & a->mask) == 0;
+}
+
+/* Drops the entries the one at `keep` already lets through */
+static uint32_t canbus_filter_absorb(canbus_filter_entry_t* work, uint32_t cnt, uint32_t keep)
+{
+	for(uint32_t i=0;i<cnt;)
 	{
-		callback_item = current_canbus->callbacks;
-		frame.id =pRxHeader.IDE == CAN_ID_STD ?  pRxHeader.StdId :  pRxHeader.ExtId;
-		frame.dlc = pRxHeader.DLC;
-		frame.id_type = pRxHeader.IDE == CAN_ID_EXT ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
-		frame.fr_format =  CBUS_FR_FRM_STD;
+		if(i != keep && canbus_filter_covers(&work[keep], &work[i]))
+		{
+			work[i] = work[--cnt];
+			if(keep == cnt)
+				keep = i;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return cnt;
+}
+
+/* Merges the pair of the given type (2: any type) that lets the fewest
+   extra ids through. Returns the new count, unchanged if nothing merges. */
+static uint32_t canbus_filter_reduce(canbus_filter_entry_t* work, uint32_t cnt, uint32_t ext)
+{
+	canbus_filter_entry_t merged;
+	canbus_filter_entry_t best = {0};
+	int64_t best_cost = INT64_MAX;
+	int64_t cost;
+	uint32_t best_i = 0;
+	uint32_t best_j = 0;
 
-		while(callback_item!=NULL)
+	for(uint32_t i=0;i<cnt;i++)
+	{
+		if(ext < 2U && work[i].ext != ext)
+			continue;
+		for(uint32_t j=i+1U;j<cnt;j++)
 		{
-   			if(callback_item->type == (pRxHeader.IDE == CAN_ID_EXT ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD))
+			if(work[j].ext != work[i].ext || work[j].fifo != work[i].fifo)
+				continue;
+			merged.ext = work[i].ext;
+			merged.fifo = work[i].fifo;
+			merged.merged = 1;
+			merged.mask = work[i].mask & work[j].mask & ~(work[i].id ^ work[j].id);
+			merged.id = work[i].id & merged.mask;
+			cost = (int64_t)canbus_filter_size(&merged) - (int64_t)canbus_filter_size(&work[i]) - (int64_t)canbus_filter_size(&work[j]);
+			if(cost < best_cost)
 			{
-				if((callback_item->mask == 0 && (callback_item->id == (pRxHeader.IDE == CAN_ID_STD ?  pRxHeader.StdId :  pRxHeader.ExtId)))
-				  || (callback_item->mask!=0 && (callback_item->id & callback_item->mask) == ((pRxHeader.IDE == CAN_ID_STD ?  pRxHeader.StdId :  pRxHeader.ExtId) & callback_item->mask)))
-					callback_item->callback(&frame);
+				best_cost = cost;
+				best = merged;
+				best_i = i;
+				best_j = j;
 			}
-			callback_item = callback_item->next;
 		}
 	}
+
+	if(best_cost == INT64_MAX)
+		return cnt;
+
+	work[best_i] = best;
+	work[best_j] = work[--cnt];
+	if(best_i == cnt)
+		best_i = best_j;
+	return canbus_filter_absorb(work, cnt, best_i);
 }
 
+/* Called by the RCU writer. Also fills in `wanted` of the report. */
+static uint32_t canbus_filter_collect(canbus_t* canbus, canbus_filter_entry_t* work)
+{
+	canbus_filter_entry_t entry = {0};
+	uint32_t cnt = 0;
+	uint32_t key;
+	uint32_t i;
 
-void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+	canbus->filter_report.wanted = 0;
+	for(canbus_callback_t* node = canbus->callbacks;node != NULL;node = node->next)
+	{
+		key = canbus_rx_key(node->type, node->id);
+		if(key == CANBUS_RX_KEY_NONE)
+			continue;
+
+		entry.ext = (key & CANBUS_RX_KEY_EXT) != 0;
+		entry.fifo = node->fifo;
+		entry.mask = node->mask == 0 ? canbus_filter_full(entry.ext) : node->mask & canbus_filter_full(entry.ext);
+		entry.id = node->id & entry.mask;
+
+		for(i=0;i<cnt;i++)
+			if(canbus_filter_covers(&work[i], &entry))
+				break;
+		if(i < cnt && work[i].merged == 0)
+			continue;
+		canbus->filter_report.wanted += canbus_filter_size(&entry);
+		if(i < cnt)
+			continue;
+
+		/* A full list always has two entries of one type and FIFO to merge */
+		if(cnt == CANBUS_FILTERS_WORK)
+			cnt = canbus_filter_reduce(work, cnt, 2U);
+		if(cnt == CANBUS_FILTERS_WORK)
+			break;
+		work[cnt] = entry;
+		cnt = canbus_filter_absorb(work, cnt + 1U, cnt);
+	}
+	return cnt;
+}
+
+/* 0: std exact, 16-bit list, 4 per bank. 1: std masked, 16-bit mask, 2 per
+   bank. 2: ext exact, 32-bit list, 2 per bank. 3: ext masked, 1 per bank. */
+static uint32_t canbus_filter_kind(const canbus_filter_entry_t* entry)
 {
-	static canbus_t* current_canbus = NULL;
+	return (entry->ext ? 2U : 0U) + (entry->mask == canbus_filter_full(entry->ext) ? 0U : 1U);
+}
 
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i]->hcan == hcan)
-			current_canbus = canbus_interfaces[i];
+static uint32_t canbus_filter_banks(const canbus_filter_entry_t* work, uint32_t cnt)
+{
+	uint32_t kinds[2][4] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+	uint32_t banks = 0;
 
-	if(current_canbus != NULL)
-	{
+	for(uint32_t i=0;i<cnt;i++)
+		kinds[work[i].fifo][canbus_filter_kind(&work[i])]++;
+	for(uint32_t fifo=0;fifo<2U;fifo++)
+		banks += (kinds[fifo][0] + 3U) / 4U + (kinds[fifo][1] + 1U) / 2U + (kinds[fifo][2] + 1U) / 2U + kinds[fifo][3];
+	return banks;
+}
 
-		//__HAL_CAN_CLEAR_FLAG(hcan, FDCAN_FLAG_BUS_OFF);
-		canbus_initialize(current_canbus);
+/* `id`/`mask` hold register images, 16-bit STID[10:0] RTR IDE EXID[17:15]
+   or 32-bit STID[10:0] EXID[17:0] IDE RTR 0, as many as the kind packs. */
+static HAL_StatusTypeDef canbus_filter_bank(canbus_t* canbus, uint32_t bank, uint32_t kind, uint32_t fifo, const uint32_t* id, const uint32_t* mask)
+{
+	CAN_FilterTypeDef filter = {0};
+
+	filter.FilterBank = bank;
+	filter.FilterMode = (kind & 1U) == 0U ? CAN_FILTERMODE_IDLIST : CAN_FILTERMODE_IDMASK;
+	filter.FilterScale = kind < 2U ? CAN_FILTERSCALE_16BIT : CAN_FILTERSCALE_32BIT;
+	filter.FilterFIFOAssignment = fifo ? CAN_FILTER_FIFO1 : CAN_FILTER_FIFO0;
+	filter.FilterActivation = CAN_FILTER_ENABLE;
+	filter.SlaveStartFilterBank = CANBUS_FILTERS_SLAVE_START;
+
+	switch(kind)
+	{
+	case 0:
+		filter.FilterIdLow = id[0];
+		filter.FilterMaskIdLow = id[1];
+		filter.FilterIdHigh = id[2];
+		filter.FilterMaskIdHigh = id[3];
+		break;
+	case 1:
+		filter.FilterIdLow = id[0];
+		filter.FilterMaskIdLow = mask[0];
+		filter.FilterIdHigh = id[1];
+		filter.FilterMaskIdHigh = mask[1];
+		break;
+	case 2:
+		filter.FilterIdHigh = id[0] >> 16U;
+		filter.FilterIdLow = id[0] & 0xFFFFU;
+		filter.FilterMaskIdHigh = id[1] >> 16U;
+		filter.FilterMaskIdLow = id[1] & 0xFFFFU;
+		break;
+	default:
+		filter.FilterIdHigh = id[0] >> 16U;
+		filter.FilterIdLow = id[0] & 0xFFFFU;
+		filter.FilterMaskIdHigh = mask[0] >> 16U;
+		filter.FilterMaskIdLow = mask[0] & 0xFFFFU;
+		break;
+	}
+	return HAL_CAN_ConfigFilter(canbus->hcan, &filter);
+}
+
+static void canbus_filters_refresh(canbus_t* canbus)
+{
+#if CANBUS_FILTERS_AUTO
+	if(canbus->filters == NULL && canbus->hcan->State == HAL_CAN_STATE_LISTENING)
+		(void)canbus_filters_update(canbus);
+#else
+	(void)canbus;
+#endif
+}
+
+/* Called under canbus_lock, the pool is shared by every interface */
+static canbus_callback_t* canbus_callback_alloc(void)
+{
+	canbus_callback_t* node = canbus_callback_free;
+
+	if(node != NULL)
+		canbus_callback_free = node->next;
+	else if(canbus_callback_pool_used < CANBUS_CALLBACK_POOL_SIZE)
+		node = &canbus_callback_pool[canbus_callback_pool_used++];
+	else
+		return NULL;
+
+	memset(node, 0, sizeof(canbus_callback_t));
+	node->pooled = 1;
+	return node;
+}
+
+/* Called under canbus_lock, caller storage is only marked free */
+static void canbus_callback_release(canbus_callback_t* node)
+{
+	node->bus = NULL;
+	node->pprev = NULL;
+	node->retired = 0;
+	if(!node->pooled)
+		return;
+	node->next = canbus_callback_free;
+	canbus_callback_free = node;
+}
+
+static i_status canbus_callback_insert(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), void(*view)(const canbus_frame_view_t*), void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags)
+{
+	i_status status = I_OK;
+	uint32_t lock;
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	(void)canbus_rcu_reclaim(canbus);
+
+	if(node == NULL)
+	{
+		lock = canbus_lock();
+		node = canbus_callback_alloc();
+		canbus_unlock(lock);
+		if(node == NULL)
+			status = I_FULL;
+	}
+	else if(node->bus != NULL)
+		status = node->retired ? I_WAIT : I_EXISTS;
+	else
+		node->pooled = 0;
+
+	if(status != I_OK)
+		goto canbus_callback_insert_error;
+	node->id = id;
+	node->mask = mask;
+	node->type = type;
+	node->callback = cb;
+	node->view = view;
+	node->handler = handler;
+	node->deferred = (flags & CBUS_CB_DEFERRED) != 0;
+	node->fifo = (flags & CBUS_CB_FIFO1) != 0;
+#if CANBUS_PROFILE
+	memset(node->hist, 0, sizeof(node->hist));
+	node->max = 0;
+	node->over = 0;
+#endif
+	node->bus = canbus;
+	node->prev = NULL;
+	node->next = canbus->callbacks;
+	if(canbus->callbacks != NULL)
+		canbus->callbacks->prev = node;
+	canbus->callbacks = node;
+	canbus_rx_index_insert(canbus, node);
+	canbus_rcu_write_end(canbus);
+	canbus_filters_refresh(canbus);
+	return I_OK;
+	canbus_callback_insert_error:
+	canbus_rcu_write_end(canbus);
+	return status;
+}
+
+/* Shared by both RX FIFO interrupts, which may preempt each other: nothing
+   static in here, each FIFO fills its own ring. In the interrupt it stops at
+   the coalescing budget and leaves the rest to canbus_process. */
+static void canbus_rx_drain(CAN_HandleTypeDef* hcan, uint32_t fifo, uint8_t isr)
+{
+	canbus_t* current_canbus = NULL;
+	canbus_rx_ring_t* ring;
+	canbus_stats_t* stats;
+	CAN_RxHeaderTypeDef pRxHeader;
+	canbus_frame_t spare;
+	canbus_frame_t* frame = &spare;
+	uint32_t lane = fifo == CAN_RX_FIFO1 ? 1 : 0;
+	uint32_t lost = lane ? CAN_FLAG_FOV1 : CAN_FLAG_FOV0;
+	uint32_t start = canbus_cycles();
+	uint32_t queued = 0;
+	uint32_t budget = 0;
+	uint32_t cnt = 0;
+	uint32_t called;
+	uint32_t epoch;
+
+	current_canbus = canbus_from_handle(hcan);
+	if(current_canbus == NULL)
+	{
+		while(HAL_CAN_GetRxMessage(hcan, fifo, &pRxHeader, frame->dt) == HAL_OK)
+			canbus_rx_orphaned++;
+		return;
+	}
+	stats = &current_canbus->stats;
+	if(isr)
+	{
+		stats->rx_irqs[lane]++;
+		if(current_canbus->rx_coalesce != NULL)
+			budget = current_canbus->rx_coalesce->budget;
+	}
+	if(__HAL_CAN_GET_FLAG(hcan, lost))
+	{
+		__HAL_CAN_CLEAR_FLAG(hcan, lost);
+		stats->rx_overruns[lane]++;
+	}
+	if(current_canbus->callbacks == NULL)
+	{
+		while(HAL_CAN_GetRxMessage(hcan, fifo, &pRxHeader, frame->dt) == HAL_OK)
+		{
+			stats->rx_frames[lane]++;
+			stats->rx_unmatched[lane]++;
+		}
+		if(isr)
+			stats->isr_cycles[lane] += canbus_cycles() - start;
+		return;
+	}
+	ring = &current_canbus->rx_ring[lane];
+	epoch = canbus_rcu_read_begin(current_canbus);
+	while(1)
+	{
+		if(budget != 0 && cnt == budget)
+		{
+			if(HAL_CAN_GetRxFifoFillLevel(hcan, fifo) != 0)
+			{
+				current_canbus->rx_backlog[lane] = 1;
+				stats->rx_deferred[lane]++;
+			}
+			break;
+		}
+		frame = canbus_rx_slot(ring, &spare);
+		if(HAL_CAN_GetRxMessage(hcan, fifo, &pRxHeader, frame->dt) != HAL_OK)
+			break;
+		cnt++;
+		frame->id =pRxHeader.IDE == CAN_ID_STD ?  pRxHeader.StdId :  pRxHeader.ExtId;
+		frame->dlc = pRxHeader.DLC;
+		frame->timestamp = pRxHeader.Timestamp;
+		frame->id_type = pRxHeader.IDE == CAN_ID_EXT ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
+		frame->fr_format =  CBUS_FR_FRM_STD;
+
+		stats->rx_frames[lane]++;
+		if(canbus_rx_dispatch(current_canbus, frame, pRxHeader.IDE == CAN_ID_EXT ? pRxHeader.ExtId | CANBUS_RX_KEY_EXT : pRxHeader.StdId, 0, &called) != 0)
+			queued += canbus_rx_publish(ring, frame);
+		else if(called == 0)
+			stats->rx_unmatched[lane]++;
+	}
+
+	canbus_rcu_read_end(current_canbus, epoch);
+
+	if(queued != 0 || current_canbus->rx_backlog[lane] != 0)
+		canbus_rx_notify(current_canbus);
+	if(isr)
+		stats->isr_cycles[lane] += canbus_cycles() - start;
+}
+
+static uint32_t canbus_rx_its(canbus_t* canbus, uint32_t lane)
+{
+	if(lane != 0)
+		return CAN_IT_RX_FIFO1_MSG_PENDING;
+	if(canbus->rx_coalesce == NULL || canbus->rx_coalesce->watermark == 0)
+		return CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_FULL;
+	return CAN_IT_RX_FIFO0_FULL;
+}
+
+/* Reads what an RX interrupt left over its budget, and with coalescing on
+   the frames waiting below the watermark. The lane's interrupt is off
+   meanwhile, so the FIFO has one reader. */
+static void canbus_rx_flush(canbus_t* canbus, uint32_t lane)
+{
+	uint32_t fifo = lane != 0 ? CAN_RX_FIFO1 : CAN_RX_FIFO0;
+	uint32_t its;
+
+	if(canbus->rx_backlog[lane] == 0)
+	{
+		if(lane != 0 || canbus->rx_coalesce == NULL || canbus->rx_coalesce->watermark == 0)
+			return;
+		if(HAL_CAN_GetRxFifoFillLevel(canbus->hcan, fifo) == 0)
+			return;
+	}
+	its = canbus_rx_its(canbus, lane);
+	(void)HAL_CAN_DeactivateNotification(canbus->hcan, its);
+	canbus->rx_backlog[lane] = 0;
+	canbus_rx_drain(canbus->hcan, fifo, 0);
+	(void)HAL_CAN_ActivateNotification(canbus->hcan, its);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+i_status canbus_initialize(canbus_t* canbus)
+{
+	i_status status;
+	uint32_t lock;
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	__disable_irq();
+	status = canbus_register(canbus);
+	if(status == I_FULL)
+	{
+		__enable_irq();
+		return I_FULL;
+	}
+
+	(void)HAL_CAN_DeactivateNotification(canbus->hcan, CAN_IT_RX_FIFO0_MSG_PENDING | CAN_IT_RX_FIFO0_FULL);
+	(void)HAL_CAN_DeactivateNotification(canbus->hcan, CAN_IT_RX_FIFO1_MSG_PENDING);
+	(void)HAL_CAN_DeInit(canbus->hcan);
+	/* Once: a list handed over in `callbacks`, later changes publish themselves */
+	if(status == I_OK)
+		canbus_rx_index_build(canbus);
+
+	/* Whatever sat in the mailboxes did not make it out, send it again */
+	for(register uint32_t i=0;i<3;i++)
+		if((queue->mailbox_busy & (1U << i)) != 0)
+			canbus_tx_push(queue, &queue->mailbox[i]);
+	queue->mailbox_busy = 0;
+	queue->mailbox_abort = 0;
+
+	__enable_irq();
+#if !defined(CANBUS_CYCLES) && defined(DWT)
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	canbus->mx_init();
+#ifdef CANBUS_IRQ_PRIORITY
+	/* MspInit set the priorities */
+	if(canbus_irq_check(canbus) != I_OK)
+		return I_INVALID;
+#endif
+
+	if(canbus->filters_cnt != 0)
+	{
+		for(int i=0;i<canbus->filters_cnt;i++)
+			if (HAL_CAN_ConfigFilter(canbus->hcan, &canbus->filters[i] ) != HAL_OK) goto canbus_initialize_error;
+	}
+
+#if CANBUS_FILTERS_AUTO
+	if(canbus->filters == NULL)
+	{
+		/* I_LOCKED: the writer holding the list refreshes them when done */
+		status = canbus_filters_update(canbus);
+		if (status != I_OK && status != I_LOCKED) goto canbus_initialize_error;
+	}
+#endif
+
+
+	/* Still in init mode: stamp received frames with the bit time counter */
+	canbus->hcan->Init.TimeTriggeredMode = ENABLE;
+	canbus->hcan->Instance->MCR |= CAN_MCR_TTCM;
+	canbus->rx_backlog[0] = 0;
+	canbus->rx_backlog[1] = 0;
+	if (HAL_CAN_Start(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_CAN_ActivateNotification(canbus->hcan, canbus_rx_its(canbus, 0)) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_RX_FIFO1_MSG_PENDING) != HAL_OK) goto canbus_initialize_error;
+	/* Bus-off only reaches HAL_CAN_ErrorCallback through the error interrupt */
+	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_ERROR | CAN_IT_BUSOFF) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_CAN_ActivateNotification(canbus->hcan, CAN_IT_TX_MAILBOX_EMPTY) != HAL_OK) goto canbus_initialize_error;
+
+	lock = canbus_lock();
+	canbus_tx_refill(canbus);
+	canbus_unlock(lock);
+
+	return I_OK;
+	canbus_initialize_error:
+		return I_ERROR;
+}
+
+i_status canbus_send_plain(canbus_t* canbus, uint16_t fr_format, uint32_t id_type, uint32_t id, uint8_t dlc, uint8_t* data)
+{
+	CAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+
+	(void)fr_format;
+	if(dlc>8)
+	{
+		return I_ERROR;
+	}
+
+	canbus_tx_header(&header, id_type, id, dlc);
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, canbus_tx_key(&header), data, 0);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+i_status canbus_send(canbus_t* canbus,canbus_frame_t* frame)
+{
+	CAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+
+	if(frame->dlc>8)
+	{
+		return I_ERROR;
+	}
+
+	canbus_tx_header(&header, frame->id_type, frame->id, frame->dlc);
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, canbus_tx_key(&header), frame->dt, 0);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+/* Same as canbus_send, a marker other than 0 also reports the frame to
+   tx_done and tx_task once it is on the bus. */
+i_status canbus_send_marked(canbus_t* canbus, canbus_frame_t* frame, uint8_t marker)
+{
+	CAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+
+	if(frame->dlc>8)
+	{
+		return I_ERROR;
+	}
+
+	canbus_tx_header(&header, frame->id_type, frame->id, frame->dlc);
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, canbus_tx_key(&header), frame->dt, marker);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+uint32_t canbus_send_burst(canbus_t* canbus, canbus_frame_t* frames, uint32_t cnt)
+{
+	CAN_TxHeaderTypeDef header;
+	uint32_t accepted = 0;
+	uint32_t lock = canbus_lock();
+
+	while(accepted < cnt && frames[accepted].dlc <= 8)
+	{
+		canbus_tx_header(&header, frames[accepted].id_type, frames[accepted].id, frames[accepted].dlc);
+		if(canbus_tx_enqueue(canbus, &header, canbus_tx_key(&header), frames[accepted].dt, 0) != I_OK)
+			break;
+		accepted++;
+	}
+	canbus_unlock(lock);
+
+	return accepted;
+}
+
+i_status canbus_tx_template_init(canbus_tx_template_t* tpl, uint16_t fr_format, uint32_t id_type, uint32_t id, uint16_t dlc)
+{
+	if(dlc > 8 || fr_format == CBUS_FR_FRM_FD || fr_format == CBUS_FR_FRM_FD_BRS)
+		return I_INVALID;
+
+	canbus_tx_header(&tpl->header, id_type, id, dlc);
+	tpl->key = canbus_tx_key(&tpl->header);
+
+	return I_OK;
+}
+
+i_status canbus_send_template(canbus_t* canbus, canbus_tx_template_t* tpl, uint8_t* data)
+{
+	i_status result;
+	uint32_t lock = canbus_lock();
+
+	result = canbus_tx_enqueue(canbus, &tpl->header, tpl->key, data, 0);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+/* Compiles the registered callbacks into the fewest filter banks this
+   interface owns, merging masks when it has to. Runs in thread context
+   and holds the RCU writer until the banks are programmed, the work list
+   lives on the stack. */
+i_status canbus_filters_update(canbus_t* canbus)
+{
+	static const uint32_t per_bank[4] = {4U, 2U, 2U, 1U};
+	canbus_filter_entry_t work[CANBUS_FILTERS_WORK];
+	canbus_filter_report_t* report = &canbus->filter_report;
+	canbus_filter_entry_t* entry;
+	CAN_FilterTypeDef filter = {0};
+	uint32_t id[4];
+	uint32_t mask[4];
+	uint32_t first = 0;
+	uint32_t last = 14U;
+	uint32_t bank;
+	uint32_t fill;
+	uint32_t cnt;
+	uint32_t prev;
+
+#ifdef CAN2
+	first = canbus->hcan->Instance == CAN2 ? CANBUS_FILTERS_SLAVE_START : 0U;
+	last = canbus->hcan->Instance == CAN2 ? 28U : CANBUS_FILTERS_SLAVE_START;
+#endif
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	cnt = canbus_filter_collect(canbus, work);
+
+	while(canbus_filter_banks(work, cnt) > last - first)
+	{
+		prev = cnt;
+		cnt = canbus_filter_reduce(work, cnt, 2U);
+		if(cnt == prev)
+			goto canbus_filters_update_error;
+	}
+
+	report->accepted = 0;
+	bank = first;
+	for(uint32_t lane=0;lane<8U;lane++)
+	{
+		uint32_t kind = lane & 3U;
+		uint32_t fifo = lane >> 2;
+
+		fill = 0;
+		for(uint32_t i=0;i<=cnt;i++)
+		{
+			entry = i < cnt ? &work[i] : NULL;
+			if(entry != NULL)
+			{
+				if(entry->fifo != fifo || canbus_filter_kind(entry) != kind)
+					continue;
+				report->accepted += canbus_filter_size(entry);
+				id[fill] = entry->ext ? (entry->id << 3U) | 0x4U : entry->id << 5U;
+				mask[fill] = entry->ext ? (entry->mask << 3U) | 0x6U : (entry->mask << 5U) | 0x18U;
+				fill++;
+			}
+			else if(fill != 0)
+			{
+				/* Pad a partly used bank with the last id */
+				for(;fill<per_bank[kind];fill++)
+				{
+					id[fill] = id[fill - 1U];
+					mask[fill] = mask[fill - 1U];
+				}
+			}
+
+			if(fill == per_bank[kind])
+			{
+				if(canbus_filter_bank(canbus, bank++, kind, fifo, id, mask) != HAL_OK) goto canbus_filters_update_error;
+				fill = 0;
+			}
+		}
+	}
+
+	report->banks = (uint8_t)(bank - first);
+	report->ratio = report->wanted == 0 ? 1000U : (uint32_t)((report->accepted * 1000U) / report->wanted);
+
+	filter.FilterActivation = CAN_FILTER_DISABLE;
+	filter.SlaveStartFilterBank = CANBUS_FILTERS_SLAVE_START;
+	for(;bank<last;bank++)
+	{
+		filter.FilterBank = bank;
+		if(HAL_CAN_ConfigFilter(canbus->hcan, &filter) != HAL_OK) goto canbus_filters_update_error;
+	}
+
+	canbus_rcu_write_end(canbus);
+	return I_OK;
+	canbus_filters_update_error:
+		canbus_rcu_write_end(canbus);
+		return I_ERROR;
+}
+
+i_status canbus_callback_add(canbus_t* canbus,uint32_t id,uint32_t mask,uint32_t type, void(*cb)(canbus_frame_t*))
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, CBUS_CB_ISR);
+}
+
+i_status canbus_callback_add_deferred(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*))
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, CBUS_CB_DEFERRED);
+}
+
+i_status canbus_callback_add_ex(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags)
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, flags);
+}
+
+/* `cb` gets a read-only view on the payload instead of the frame */
+i_status canbus_callback_add_view(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(const canbus_frame_view_t*), uint32_t flags)
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, NULL, cb, NULL, flags);
+}
+
+/* Same as canbus_callback_add_ex on storage the caller owns, zeroed before
+   the first use. The node is the caller's again once canbus_callback_reclaim
+   gives I_OK after canbus_callback_remove. */
+i_status canbus_callback_register(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags)
+{
+	if(node == NULL)
+		return I_INVALID;
+	return canbus_callback_insert(canbus, node, id, mask, type, cb, NULL, NULL, flags);
+}
+
+/* canbus_callback_register for a handler that also gets its node, so it can
+   tell which of several nodes on the same function the frame came through */
+i_status canbus_callback_register_handler(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags)
+{
+	if(node == NULL || handler == NULL)
+		return I_INVALID;
+	return canbus_callback_insert(canbus, node, id, mask, type, NULL, NULL, handler, flags);
+}
+
+/* Runs the deferred callbacks of the frames the RX ISR queued, after reading
+   the frames it left in the FIFOs. Call it from one task, the one `rx_task`
+   names when task notifications are used. */
+uint32_t canbus_process(canbus_t* canbus)
+{
+	canbus_rx_ring_t* ring;
+	canbus_frame_t* frame;
+	uint32_t cnt = 0;
+	uint32_t called;
+	uint32_t epoch;
+
+	canbus_rx_flush(canbus, 1);
+	canbus_rx_flush(canbus, 0);
+	epoch = canbus_rcu_read_begin(canbus);
+
+	/* FIFO1 lane first */
+	for(uint32_t lane=0;lane<2U;lane++)
+	{
+		ring = &canbus->rx_ring[1U - lane];
+		while(ring->tail != ring->head)
+		{
+			__DMB();
+			frame = &ring->items[ring->tail & (CANBUS_RX_RING_SIZE - 1U)];
+			(void)canbus_rx_dispatch(canbus, frame, frame->id_type == CBUS_ID_T_EXTENDED ? frame->id | CANBUS_RX_KEY_EXT : frame->id, 1, &called);
+			__DMB();
+			ring->tail++;
+			cnt++;
+		}
+	}
+	canbus_rcu_read_end(canbus, epoch);
+	return cnt;
+}
+
+i_status canbus_callback_remove(canbus_t* canbus,canbus_callback_t* clb)
+{
+	if(clb == NULL)
+		return I_NOTEXISTS;
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+
+	if(clb->bus != canbus || clb->retired)
+	{
+		canbus_rcu_write_end(canbus);
+		return I_NOTEXISTS;
+	}
+
+	if(clb->prev != NULL)
+		clb->prev->next = clb->next;
+	else
+		canbus->callbacks = clb->next;
+	if(clb->next != NULL)
+		clb->next->prev = clb->prev;
+	canbus_rx_index_remove(clb);
+	canbus_rcu_retire(canbus, clb);
+	(void)canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
+	canbus_filters_refresh(canbus);
+	return I_OK;
+}
+
+i_status canbus_callback_exists(canbus_t* canbus,canbus_callback_t* clb)
+{
+	if(clb == NULL || clb->bus != canbus || clb->retired)
+		return I_NOTEXISTS;
+	return I_EXISTS;
+}
+
+/* Removed callbacks stay readable until every dispatch that could see them
+   has returned. I_WAIT while some still do; a node in caller storage can be
+   registered again once this gives I_OK. */
+i_status canbus_callback_reclaim(canbus_t* canbus)
+{
+	uint32_t waiting;
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	waiting = canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
+	return waiting != 0 ? I_WAIT : I_OK;
+}
+
+/* Call periodically from a task or the main loop. Once the backoff ran out
+   the controller only goes through init mode: filters, notifications and
+   callbacks stay as they are, the protocol waits out 128 x 11 recessive bits
+   before the bus is back. */
+void canbus_recover_if_needs(canbus_t* canbus)
+{
+	canbus_recovery_t* recovery = &canbus->recovery;
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	uint32_t now;
+	uint32_t lock;
+
+	if(recovery->state == CBUS_RC_IDLE)
+		return;
+
+	now = HAL_GetTick();
+	if(recovery->state == CBUS_RC_BACKOFF)
+	{
+		if(now - recovery->since < recovery->backoff)
+			return;
+		recovery->state = CBUS_RC_RESTART;
+		/* Waits on INAK only, a few bit times, so outside the lock. A HAL
+		   timeout leaves the handle in error, only a full init gets it back. */
+		if(HAL_CAN_Stop(canbus->hcan) != HAL_OK || HAL_CAN_Start(canbus->hcan) != HAL_OK)
+			(void)canbus_initialize(canbus);
+		return;
+	}
+
+	lock = canbus_lock();
+	if(recovery->state == CBUS_RC_RESTART && (canbus->hcan->Instance->ESR & CAN_ESR_BOFF) == 0)
+	{
+		recovery->state = CBUS_RC_IDLE;
+		recovery->done = now;
+		canbus->stats.recovery_ticks[0] = now - recovery->since;
+		if(canbus->stats.recovery_ticks[0] > canbus->stats.recovery_ticks[1])
+			canbus->stats.recovery_ticks[1] = canbus->stats.recovery_ticks[0];
+		/* Mailboxes the bus-off emptied without completing, send them again */
+		for(register uint32_t i=0;i<3;i++)
+			if((queue->mailbox_busy & (1U << i)) != 0
+				&& (canbus->hcan->Instance->TSR & ((CAN_TSR_TME0 << i) | (CAN_TSR_RQCP0 << (i*8U)))) == (CAN_TSR_TME0 << i))
+			{
+				canbus_tx_push(queue, &queue->mailbox[i]);
+				queue->mailbox_busy &= ~(1U << i);
+				queue->mailbox_abort &= ~(1U << i);
+			}
+		canbus_tx_refill(canbus);
+	}
+	canbus_unlock(lock);
+}
+
+/* Copies the counters without masking interrupts: the copy is taken again
+   until the live counters still match it, they only ever count up. I_WAIT
+   when interrupts kept them moving for 4 rounds, `stats` holds the last copy. */
+i_status canbus_stats_snapshot(canbus_t* canbus, canbus_stats_t* stats)
+{
+	for(uint32_t i=0;i<4U;i++)
+	{
+		__DMB();
+		memcpy(stats, &canbus->stats, sizeof(canbus_stats_t));
+		__DMB();
+		if(memcmp(stats, &canbus->stats, sizeof(canbus_stats_t)) == 0)
+		{
+			stats->rx_orphaned = canbus_rx_orphaned;
+			return I_OK;
+		}
+	}
+	stats->rx_orphaned = canbus_rx_orphaned;
+	return I_WAIT;
+}
+
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_rx_drain(hcan, CAN_RX_FIFO0, 1);
+}
+
+/* The coalesced FIFO0 interrupt. Without coalescing the pending interrupt,
+   handled right after it, reads the FIFO. */
+void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+
+	if(canbus != NULL && canbus->rx_coalesce != NULL && canbus->rx_coalesce->watermark != 0)
+		canbus_rx_drain(hcan, CAN_RX_FIFO0, 1);
+}
+
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_rx_drain(hcan, CAN_RX_FIFO1, 1);
+}
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_done(canbus, CAN_TX_MAILBOX0);
+}
+
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_done(canbus, CAN_TX_MAILBOX1);
+}
+
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_done(canbus, CAN_TX_MAILBOX2);
+}
+
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_release(canbus, CAN_TX_MAILBOX0, 1);
+}
+
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_release(canbus, CAN_TX_MAILBOX1, 1);
+}
+
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* canbus = canbus_from_handle(hcan);
+	if(canbus != NULL)
+		canbus_tx_release(canbus, CAN_TX_MAILBOX2, 1);
+}
+
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+	canbus_t* current_canbus = canbus_from_handle(hcan);
+	uint32_t error = HAL_CAN_GetError(hcan);
+	uint32_t start;
+
+	if(current_canbus != NULL)
+	{
+		(void)HAL_CAN_ResetError(hcan);
+
+		/* Transmission failed for good (no automatic retransmission). A mailbox
+		   canbus_tx_preempt aborted after it lost arbitration completes here
+		   with ALST rather than as an abort, and goes back into the queue. */
+		if((error & (HAL_CAN_ERROR_TX_ALST0 | HAL_CAN_ERROR_TX_TERR0)) != 0)
+			canbus_tx_release(current_canbus, CAN_TX_MAILBOX0, CANBUS_TX_REQUEUE_ABORTED);
+		if((error & (HAL_CAN_ERROR_TX_ALST1 | HAL_CAN_ERROR_TX_TERR1)) != 0)
+			canbus_tx_release(current_canbus, CAN_TX_MAILBOX1, CANBUS_TX_REQUEUE_ABORTED);
+		if((error & (HAL_CAN_ERROR_TX_ALST2 | HAL_CAN_ERROR_TX_TERR2)) != 0)
+			canbus_tx_release(current_canbus, CAN_TX_MAILBOX2, CANBUS_TX_REQUEUE_ABORTED);
+
+		/* canbus_tx_release counts its own cycles */
+		if((error & HAL_CAN_ERROR_BOF) != 0)
+		{
+			start = canbus_cycles();
+			canbus_bus_off(current_canbus);
+			current_canbus->stats.isr_cycles[2] += canbus_cycles() - start;
+		}
 	}
 }
 
@@ -32,6 +32,70 @@
 #ifndef DRV_CANBUS_VCAN_H_
 #define DRV_CANBUS_VCAN_H_
 
+#ifndef CANBUS_TX_QUEUE_SIZE
+#define CANBUS_TX_QUEUE_SIZE	16U	/* Software TX queue per interface */
+#endif
+
+#ifndef CANBUS_RX_INDEX_SIZE
+#define CANBUS_RX_INDEX_SIZE	64U	/* Exact id hash slots per interface, power of 2 */
+#endif
+
+#if (CANBUS_RX_INDEX_SIZE & (CANBUS_RX_INDEX_SIZE - 1U)) != 0
+#error "CANBUS_RX_INDEX_SIZE must be a power of 2"
+#endif
+
+#ifndef CANBUS_RX_RING_SIZE
+#define CANBUS_RX_RING_SIZE	32U	/* Frames held for deferred callbacks per interface, power of 2 */
+#endif
+
+#if (CANBUS_RX_RING_SIZE & (CANBUS_RX_RING_SIZE - 1U)) != 0
+#error "CANBUS_RX_RING_SIZE must be a power of 2"
+#endif
+
+#ifndef CANBUS_FILTERS_AUTO
+#define CANBUS_FILTERS_AUTO	0	/* 1: derive the hardware filters from the callbacks when `filters` is NULL */
+#endif
+
+#ifndef CANBUS_FILTERS_WORK
+#define CANBUS_FILTERS_WORK	64U	/* Filter candidates held while merging, on the caller's stack */
+#endif
+
+#ifndef CANBUS_INTERFACES_MAX
+#define CANBUS_INTERFACES_MAX	8U	/* Interfaces canbus_initialize can register, power of 2 */
+#endif
+
+#if (CANBUS_INTERFACES_MAX & (CANBUS_INTERFACES_MAX - 1U)) != 0
+#error "CANBUS_INTERFACES_MAX must be a power of 2"
+#endif
+
+#ifndef CANBUS_CALLBACK_POOL_SIZE
+#define CANBUS_CALLBACK_POOL_SIZE	32U	/* Callback nodes shared by all interfaces */
+#endif
+
+#ifndef CANBUS_PROFILE
+#define CANBUS_PROFILE	0	/* 1: time every callback into a histogram of its own */
+#endif
+
+#ifndef CANBUS_PROFILE_BINS
+#define CANBUS_PROFILE_BINS	16U	/* Histogram bins, bin n counts calls of 2^(n-1) up to 2^n cycles */
+#endif
+
+#ifndef CANBUS_PROFILE_BUDGET
+#define CANBUS_PROFILE_BUDGET	0U	/* Cycles a callback may take when its own budget is 0, 0: no limit */
+#endif
+
+#ifndef CANBUS_RECOVERY_BACKOFF_MIN
+#define CANBUS_RECOVERY_BACKOFF_MIN	10U	/* HAL ticks from bus-off to the first restart, doubled per bus-off in a row */
+#endif
+
+#ifndef CANBUS_RECOVERY_BACKOFF_MAX
+#define CANBUS_RECOVERY_BACKOFF_MAX	1000U	/* Backoff cap, the bus staying up this long starts over from the minimum */
+#endif
+
+#ifndef CANBUS_FILTERS_SLAVE_START
+#define CANBUS_FILTERS_SLAVE_START	14U	/* First filter bank owned by CAN2 on dual CAN parts */
+#endif
+
 /******************************************************************************
 * Includes
 ******************************************************************************/
@@ -122,7 +186,8 @@ typedef enum
 typedef enum
 {
 	CBUS_FR_FRM_STD = 0x01,		/* Standard CANBUS */
-	CBUS_FR_FRM_FD  = 0x02		/* FD CANBUS       */
+	CBUS_FR_FRM_FD  = 0x02,		/* FD CANBUS       */
+	CBUS_FR_FRM_FD_BRS = 0x03	/* FD CANBUS, data phase at the data bit rate */
 }cbus_fr_format;
 #endif
 
@@ -148,27 +213,212 @@ typedef struct
 	uint16_t fr_format;	/* CAN Frame Format `cbus_fr_format` */
 	uint16_t dlc;		/* Size of data */
 	uint8_t dt[64];		/* Actual data of the frame */
+	uint32_t timestamp;	/* RX: hardware capture at the start of frame, 16 bit */
 }canbus_frame_t;
 #endif
 
+/* --- CANBus Frame View --------------------------------------------------- */
+
+#ifndef CANBUS_FRAME_VIEW
+#define CANBUS_FRAME_VIEW
+typedef struct
+{
+	uint32_t id;
+	uint32_t id_type;		/* `cbus_id_type` */
+	uint16_t fr_format;		/* `cbus_fr_format` */
+	uint16_t dlc;			/* Bytes behind `data` */
+	const volatile uint32_t* data;	/* Payload words, valid during the call only */
+	uint32_t timestamp;
+}canbus_frame_view_t;
+
+/* Byte `i` of the payload, reading whole words like the message RAM wants */
+#define CANBUS_VIEW_BYTE(view, i)	((uint8_t)((view)->data[(i) >> 2] >> (8U * ((i) & 3U))))
+#endif
+
+/* --- Callback Options ---------------------------------------------------- */
+
+typedef enum
+{
+	CBUS_CB_ISR      = 0x00U,	/* Runs in the RX interrupt */
+	CBUS_CB_DEFERRED = 0x01U,	/* Runs from canbus_process */
+	CBUS_CB_FIFO1    = 0x02U	/* Derived filters route the ids to RX FIFO1 */
+}cbus_cb_flags;
+
 struct canbus_callback
 {
 	uint32_t id;
 	uint32_t mask;
 	uint32_t type;
 	void (*callback)(canbus_frame_t*);
+	void (*view)(const canbus_frame_view_t*);	/* Set instead of `callback`: payload read in place */
+	void (*handler)(struct canbus_callback*, canbus_frame_t*);	/* Set instead of `callback`: also gets the node */
 	struct canbus_callback *next;
+	uint32_t key;			/* Id and id type as indexed, owned by the driver */
+	struct canbus_callback *link;	/* Next entry of the same index slot, owned by the driver */
+	struct canbus_callback **pprev;	/* Index slot pointing at this entry, owned by the driver */
+	struct canbus_callback *prev;	/* Previous entry of `callbacks`, owned by the driver */
+	void *bus;			/* Interface the entry is registered on, NULL when free */
+	uint8_t pooled;			/* 1: taken from the driver pool, returned once reclaimed */
+	uint8_t retired;		/* 1: removed, dispatch may still be walking it */
+	uint8_t deferred;		/* 1: runs from canbus_process instead of the RX ISR */
+	uint8_t fifo;			/* RX FIFO the derived filters route the ids to */
+#if CANBUS_PROFILE
+	uint32_t budget;		/* Cycles a call may take, 0: CANBUS_PROFILE_BUDGET */
+	uint32_t hist[CANBUS_PROFILE_BINS];	/* Calls per duration, the last bin is open ended */
+	uint32_t max;			/* Longest call in cycles */
+	uint32_t over;			/* Calls past the budget */
+#endif
 };
 
 typedef struct canbus_callback canbus_callback_t;
 
+/* --- RX Dispatch Index --------------------------------------------------- */
+
+typedef struct
+{
+	canbus_callback_t* exact[CANBUS_RX_INDEX_SIZE];	/* mask == 0, hashed on id and type */
+	canbus_callback_t* masked;			/* mask != 0, kept sorted on mask */
+}canbus_rx_index_t;
+
+/* --- Callback Snapshots ------------------------------------------------- */
+
+typedef struct
+{
+	volatile uint32_t epoch;	/* Bumped when removed callbacks start their grace period */
+	volatile uint32_t readers[2];	/* Dispatches running, per epoch parity */
+	volatile uint8_t writer;	/* 1: an add or remove is publishing */
+	canbus_callback_t* retired;	/* Removed since the last epoch bump */
+	canbus_callback_t* grace;	/* Removed before it, reclaimed once its readers left */
+}canbus_rcu_t;
+
+/* --- RX Ring ------------------------------------------------------------- */
+
+typedef struct
+{
+	canbus_frame_t items[CANBUS_RX_RING_SIZE];
+	volatile uint32_t head;		/* next free slot, written by the RX ISR */
+	volatile uint32_t tail;		/* next frame to dispatch, written by canbus_process */
+	volatile uint32_t dropped;	/* deferred frames lost to a full ring */
+}canbus_rx_ring_t;
+
+/* --- TX Queue ------------------------------------------------------------ */
+
+typedef struct
+{
+	CAN_TxHeaderTypeDef header;
+	uint8_t dt[8];
+	uint32_t key;		/* Arbitration order, lower wins the bus */
+	uint32_t seq;		/* Keeps frames of the same id in call order */
+	uint8_t marker;		/* canbus_send_marked, 0: no completion */
+}canbus_tx_item_t;
+
+typedef struct
+{
+	canbus_tx_item_t items[CANBUS_TX_QUEUE_SIZE + 3];	/* Binary min-heap on key/seq, room to take the mailboxes back */
+	uint32_t count;
+	uint32_t seq;
+	canbus_tx_item_t mailbox[3];	/* Copy of the frame held by each mailbox */
+	uint8_t mailbox_busy;		/* CAN_TX_MAILBOXx bits */
+	uint8_t mailbox_abort;		/* CAN_TX_MAILBOXx bits, abort requested */
+}canbus_tx_queue_t;
+
+/* --- Bus-off Recovery ---------------------------------------------------- */
+
+typedef enum
+{
+	CBUS_RC_IDLE    = 0x00U,	/* Bus active */
+	CBUS_RC_BACKOFF = 0x01U,	/* Bus-off, waiting out the backoff */
+	CBUS_RC_RESTART = 0x02U		/* Restarted, waiting for 128 x 11 recessive bits */
+}cbus_rc_state;
+
+typedef struct
+{
+	volatile uint8_t state;		/* cbus_rc_state, moved on by the bus-off ISR and canbus_recover_if_needs */
+	uint8_t attempts;		/* Bus-offs in a row */
+	uint32_t since;			/* HAL tick of the last bus-off */
+	uint32_t backoff;		/* HAL ticks to wait before the restart */
+	uint32_t done;			/* HAL tick the bus came back */
+}canbus_recovery_t;
+
+/* --- RX Coalescing ------------------------------------------------------- */
+
+typedef struct
+{
+	uint8_t watermark;		/* Any value but 0: RX FIFO0 interrupts once full (3 frames), 0: one per frame */
+	uint16_t timeout;		/* Not used, bxCAN has no timeout counter: canbus_process flushes below the watermark */
+	uint16_t budget;		/* Frames per RX interrupt entry, the rest goes to canbus_process, 0: no limit */
+}canbus_rx_coalesce_t;
+
+/* --- TX Template --------------------------------------------------------- */
+
+typedef struct
+{
+	CAN_TxHeaderTypeDef header;
+	uint32_t key;		/* Arbitration order, see canbus_tx_item_t */
+}canbus_tx_template_t;
+
+/* --- TX Event ------------------------------------------------------------ */
+
+typedef struct
+{
+	uint32_t id;		/* CAN Frame Id */
+	uint32_t id_type;	/* CAN Frame Id Type `cbus_id_type` */
+	uint32_t timestamp;	/* Start of frame on the bus, 16 bit, same counter as RX */
+	uint8_t marker;		/* As given to canbus_send_marked */
+}canbus_tx_event_t;
+
+/* --- Filter Report ------------------------------------------------------- */
+
+typedef struct
+{
+	uint64_t wanted;	/* Ids the callbacks listen to */
+	uint64_t accepted;	/* Ids the derived filters let through */
+	uint32_t ratio;		/* Over-acceptance, accepted / wanted in 1/1000 (1000 = exact) */
+	uint8_t banks;		/* Filter banks in use */
+}canbus_filter_report_t;
+
+/* --- Statistics ---------------------------------------------------------- */
+
+typedef struct
+{
+	uint32_t rx_frames[2];		/* Read from RX FIFO0 / FIFO1 */
+	uint32_t rx_unmatched[2];	/* Read but no callback listens to the id, the rest reached one */
+	uint32_t rx_overruns[2];	/* Message lost flags seen, the hardware FIFO overflowed */
+	uint32_t rx_orphaned;		/* Read on handles no interface is registered for, filled in by the snapshot */
+	uint32_t tx_frames;		/* Taken by the send functions */
+	uint32_t tx_full;		/* Refused with I_FULL, TX queue full */
+	uint32_t tx_errors;		/* Refused with I_ERROR by the HAL */
+	uint32_t bus_off;		/* Bus-off events */
+	uint32_t recovery_ticks[2];	/* Bus-off to bus active in HAL ticks, backoff included: last / longest */
+	uint32_t isr_cycles[3];		/* Spent in the RX FIFO0 / FIFO1 and the TX plus error interrupts */
+	uint32_t rx_irqs[2];		/* RX FIFO0 / FIFO1 interrupt entries */
+	uint32_t rx_deferred[2];	/* Entries that ran out of budget and left the FIFO to canbus_process */
+}canbus_stats_t;
+
 typedef struct
 {
 	void (*mx_init)();
 	CAN_HandleTypeDef *hcan;
 	CAN_FilterTypeDef *filters;
 	uint8_t filters_cnt;
+	const canbus_rx_coalesce_t* rx_coalesce;	/* RX interrupt coalescing and budget, NULL: one interrupt per frame, no limit */
 	canbus_callback_t * callbacks;
+	canbus_tx_queue_t tx_queue;
+	canbus_rx_index_t rx_index;
+	canbus_rcu_t rcu;
+	canbus_filter_report_t filter_report;
+	canbus_rx_ring_t rx_ring[2];	/* One per RX FIFO, each filled by its own ISR */
+	canbus_stats_t stats;		/* Read through canbus_stats_snapshot */
+	canbus_recovery_t recovery;	/* Driven by canbus_recover_if_needs */
+	volatile uint8_t rx_backlog[2];	/* 1: the RX interrupt left frames in the FIFO for canbus_process */
+#if CANBUS_PROFILE
+	void (*budget_hook)(canbus_callback_t* node, canbus_frame_t* frame, uint32_t cycles);	/* Called after a callback ran past its budget, may be NULL */
+#endif
+	void (*tx_done)(canbus_tx_event_t* event);	/* Frames sent with a marker left, from the TX interrupt, may be NULL */
+#if __has_include("task.h")
+	TaskHandle_t rx_task;		/* Notified when frames wait in rx_ring, may be NULL */
+	TaskHandle_t tx_task;		/* Notified with marker << 16 | timestamp of each marked frame, may be NULL */
+#endif
 }canbus_t;
 
 /******************************************************************************
@@ -178,7 +428,20 @@ typedef struct
 i_status canbus_initialize(canbus_t* canbus);
 i_status canbus_send(canbus_t* canbus, canbus_frame_t* frame);
 i_status canbus_send_plain(canbus_t* canbus, uint16_t fr_format, uint32_t id_type, uint32_t id, uint8_t dlc, uint8_t* data);
+uint32_t canbus_send_burst(canbus_t* canbus, canbus_frame_t* frames, uint32_t cnt);
+i_status canbus_send_marked(canbus_t* canbus, canbus_frame_t* frame, uint8_t marker);
+i_status canbus_tx_template_init(canbus_tx_template_t* tpl, uint16_t fr_format, uint32_t id_type, uint32_t id, uint16_t dlc);
+i_status canbus_send_template(canbus_t* canbus, canbus_tx_template_t* tpl, uint8_t* data);
+i_status canbus_filters_update(canbus_t* canbus);
 i_status canbus_callback_add(canbus_t* canbus, uint32_t id, uint32_t mask,uint32_t type, void(*cb)(canbus_frame_t*));
+i_status canbus_callback_add_deferred(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*));
+i_status canbus_callback_add_ex(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags);
+i_status canbus_callback_register(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags);
+i_status canbus_callback_register_handler(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags);
+i_status canbus_callback_add_view(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(const canbus_frame_view_t*), uint32_t flags);
+uint32_t canbus_process(canbus_t* canbus);
+i_status canbus_callback_reclaim(canbus_t* canbus);
+i_status canbus_stats_snapshot(canbus_t* canbus, canbus_stats_t* stats);
 i_status canbus_callback_remove(canbus_t* canbus, canbus_callback_t* clb);
 i_status canbus_callback_exists(canbus_t* canbus, canbus_callback_t* clb);
 void canbus_recover_if_needs(canbus_t* canbus);
@@ -27,6 +27,53 @@
 * Preprocessor Definitions & Macros
 ******************************************************************************/
 
+#ifdef FDCAN_TX_BUFFER31
+#define CANBUS_TX_BUFFERS_ALL	0xFFFFFFFFU
+#else
+#define CANBUS_TX_BUFFERS_ALL	(FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2)
+#endif
+
+#ifdef FDCAN_IT_GROUP_RX_FIFO1
+#define CANBUS_IT_LINE_FIFO1	FDCAN_IT_GROUP_RX_FIFO1
+#else
+#define CANBUS_IT_LINE_FIFO1	(FDCAN_IT_RX_FIFO1_NEW_MESSAGE | FDCAN_IT_RX_FIFO1_FULL | FDCAN_IT_RX_FIFO1_MESSAGE_LOST)
+#endif
+
+/* Coalesced RX FIFO0 interrupt: the watermark where there is one (H7), FIFO full otherwise */
+#ifdef FDCAN_IT_RX_FIFO0_WATERMARK
+#define CANBUS_IT_RX_FIFO0_BATCH	FDCAN_IT_RX_FIFO0_WATERMARK
+#else
+#define CANBUS_IT_RX_FIFO0_BATCH	FDCAN_IT_RX_FIFO0_FULL
+#endif
+
+#ifdef FDCAN_TXESC_TBDS
+/* H7: message RAM laid out by HAL_FDCAN_Init, element size in words */
+#define CANBUS_TX_ELEMENT(hcan, index)	((volatile uint32_t*)((hcan)->msgRam.TxBufferSA + ((index) * (hcan)->Init.TxElmtSize * 4U)))
+#else
+/* G4/L5/U5: fixed 18 word elements */
+#define CANBUS_TX_ELEMENT(hcan, index)	((volatile uint32_t*)((hcan)->msgRam.TxFIFOQSA + ((index) * 18U * 4U)))
+#endif
+
+#ifdef FDCAN_TXESC_TBDS
+#define CANBUS_RX_ELEMENT(hcan, lane, index)	((volatile uint32_t*)((lane) != 0 ? (hcan)->msgRam.RxFIFO1SA + ((index) * (hcan)->Init.RxFifo1ElmtSize * 4U) : (hcan)->msgRam.RxFIFO0SA + ((index) * (hcan)->Init.RxFifo0ElmtSize * 4U)))
+#else
+#define CANBUS_RX_ELEMENT(hcan, lane, index)	((volatile uint32_t*)(((lane) != 0 ? (hcan)->msgRam.RxFIFO1SA : (hcan)->msgRam.RxFIFO0SA) + ((index) * 18U * 4U)))
+#endif
+
+#if CANBUS_MSGRAM_DIRECT
+#define CANBUS_TX_ROOM(hcan)	(((hcan)->Instance->TXFQS & FDCAN_TXFQS_TFQF) == 0)
+#else
+#define CANBUS_TX_ROOM(hcan)	(HAL_FDCAN_GetTxFifoFreeLevel(hcan) != 0)
+#endif
+
+#define CANBUS_RX_KEY_EXT	0x80000000U	/* Id type folded into the top bit of the key */
+#define CANBUS_RX_KEY_NONE	0xFFFFFFFFU	/* Id type the driver does not know, never matches */
+#define CANBUS_RX_TSC(hcan)	((hcan)->Instance->TSCV & FDCAN_TSCV_TSC)
+#define CANBUS_RX_SLOT(key)	((((key) * 0x9E3779B1U) >> 16) & (CANBUS_RX_INDEX_SIZE - 1U))
+#ifdef CANBUS_IRQ_PRIORITY
+#define CANBUS_LOCK_LEVEL	((CANBUS_IRQ_PRIORITY) << (8U - __NVIC_PRIO_BITS))
+#endif
+#define CANBUS_HANDLE_SLOT(h)	(((((uint32_t)(uintptr_t)(h)) * 0x9E3779B1U) >> 16) & (CANBUS_INTERFACES_MAX - 1U))
 
 /******************************************************************************
 * Includes
@@ -41,427 +88,1788 @@
 * Enumerations, structures & Variables
 ******************************************************************************/
 
-static FDCAN_TxHeaderTypeDef TxHeader;
-static canbus_t* canbus_interfaces[8] = {NULL,NULL,NULL,NULL,NULL,NULL,NULL,NULL};
-static uint32_t canbus_interfaces_cnt = 0;
+static const uint8_t canbus_dlc_bytes[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+#if CANBUS_MSGRAM_DIRECT
+/* RX element R0.XTD and R1.FDF/BRS decoded by index */
+static const uint32_t canbus_rx_id_mask[2] = {0x7FFU, 0x1FFFFFFFU};
+static const uint8_t canbus_rx_id_shift[2] = {18U, 0U};
+static const uint8_t canbus_rx_format[4] = {CBUS_FR_FRM_STD, CBUS_FR_FRM_STD, CBUS_FR_FRM_FD, CBUS_FR_FRM_FD_BRS};
+#endif
+static canbus_t* canbus_interfaces[CANBUS_INTERFACES_MAX];	/* Hashed on the HAL handle */
+
+typedef struct
+{
+	uint32_t id;
+	uint32_t mask;		/* Compared bits, every id bit for an exact id */
+	uint8_t ext;
+	uint8_t fifo;
+	uint8_t merged;		/* Lets through ids no callback asked for */
+}canbus_filter_entry_t;
+
+static canbus_callback_t canbus_callback_pool[CANBUS_CALLBACK_POOL_SIZE];
+static canbus_callback_t* canbus_callback_free = NULL;
+static uint32_t canbus_callback_pool_used = 0;
+static uint32_t canbus_rx_orphaned = 0;
 
 /******************************************************************************
 * Declaration | Static Functions
 ******************************************************************************/
 
 static void canbus_remove_callbacks(canbus_t* canbus);
+static uint32_t canbus_lock(void);
+static void canbus_unlock(uint32_t state);
+static uint32_t canbus_cycles(void);
+static canbus_t* canbus_from_handle(FDCAN_HandleTypeDef* hfdcan);
+static i_status canbus_register(canbus_t* canbus);
+#ifdef CANBUS_IRQ_PRIORITY
+static i_status canbus_irq_check(canbus_t* canbus);
+#endif
+static uint32_t canbus_rx_key(uint32_t type, uint32_t id);
+static void canbus_rx_index_insert(canbus_t* canbus, canbus_callback_t* node);
+static void canbus_rx_index_remove(canbus_callback_t* node);
+static void canbus_rx_index_build(canbus_t* canbus);
+static i_status canbus_rcu_write_begin(canbus_t* canbus);
+static void canbus_rcu_write_end(canbus_t* canbus);
+static uint32_t canbus_rcu_read_begin(canbus_t* canbus);
+static void canbus_rcu_read_end(canbus_t* canbus, uint32_t epoch);
+static void canbus_rcu_retire(canbus_t* canbus, canbus_callback_t* node);
+static uint32_t canbus_rcu_reclaim(canbus_t* canbus);
+static uint32_t canbus_rx_dispatch(canbus_t* canbus, canbus_frame_t* frame, canbus_frame_view_t* view, uint32_t key, uint8_t deferred, uint32_t* called);
+static void canbus_rx_call(canbus_t* canbus, canbus_callback_t* item, canbus_frame_t* frame, canbus_frame_view_t* view);
+static void canbus_rx_view(canbus_frame_view_t* view, const canbus_frame_t* frame, const volatile uint32_t* data);
+static void canbus_rx_payload(canbus_frame_t* frame, canbus_frame_view_t* view);
+static void canbus_rx_latency_track(canbus_t* canbus, const canbus_frame_t* frame, uint8_t deferred);
+static canbus_frame_t* canbus_rx_slot(canbus_rx_ring_t* ring, canbus_frame_t* spare);
+static uint32_t canbus_rx_publish(canbus_rx_ring_t* ring, canbus_frame_t* frame);
+static void canbus_rx_notify(canbus_t* canbus);
+static void canbus_rx_drain(FDCAN_HandleTypeDef* hfdcan, uint32_t fifo, uint8_t isr);
+static uint32_t canbus_rx_its(canbus_t* canbus, uint32_t lane);
+static void canbus_rx_flush(canbus_t* canbus, uint32_t lane);
+static canbus_callback_t* canbus_callback_alloc(void);
+static void canbus_callback_release(canbus_callback_t* node);
+static i_status canbus_callback_insert(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), void(*view)(const canbus_frame_view_t*), void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags);
+static uint32_t canbus_filter_full(uint8_t ext);
+static uint64_t canbus_filter_size(const canbus_filter_entry_t* entry);
+static uint32_t canbus_filter_covers(const canbus_filter_entry_t* a, const canbus_filter_entry_t* b);
+static uint32_t canbus_filter_absorb(canbus_filter_entry_t* work, uint32_t cnt, uint32_t keep);
+static uint32_t canbus_filter_reduce(canbus_filter_entry_t* work, uint32_t cnt, uint32_t ext);
+static uint32_t canbus_filter_collect(canbus_t* canbus, canbus_filter_entry_t* work);
+static uint32_t canbus_filter_slots(const canbus_filter_entry_t* work, uint32_t cnt, uint8_t ext);
+static void canbus_filters_refresh(canbus_t* canbus);
+static void canbus_tx_header(FDCAN_TxHeaderTypeDef* header, uint16_t fr_format, uint32_t id_type, uint32_t id, uint16_t dlc);
+static i_status canbus_tx_enqueue(canbus_t* canbus, FDCAN_TxHeaderTypeDef* header, uint8_t* data, uint16_t dlc);
+static void canbus_tx_refill(canbus_t* canbus);
+static void canbus_tx_write_element(canbus_t* canbus, uint32_t t0, uint32_t t1, const uint8_t* data, uint32_t dlc, uint32_t words);
+static HAL_StatusTypeDef canbus_tx_put(canbus_t* canbus, FDCAN_TxHeaderTypeDef* header, uint8_t* data, uint32_t dlc);
+#if CANBUS_MSGRAM_DIRECT
+static uint32_t canbus_rx_peek(FDCAN_HandleTypeDef* hfdcan, uint32_t lane, canbus_frame_t* frame, canbus_frame_view_t* view, uint32_t* index);
+static void canbus_rx_ack(FDCAN_HandleTypeDef* hfdcan, uint32_t lane, uint32_t index);
+#endif
+static void canbus_tx_notify(canbus_t* canbus, canbus_tx_event_t* event);
+static void canbus_bus_off(canbus_t* canbus);
 
 /******************************************************************************
 * Definition  | Static Functions
 ******************************************************************************/
 
-static void canbus_remove_callbacks(canbus_t* canbus)
+/* Masks what the driver shares state with: the interrupts up to
+   CANBUS_IRQ_PRIORITY through BASEPRI when the config sets it, all of them
+   otherwise. Restores the previous level, so it nests. */
+static uint32_t canbus_lock(void)
 {
-	if(canbus->callbacks == NULL)
-		return;
+	uint32_t state;
+#ifdef CANBUS_LOCK_LEVEL
+	state = __get_BASEPRI();
+	__set_BASEPRI_MAX(CANBUS_LOCK_LEVEL);
+#else
+	state = __get_PRIMASK();
 	__disable_irq();
+#endif
+	return state;
+}
+
+static void canbus_unlock(uint32_t state)
+{
+#ifdef CANBUS_LOCK_LEVEL
+	__set_BASEPRI(state);
+#else
+	__set_PRIMASK(state);
+#endif
+}
+
+/* CANBUS_CYCLES() when the config gives one, the DWT cycle counter otherwise */
+static uint32_t canbus_cycles(void)
+{
+#if defined(CANBUS_CYCLES)
+	return CANBUS_CYCLES();
+#elif defined(DWT)
+	return DWT->CYCCNT;
+#else
+	return 0;
+#endif
+}
 
+static void canbus_remove_callbacks(canbus_t* canbus)
+{
 	canbus_callback_t* next = NULL;
 	canbus_callback_t *current = canbus->callbacks;
 
+	if(current == NULL || canbus_rcu_write_begin(canbus) != I_OK)
+		return;
+
 	while (current != NULL)
 	{
 		next = current->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
+		canbus_rx_index_remove(current);
+		canbus_rcu_retire(canbus, current);
 		current = next;
 	}
 
 	canbus->callbacks = NULL;
-	__enable_irq();
-}
-
-/******************************************************************************
-* Definition  | Public Functions
-******************************************************************************/
-
-
-i_status canbus_initialize(canbus_t* canbus)
-{
-	__disable_irq();
-
-	(void)HAL_FDCAN_DeactivateNotification(canbus->hcan, FDCAN_IT_RX_FIFO0_NEW_MESSAGE);
-	(void)HAL_FDCAN_DeInit(canbus->hcan);
-
-	__enable_irq();
-	canbus->mx_init();
-
-	if(canbus->filters_cnt != 0)
-	{
-		for(int i=0;i<canbus->filters_cnt;i++)
-			if (HAL_FDCAN_ConfigFilter(canbus->hcan, &canbus->filters[i] ) != HAL_OK) goto canbus_initialize_error;
-	}
-
-	if (HAL_FDCAN_ConfigGlobalFilter(canbus->hcan,FDCAN_REJECT,FDCAN_REJECT,FDCAN_REJECT_REMOTE,FDCAN_REJECT_REMOTE) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_FDCAN_Start(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_RX_FIFO0_NEW_MESSAGE, 0) != HAL_OK) goto canbus_initialize_error;
-	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_BUS_OFF, 0) != HAL_OK) goto canbus_initialize_error;
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i] == canbus)
-			return I_OK;
-
-	canbus_interfaces[canbus_interfaces_cnt] = canbus;
-	canbus_interfaces_cnt++;
-
-	return I_OK;
-	canbus_initialize_error:
-		return I_ERROR;
+	(void)canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
 }
 
-i_status canbus_send_plain(canbus_t* canbus, uint16_t fr_format, uint32_t id_type, uint32_t id, uint8_t dlc, uint8_t* data)
+static void canbus_tx_header(FDCAN_TxHeaderTypeDef* header, uint16_t fr_format, uint32_t id_type, uint32_t id, uint16_t dlc)
 {
-	uint32_t timeout = HAL_GetTick();
-	uint8_t iterrations = 0;
-	__disable_irq();
+	header->Identifier = id;
+	header->IdType = id_type == CBUS_ID_T_EXTENDED ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+	header->TxFrameType = FDCAN_DATA_FRAME;
 
-	TxHeader.Identifier = id;
-	TxHeader.IdType = id_type == CBUS_ID_T_EXTENDED ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
-	TxHeader.TxFrameType = FDCAN_DATA_FRAME;
 	if(dlc<=8)
 	{
-		TxHeader.DataLength = dlc * 0x00010000U;
+		header->DataLength = dlc * 0x00010000U;
 	}
 	else
 	{
 		if (dlc <= 12)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_12;
+			header->DataLength = FDCAN_DLC_BYTES_12;
 		}
 		else if (dlc <= 16)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_16;
+			header->DataLength = FDCAN_DLC_BYTES_16;
 		}
 		else if (dlc <= 20)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_20;
+			header->DataLength = FDCAN_DLC_BYTES_20;
 		}
 		else if (dlc <= 24)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_24;
+			header->DataLength = FDCAN_DLC_BYTES_24;
 		}
 		else if (dlc <= 32)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_32;
+			header->DataLength = FDCAN_DLC_BYTES_32;
 		}
 		else if (dlc <= 48)
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_48;
+			header->DataLength = FDCAN_DLC_BYTES_48;
 		}
 		else
 		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_64;
+			header->DataLength = FDCAN_DLC_BYTES_64;
 		}
 	}
-	TxHeader.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
-	TxHeader.BitRateSwitch = FDCAN_BRS_OFF;
-	TxHeader.FDFormat = fr_format == CBUS_FR_FRM_FD ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
-	TxHeader.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-	TxHeader.MessageMarker = TxHeader.MessageMarker > 3 ? 0 : TxHeader.MessageMarker+1;
-	HAL_StatusTypeDef result;
-	do
-	{
-		result = HAL_FDCAN_AddMessageToTxFifoQ(canbus->hcan, &TxHeader, data);
-		iterrations++;
-		if(iterrations == 0xFF)
+
+	header->ErrorStateIndicator = FDCAN_ESI_ACTIVE;
+	header->BitRateSwitch = fr_format == CBUS_FR_FRM_FD_BRS ? FDCAN_BRS_ON : FDCAN_BRS_OFF;
+	header->FDFormat = fr_format == CBUS_FR_FRM_FD || fr_format == CBUS_FR_FRM_FD_BRS ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
+	header->TxEventFifoControl = FDCAN_NO_TX_EVENTS;
+	header->MessageMarker = 0;
+}
+
+/* Called with interrupts disabled. Goes straight to the hardware FIFO while
+   nothing is waiting in software, so frames always leave in call order. */
+static i_status canbus_tx_enqueue(canbus_t* canbus, FDCAN_TxHeaderTypeDef* header, uint8_t* data, uint16_t dlc)
+{
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	canbus_tx_item_t* item;
+	uint32_t bytes = canbus_dlc_bytes[(header->DataLength >> 16U) & 0xFU];
+	uint32_t copy = dlc < bytes ? dlc : bytes;
+
+	if(queue->head == queue->tail && CANBUS_TX_ROOM(canbus->hcan))
+	{
+		if(canbus_tx_put(canbus, header, data, dlc) != HAL_OK)
 		{
-			__enable_irq();
+			canbus->stats.tx_errors++;
 			return I_ERROR;
 		}
+		canbus->stats.tx_frames++;
+		return I_OK;
 	}
-	while(result != HAL_OK);
-	__enable_irq();
-	while( canbus->hcan->Instance->TXBRP!=0 )
+
+	if((queue->head - queue->tail) == CANBUS_TX_QUEUE_SIZE)
 	{
-		__NOP();
-		if((timeout + 3)< HAL_GetTick())
-			return I_ERROR;
+		canbus->stats.tx_full++;
+		return I_FULL;
 	}
 
-	return result == HAL_OK ? I_OK :I_ERROR;
+	item = &queue->items[queue->head & (CANBUS_TX_QUEUE_SIZE - 1U)];
+	item->header = *header;
+	/* DataLength rounds dlc up, the padding goes out as zeros */
+	memcpy(item->dt, data, copy);
+	memset(&item->dt[copy], 0, bytes - copy);
+	queue->head++;
+	canbus->stats.tx_frames++;
+	return I_OK;
 }
 
-i_status canbus_send(canbus_t* canbus,canbus_frame_t* frame)
+static void canbus_tx_refill(canbus_t* canbus)
 {
-	uint32_t timeout = HAL_GetTick();
-	uint8_t iterrations = 0;
-	__disable_irq();
-	TxHeader.Identifier = frame->id;
-	TxHeader.IdType = frame->id_type == CBUS_ID_T_EXTENDED ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
-	TxHeader.TxFrameType = FDCAN_DATA_FRAME;
+	canbus_tx_queue_t* queue = &canbus->tx_queue;
+	canbus_tx_item_t* item;
 
-	if(frame->dlc<=8)
+	while(queue->tail != queue->head && CANBUS_TX_ROOM(canbus->hcan))
 	{
-		TxHeader.DataLength = frame->dlc * 0x00010000U;
+		item = &queue->items[queue->tail & (CANBUS_TX_QUEUE_SIZE - 1U)];
+		if(canbus_tx_put(canbus, &item->header, item->dt, sizeof(item->dt)) != HAL_OK)
+			break;
+		queue->tail++;
 	}
-	else
+}
+
+/* Called with interrupts disabled and room in the TX FIFO. Message RAM only
+   takes word accesses, the tail past dlc is zero padded. */
+static void canbus_tx_write_element(canbus_t* canbus, uint32_t t0, uint32_t t1, const uint8_t* data, uint32_t dlc, uint32_t words)
+{
+	FDCAN_HandleTypeDef* hcan = canbus->hcan;
+	uint32_t index = (hcan->Instance->TXFQS & FDCAN_TXFQS_TFQPI) >> FDCAN_TXFQS_TFQPI_Pos;
+	volatile uint32_t* element = CANBUS_TX_ELEMENT(hcan, index);
+	uint32_t word;
+	uint32_t i = 0;
+
+	element[0] = t0;
+	element[1] = t1;
+	for(;(i + 4U) <= dlc;i+=4U)
 	{
-		if (frame->dlc <= 12)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_12;
-		}
-		else if (frame->dlc <= 16)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_16;
-		}
-		else if (frame->dlc <= 20)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_20;
-		}
-		else if (frame->dlc <= 24)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_24;
-		}
-		else if (frame->dlc <= 32)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_32;
-		}
-		else if (frame->dlc <= 48)
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_48;
-		}
-		else
-		{
-			TxHeader.DataLength = FDCAN_DLC_BYTES_64;
-		}
+		memcpy(&word, &data[i], 4U);
+		element[2U + (i >> 2)] = word;
 	}
-
-	TxHeader.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
-	TxHeader.BitRateSwitch = FDCAN_BRS_OFF;
-	TxHeader.FDFormat = frame->fr_format == CBUS_FR_FRM_FD ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN;
-	TxHeader.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-	TxHeader.MessageMarker = TxHeader.MessageMarker > 3 ? 0 : TxHeader.MessageMarker+1;
-	HAL_StatusTypeDef result;
-	do
+	for(;i < words * 4U;i+=4U)
 	{
-		result = HAL_FDCAN_AddMessageToTxFifoQ(canbus->hcan, &TxHeader, frame->dt);
-		iterrations++;
-		if(iterrations == 0xFF)
-		{
-			 __enable_irq();
-			return I_ERROR;
-		}
+		word = 0;
+		for(register uint32_t k=0;k<4U && (i + k) < dlc;k++)
+			word |= (uint32_t)data[i + k] << (8U * k);
+		element[2U + (i >> 2)] = word;
 	}
-	while(result != HAL_OK);
-	__enable_irq();
 
-	while( canbus->hcan->Instance->TXBRP!=0 )
+	hcan->LatestTxFifoQRequest = 1U << index;
+	hcan->Instance->TXBAR = 1U << index;
+	__DSB();
+}
+
+/* HAL_FDCAN_AddMessageToTxFifoQ, or the element written straight from the
+   header when CANBUS_MSGRAM_DIRECT is set. Room in the FIFO is checked by
+   the caller. Only `dlc` bytes of data are read, the rest of the length
+   DataLength rounds up to goes out as zeros. */
+static HAL_StatusTypeDef canbus_tx_put(canbus_t* canbus, FDCAN_TxHeaderTypeDef* header, uint8_t* data, uint32_t dlc)
+{
+	uint32_t bytes = canbus_dlc_bytes[(header->DataLength >> 16U) & 0xFU];
+#if CANBUS_MSGRAM_DIRECT
+	uint32_t t0;
+
+	if(canbus->hcan->State != HAL_FDCAN_STATE_BUSY)
+		return HAL_ERROR;
+	if(header->IdType == FDCAN_STANDARD_ID)
+		t0 = header->ErrorStateIndicator | header->TxFrameType | FDCAN_STANDARD_ID | (header->Identifier << 18U);
+	else
+		t0 = header->ErrorStateIndicator | header->TxFrameType | FDCAN_EXTENDED_ID | header->Identifier;
+	canbus_tx_write_element(canbus, t0, (header->MessageMarker << 24U) | header->TxEventFifoControl | header->FDFormat | header->BitRateSwitch | header->DataLength,
+		data, dlc < bytes ? dlc : bytes, (bytes + 3U) / 4U);
+	return HAL_OK;
+#else
+	uint8_t padded[64];
+
+	if(dlc < bytes && bytes <= sizeof(padded))
 	{
-		__NOP();
-		if((timeout + 3)< HAL_GetTick())
-			return I_ERROR;
+		memcpy(padded, data, dlc);
+		memset(&padded[dlc], 0, bytes - dlc);
+		data = padded;
 	}
+	return HAL_FDCAN_AddMessageToTxFifoQ(canbus->hcan, header, data);
+#endif
+}
+
+#if CANBUS_MSGRAM_DIRECT
+/* Header of the next element of the lane's RX FIFO into `frame`, the view
+   on its payload words left in message RAM until canbus_rx_ack. Returns the
+   dispatch key, CANBUS_RX_KEY_NONE once the FIFO is empty. RXF0S and RXF1S
+   share one layout. */
+static uint32_t canbus_rx_peek(FDCAN_HandleTypeDef* hfdcan, uint32_t lane, canbus_frame_t* frame, canbus_frame_view_t* view, uint32_t* index)
+{
+	uint32_t status = lane != 0 ? hfdcan->Instance->RXF1S : hfdcan->Instance->RXF0S;
+	volatile uint32_t* element;
+	uint32_t r0;
+	uint32_t r1;
+	uint32_t xtd;
 
-	return result == HAL_OK ? I_OK :I_ERROR;
+	if((status & FDCAN_RXF0S_F0FL) == 0)
+		return CANBUS_RX_KEY_NONE;
+	*index = (status & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+	element = CANBUS_RX_ELEMENT(hfdcan, lane, *index);
+	r0 = element[0];
+	r1 = element[1];
+	xtd = (r0 >> 30) & 1U;
+	frame->id = (r0 >> canbus_rx_id_shift[xtd]) & canbus_rx_id_mask[xtd];
+	frame->id_type = xtd != 0 ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
+	frame->fr_format = canbus_rx_format[(r1 >> 20) & 3U];
+	frame->dlc = canbus_dlc_bytes[(r1 >> 16) & 0xFU];
+	frame->timestamp = r1 & 0xFFFFU;
+	canbus_rx_view(view, frame, &element[2]);
+	return frame->id | (xtd << 31);
 }
 
-i_status canbus_callback_add(canbus_t* canbus,uint32_t id,uint32_t mask,uint32_t type, void(*cb)(canbus_frame_t*))
+/* Hands the element back once the callbacks are done with it */
+static void canbus_rx_ack(FDCAN_HandleTypeDef* hfdcan, uint32_t lane, uint32_t index)
 {
-	__disable_irq();
-	canbus_callback_t* node = (canbus_callback_t*)malloc(sizeof(canbus_callback_t));
+	if(lane != 0)
+		hfdcan->Instance->RXF1A = index;
+	else
+		hfdcan->Instance->RXF0A = index;
+	/* Acknowledge in before the status is read again */
+	__DSB();
+}
+#endif
 
-	#if __has_include("FreeRTOS.h")
-	if(node == NULL)
-			node = (canbus_callback_t*)pvPortMalloc(sizeof(canbus_callback_t));
-	#else
-	if(node == NULL)
-				node = (canbus_callback_t*)malloc(sizeof(canbus_callback_t));
-	#endif
+/* From the TX interrupts, once the frame made it onto the bus */
+static void canbus_tx_notify(canbus_t* canbus, canbus_tx_event_t* event)
+{
+#if __has_include("task.h")
+	BaseType_t woken = pdFALSE;
+#endif
 
-	if(node == NULL)
-		goto canbus_callback_add_error;
-	node->id = id;
-	node->mask = mask;
-	node->type = type;
-	node->callback = cb;
-	node->next = canbus->callbacks;
-	canbus->callbacks = node;
-	__enable_irq();
-	return I_OK;
-	canbus_callback_add_error:
-	__enable_irq();
-	return I_ERROR;
+	if(canbus->tx_done != NULL)
+		canbus->tx_done(event);
+#if __has_include("task.h")
+	if(canbus->tx_task == NULL)
+		return;
+	xTaskNotifyFromISR(canbus->tx_task, ((uint32_t)event->marker << 16) | event->timestamp, eSetValueWithOverwrite, &woken);
+	portYIELD_FROM_ISR(woken);
+#endif
 }
 
-i_status canbus_callback_remove(canbus_t* canbus,canbus_callback_t* clb)
+/* From the bus-off ISR: the controller already sits in init mode, only the
+   backoff is armed here and canbus_recover_if_needs does the restart */
+static void canbus_bus_off(canbus_t* canbus)
 {
-	if(canbus->callbacks == NULL)
-		return I_NOTEXISTS;
-	__disable_irq();
+	canbus_recovery_t* recovery = &canbus->recovery;
+	uint32_t now = HAL_GetTick();
+	uint32_t backoff;
+
+	if(recovery->state == CBUS_RC_IDLE && now - recovery->done >= CANBUS_RECOVERY_BACKOFF_MAX)
+		recovery->attempts = 0;
+	backoff = recovery->attempts < 16U ? CANBUS_RECOVERY_BACKOFF_MIN << recovery->attempts : CANBUS_RECOVERY_BACKOFF_MAX;
+	if(backoff > CANBUS_RECOVERY_BACKOFF_MAX)
+		backoff = CANBUS_RECOVERY_BACKOFF_MAX;
+	if(recovery->attempts < 0xFFU)
+		recovery->attempts++;
 
-	canbus_callback_t *current;
-	canbus_callback_t *to_remove;
+	recovery->since = now;
+	recovery->backoff = backoff;
+	recovery->state = CBUS_RC_BACKOFF;
+	canbus->stats.bus_off++;
+}
+
+/* Probes from the hashed slot, first hit on a single interface per slot */
+static canbus_t* canbus_from_handle(FDCAN_HandleTypeDef* hfdcan)
+{
+	uint32_t slot = CANBUS_HANDLE_SLOT(hfdcan);
+	canbus_t* canbus;
 
-	if(canbus->callbacks == clb)
+	for(uint32_t i=0;i<CANBUS_INTERFACES_MAX;i++)
 	{
-		current = canbus->callbacks;
-		canbus->callbacks = current->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
-		__enable_irq();
+		canbus = canbus_interfaces[(slot + i) & (CANBUS_INTERFACES_MAX - 1U)];
+		if(canbus == NULL || canbus->hcan == hfdcan)
+			return canbus;
+	}
+	return NULL;
+}
+
+/* Called with IRQs disabled, I_OK the first time an interface is seen */
+static i_status canbus_register(canbus_t* canbus)
+{
+	uint32_t slot = CANBUS_HANDLE_SLOT(canbus->hcan);
+	canbus_t** entry;
+
+	for(uint32_t i=0;i<CANBUS_INTERFACES_MAX;i++)
+	{
+		entry = &canbus_interfaces[(slot + i) & (CANBUS_INTERFACES_MAX - 1U)];
+		if(*entry == canbus)
+			return I_EXISTS;
+		if(*entry != NULL && (*entry)->hcan != canbus->hcan)
+			continue;
+		*entry = canbus;
 		return I_OK;
 	}
+	return I_FULL;
+}
 
-	current = canbus->callbacks;
+#ifdef CANBUS_IRQ_PRIORITY
+/* canbus_lock masks up to CANBUS_IRQ_PRIORITY only: a line set more urgent,
+   e.g. FIFO1 on interrupt line 1, would get into the locked sections. Lines
+   of families the driver does not know are not checked. */
+static i_status canbus_irq_check(canbus_t* canbus)
+{
+	int32_t lines[2] = {-1, -1};
 
-	while (current != NULL)
+#if defined(STM32G4) || defined(STM32H7)
+	if(canbus->hcan->Instance == FDCAN1)
 	{
-		if(current->next == clb)
-		{
-			to_remove = current->next;
-			current->next = to_remove->next;
-		#if __has_include("FreeRTOS.h")
-				vPortFree(current);
-		#else
-				free(current);
-		#endif
-			__enable_irq();
-			return I_OK;
-		}
-		current = current->next;
+		lines[0] = FDCAN1_IT0_IRQn;
+		lines[1] = FDCAN1_IT1_IRQn;
 	}
-	__enable_irq();
-	return I_NOTEXISTS;
+#ifdef FDCAN2
+	if(canbus->hcan->Instance == FDCAN2)
+	{
+		lines[0] = FDCAN2_IT0_IRQn;
+		lines[1] = FDCAN2_IT1_IRQn;
+	}
+#endif
+#ifdef FDCAN3
+	if(canbus->hcan->Instance == FDCAN3)
+	{
+		lines[0] = FDCAN3_IT0_IRQn;
+		lines[1] = FDCAN3_IT1_IRQn;
+	}
+#endif
+#else
+	(void)canbus;
+#endif
+	for(uint32_t i=0;i<2U;i++)
+		if(lines[i] >= 0 && NVIC_GetPriority((IRQn_Type)lines[i]) < (CANBUS_IRQ_PRIORITY))
+			return I_INVALID;
+	return I_OK;
 }
+#endif
 
-i_status canbus_callback_exists(canbus_t* canbus,canbus_callback_t* clb)
+static uint32_t canbus_rx_key(uint32_t type, uint32_t id)
 {
-	if(canbus->callbacks == NULL)
-		return I_NOTEXISTS;
-	__disable_irq();
+	if(type == FDCAN_EXTENDED_ID || type == CBUS_ID_T_EXTENDED)
+		return id | CANBUS_RX_KEY_EXT;
+	if(type == FDCAN_STANDARD_ID || type == CBUS_ID_T_STANDARD)
+		return id & ~CANBUS_RX_KEY_EXT;
+	return CANBUS_RX_KEY_NONE;
+}
 
-	canbus_callback_t *current = canbus->callbacks;
+/* Called with interrupts disabled. Exact ids land in a hash slot, masked
+   entries in one list ordered on mask so each mask is applied once per frame. */
+static void canbus_rx_index_insert(canbus_t* canbus, canbus_callback_t* node)
+{
+	canbus_callback_t** slot;
 
-	while (current != NULL)
+	node->link = NULL;
+	node->pprev = NULL;
+	node->key = canbus_rx_key(node->type, node->id);
+	if(node->key == CANBUS_RX_KEY_NONE)
+		return;
+
+	if(node->mask == 0)
 	{
-		if(current == clb)
-		{
-			__enable_irq();
-			return I_EXISTS;
-		}
-		current = current->next;
+		slot = &canbus->rx_index.exact[CANBUS_RX_SLOT(node->key)];
+	}
+	else
+	{
+		node->key &= node->mask | CANBUS_RX_KEY_EXT;
+		slot = &canbus->rx_index.masked;
+		while(*slot != NULL && (*slot)->mask < node->mask)
+			slot = &(*slot)->link;
 	}
 
-	__enable_irq();
-	return I_NOTEXISTS;
+	/* Readers see the node complete or not at all */
+	node->link = *slot;
+	node->pprev = slot;
+	if(*slot != NULL)
+		(*slot)->pprev = &node->link;
+	__DMB();
+	*slot = node;
 }
 
-void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+static void canbus_rx_index_remove(canbus_callback_t* node)
 {
-	static canbus_t* current_canbus = NULL;
-	static FDCAN_RxHeaderTypeDef pRxHeader;
-	static canbus_frame_t frame;
-	static canbus_callback_t* callback_item = NULL;
+	if(node->pprev == NULL)
+		return;
+	/* `link` stays, a dispatch standing on the node carries on past it */
+	*node->pprev = node->link;
+	if(node->link != NULL)
+		node->link->pprev = node->pprev;
+	node->pprev = NULL;
+}
 
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i]->hcan == hfdcan)
-			current_canbus = canbus_interfaces[i];
+/* Picks up lists handed over in `callbacks` before the first initialize */
+static void canbus_rx_index_build(canbus_t* canbus)
+{
+	canbus_callback_t* prev = NULL;
 
-	if(current_canbus == NULL)
+	memset(&canbus->rx_index, 0, sizeof(canbus->rx_index));
+	for(canbus_callback_t* node = canbus->callbacks;node != NULL;node = node->next)
 	{
-		while(HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK);
-		return;
+		node->prev = prev;
+		node->bus = canbus;
+		canbus_rx_index_insert(canbus, node);
+		prev = node;
 	}
+}
 
-	if(current_canbus->callbacks == NULL)
+/* Writers run in thread context, one at a time per interface; a second one
+   gets I_LOCKED instead of waiting. The RX ISR never waits on them. */
+static i_status canbus_rcu_write_begin(canbus_t* canbus)
+{
+	uint32_t lock = canbus_lock();
+	uint8_t busy = canbus->rcu.writer;
+
+	canbus->rcu.writer = 1;
+	canbus_unlock(lock);
+	return busy ? I_LOCKED : I_OK;
+}
+
+static void canbus_rcu_write_end(canbus_t* canbus)
+{
+	__DMB();
+	canbus->rcu.writer = 0;
+}
+
+/* Counts the dispatch in the current epoch. Nested ISRs restore the counter
+   before they return, so a plain increment is enough on one core. */
+static uint32_t canbus_rcu_read_begin(canbus_t* canbus)
+{
+	uint32_t epoch;
+
+	while(1)
 	{
-		while(HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK);
-		return;
+		epoch = canbus->rcu.epoch & 1U;
+		canbus->rcu.readers[epoch]++;
+		__DMB();
+		if((canbus->rcu.epoch & 1U) == epoch)
+			return epoch;
+		canbus->rcu.readers[epoch]--;
 	}
+}
+
+static void canbus_rcu_read_end(canbus_t* canbus, uint32_t epoch)
+{
+	__DMB();
+	canbus->rcu.readers[epoch]--;
+}
+
+/* Node already unlinked from the list and the index */
+static void canbus_rcu_retire(canbus_t* canbus, canbus_callback_t* node)
+{
+	node->retired = 1;
+	node->next = canbus->rcu.retired;
+	canbus->rcu.retired = node;
+}
 
-	while(HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &pRxHeader, frame.dt) == HAL_OK)
+/* Hands back the nodes no dispatch can reach any more and returns how many
+   still wait. Never blocks: a grace period with readers left is checked
+   again by the next writer. */
+static uint32_t canbus_rcu_reclaim(canbus_t* canbus)
+{
+	canbus_rcu_t* rcu = &canbus->rcu;
+	canbus_callback_t* node;
+	uint32_t waiting = 0;
+	uint32_t lock;
+
+	for(uint32_t pass=0;pass<2U;pass++)
 	{
-		callback_item = current_canbus->callbacks;
-		frame.id = pRxHeader.Identifier;
-		switch(pRxHeader.DataLength)
+		if(rcu->grace == NULL)
 		{
-		case FDCAN_DLC_BYTES_0:
-			frame.dlc = 0;
-			break;
-		case FDCAN_DLC_BYTES_1:
-			frame.dlc = 1;
-			break;
-		case FDCAN_DLC_BYTES_2:
-			frame.dlc = 2;
-			break;
-		case FDCAN_DLC_BYTES_3:
-			frame.dlc = 3;
-			break;
-		case FDCAN_DLC_BYTES_4:
-			frame.dlc = 4;
-			break;
-		case FDCAN_DLC_BYTES_5:
-			frame.dlc = 5;
-			break;
-		case FDCAN_DLC_BYTES_6:
-			frame.dlc = 6;
-			break;
-		case FDCAN_DLC_BYTES_7:
-			frame.dlc = 7;
-			break;
-		case FDCAN_DLC_BYTES_8:
-			frame.dlc = 8;
-			break;
-		case FDCAN_DLC_BYTES_12:
-			frame.dlc = 12;
-			break;
-		case FDCAN_DLC_BYTES_16:
-			frame.dlc = 16;
-			break;
-		case FDCAN_DLC_BYTES_20:
-			frame.dlc = 20;
-			break;
-		case FDCAN_DLC_BYTES_24:
-			frame.dlc = 24;
-			break;
-		case FDCAN_DLC_BYTES_32:
-			frame.dlc = 32;
-			break;
-		case FDCAN_DLC_BYTES_48:
-			frame.dlc = 48;
-			break;
-		case FDCAN_DLC_BYTES_64:
-			frame.dlc = 64;
-			break;
+			if(rcu->retired == NULL)
+				break;
+			rcu->grace = rcu->retired;
+			rcu->retired = NULL;
+			rcu->epoch++;
+			__DMB();
 		}
+		if(rcu->readers[(rcu->epoch - 1U) & 1U] != 0)
+			break;
 
-		frame.id_type = pRxHeader.IdType == FDCAN_EXTENDED_ID ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
-		frame.fr_format = pRxHeader.FDFormat == FDCAN_FD_CAN ? CBUS_FR_FRM_FD : CBUS_FR_FRM_STD;
-
-		while(callback_item!=NULL)
+		lock = canbus_lock();
+		while(rcu->grace != NULL)
 		{
-			if(callback_item->type == pRxHeader.IdType)
-			{
-				if((callback_item->mask == 0 && (callback_item->id == pRxHeader.Identifier)) || (callback_item->mask!=0 && (callback_item->id & callback_item->mask) == (pRxHeader.Identifier & callback_item->mask)))
-					callback_item->callback(&frame);
-			}
-			callback_item = callback_item->next;
+			node = rcu->grace;
+			rcu->grace = node->next;
+			canbus_callback_release(node);
 		}
+		canbus_unlock(lock);
 	}
+
+	for(node = rcu->grace;node != NULL;node = node->next)
+		waiting++;
+	for(node = rcu->retired;node != NULL;node = node->next)
+		waiting++;
+	return waiting;
 }
 
-void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs)
+/* Runs the matching callbacks of one delivery kind, returns how many of the
+   other kind matched. `called` takes how many ran. */
+static uint32_t canbus_rx_dispatch(canbus_t* canbus, canbus_frame_t* frame, canbus_frame_view_t* view, uint32_t key, uint8_t deferred, uint32_t* called)
 {
-	static canbus_t* current_canbus = NULL;
+	canbus_callback_t* item = canbus->rx_index.exact[CANBUS_RX_SLOT(key)];
+	canbus_callback_t* next;
+	uint32_t mask = 0;
+	uint32_t masked = 0;
+	uint32_t other = 0;
 
-	for(register uint32_t i=0;i<canbus_interfaces_cnt;i++)
-		if(canbus_interfaces[i]->hcan == hfdcan)
-			current_canbus = canbus_interfaces[i];
+	*called = 0;
+	for(;item != NULL;item = next)
+	{
+		next = item->link;
+		if(item->key != key)
+			continue;
+		if(item->deferred != deferred)
+		{
+			other++;
+			continue;
+		}
+		if((*called)++ == 0)
+			canbus_rx_latency_track(canbus, frame, deferred);
+		canbus_rx_call(canbus, item, frame, view);
+	}
+
+	for(item = canbus->rx_index.masked;item != NULL;item = next)
+	{
+		next = item->link;
+		if(item->mask != mask)
+		{
+			mask = item->mask;
+			masked = key & (mask | CANBUS_RX_KEY_EXT);
+		}
+		if(item->key != masked)
+			continue;
+		if(item->deferred != deferred)
+		{
+			other++;
+			continue;
+		}
+		if((*called)++ == 0)
+			canbus_rx_latency_track(canbus, frame, deferred);
+		canbus_rx_call(canbus, item, frame, view);
+	}
+	return other;
+}
+
+/* At the first callback of a frame. FIFO0 and FIFO1 ISRs share lane 0, a
+   sample may get lost when one preempts the other. */
+static void canbus_rx_latency_track(canbus_t* canbus, const canbus_frame_t* frame, uint8_t deferred)
+{
+#if CANBUS_RX_LATENCY
+	canbus_rx_latency_t* lat = &canbus->rx_latency[deferred ? 1 : 0];
+
+	lat->last = (CANBUS_RX_TSC(canbus->hcan) - frame->timestamp) & FDCAN_TSCV_TSC;
+	if(lat->last > lat->max)
+		lat->max = lat->last;
+	lat->frames++;
+#else
+	(void)canbus;
+	(void)frame;
+	(void)deferred;
+#endif
+}
+
+/* With CANBUS_PROFILE the call is timed into the histogram of the node. Two
+   RX FIFO ISRs running the same node may lose a count. */
+static void canbus_rx_call(canbus_t* canbus, canbus_callback_t* item, canbus_frame_t* frame, canbus_frame_view_t* view)
+{
+#if CANBUS_PROFILE
+	uint32_t start = canbus_cycles();
+	uint32_t cycles;
+	uint32_t bin;
+	uint32_t budget;
+
+	if(item->view != NULL)
+		item->view(view);
+	else
+	{
+		canbus_rx_payload(frame, view);
+		if(item->handler != NULL)
+			item->handler(item, frame);
+		else
+			item->callback(frame);
+	}
+	cycles = canbus_cycles() - start;
+	bin = 32U - __CLZ(cycles);
+	item->hist[bin < CANBUS_PROFILE_BINS ? bin : CANBUS_PROFILE_BINS - 1U]++;
+	if(cycles > item->max)
+		item->max = cycles;
+
+	budget = item->budget != 0 ? item->budget : CANBUS_PROFILE_BUDGET;
+	if(budget == 0 || cycles <= budget)
+		return;
+	item->over++;
+	if(canbus->budget_hook == NULL)
+		return;
+	canbus_rx_payload(frame, view);
+	canbus->budget_hook(item, frame, cycles);
+#else
+	(void)canbus;
+	if(item->view != NULL)
+		item->view(view);
+	else
+	{
+		canbus_rx_payload(frame, view);
+		if(item->handler != NULL)
+			item->handler(item, frame);
+		else
+			item->callback(frame);
+	}
+#endif
+}
+
+static void canbus_rx_view(canbus_frame_view_t* view, const canbus_frame_t* frame, const volatile uint32_t* data)
+{
+	view->id = frame->id;
+	view->id_type = frame->id_type;
+	view->fr_format = frame->fr_format;
+	view->dlc = frame->dlc;
+	view->data = data;
+	view->timestamp = frame->timestamp;
+}
+
+/* Copies the payload into `frame` the first time a callback needs it there,
+   the view then reads the copy */
+static void canbus_rx_payload(canbus_frame_t* frame, canbus_frame_view_t* view)
+{
+	const volatile uint32_t* dt = (const volatile uint32_t*)(const void*)frame->dt;
+	uint32_t word;
+
+	if(view->data == dt)
+		return;
+	for(register uint32_t i=0;i<frame->dlc;i+=4U)
+	{
+		word = view->data[i >> 2];
+		memcpy(&frame->dt[i], &word, 4U);
+	}
+	view->data = dt;
+}
+
+/* Frames are read straight into the next ring slot, `spare` takes them while
+   the ring is full. */
+static canbus_frame_t* canbus_rx_slot(canbus_rx_ring_t* ring, canbus_frame_t* spare)
+{
+	if((ring->head - ring->tail) == CANBUS_RX_RING_SIZE)
+		return spare;
+	return &ring->items[ring->head & (CANBUS_RX_RING_SIZE - 1U)];
+}
+
+static uint32_t canbus_rx_publish(canbus_rx_ring_t* ring, canbus_frame_t* frame)
+{
+	if(frame != &ring->items[ring->head & (CANBUS_RX_RING_SIZE - 1U)] || (ring->head - ring->tail) == CANBUS_RX_RING_SIZE)
+	{
+		ring->dropped++;
+		return 0;
+	}
+	__DMB();
+	ring->head++;
+	return 1;
+}
+
+static void canbus_rx_notify(canbus_t* canbus)
+{
+#if __has_include("task.h")
+	BaseType_t woken = pdFALSE;
+
+	if(canbus->rx_task == NULL)
+		return;
+	vTaskNotifyGiveFromISR(canbus->rx_task, &woken);
+	portYIELD_FROM_ISR(woken);
+#else
+	(void)canbus;
+#endif
+}
+
+static uint32_t canbus_filter_full(uint8_t ext)
+{
+	return ext ? 0x1FFFFFFFU : 0x7FFU;
+}
+
+static uint64_t canbus_filter_size(const canbus_filter_entry_t* entry)
+{
+	uint32_t free = entry->ext ? 29U : 11U;
+
+	for(uint32_t m = entry->mask & canbus_filter_full(entry->ext);m != 0;m &= m - 1U)
+		free--;
+	return (uint64_t)1U << free;
+}
+
+/* a lets through every id b does */
+static uint32_t canbus_filter_covers(const canbus_filter_entry_t* a, const canbus_filter_entry_t* b)
+{
+	return a->ext == b->ext && a->fifo == b->fifo && (a->mask & ~b->mask) == 0 && ((a->id ^ b->id) & a->mask) == 0;
+}
+
+/* Drops the entries the one at `keep` already lets through */
+static uint32_t canbus_filter_absorb(canbus_filter_entry_t* work, uint32_t cnt, uint32_t keep)
+{
+	for(uint32_t i=0;i<cnt;)
+	{
+		if(i != keep && canbus_filter_covers(&work[keep], &work[i]))
+		{
+			work[i] = work[--cnt];
+			if(keep == cnt)
+				keep = i;
+		}
+		else
+		{
+			i++;
+		}
+	}
+	return cnt;
+}
+
+/* Merges the pair of the given type (2: any type) that lets the fewest
+   extra ids through. Returns the new count, unchanged if nothing merges. */
+static uint32_t canbus_filter_reduce(canbus_filter_entry_t* work, uint32_t cnt, uint32_t ext)
+{
+	canbus_filter_entry_t merged;
+	canbus_filter_entry_t best = {0};
+	int64_t best_cost = INT64_MAX;
+	int64_t cost;
+	uint32_t best_i = 0;
+	uint32_t best_j = 0;
+
+	for(uint32_t i=0;i<cnt;i++)
+	{
+		if(ext < 2U && work[i].ext != ext)
+			continue;
+		for(uint32_t j=i+1U;j<cnt;j++)
+		{
+			if(work[j].ext != work[i].ext || work[j].fifo != work[i].fifo)
+				continue;
+			merged.ext = work[i].ext;
+			merged.fifo = work[i].fifo;
+			merged.merged = 1;
+			merged.mask = work[i].mask & work[j].mask & ~(work[i].id ^ work[j].id);
+			merged.id = work[i].id & merged.mask;
+			cost = (int64_t)canbus_filter_size(&merged) - (int64_t)canbus_filter_size(&work[i]) - (int64_t)canbus_filter_size(&work[j]);
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				best = merged;
+				best_i = i;
+				best_j = j;
+			}
+		}
+	}
+
+	if(best_cost == INT64_MAX)
+		return cnt;
+
+	work[best_i] = best;
+	work[best_j] = work[--cnt];
+	if(best_i == cnt)
+		best_i = best_j;
+	return canbus_filter_absorb(work, cnt, best_i);
+}
+
+/* Called by the RCU writer. Also fills in `wanted` of the report. */
+static uint32_t canbus_filter_collect(canbus_t* canbus, canbus_filter_entry_t* work)
+{
+	canbus_filter_entry_t entry = {0};
+	uint32_t cnt = 0;
+	uint32_t key;
+	uint32_t i;
+
+	canbus->filter_report.wanted = 0;
+	for(canbus_callback_t* node = canbus->callbacks;node != NULL;node = node->next)
+	{
+		key = canbus_rx_key(node->type, node->id);
+		if(key == CANBUS_RX_KEY_NONE)
+			continue;
+
+		entry.ext = (key & CANBUS_RX_KEY_EXT) != 0;
+		entry.fifo = node->fifo;
+		entry.mask = node->mask == 0 ? canbus_filter_full(entry.ext) : node->mask & canbus_filter_full(entry.ext);
+		entry.id = node->id & entry.mask;
+
+		for(i=0;i<cnt;i++)
+			if(canbus_filter_covers(&work[i], &entry))
+				break;
+		if(i < cnt && work[i].merged == 0)
+			continue;
+		canbus->filter_report.wanted += canbus_filter_size(&entry);
+		if(i < cnt)
+			continue;
+
+		/* A full list always has two entries of one type and FIFO to merge */
+		if(cnt == CANBUS_FILTERS_WORK)
+			cnt = canbus_filter_reduce(work, cnt, 2U);
+		if(cnt == CANBUS_FILTERS_WORK)
+			break;
+		work[cnt] = entry;
+		cnt = canbus_filter_absorb(work, cnt + 1U, cnt);
+	}
+	return cnt;
+}
+
+/* Exact ids go in pairs into dual id elements */
+static uint32_t canbus_filter_slots(const canbus_filter_entry_t* work, uint32_t cnt, uint8_t ext)
+{
+	uint32_t exact[2] = {0, 0};
+	uint32_t masked = 0;
+
+	for(uint32_t i=0;i<cnt;i++)
+	{
+		if(work[i].ext != ext)
+			continue;
+		if(work[i].mask == canbus_filter_full(ext))
+			exact[work[i].fifo]++;
+		else
+			masked++;
+	}
+	return (exact[0] + 1U) / 2U + (exact[1] + 1U) / 2U + masked;
+}
+
+static void canbus_filters_refresh(canbus_t* canbus)
+{
+#if CANBUS_FILTERS_AUTO
+	if(canbus->filters == NULL && canbus->hcan->State == HAL_FDCAN_STATE_BUSY)
+		(void)canbus_filters_update(canbus);
+#else
+	(void)canbus;
+#endif
+}
+
+/* Called under canbus_lock, the pool is shared by every interface */
+static canbus_callback_t* canbus_callback_alloc(void)
+{
+	canbus_callback_t* node = canbus_callback_free;
+
+	if(node != NULL)
+		canbus_callback_free = node->next;
+	else if(canbus_callback_pool_used < CANBUS_CALLBACK_POOL_SIZE)
+		node = &canbus_callback_pool[canbus_callback_pool_used++];
+	else
+		return NULL;
+
+	memset(node, 0, sizeof(canbus_callback_t));
+	node->pooled = 1;
+	return node;
+}
+
+/* Called under canbus_lock, caller storage is only marked free */
+static void canbus_callback_release(canbus_callback_t* node)
+{
+	node->bus = NULL;
+	node->pprev = NULL;
+	node->retired = 0;
+	if(!node->pooled)
+		return;
+	node->next = canbus_callback_free;
+	canbus_callback_free = node;
+}
+
+static i_status canbus_callback_insert(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), void(*view)(const canbus_frame_view_t*), void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags)
+{
+	i_status status = I_OK;
+	uint32_t lock;
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	(void)canbus_rcu_reclaim(canbus);
+
+	if(node == NULL)
+	{
+		lock = canbus_lock();
+		node = canbus_callback_alloc();
+		canbus_unlock(lock);
+		if(node == NULL)
+			status = I_FULL;
+	}
+	else if(node->bus != NULL)
+		status = node->retired ? I_WAIT : I_EXISTS;
+	else
+		node->pooled = 0;
+
+	if(status != I_OK)
+		goto canbus_callback_insert_error;
+	node->id = id;
+	node->mask = mask;
+	node->type = type;
+	node->callback = cb;
+	node->view = view;
+	node->handler = handler;
+	node->deferred = (flags & CBUS_CB_DEFERRED) != 0;
+	node->fifo = (flags & CBUS_CB_FIFO1) != 0;
+#if CANBUS_PROFILE
+	memset(node->hist, 0, sizeof(node->hist));
+	node->max = 0;
+	node->over = 0;
+#endif
+	node->bus = canbus;
+	node->prev = NULL;
+	node->next = canbus->callbacks;
+	if(canbus->callbacks != NULL)
+		canbus->callbacks->prev = node;
+	canbus->callbacks = node;
+	canbus_rx_index_insert(canbus, node);
+	canbus_rcu_write_end(canbus);
+	canbus_filters_refresh(canbus);
+	return I_OK;
+	canbus_callback_insert_error:
+	canbus_rcu_write_end(canbus);
+	return status;
+}
+
+/* Shared by both RX FIFO interrupts, which may preempt each other: nothing
+   static in here, each FIFO fills its own ring. In the interrupt it stops at
+   the coalescing budget and leaves the rest to canbus_process. */
+static void canbus_rx_drain(FDCAN_HandleTypeDef* hfdcan, uint32_t fifo, uint8_t isr)
+{
+	canbus_t* current_canbus = NULL;
+	canbus_rx_ring_t* ring;
+	canbus_stats_t* stats;
+	FDCAN_RxHeaderTypeDef pRxHeader;
+	canbus_frame_t spare;
+	canbus_frame_t* frame = &spare;
+	uint32_t lane = fifo == FDCAN_RX_FIFO1 ? 1 : 0;
+	uint32_t lost = lane ? FDCAN_FLAG_RX_FIFO1_MESSAGE_LOST : FDCAN_FLAG_RX_FIFO0_MESSAGE_LOST;
+	uint32_t start = canbus_cycles();
+	uint32_t queued = 0;
+	uint32_t budget = 0;
+	uint32_t cnt = 0;
+	uint32_t called;
+	uint32_t key;
+	uint32_t epoch;
+	canbus_frame_view_t view;
+#if CANBUS_MSGRAM_DIRECT
+	uint32_t index = 0;
+#endif
+
+	current_canbus = canbus_from_handle(hfdcan);
+	if(current_canbus == NULL)
+	{
+		while(HAL_FDCAN_GetRxMessage(hfdcan, fifo, &pRxHeader, frame->dt) == HAL_OK)
+			canbus_rx_orphaned++;
+		return;
+	}
+
+	stats = &current_canbus->stats;
+	if(isr)
+	{
+		stats->rx_irqs[lane]++;
+		if(current_canbus->rx_coalesce != NULL)
+			budget = current_canbus->rx_coalesce->budget;
+	}
+	if(__HAL_FDCAN_GET_FLAG(hfdcan, lost))
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, lost);
+		stats->rx_overruns[lane]++;
+	}
+
+	if(current_canbus->callbacks == NULL)
+	{
+		while(HAL_FDCAN_GetRxMessage(hfdcan, fifo, &pRxHeader, frame->dt) == HAL_OK)
+		{
+			stats->rx_frames[lane]++;
+			stats->rx_unmatched[lane]++;
+		}
+		if(isr)
+			stats->isr_cycles[lane] += canbus_cycles() - start;
+		return;
+	}
+
+	ring = &current_canbus->rx_ring[lane];
+	epoch = canbus_rcu_read_begin(current_canbus);
+	while(1)
+	{
+		if(budget != 0 && cnt == budget)
+		{
+			if(HAL_FDCAN_GetRxFifoFillLevel(hfdcan, fifo) != 0)
+			{
+				current_canbus->rx_backlog[lane] = 1;
+				stats->rx_deferred[lane]++;
+			}
+			break;
+		}
+		frame = canbus_rx_slot(ring, &spare);
+#if CANBUS_MSGRAM_DIRECT
+		key = canbus_rx_peek(hfdcan, lane, frame, &view, &index);
+		if(key == CANBUS_RX_KEY_NONE)
+			break;
+		cnt++;
+#else
+		if(HAL_FDCAN_GetRxMessage(hfdcan, fifo, &pRxHeader, frame->dt) != HAL_OK)
+			break;
+		cnt++;
+		frame->id = pRxHeader.Identifier;
+		frame->timestamp = pRxHeader.RxTimestamp;
+		switch(pRxHeader.DataLength)
+		{
+		case FDCAN_DLC_BYTES_0:
+			frame->dlc = 0;
+			break;
+		case FDCAN_DLC_BYTES_1:
+			frame->dlc = 1;
+			break;
+		case FDCAN_DLC_BYTES_2:
+			frame->dlc = 2;
+			break;
+		case FDCAN_DLC_BYTES_3:
+			frame->dlc = 3;
+			break;
+		case FDCAN_DLC_BYTES_4:
+			frame->dlc = 4;
+			break;
+		case FDCAN_DLC_BYTES_5:
+			frame->dlc = 5;
+			break;
+		case FDCAN_DLC_BYTES_6:
+			frame->dlc = 6;
+			break;
+		case FDCAN_DLC_BYTES_7:
+			frame->dlc = 7;
+			break;
+		case FDCAN_DLC_BYTES_8:
+			frame->dlc = 8;
+			break;
+		case FDCAN_DLC_BYTES_12:
+			frame->dlc = 12;
+			break;
+		case FDCAN_DLC_BYTES_16:
+			frame->dlc = 16;
+			break;
+		case FDCAN_DLC_BYTES_20:
+			frame->dlc = 20;
+			break;
+		case FDCAN_DLC_BYTES_24:
+			frame->dlc = 24;
+			break;
+		case FDCAN_DLC_BYTES_32:
+			frame->dlc = 32;
+			break;
+		case FDCAN_DLC_BYTES_48:
+			frame->dlc = 48;
+			break;
+		case FDCAN_DLC_BYTES_64:
+			frame->dlc = 64;
+			break;
+		}
+
+		frame->id_type = pRxHeader.IdType == FDCAN_EXTENDED_ID ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
+		if(pRxHeader.FDFormat == FDCAN_FD_CAN)
+			frame->fr_format = pRxHeader.BitRateSwitch == FDCAN_BRS_ON ? CBUS_FR_FRM_FD_BRS : CBUS_FR_FRM_FD;
+		else
+			frame->fr_format = CBUS_FR_FRM_STD;
+
+		key = pRxHeader.IdType == FDCAN_EXTENDED_ID ? pRxHeader.Identifier | CANBUS_RX_KEY_EXT : pRxHeader.Identifier;
+		canbus_rx_view(&view, frame, (const volatile uint32_t*)(const void*)frame->dt);
+#endif
+
+		stats->rx_frames[lane]++;
+		if(canbus_rx_dispatch(current_canbus, frame, &view, key, 0, &called) != 0)
+		{
+			canbus_rx_payload(frame, &view);
+			queued += canbus_rx_publish(ring, frame);
+		}
+		else if(called == 0)
+			stats->rx_unmatched[lane]++;
+#if CANBUS_MSGRAM_DIRECT
+		canbus_rx_ack(hfdcan, lane, index);
+#endif
+	}
+
+	canbus_rcu_read_end(current_canbus, epoch);
+
+	if(queued != 0 || current_canbus->rx_backlog[lane] != 0)
+		canbus_rx_notify(current_canbus);
+	if(isr)
+		stats->isr_cycles[lane] += canbus_cycles() - start;
+}
+
+static uint32_t canbus_rx_its(canbus_t* canbus, uint32_t lane)
+{
+	if(lane != 0)
+		return FDCAN_IT_RX_FIFO1_NEW_MESSAGE;
+	if(canbus->rx_coalesce == NULL || canbus->rx_coalesce->watermark == 0)
+		return FDCAN_IT_RX_FIFO0_NEW_MESSAGE;
+	return canbus->rx_coalesce->timeout != 0 ? CANBUS_IT_RX_FIFO0_BATCH | FDCAN_IT_TIMEOUT_OCCURRED : CANBUS_IT_RX_FIFO0_BATCH;
+}
+
+/* Reads what an RX interrupt left over its budget, and with coalescing on
+   the frames waiting below the watermark. The lane's interrupt is off
+   meanwhile, so the FIFO has one reader. */
+static void canbus_rx_flush(canbus_t* canbus, uint32_t lane)
+{
+	uint32_t fifo = lane != 0 ? FDCAN_RX_FIFO1 : FDCAN_RX_FIFO0;
+	uint32_t its;
+
+	if(canbus->rx_backlog[lane] == 0)
+	{
+		if(lane != 0 || canbus->rx_coalesce == NULL || canbus->rx_coalesce->watermark == 0)
+			return;
+		if(HAL_FDCAN_GetRxFifoFillLevel(canbus->hcan, fifo) == 0)
+			return;
+	}
+	its = canbus_rx_its(canbus, lane);
+	(void)HAL_FDCAN_DeactivateNotification(canbus->hcan, its);
+	canbus->rx_backlog[lane] = 0;
+	canbus_rx_drain(canbus->hcan, fifo, 0);
+	(void)HAL_FDCAN_ActivateNotification(canbus->hcan, its, 0);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+
+i_status canbus_initialize(canbus_t* canbus)
+{
+	i_status status;
+	uint32_t lock;
+#if CANBUS_TDC
+	uint32_t tdc_offset;
+#endif
+	__disable_irq();
+	status = canbus_register(canbus);
+	if(status == I_FULL)
+	{
+		__enable_irq();
+		return I_FULL;
+	}
+
+	(void)HAL_FDCAN_DeactivateNotification(canbus->hcan, FDCAN_IT_RX_FIFO0_NEW_MESSAGE | CANBUS_IT_RX_FIFO0_BATCH | FDCAN_IT_TIMEOUT_OCCURRED);
+	(void)HAL_FDCAN_DeactivateNotification(canbus->hcan, FDCAN_IT_RX_FIFO1_NEW_MESSAGE);
+	(void)HAL_FDCAN_DeInit(canbus->hcan);
+	/* Once: a list handed over in `callbacks`, later changes publish themselves */
+	if(status == I_OK)
+		canbus_rx_index_build(canbus);
+
+	__enable_irq();
+#if !defined(CANBUS_CYCLES) && defined(DWT)
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+	canbus->mx_init();
+#ifdef CANBUS_IRQ_PRIORITY
+	/* MspInit set the priorities */
+	if(canbus_irq_check(canbus) != I_OK)
+		return I_INVALID;
+#endif
+
+	if(canbus->data_timing != NULL)
+	{
+		/* Still in init mode, run the HAL init again with the data phase switched on */
+		canbus->hcan->Init.FrameFormat = FDCAN_FRAME_FD_BRS;
+		canbus->hcan->Init.DataPrescaler = canbus->data_timing->prescaler;
+		canbus->hcan->Init.DataSyncJumpWidth = canbus->data_timing->sjw;
+		canbus->hcan->Init.DataTimeSeg1 = canbus->data_timing->seg1;
+		canbus->hcan->Init.DataTimeSeg2 = canbus->data_timing->seg2;
+		if (HAL_FDCAN_Init(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
+	}
+
+#if CANBUS_TDC
+	/* Fast data phases end before the transceiver loop delay does, the second
+	   sample point sits at the data sample point past the measured delay */
+	if(canbus->hcan->Init.FrameFormat == FDCAN_FRAME_FD_BRS && canbus->hcan->Init.DataPrescaler <= 2U)
+	{
+		tdc_offset = canbus->hcan->Init.DataPrescaler * canbus->hcan->Init.DataTimeSeg1;
+		if (HAL_FDCAN_ConfigTxDelayCompensation(canbus->hcan, tdc_offset > 127U ? 127U : tdc_offset, CANBUS_TDC_FILTER) != HAL_OK) goto canbus_initialize_error;
+		if (HAL_FDCAN_EnableTxDelayCompensation(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
+	}
+#endif
+
+	if(canbus->filters_cnt != 0)
+	{
+		for(int i=0;i<canbus->filters_cnt;i++)
+			if (HAL_FDCAN_ConfigFilter(canbus->hcan, &canbus->filters[i] ) != HAL_OK) goto canbus_initialize_error;
+	}
+
+#if CANBUS_FILTERS_AUTO
+	if(canbus->filters == NULL)
+	{
+		/* I_LOCKED: the writer holding the list refreshes them when done */
+		status = canbus_filters_update(canbus);
+		if (status != I_OK && status != I_LOCKED) goto canbus_initialize_error;
+	}
+#endif
+
+	if (HAL_FDCAN_ConfigGlobalFilter(canbus->hcan,FDCAN_REJECT,FDCAN_REJECT,FDCAN_REJECT_REMOTE,FDCAN_REJECT_REMOTE) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ConfigTimestampCounter(canbus->hcan, CANBUS_TIMESTAMP_PRESCALER) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_EnableTimestampCounter(canbus->hcan, FDCAN_TIMESTAMP_INTERNAL) != HAL_OK) goto canbus_initialize_error;
+	canbus->rx_backlog[0] = 0;
+	canbus->rx_backlog[1] = 0;
+	if(canbus->rx_coalesce != NULL && canbus->rx_coalesce->watermark != 0)
+	{
+#ifdef FDCAN_CFG_RX_FIFO0
+		if (HAL_FDCAN_ConfigFifoWatermark(canbus->hcan, FDCAN_CFG_RX_FIFO0, canbus->rx_coalesce->watermark) != HAL_OK) goto canbus_initialize_error;
+#endif
+		/* Counts timestamp ticks while FIFO0 holds frames, flushes a partial batch */
+		if(canbus->rx_coalesce->timeout != 0)
+		{
+			if (HAL_FDCAN_ConfigTimeoutCounter(canbus->hcan, FDCAN_TIMEOUT_RX_FIFO0, canbus->rx_coalesce->timeout) != HAL_OK) goto canbus_initialize_error;
+			if (HAL_FDCAN_EnableTimeoutCounter(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
+		}
+	}
+	if (HAL_FDCAN_Start(canbus->hcan) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ActivateNotification(canbus->hcan, canbus_rx_its(canbus, 0), 0) != HAL_OK) goto canbus_initialize_error;
+	/* FIFO1 on interrupt line 1 so it can sit at its own NVIC priority */
+	if (HAL_FDCAN_ConfigInterruptLines(canbus->hcan, CANBUS_IT_LINE_FIFO1, FDCAN_INTERRUPT_LINE1) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_RX_FIFO1_NEW_MESSAGE, 0) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_BUS_OFF, 0) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_TX_COMPLETE, CANBUS_TX_BUFFERS_ALL) != HAL_OK) goto canbus_initialize_error;
+	if (HAL_FDCAN_ActivateNotification(canbus->hcan, FDCAN_IT_TX_EVT_FIFO_NEW_DATA | FDCAN_IT_TX_EVT_FIFO_ELT_LOST, 0) != HAL_OK) goto canbus_initialize_error;
+
+	lock = canbus_lock();
+	canbus_tx_refill(canbus);
+	canbus_unlock(lock);
+
+	return I_OK;
+	canbus_initialize_error:
+		return I_ERROR;
+}
+
+i_status canbus_send_plain(canbus_t* canbus, uint16_t fr_format, uint32_t id_type, uint32_t id, uint8_t dlc, uint8_t* data)
+{
+	FDCAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+	canbus_tx_header(&header, fr_format, id_type, id, dlc);
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, data, dlc);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+i_status canbus_send(canbus_t* canbus,canbus_frame_t* frame)
+{
+	FDCAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+	canbus_tx_header(&header, frame->fr_format, frame->id_type, frame->id, frame->dlc);
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, frame->dt, frame->dlc);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+/* Same as canbus_send, a marker other than 0 also stores a TX event: tx_done
+   and tx_task hear about the frame once it is on the bus. */
+i_status canbus_send_marked(canbus_t* canbus, canbus_frame_t* frame, uint8_t marker)
+{
+	FDCAN_TxHeaderTypeDef header;
+	i_status result;
+	uint32_t lock;
+	canbus_tx_header(&header, frame->fr_format, frame->id_type, frame->id, frame->dlc);
+	if(marker != 0)
+	{
+		header.TxEventFifoControl = FDCAN_STORE_TX_EVENTS;
+		header.MessageMarker = marker;
+	}
+	lock = canbus_lock();
+	result = canbus_tx_enqueue(canbus, &header, frame->dt, frame->dlc);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+uint32_t canbus_send_burst(canbus_t* canbus, canbus_frame_t* frames, uint32_t cnt)
+{
+	FDCAN_TxHeaderTypeDef header;
+	uint32_t accepted = 0;
+	uint32_t lock = canbus_lock();
+
+	while(accepted < cnt)
+	{
+		canbus_tx_header(&header, frames[accepted].fr_format, frames[accepted].id_type, frames[accepted].id, frames[accepted].dlc);
+		if(canbus_tx_enqueue(canbus, &header, frames[accepted].dt, frames[accepted].dlc) != I_OK)
+			break;
+		accepted++;
+	}
+	canbus_unlock(lock);
+
+	return accepted;
+}
+
+i_status canbus_tx_template_init(canbus_tx_template_t* tpl, uint16_t fr_format, uint32_t id_type, uint32_t id, uint16_t dlc)
+{
+	if(dlc > 64)
+		return I_INVALID;
+
+	canbus_tx_header(&tpl->header, fr_format, id_type, id, dlc);
+
+	if(tpl->header.IdType == FDCAN_STANDARD_ID)
+		tpl->element[0] = tpl->header.ErrorStateIndicator | tpl->header.TxFrameType | FDCAN_STANDARD_ID | (id << 18U);
+	else
+		tpl->element[0] = tpl->header.ErrorStateIndicator | tpl->header.TxFrameType | FDCAN_EXTENDED_ID | id;
+	tpl->element[1] = (tpl->header.MessageMarker << 24U) | tpl->header.TxEventFifoControl | tpl->header.FDFormat | tpl->header.BitRateSwitch | tpl->header.DataLength;
+	tpl->dlc = dlc;
+	tpl->words = (canbus_dlc_bytes[(tpl->header.DataLength >> 16U) & 0xFU] + 3U) / 4U;
+
+	return I_OK;
+}
+
+i_status canbus_send_template(canbus_t* canbus, canbus_tx_template_t* tpl, uint8_t* data)
+{
+	i_status result = I_OK;
+	uint32_t lock = canbus_lock();
+
+	if(canbus->tx_queue.head == canbus->tx_queue.tail && canbus->hcan->State == HAL_FDCAN_STATE_BUSY && (canbus->hcan->Instance->TXFQS & FDCAN_TXFQS_TFQF) == 0)
+	{
+		canbus_tx_write_element(canbus, tpl->element[0], tpl->element[1], data, tpl->dlc, tpl->words);
+		canbus->stats.tx_frames++;
+	}
+	else
+		result = canbus_tx_enqueue(canbus, &tpl->header, data, tpl->dlc);
+	canbus_unlock(lock);
+
+	return result;
+}
+
+/* Compiles the registered callbacks into the fewest filter elements the
+   peripheral was set up with, merging masks when it has to. Runs in thread
+   context and holds the RCU writer until the filters are programmed, the
+   work list lives on the stack. */
+i_status canbus_filters_update(canbus_t* canbus)
+{
+	FDCAN_FilterTypeDef filter = {0};
+	canbus_filter_entry_t work[CANBUS_FILTERS_WORK];
+	canbus_filter_report_t* report = &canbus->filter_report;
+	canbus_filter_entry_t* pending[2][2] = {{NULL, NULL}, {NULL, NULL}};
+	canbus_filter_entry_t* entry;
+	uint32_t limit[2] = {canbus->hcan->Init.StdFiltersNbr, canbus->hcan->Init.ExtFiltersNbr};
+	uint32_t index[2] = {0, 0};
+	uint32_t cnt;
+	uint32_t prev;
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	cnt = canbus_filter_collect(canbus, work);
+
+	for(uint8_t ext=0;ext<2U;ext++)
+	{
+		while(canbus_filter_slots(work, cnt, ext) > limit[ext])
+		{
+			prev = cnt;
+			cnt = canbus_filter_reduce(work, cnt, ext);
+			if(cnt == prev)
+				goto canbus_filters_update_error;
+		}
+	}
+
+	report->accepted = 0;
+	for(uint32_t i=0;i<cnt;i++)
+	{
+		entry = &work[i];
+		report->accepted += canbus_filter_size(entry);
+		filter.IdType = entry->ext ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+		filter.FilterConfig = entry->fifo ? FDCAN_FILTER_TO_RXFIFO1 : FDCAN_FILTER_TO_RXFIFO0;
+
+		if(entry->mask == canbus_filter_full(entry->ext))
+		{
+			if(pending[entry->ext][entry->fifo] == NULL)
+			{
+				pending[entry->ext][entry->fifo] = entry;
+				continue;
+			}
+			filter.FilterType = FDCAN_FILTER_DUAL;
+			filter.FilterID1 = pending[entry->ext][entry->fifo]->id;
+			filter.FilterID2 = entry->id;
+			pending[entry->ext][entry->fifo] = NULL;
+		}
+		else
+		{
+			filter.FilterType = FDCAN_FILTER_MASK;
+			filter.FilterID1 = entry->id;
+			filter.FilterID2 = entry->mask;
+		}
+
+		filter.FilterIndex = index[entry->ext]++;
+		if(HAL_FDCAN_ConfigFilter(canbus->hcan, &filter) != HAL_OK) goto canbus_filters_update_error;
+	}
+
+	for(uint32_t k=0;k<4U;k++)
+	{
+		entry = pending[k >> 1][k & 1U];
+		if(entry == NULL)
+			continue;
+		filter.IdType = entry->ext ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+		filter.FilterConfig = entry->fifo ? FDCAN_FILTER_TO_RXFIFO1 : FDCAN_FILTER_TO_RXFIFO0;
+		filter.FilterType = FDCAN_FILTER_DUAL;
+		filter.FilterID1 = entry->id;
+		filter.FilterID2 = entry->id;
+		filter.FilterIndex = index[entry->ext]++;
+		if(HAL_FDCAN_ConfigFilter(canbus->hcan, &filter) != HAL_OK) goto canbus_filters_update_error;
+	}
+
+	report->std_cnt = (uint8_t)index[0];
+	report->ext_cnt = (uint8_t)index[1];
+	report->ratio = report->wanted == 0 ? 1000U : (uint32_t)((report->accepted * 1000U) / report->wanted);
+
+	filter.FilterConfig = FDCAN_FILTER_DISABLE;
+	filter.FilterType = FDCAN_FILTER_MASK;
+	filter.FilterID1 = 0;
+	filter.FilterID2 = 0;
+	for(uint8_t ext=0;ext<2U;ext++)
+	{
+		filter.IdType = ext ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+		for(filter.FilterIndex=index[ext];filter.FilterIndex<limit[ext];filter.FilterIndex++)
+			if(HAL_FDCAN_ConfigFilter(canbus->hcan, &filter) != HAL_OK) goto canbus_filters_update_error;
+	}
+
+	canbus_rcu_write_end(canbus);
+	return I_OK;
+	canbus_filters_update_error:
+		canbus_rcu_write_end(canbus);
+		return I_ERROR;
+}
+
+i_status canbus_callback_add(canbus_t* canbus,uint32_t id,uint32_t mask,uint32_t type, void(*cb)(canbus_frame_t*))
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, CBUS_CB_ISR);
+}
+
+i_status canbus_callback_add_deferred(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*))
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, CBUS_CB_DEFERRED);
+}
+
+i_status canbus_callback_add_ex(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags)
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, cb, NULL, NULL, flags);
+}
+
+/* `cb` gets a view on the payload instead of a copy: with
+   CANBUS_MSGRAM_DIRECT it reads the RX element in message RAM, and frames
+   only view callbacks want are never copied */
+i_status canbus_callback_add_view(canbus_t* canbus, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(const canbus_frame_view_t*), uint32_t flags)
+{
+	return canbus_callback_insert(canbus, NULL, id, mask, type, NULL, cb, NULL, flags);
+}
+
+/* Same as canbus_callback_add_ex on storage the caller owns, zeroed before
+   the first use. The node is the caller's again once canbus_callback_reclaim
+   gives I_OK after canbus_callback_remove. */
+i_status canbus_callback_register(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*), uint32_t flags)
+{
+	if(node == NULL)
+		return I_INVALID;
+	return canbus_callback_insert(canbus, node, id, mask, type, cb, NULL, NULL, flags);
+}
+
+/* canbus_callback_register for a handler that also gets its node, so it can
+   tell which of several nodes on the same function the frame came through */
+i_status canbus_callback_register_handler(canbus_t* canbus, canbus_callback_t* node, uint32_t id, uint32_t mask, uint32_t type, void(*handler)(canbus_callback_t*, canbus_frame_t*), uint32_t flags)
+{
+	if(node == NULL || handler == NULL)
+		return I_INVALID;
+	return canbus_callback_insert(canbus, node, id, mask, type, NULL, NULL, handler, flags);
+}
+
+/* Runs the deferred callbacks of the frames the RX ISR queued, after reading
+   the frames it left in the FIFOs. Call it from one task, the one `rx_task`
+   names when task notifications are used. */
+uint32_t canbus_process(canbus_t* canbus)
+{
+	canbus_rx_ring_t* ring;
+	canbus_frame_t* frame;
+	canbus_frame_view_t view;
+	uint32_t cnt = 0;
+	uint32_t called;
+	uint32_t epoch;
+
+	canbus_rx_flush(canbus, 1);
+	canbus_rx_flush(canbus, 0);
+	epoch = canbus_rcu_read_begin(canbus);
+
+	/* FIFO1 lane first */
+	for(uint32_t lane=0;lane<2U;lane++)
+	{
+		ring = &canbus->rx_ring[1U - lane];
+		while(ring->tail != ring->head)
+		{
+			__DMB();
+			frame = &ring->items[ring->tail & (CANBUS_RX_RING_SIZE - 1U)];
+			canbus_rx_view(&view, frame, (const volatile uint32_t*)(const void*)frame->dt);
+			(void)canbus_rx_dispatch(canbus, frame, &view, frame->id_type == CBUS_ID_T_EXTENDED ? frame->id | CANBUS_RX_KEY_EXT : frame->id, 1, &called);
+			__DMB();
+			ring->tail++;
+			cnt++;
+		}
+	}
+	canbus_rcu_read_end(canbus, epoch);
+	return cnt;
+}
+
+i_status canbus_callback_remove(canbus_t* canbus,canbus_callback_t* clb)
+{
+	if(clb == NULL)
+		return I_NOTEXISTS;
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+
+	if(clb->bus != canbus || clb->retired)
+	{
+		canbus_rcu_write_end(canbus);
+		return I_NOTEXISTS;
+	}
+
+	if(clb->prev != NULL)
+		clb->prev->next = clb->next;
+	else
+		canbus->callbacks = clb->next;
+	if(clb->next != NULL)
+		clb->next->prev = clb->prev;
+	canbus_rx_index_remove(clb);
+	canbus_rcu_retire(canbus, clb);
+	(void)canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
+	canbus_filters_refresh(canbus);
+	return I_OK;
+}
+
+i_status canbus_callback_exists(canbus_t* canbus,canbus_callback_t* clb)
+{
+	if(clb == NULL || clb->bus != canbus || clb->retired)
+		return I_NOTEXISTS;
+	return I_EXISTS;
+}
+
+/* Removed callbacks stay readable until every dispatch that could see them
+   has returned. I_WAIT while some still do; a node in caller storage can be
+   registered again once this gives I_OK. */
+i_status canbus_callback_reclaim(canbus_t* canbus)
+{
+	uint32_t waiting;
+
+	if(canbus_rcu_write_begin(canbus) != I_OK)
+		return I_LOCKED;
+	waiting = canbus_rcu_reclaim(canbus);
+	canbus_rcu_write_end(canbus);
+	return waiting != 0 ? I_WAIT : I_OK;
+}
+
+/* Call periodically from a task or the main loop. Once the backoff ran out
+   the controller only leaves init mode: filters, message RAM, notifications
+   and callbacks stay as they are, the protocol waits out 128 x 11 recessive
+   bits before the bus is back. */
+void canbus_recover_if_needs(canbus_t* canbus)
+{
+	canbus_recovery_t* recovery = &canbus->recovery;
+	FDCAN_ProtocolStatusTypeDef protocol;
+	uint32_t now;
+	uint32_t lock;
+
+	if(recovery->state == CBUS_RC_IDLE)
+		return;
+
+	now = HAL_GetTick();
+	lock = canbus_lock();
+	if(recovery->state == CBUS_RC_BACKOFF && now - recovery->since >= recovery->backoff)
+	{
+		recovery->state = CBUS_RC_RESTART;
+		CLEAR_BIT(canbus->hcan->Instance->CCCR, FDCAN_CCCR_INIT);
+	}
+	else if(recovery->state == CBUS_RC_RESTART
+		&& HAL_FDCAN_GetProtocolStatus(canbus->hcan, &protocol) == HAL_OK && protocol.BusOff == 0)
+	{
+		recovery->state = CBUS_RC_IDLE;
+		recovery->done = now;
+		canbus->stats.recovery_ticks[0] = now - recovery->since;
+		if(canbus->stats.recovery_ticks[0] > canbus->stats.recovery_ticks[1])
+			canbus->stats.recovery_ticks[1] = canbus->stats.recovery_ticks[0];
+		/* Frames queued in software while the bus was off */
+		canbus_tx_refill(canbus);
+	}
+	canbus_unlock(lock);
+}
+
+/* Copies the counters without masking interrupts: the copy is taken again
+   until the live counters still match it, they only ever count up. I_WAIT
+   when interrupts kept them moving for 4 rounds, `stats` holds the last copy. */
+i_status canbus_stats_snapshot(canbus_t* canbus, canbus_stats_t* stats)
+{
+	for(uint32_t i=0;i<4U;i++)
+	{
+		__DMB();
+		memcpy(stats, &canbus->stats, sizeof(canbus_stats_t));
+		__DMB();
+		if(memcmp(stats, &canbus->stats, sizeof(canbus_stats_t)) == 0)
+		{
+			stats->rx_orphaned = canbus_rx_orphaned;
+			return I_OK;
+		}
+	}
+	stats->rx_orphaned = canbus_rx_orphaned;
+	return I_WAIT;
+}
+
+/* Timestamp counter ticks from the capture of `frame` to now. Aliases once
+   the frame is older than one counter wrap (65536 ticks). */
+uint32_t canbus_rx_latency(canbus_t* canbus, const canbus_frame_t* frame)
+{
+	return (CANBUS_RX_TSC(canbus->hcan) - frame->timestamp) & FDCAN_TSCV_TSC;
+}
+
+void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+{
+	(void)RxFifo0ITs;
+	canbus_rx_drain(hfdcan, FDCAN_RX_FIFO0, 1);
+}
+
+void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo1ITs)
+{
+	(void)RxFifo1ITs;
+	canbus_rx_drain(hfdcan, FDCAN_RX_FIFO1, 1);
+}
+
+/* Coalescing: FIFO0 held frames below the watermark for the whole timeout */
+void HAL_FDCAN_TimeoutOccurredCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	canbus_rx_drain(hfdcan, FDCAN_RX_FIFO0, 1);
+}
+
+void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes)
+{
+	canbus_t* canbus = canbus_from_handle(hfdcan);
+	uint32_t start = canbus_cycles();
+
+	(void)BufferIndexes;
+	if(canbus != NULL)
+	{
+		canbus_tx_refill(canbus);
+		canbus->stats.isr_cycles[2] += canbus_cycles() - start;
+	}
+}
+
+void HAL_FDCAN_TxEventFifoCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t TxEventFifoITs)
+{
+	canbus_t* canbus = canbus_from_handle(hfdcan);
+	FDCAN_TxEventFifoTypeDef pTxEvent;
+	canbus_tx_event_t event;
+	uint32_t start = canbus_cycles();
+
+	if(canbus == NULL)
+	{
+		while(HAL_FDCAN_GetTxEvent(hfdcan, &pTxEvent) == HAL_OK);
+		return;
+	}
+
+	if((TxEventFifoITs & FDCAN_IT_TX_EVT_FIFO_ELT_LOST) != 0)
+		canbus->stats.tx_events_lost++;
+	while(HAL_FDCAN_GetTxEvent(hfdcan, &pTxEvent) == HAL_OK)
+	{
+		event.id = pTxEvent.Identifier;
+		event.id_type = pTxEvent.IdType == FDCAN_EXTENDED_ID ? CBUS_ID_T_EXTENDED : CBUS_ID_T_STANDARD;
+		event.timestamp = pTxEvent.TxTimestamp;
+		event.marker = (uint8_t)pTxEvent.MessageMarker;
+		canbus_tx_notify(canbus, &event);
+	}
+	canbus->stats.isr_cycles[2] += canbus_cycles() - start;
+}
+
+void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs)
+{
+	canbus_t* current_canbus = canbus_from_handle(hfdcan);
+	uint32_t start = canbus_cycles();
 
-	if(current_canbus != NULL)
+	if(current_canbus != NULL && (ErrorStatusITs & FDCAN_IT_BUS_OFF) != 0)
 	{
 		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_FLAG_BUS_OFF);
-		canbus_initialize(current_canbus);
+		canbus_bus_off(current_canbus);
+		current_canbus->stats.isr_cycles[2] += canbus_cycles() - start;
 	}
 }
 
@@ -0,0 +1,455 @@
+/*!
+	@file   _xcore.c
+	@brief  Frames and subscriptions shared between two cores
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifdef CANBUS_IRQ_PRIORITY
+#define CANBUS_XCORE_LOCK_LEVEL	((CANBUS_IRQ_PRIORITY) << (8U - __NVIC_PRIO_BITS))
+#endif
+
+#define CANBUS_XCORE_RING_MASK	(CANBUS_XCORE_RING_SIZE - 1U)
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "drv_canbus.h"
+
+#if defined(DRV_CANBUS_ENABLED) && CANBUS_XCORE
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* Channels of the interfaces this core drives, the forwarding callback
+   finds its own through the interface of its node */
+static canbus_xcore_t* canbus_xcore_owners = NULL;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static uint32_t canbus_xcore_lock(void);
+static void canbus_xcore_unlock(uint32_t state);
+static void canbus_xcore_copy(canbus_frame_t* dst, const canbus_frame_t* src);
+static i_status canbus_xcore_push(canbus_xcore_ring_t* ring, const canbus_frame_t* frame);
+static canbus_frame_t* canbus_xcore_peek(canbus_xcore_ring_t* ring);
+static void canbus_xcore_pop(canbus_xcore_ring_t* ring);
+static uint32_t canbus_xcore_matches(const canbus_xcore_sub_t* sub, const canbus_frame_t* frame);
+static uint32_t canbus_xcore_overlaps(canbus_xcore_t* xc, uint32_t slot);
+static int32_t canbus_xcore_find(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type);
+static void canbus_xcore_forward(canbus_callback_t* node, canbus_frame_t* frame);
+static void canbus_xcore_subs_update(canbus_xcore_t* xc);
+static uint32_t canbus_xcore_tx(canbus_xcore_t* xc);
+static uint32_t canbus_xcore_rx(canbus_xcore_t* xc);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+/* Only serialises the producers of one core, the other core never takes it */
+static uint32_t canbus_xcore_lock(void)
+{
+	uint32_t state = 0;
+#if !CANBUS_XCORE_LOCAL_LOCK
+#elif defined(CANBUS_XCORE_LOCK_LEVEL)
+	state = __get_BASEPRI();
+	__set_BASEPRI_MAX(CANBUS_XCORE_LOCK_LEVEL);
+#else
+	state = __get_PRIMASK();
+	__disable_irq();
+#endif
+	return state;
+}
+
+static void canbus_xcore_unlock(uint32_t state)
+{
+#if !CANBUS_XCORE_LOCAL_LOCK
+	(void)state;
+#elif defined(CANBUS_XCORE_LOCK_LEVEL)
+	__set_BASEPRI(state);
+#else
+	__set_PRIMASK(state);
+#endif
+}
+
+static void canbus_xcore_copy(canbus_frame_t* dst, const canbus_frame_t* src)
+{
+	dst->id = src->id;
+	dst->id_type = src->id_type;
+	dst->fr_format = src->fr_format;
+	dst->dlc = src->dlc <= sizeof(dst->dt) ? src->dlc : sizeof(dst->dt);
+	dst->timestamp = src->timestamp;
+	memcpy(dst->dt, src->dt, dst->dlc);
+}
+
+/* Producer side, called under canbus_xcore_lock */
+static i_status canbus_xcore_push(canbus_xcore_ring_t* ring, const canbus_frame_t* frame)
+{
+	uint32_t head = ring->head;
+
+	if((head - ring->tail) == CANBUS_XCORE_RING_SIZE)
+		return I_FULL;
+	canbus_xcore_copy(&ring->items[head & CANBUS_XCORE_RING_MASK], frame);
+	/* Frame in memory before the other core sees the index move */
+	__DMB();
+	ring->head = head + 1U;
+	return I_OK;
+}
+
+/* Consumer side: the frame stays in the ring, read in place, until
+   canbus_xcore_pop */
+static canbus_frame_t* canbus_xcore_peek(canbus_xcore_ring_t* ring)
+{
+	uint32_t tail = ring->tail;
+
+	if(tail == ring->head)
+		return NULL;
+	__DMB();
+	return &ring->items[tail & CANBUS_XCORE_RING_MASK];
+}
+
+static void canbus_xcore_pop(canbus_xcore_ring_t* ring)
+{
+	__DMB();
+	ring->tail = ring->tail + 1U;
+}
+
+/* Mask bits set are compared, 0 compares all of them like the driver */
+static uint32_t canbus_xcore_matches(const canbus_xcore_sub_t* sub, const canbus_frame_t* frame)
+{
+	uint32_t mask = sub->mask != 0 ? sub->mask : 0x1FFFFFFFU;
+
+	return sub->type == frame->id_type && ((sub->id ^ frame->id) & mask) == 0;
+}
+
+/* Frames of overlapping subscriptions would be forwarded once per match */
+static uint32_t canbus_xcore_overlaps(canbus_xcore_t* xc, uint32_t slot)
+{
+	const canbus_xcore_sub_t* sub = &xc->shm->subs[slot];
+	const canbus_xcore_sub_t* other;
+	uint32_t mask = sub->mask != 0 ? sub->mask : 0x1FFFFFFFU;
+	uint32_t state;
+
+	for(uint32_t i=0;i<CANBUS_XCORE_SUBS;i++)
+	{
+		other = &xc->shm->subs[i];
+		state = other->state;
+		if(i == slot || other->type != sub->type)
+			continue;
+		if(state != CBUS_XC_SUB_ACTIVE && state != CBUS_XC_SUB_REMOVE)
+			continue;
+		if(((other->id ^ sub->id) & mask & (other->mask != 0 ? other->mask : 0x1FFFFFFFU)) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int32_t canbus_xcore_find(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type)
+{
+	canbus_xcore_sub_t* sub;
+
+	for(uint32_t i=0;i<CANBUS_XCORE_SUBS;i++)
+	{
+		sub = &xc->shm->subs[i];
+		if(sub->state != CBUS_XC_SUB_FREE && sub->id == id && sub->mask == mask && sub->type == type)
+			return (int32_t)i;
+	}
+	return -1;
+}
+
+/* Owner RX callback of every active subscription. Both RX FIFO interrupts
+   may produce, the lock keeps them apart. */
+static void canbus_xcore_forward(canbus_callback_t* node, canbus_frame_t* frame)
+{
+	canbus_xcore_t* xc;
+	uint32_t lock;
+	i_status status;
+
+	for(xc = canbus_xcore_owners;xc != NULL;xc = xc->link)
+		if(xc->canbus == node->bus)
+			break;
+	if(xc == NULL)
+		return;
+	lock = canbus_xcore_lock();
+	status = canbus_xcore_push(&xc->shm->rx, frame);
+	if(status != I_OK)
+		xc->shm->rx.dropped++;
+	canbus_xcore_unlock(lock);
+	if(status == I_OK)
+		CANBUS_XCORE_RING(CANBUS_XCORE_SEM_REMOTE);
+}
+
+/* Owner side of the subscription handshake. A removed node is only reused
+   once the driver reclaimed it. */
+static void canbus_xcore_subs_update(canbus_xcore_t* xc)
+{
+	canbus_xcore_sub_t* sub;
+	i_status status;
+
+	for(uint32_t i=0;i<CANBUS_XCORE_SUBS;i++)
+	{
+		sub = &xc->shm->subs[i];
+		if(sub->state == CBUS_XC_SUB_ADD)
+		{
+			__DMB();
+			if(canbus_xcore_overlaps(xc, i))
+				status = I_EXISTS;
+			else
+				status = canbus_callback_register_handler(xc->canbus, &xc->nodes[i], sub->id, sub->mask, sub->type, canbus_xcore_forward, CBUS_CB_ISR);
+			if(status == I_LOCKED || status == I_WAIT)
+				continue;
+			sub->state = status == I_OK ? CBUS_XC_SUB_ACTIVE : CBUS_XC_SUB_REJECTED;
+		}
+		else if(sub->state == CBUS_XC_SUB_REMOVE && !xc->retiring[i])
+		{
+			if(canbus_callback_remove(xc->canbus, &xc->nodes[i]) == I_LOCKED)
+				continue;
+			xc->retiring[i] = 1;
+		}
+
+		if(xc->retiring[i] && canbus_callback_reclaim(xc->canbus) == I_OK)
+		{
+			xc->retiring[i] = 0;
+			memset(&xc->nodes[i], 0, sizeof(canbus_callback_t));
+			__DMB();
+			sub->state = CBUS_XC_SUB_FREE;
+		}
+	}
+}
+
+/* Owner: frames the other core queued, left in the ring while the TX queue
+   is full */
+static uint32_t canbus_xcore_tx(canbus_xcore_t* xc)
+{
+	canbus_frame_t* frame;
+	uint32_t cnt = 0;
+
+	while((frame = canbus_xcore_peek(&xc->shm->tx)) != NULL)
+	{
+		if(canbus_send(xc->canbus, frame) == I_FULL)
+			break;
+		canbus_xcore_pop(&xc->shm->tx);
+		cnt++;
+	}
+	return cnt;
+}
+
+/* Other core: forwarded frames to the callback of the subscription they
+   match, straight out of shared memory */
+static uint32_t canbus_xcore_rx(canbus_xcore_t* xc)
+{
+	canbus_frame_t* frame;
+	uint32_t cnt = 0;
+
+	while((frame = canbus_xcore_peek(&xc->shm->rx)) != NULL)
+	{
+		for(uint32_t i=0;i<CANBUS_XCORE_SUBS;i++)
+		{
+			if(xc->shm->subs[i].state != CBUS_XC_SUB_ACTIVE || !canbus_xcore_matches(&xc->shm->subs[i], frame))
+				continue;
+			if(xc->callbacks[i] != NULL)
+				xc->callbacks[i](frame);
+			break;
+		}
+		canbus_xcore_pop(&xc->shm->rx);
+		cnt++;
+	}
+	return cnt;
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+/* `shm` and, on the core driving the interface, `canbus` filled in. The owner
+   sets the shared memory up and has to run first; the other core gets I_WAIT
+   until it did. One channel per interface, each with its own `shm`; the
+   channels of a core share its doorbell. Thread context, before the RX
+   interrupts can reach the channel. */
+i_status canbus_xcore_init(canbus_xcore_t* xc)
+{
+	canbus_xcore_t* it;
+
+	if(xc == NULL || xc->shm == NULL)
+		return I_INVALID;
+
+	if(xc->canbus == NULL)
+	{
+		if(xc->shm->ready != CANBUS_XCORE_READY)
+			return I_WAIT;
+		memset(xc->callbacks, 0, sizeof(xc->callbacks));
+		CANBUS_XCORE_ARM(CANBUS_XCORE_SEM_REMOTE);
+		return I_OK;
+	}
+
+	for(it = canbus_xcore_owners;it != NULL;it = it->link)
+		if(it == xc || it->canbus == xc->canbus || it->shm == xc->shm)
+			return I_EXISTS;
+	memset((void*)xc->shm, 0, sizeof(canbus_xcore_shared_t));
+	memset(xc->nodes, 0, sizeof(xc->nodes));
+	memset(xc->retiring, 0, sizeof(xc->retiring));
+	xc->link = canbus_xcore_owners;
+	__DMB();
+	canbus_xcore_owners = xc;
+	__DMB();
+	xc->shm->ready = CANBUS_XCORE_READY;
+	CANBUS_XCORE_ARM(CANBUS_XCORE_SEM_OWNER);
+	return I_OK;
+}
+
+/* From HAL_HSEM_FreeCallback on either core. Arms the notification the HAL
+   interrupt handler turned off again and wakes `task`. Returns 1 when the
+   semaphore was the channel's. */
+uint32_t canbus_xcore_doorbell(canbus_xcore_t* xc, uint32_t sem_mask)
+{
+	uint32_t sem = xc->canbus != NULL ? CANBUS_XCORE_SEM_OWNER : CANBUS_XCORE_SEM_REMOTE;
+#if __has_include("task.h")
+	BaseType_t woken = pdFALSE;
+#endif
+
+	if((sem_mask & (1UL << sem)) == 0)
+		return 0;
+	CANBUS_XCORE_ARM(sem);
+#if __has_include("task.h")
+	if(xc->task != NULL)
+	{
+		vTaskNotifyGiveFromISR(xc->task, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+#endif
+	return 1;
+}
+
+/* Owner: takes in subscription changes and sends what the other core
+   queued. Other core: runs the callbacks of the forwarded frames. Call it
+   from one task per core, after the doorbell. Returns the frames moved. */
+uint32_t canbus_xcore_process(canbus_xcore_t* xc)
+{
+	if(xc->canbus == NULL)
+		return canbus_xcore_rx(xc);
+	canbus_xcore_subs_update(xc);
+	return canbus_xcore_tx(xc);
+}
+
+/* Other core: queues the frame for the owner, I_FULL when the ring is */
+i_status canbus_xcore_send(canbus_xcore_t* xc, const canbus_frame_t* frame)
+{
+	uint32_t lock;
+	i_status status;
+
+	if(xc->canbus != NULL)
+		return canbus_send(xc->canbus, (canbus_frame_t*)frame);
+	lock = canbus_xcore_lock();
+	status = canbus_xcore_push(&xc->shm->tx, frame);
+	canbus_xcore_unlock(lock);
+	if(status == I_OK)
+		CANBUS_XCORE_RING(CANBUS_XCORE_SEM_OWNER);
+	return status;
+}
+
+/* Other core: asks the owner for the frames matching id/mask, `type` a
+   `cbus_id_type`. I_OK once asked, canbus_xcore_callback_status tells when
+   the owner took it. */
+i_status canbus_xcore_callback_add(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*))
+{
+	canbus_xcore_sub_t* sub;
+
+	if(xc->canbus != NULL || cb == NULL)
+		return I_INVALID;
+	if(canbus_xcore_find(xc, id, mask, type) >= 0)
+		return I_EXISTS;
+
+	for(uint32_t i=0;i<CANBUS_XCORE_SUBS;i++)
+	{
+		sub = &xc->shm->subs[i];
+		if(sub->state != CBUS_XC_SUB_FREE)
+			continue;
+		sub->id = id;
+		sub->mask = mask;
+		sub->type = type;
+		xc->callbacks[i] = cb;
+		__DMB();
+		sub->state = CBUS_XC_SUB_ADD;
+		CANBUS_XCORE_RING(CANBUS_XCORE_SEM_OWNER);
+		return I_OK;
+	}
+	return I_FULL;
+}
+
+/* Other core: rejected subscriptions are freed right away, active ones once
+   the owner dropped its node. I_WAIT while an add is still pending. */
+i_status canbus_xcore_callback_remove(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type)
+{
+	int32_t slot = canbus_xcore_find(xc, id, mask, type);
+	canbus_xcore_sub_t* sub;
+
+	if(xc->canbus != NULL)
+		return I_INVALID;
+	if(slot < 0)
+		return I_NOTEXISTS;
+	sub = &xc->shm->subs[slot];
+	switch(sub->state)
+	{
+	case CBUS_XC_SUB_REJECTED:
+		xc->callbacks[slot] = NULL;
+		sub->state = CBUS_XC_SUB_FREE;
+		return I_OK;
+	case CBUS_XC_SUB_ACTIVE:
+		sub->state = CBUS_XC_SUB_REMOVE;
+		CANBUS_XCORE_RING(CANBUS_XCORE_SEM_OWNER);
+		return I_OK;
+	case CBUS_XC_SUB_REMOVE:
+		return I_OK;
+	default:
+		return I_WAIT;
+	}
+}
+
+/* I_OK active, I_WAIT pending, I_EXISTS rejected by the owner (overlapping
+   another one or no node left), I_NOTEXISTS unknown */
+i_status canbus_xcore_callback_status(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type)
+{
+	int32_t slot = canbus_xcore_find(xc, id, mask, type);
+
+	if(slot < 0)
+		return I_NOTEXISTS;
+	switch(xc->shm->subs[slot].state)
+	{
+	case CBUS_XC_SUB_ACTIVE:
+		return I_OK;
+	case CBUS_XC_SUB_REJECTED:
+		return I_EXISTS;
+	default:
+		return I_WAIT;
+	}
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,152 @@
+/*!
+	@file   _xcore.h
+	@brief  Frames and subscriptions shared between two cores
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2019 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef DRV_CANBUS_XCORE_H_
+#define DRV_CANBUS_XCORE_H_
+
+#ifndef CANBUS_XCORE
+#define CANBUS_XCORE	0	/* 1: cross-core channel, STM32H7 dual-core */
+#endif
+
+#ifndef CANBUS_XCORE_RING_SIZE
+#define CANBUS_XCORE_RING_SIZE	16U	/* Frames per direction, power of 2 */
+#endif
+
+#ifndef CANBUS_XCORE_SUBS
+#define CANBUS_XCORE_SUBS	16U	/* Subscriptions the other core may hold */
+#endif
+
+#ifndef CANBUS_XCORE_SEM_OWNER
+#define CANBUS_XCORE_SEM_OWNER	30U	/* HSEM rung towards the core driving the interface */
+#endif
+
+#ifndef CANBUS_XCORE_SEM_REMOTE
+#define CANBUS_XCORE_SEM_REMOTE	31U	/* HSEM rung towards the other core */
+#endif
+
+#ifndef CANBUS_XCORE_LOCAL_LOCK
+#define CANBUS_XCORE_LOCAL_LOCK	1	/* Producers of one core exclude each other by masking the CAN interrupts */
+#endif
+
+/* Taking and freeing a semaphore raises the free interrupt on the core that
+   armed its notification */
+#ifndef CANBUS_XCORE_RING
+#define CANBUS_XCORE_RING(sem)	do{ if(HAL_HSEM_FastTake(sem) == HAL_OK) HAL_HSEM_Release((sem), 0U); }while(0)
+#endif
+
+#ifndef CANBUS_XCORE_ARM
+#define CANBUS_XCORE_ARM(sem)	HAL_HSEM_ActivateNotification(1UL << (sem))
+#endif
+
+#define CANBUS_XCORE_READY	0x43424358U
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#if defined(DRV_CANBUS_ENABLED) && CANBUS_XCORE
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* --- Cross-core Subscription States -------------------------------------- */
+
+typedef enum
+{
+	CBUS_XC_SUB_FREE     = 0x00U,
+	CBUS_XC_SUB_ADD      = 0x01U,	/* Written by the other core, waits for the owner */
+	CBUS_XC_SUB_ACTIVE   = 0x02U,	/* Owner forwards the matching frames */
+	CBUS_XC_SUB_REMOVE   = 0x03U,	/* Written by the other core, waits for the owner */
+	CBUS_XC_SUB_REJECTED = 0x04U	/* Overlaps an active one or no node left, slot free again */
+}cbus_xc_sub;
+
+/* --- Cross-core Shared Memory -------------------------------------------- */
+
+/* One producer and one consumer core, each index written by one side only */
+typedef struct
+{
+	volatile uint32_t head;		/* Written by the producer */
+	volatile uint32_t tail;		/* Written by the consumer */
+	volatile uint32_t dropped;	/* Frames the producer found no room for */
+	canbus_frame_t items[CANBUS_XCORE_RING_SIZE];
+}canbus_xcore_ring_t;
+
+typedef struct
+{
+	uint32_t id;
+	uint32_t mask;
+	uint32_t type;
+	volatile uint32_t state;	/* `cbus_xc_sub`, each transition written by one side */
+}canbus_xcore_sub_t;
+
+/* Same address on both cores, non-cacheable on the M7 (MPU) */
+typedef struct
+{
+	volatile uint32_t ready;	/* CANBUS_XCORE_READY once the owner set it up */
+	canbus_xcore_ring_t rx;		/* Owner -> other core: frames of its subscriptions */
+	canbus_xcore_ring_t tx;		/* Other core -> owner: frames to send */
+	canbus_xcore_sub_t subs[CANBUS_XCORE_SUBS];
+}canbus_xcore_shared_t;
+
+/* --- Cross-core Channel -------------------------------------------------- */
+
+/* One per core, in its own RAM */
+typedef struct canbus_xcore canbus_xcore_t;
+
+struct canbus_xcore
+{
+	canbus_xcore_shared_t* shm;
+	canbus_t* canbus;		/* Owner: the interface it drives, NULL on the other core */
+	void (*callbacks[CANBUS_XCORE_SUBS])(canbus_frame_t*);	/* Other core: per subscription slot */
+	canbus_callback_t nodes[CANBUS_XCORE_SUBS];	/* Owner: forwarding node per slot */
+	uint8_t retiring[CANBUS_XCORE_SUBS];	/* Owner: node removed, waiting for the reclaim */
+	struct canbus_xcore* link;	/* Owner: next channel of this core, owned by the driver */
+#if __has_include("task.h")
+	TaskHandle_t task;		/* Notified by canbus_xcore_doorbell, may be NULL */
+#endif
+};
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+i_status canbus_xcore_init(canbus_xcore_t* xc);
+uint32_t canbus_xcore_doorbell(canbus_xcore_t* xc, uint32_t sem_mask);
+uint32_t canbus_xcore_process(canbus_xcore_t* xc);
+i_status canbus_xcore_send(canbus_xcore_t* xc, const canbus_frame_t* frame);
+i_status canbus_xcore_callback_add(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type, void(*cb)(canbus_frame_t*));
+i_status canbus_xcore_callback_remove(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type);
+i_status canbus_xcore_callback_status(canbus_xcore_t* xc, uint32_t id, uint32_t mask, uint32_t type);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
+#endif
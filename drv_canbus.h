@@ -44,4 +44,8 @@
 	#error "Missing proper configuration of drv_canbus_config.h. The library is disabled"
 #endif
 
+#include "driver/_isotp.h"
+#include "driver/_xcore.h"
+#include "driver/_cyclic.h"
+
 #endif
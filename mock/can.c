@@ -0,0 +1,84 @@
+/*!
+	@file   can.c
+	@brief  Host stand-in for the CubeMX generated can.c
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "can.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+CAN_HandleTypeDef hcan1;
+CAN_HandleTypeDef hcan2;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void mx_can_init(CAN_HandleTypeDef *hcan, CAN_TypeDef *instance);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+/* 500 kbit/s @ 32 MHz APB1 */
+static void mx_can_init(CAN_HandleTypeDef *hcan, CAN_TypeDef *instance)
+{
+	hcan->Instance = instance;
+	hcan->Init.Prescaler = 4;
+	hcan->Init.Mode = CAN_MODE_NORMAL;
+	hcan->Init.SyncJumpWidth = CAN_SJW_1TQ;
+	hcan->Init.TimeSeg1 = CAN_BS1_13TQ;
+	hcan->Init.TimeSeg2 = CAN_BS2_2TQ;
+	hcan->Init.TimeTriggeredMode = DISABLE;
+	hcan->Init.AutoBusOff = DISABLE;
+	hcan->Init.AutoWakeUp = DISABLE;
+	hcan->Init.AutoRetransmission = ENABLE;
+	hcan->Init.ReceiveFifoLocked = DISABLE;
+	hcan->Init.TransmitFifoPriority = DISABLE;
+	(void)HAL_CAN_Init(hcan);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+void MX_CAN1_Init(void)
+{
+	mx_can_init(&hcan1, CAN1);
+}
+
+void MX_CAN2_Init(void)
+{
+	mx_can_init(&hcan2, CAN2);
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
@@ -0,0 +1,43 @@
+/*!
+	@file   drv_canbus_config.h
+	@brief  Driver configuration used by the host builds
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#if !defined(CANBUS_HAL_CAN) && !defined(CANBUS_HAL_FDCAN)
+#define CANBUS_HAL_FDCAN
+#endif
+
+#define CANBUS_FILTERS_AUTO	1
+#define CANBUS_CALLBACK_POOL_SIZE	256
+#define CANBUS_IRQ_PRIORITY	5	/* MOCK_IRQ_PRIORITY */
+#define CANBUS_CYCLES()	mock_cycles()
+#define CANBUS_PROFILE	1
+#define CANBUS_RECOVERY_BACKOFF_MIN	1U	/* HAL ticks are host milliseconds, keep the storm bench short */
+#define CANBUS_RECOVERY_BACKOFF_MAX	8U
+#define CANBUS_XCORE	1
+#define CANBUS_CYCLIC_TICK_CYCLES	100000U	/* mock_cycles() are ns, bench_cyclic ticks every 100 us */
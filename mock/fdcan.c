@@ -0,0 +1,90 @@
+/*!
+	@file   fdcan.c
+	@brief  Host stand-in for the CubeMX generated fdcan.c
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "fdcan.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+FDCAN_HandleTypeDef hfdcan1;
+FDCAN_HandleTypeDef hfdcan2;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void mx_fdcan_init(FDCAN_HandleTypeDef *hfdcan, FDCAN_GlobalTypeDef *instance);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+/* 500 kbit/s nominal, 2 Mbit/s data @ 160 MHz kernel clock */
+static void mx_fdcan_init(FDCAN_HandleTypeDef *hfdcan, FDCAN_GlobalTypeDef *instance)
+{
+	hfdcan->Instance = instance;
+	hfdcan->Init.ClockDivider = FDCAN_CLOCK_DIV1;
+	hfdcan->Init.FrameFormat = FDCAN_FRAME_FD_NO_BRS;
+	hfdcan->Init.Mode = FDCAN_MODE_NORMAL;
+	hfdcan->Init.AutoRetransmission = ENABLE;
+	hfdcan->Init.TransmitPause = DISABLE;
+	hfdcan->Init.ProtocolException = DISABLE;
+	hfdcan->Init.NominalPrescaler = 2;
+	hfdcan->Init.NominalSyncJumpWidth = 32;
+	hfdcan->Init.NominalTimeSeg1 = 127;
+	hfdcan->Init.NominalTimeSeg2 = 32;
+	hfdcan->Init.DataPrescaler = 2;
+	hfdcan->Init.DataSyncJumpWidth = 8;
+	hfdcan->Init.DataTimeSeg1 = 31;
+	hfdcan->Init.DataTimeSeg2 = 8;
+	hfdcan->Init.StdFiltersNbr = 28;
+	hfdcan->Init.ExtFiltersNbr = 8;
+	hfdcan->Init.TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
+	(void)HAL_FDCAN_Init(hfdcan);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+void MX_FDCAN1_Init(void)
+{
+	mx_fdcan_init(&hfdcan1, FDCAN1);
+}
+
+void MX_FDCAN2_Init(void)
+{
+	mx_fdcan_init(&hfdcan2, FDCAN2);
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
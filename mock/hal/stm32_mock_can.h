@@ -0,0 +1,415 @@
+/*!
+	@file   stm32_mock_can.h
+	@brief  Host-side emulation of the STM32 bxCAN peripheral & HAL driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Federico Carnevale, Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+
+	The emulated peripheral follows the dual bxCAN of the F4/F7 families:
+	3 TX mailboxes, two 3-deep RX FIFOs per controller and 28 filter banks
+	shared between CAN1 (master) and CAN2 (slave).
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef STM32_MOCK_CAN_H_
+#define STM32_MOCK_CAN_H_
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "stm32_mock_hal.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* --- Peripheral registers ------------------------------------------------ */
+
+typedef struct
+{
+	__IO uint32_t TIR;
+	__IO uint32_t TDTR;
+	__IO uint32_t TDLR;
+	__IO uint32_t TDHR;
+}CAN_TxMailBox_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t RIR;
+	__IO uint32_t RDTR;
+	__IO uint32_t RDLR;
+	__IO uint32_t RDHR;
+}CAN_FIFOMailBox_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t FR1;
+	__IO uint32_t FR2;
+}CAN_FilterRegister_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t MCR;
+	__IO uint32_t MSR;
+	__IO uint32_t TSR;
+	__IO uint32_t RF0R;
+	__IO uint32_t RF1R;
+	__IO uint32_t IER;
+	__IO uint32_t ESR;
+	__IO uint32_t BTR;
+	uint32_t RESERVED0[88];
+	CAN_TxMailBox_TypeDef sTxMailBox[3];
+	CAN_FIFOMailBox_TypeDef sFIFOMailBox[2];
+	uint32_t RESERVED1[12];
+	__IO uint32_t FMR;
+	__IO uint32_t FM1R;
+	uint32_t RESERVED2;
+	__IO uint32_t FS1R;
+	uint32_t RESERVED3;
+	__IO uint32_t FFA1R;
+	uint32_t RESERVED4;
+	__IO uint32_t FA1R;
+	uint32_t RESERVED5[8];
+	CAN_FilterRegister_TypeDef sFilterRegister[28];
+}CAN_TypeDef;
+
+#define STM32F4				/* Family the emulated bxCAN follows */
+
+#define MOCK_CAN_INSTANCES		2U
+#define MOCK_CAN_FILTER_BANKS		28U
+#define MOCK_CAN_RX_FIFO_DEPTH		3U
+
+extern CAN_TypeDef mock_can_regs[MOCK_CAN_INSTANCES];
+
+#define CAN1				(&mock_can_regs[0])
+#define CAN2				(&mock_can_regs[1])
+
+#define CAN_MCR_INRQ			(0x1UL << 0)
+#define CAN_MCR_SLEEP			(0x1UL << 1)
+#define CAN_MCR_TXFP			(0x1UL << 2)
+#define CAN_MCR_RFLM			(0x1UL << 3)
+#define CAN_MCR_NART			(0x1UL << 4)
+#define CAN_MCR_AWUM			(0x1UL << 5)
+#define CAN_MCR_ABOM			(0x1UL << 6)
+#define CAN_MCR_TTCM			(0x1UL << 7)
+#define CAN_MCR_RESET			(0x1UL << 15)
+
+#define CAN_MSR_INAK			(0x1UL << 0)
+#define CAN_MSR_SLAK			(0x1UL << 1)
+#define CAN_MSR_ERRI			(0x1UL << 2)
+
+#define CAN_TSR_RQCP0			(0x1UL << 0)
+#define CAN_TSR_TXOK0			(0x1UL << 1)
+#define CAN_TSR_ALST0			(0x1UL << 2)
+#define CAN_TSR_TERR0			(0x1UL << 3)
+#define CAN_TSR_ABRQ0			(0x1UL << 7)
+#define CAN_TSR_RQCP1			(0x1UL << 8)
+#define CAN_TSR_TXOK1			(0x1UL << 9)
+#define CAN_TSR_ALST1			(0x1UL << 10)
+#define CAN_TSR_TERR1			(0x1UL << 11)
+#define CAN_TSR_ABRQ1			(0x1UL << 15)
+#define CAN_TSR_RQCP2			(0x1UL << 16)
+#define CAN_TSR_TXOK2			(0x1UL << 17)
+#define CAN_TSR_ALST2			(0x1UL << 18)
+#define CAN_TSR_TERR2			(0x1UL << 19)
+#define CAN_TSR_ABRQ2			(0x1UL << 23)
+#define CAN_TSR_CODE_Pos		(24U)
+#define CAN_TSR_CODE			(0x3UL << CAN_TSR_CODE_Pos)
+#define CAN_TSR_TME_Pos			(26U)
+#define CAN_TSR_TME0			(0x1UL << 26)
+#define CAN_TSR_TME1			(0x1UL << 27)
+#define CAN_TSR_TME2			(0x1UL << 28)
+#define CAN_TSR_TME			(0x7UL << CAN_TSR_TME_Pos)
+
+#define CAN_RF0R_FMP0			(0x3UL << 0)
+#define CAN_RF0R_FULL0			(0x1UL << 3)
+#define CAN_RF0R_FOVR0			(0x1UL << 4)
+#define CAN_RF0R_RFOM0			(0x1UL << 5)
+#define CAN_RF1R_FMP1			(0x3UL << 0)
+#define CAN_RF1R_FULL1			(0x1UL << 3)
+#define CAN_RF1R_FOVR1			(0x1UL << 4)
+#define CAN_RF1R_RFOM1			(0x1UL << 5)
+
+#define CAN_IER_TMEIE			(0x1UL << 0)
+#define CAN_IER_FMPIE0			(0x1UL << 1)
+#define CAN_IER_FFIE0			(0x1UL << 2)
+#define CAN_IER_FOVIE0			(0x1UL << 3)
+#define CAN_IER_FMPIE1			(0x1UL << 4)
+#define CAN_IER_FFIE1			(0x1UL << 5)
+#define CAN_IER_FOVIE1			(0x1UL << 6)
+#define CAN_IER_EWGIE			(0x1UL << 8)
+#define CAN_IER_EPVIE			(0x1UL << 9)
+#define CAN_IER_BOFIE			(0x1UL << 10)
+#define CAN_IER_LECIE			(0x1UL << 11)
+#define CAN_IER_ERRIE			(0x1UL << 15)
+#define CAN_IER_WKUIE			(0x1UL << 16)
+#define CAN_IER_SLKIE			(0x1UL << 17)
+
+#define CAN_ESR_EWGF			(0x1UL << 0)
+#define CAN_ESR_EPVF			(0x1UL << 1)
+#define CAN_ESR_BOFF			(0x1UL << 2)
+#define CAN_ESR_LEC			(0x7UL << 4)
+#define CAN_ESR_TEC_Pos			(16U)
+#define CAN_ESR_TEC			(0xFFUL << CAN_ESR_TEC_Pos)
+#define CAN_ESR_REC_Pos			(24U)
+#define CAN_ESR_REC			(0xFFUL << CAN_ESR_REC_Pos)
+
+#define CAN_TI0R_TXRQ			(0x1UL << 0)
+#define CAN_TI0R_RTR			(0x1UL << 1)
+#define CAN_TI0R_IDE			(0x1UL << 2)
+#define CAN_TI0R_EXID_Pos		(3U)
+#define CAN_TI0R_STID_Pos		(21U)
+#define CAN_TDT0R_DLC			(0xFUL << 0)
+#define CAN_TDT0R_TGT			(0x1UL << 8)
+#define CAN_TDT0R_TIME_Pos		(16U)
+
+#define CAN_RI0R_RTR			(0x1UL << 1)
+#define CAN_RI0R_IDE			(0x1UL << 2)
+#define CAN_RI0R_EXID_Pos		(3U)
+#define CAN_RI0R_EXID			(0x3FFFFUL << CAN_RI0R_EXID_Pos)
+#define CAN_RI0R_STID_Pos		(21U)
+#define CAN_RI0R_STID			(0x7FFUL << CAN_RI0R_STID_Pos)
+#define CAN_RDT0R_DLC			(0xFUL << 0)
+#define CAN_RDT0R_FMI_Pos		(8U)
+#define CAN_RDT0R_FMI			(0xFFUL << CAN_RDT0R_FMI_Pos)
+#define CAN_RDT0R_TIME_Pos		(16U)
+#define CAN_RDT0R_TIME			(0xFFFFUL << CAN_RDT0R_TIME_Pos)
+
+#define CAN_FMR_FINIT			(0x1UL << 0)
+#define CAN_FMR_CAN2SB_Pos		(8U)
+#define CAN_FMR_CAN2SB			(0x3FUL << CAN_FMR_CAN2SB_Pos)
+
+/* --- HAL definitions ----------------------------------------------------- */
+
+typedef enum
+{
+	HAL_CAN_STATE_RESET             = 0x00U,
+	HAL_CAN_STATE_READY             = 0x01U,
+	HAL_CAN_STATE_LISTENING         = 0x02U,
+	HAL_CAN_STATE_SLEEP_PENDING     = 0x03U,
+	HAL_CAN_STATE_SLEEP_ACTIVE      = 0x04U,
+	HAL_CAN_STATE_ERROR             = 0x05U
+}HAL_CAN_StateTypeDef;
+
+typedef struct
+{
+	uint32_t Prescaler;
+	uint32_t Mode;
+	uint32_t SyncJumpWidth;
+	uint32_t TimeSeg1;
+	uint32_t TimeSeg2;
+	FunctionalState TimeTriggeredMode;
+	FunctionalState AutoBusOff;
+	FunctionalState AutoWakeUp;
+	FunctionalState AutoRetransmission;
+	FunctionalState ReceiveFifoLocked;
+	FunctionalState TransmitFifoPriority;
+}CAN_InitTypeDef;
+
+typedef struct
+{
+	uint32_t FilterIdHigh;
+	uint32_t FilterIdLow;
+	uint32_t FilterMaskIdHigh;
+	uint32_t FilterMaskIdLow;
+	uint32_t FilterFIFOAssignment;
+	uint32_t FilterBank;
+	uint32_t FilterMode;
+	uint32_t FilterScale;
+	uint32_t FilterActivation;
+	uint32_t SlaveStartFilterBank;
+}CAN_FilterTypeDef;
+
+typedef struct
+{
+	uint32_t StdId;
+	uint32_t ExtId;
+	uint32_t IDE;
+	uint32_t RTR;
+	uint32_t DLC;
+	FunctionalState TransmitGlobalTime;
+}CAN_TxHeaderTypeDef;
+
+typedef struct
+{
+	uint32_t StdId;
+	uint32_t ExtId;
+	uint32_t IDE;
+	uint32_t RTR;
+	uint32_t DLC;
+	uint32_t Timestamp;
+	uint32_t FilterMatchIndex;
+}CAN_RxHeaderTypeDef;
+
+typedef struct __CAN_HandleTypeDef
+{
+	CAN_TypeDef *Instance;
+	CAN_InitTypeDef Init;
+	__IO HAL_CAN_StateTypeDef State;
+	__IO uint32_t ErrorCode;
+}CAN_HandleTypeDef;
+
+#define HAL_CAN_ERROR_NONE		(0x00000000U)
+#define HAL_CAN_ERROR_EWG		(0x00000001U)
+#define HAL_CAN_ERROR_EPV		(0x00000002U)
+#define HAL_CAN_ERROR_BOF		(0x00000004U)
+#define HAL_CAN_ERROR_STF		(0x00000008U)
+#define HAL_CAN_ERROR_FOR		(0x00000010U)
+#define HAL_CAN_ERROR_ACK		(0x00000020U)
+#define HAL_CAN_ERROR_BR		(0x00000040U)
+#define HAL_CAN_ERROR_BD		(0x00000080U)
+#define HAL_CAN_ERROR_CRC		(0x00000100U)
+#define HAL_CAN_ERROR_RX_FOV0		(0x00000200U)
+#define HAL_CAN_ERROR_RX_FOV1		(0x00000400U)
+#define HAL_CAN_ERROR_TX_ALST0		(0x00000800U)
+#define HAL_CAN_ERROR_TX_TERR0		(0x00001000U)
+#define HAL_CAN_ERROR_TX_ALST1		(0x00002000U)
+#define HAL_CAN_ERROR_TX_TERR1		(0x00004000U)
+#define HAL_CAN_ERROR_TX_ALST2		(0x00008000U)
+#define HAL_CAN_ERROR_TX_TERR2		(0x00010000U)
+#define HAL_CAN_ERROR_TIMEOUT		(0x00020000U)
+#define HAL_CAN_ERROR_NOT_INITIALIZED	(0x00040000U)
+#define HAL_CAN_ERROR_NOT_READY		(0x00080000U)
+#define HAL_CAN_ERROR_NOT_STARTED	(0x00100000U)
+#define HAL_CAN_ERROR_PARAM		(0x00200000U)
+
+#define CAN_MODE_NORMAL			(0x00000000U)
+#define CAN_MODE_LOOPBACK		(0x40000000U)
+#define CAN_MODE_SILENT			(0x80000000U)
+#define CAN_MODE_SILENT_LOOPBACK	(0xC0000000U)
+
+#define CAN_SJW_1TQ			(0x00000000U)
+#define CAN_BS1_13TQ			(0x000C0000U)
+#define CAN_BS2_2TQ			(0x00100000U)
+
+#define CAN_ID_STD			(0x00000000U)
+#define CAN_ID_EXT			(0x00000004U)
+
+#define CAN_RTR_DATA			(0x00000000U)
+#define CAN_RTR_REMOTE			(0x00000002U)
+
+#define CAN_RX_FIFO0			(0x00000000U)
+#define CAN_RX_FIFO1			(0x00000001U)
+
+#define CAN_TX_MAILBOX0			(0x00000001U)
+#define CAN_TX_MAILBOX1			(0x00000002U)
+#define CAN_TX_MAILBOX2			(0x00000004U)
+
+#define CAN_FILTERMODE_IDMASK		(0x00000000U)
+#define CAN_FILTERMODE_IDLIST		(0x00000001U)
+#define CAN_FILTERSCALE_16BIT		(0x00000000U)
+#define CAN_FILTERSCALE_32BIT		(0x00000001U)
+#define CAN_FILTER_DISABLE		(0x00000000U)
+#define CAN_FILTER_ENABLE		(0x00000001U)
+#define CAN_FILTER_FIFO0		(0x00000000U)
+#define CAN_FILTER_FIFO1		(0x00000001U)
+
+#define CAN_IT_TX_MAILBOX_EMPTY		CAN_IER_TMEIE
+#define CAN_IT_RX_FIFO0_MSG_PENDING	CAN_IER_FMPIE0
+#define CAN_IT_RX_FIFO0_FULL		CAN_IER_FFIE0
+#define CAN_IT_RX_FIFO0_OVERRUN		CAN_IER_FOVIE0
+#define CAN_IT_RX_FIFO1_MSG_PENDING	CAN_IER_FMPIE1
+#define CAN_IT_RX_FIFO1_FULL		CAN_IER_FFIE1
+#define CAN_IT_RX_FIFO1_OVERRUN		CAN_IER_FOVIE1
+#define CAN_IT_WAKEUP			CAN_IER_WKUIE
+#define CAN_IT_SLEEP_ACK		CAN_IER_SLKIE
+#define CAN_IT_ERROR_WARNING		CAN_IER_EWGIE
+#define CAN_IT_ERROR_PASSIVE		CAN_IER_EPVIE
+#define CAN_IT_BUSOFF			CAN_IER_BOFIE
+#define CAN_IT_LAST_ERROR_CODE		CAN_IER_LECIE
+#define CAN_IT_ERROR			CAN_IER_ERRIE
+
+#define CAN_FLAG_FF0			(0x00000203U)
+#define CAN_FLAG_FOV0			(0x00000204U)
+#define CAN_FLAG_FF1			(0x00000403U)
+#define CAN_FLAG_FOV1			(0x00000404U)
+
+#define __HAL_CAN_ENABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->IER |= (__INTERRUPT__))
+#define __HAL_CAN_DISABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->IER &= ~(__INTERRUPT__))
+#define __HAL_CAN_GET_FLAG(__HANDLE__, __FLAG__)	mock_can_get_flag((__HANDLE__), (__FLAG__))
+#define __HAL_CAN_CLEAR_FLAG(__HANDLE__, __FLAG__)	mock_can_clear_flag((__HANDLE__), (__FLAG__))
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_DeInit(CAN_HandleTypeDef *hcan);
+void HAL_CAN_MspInit(CAN_HandleTypeDef *hcan);
+void HAL_CAN_MspDeInit(CAN_HandleTypeDef *hcan);
+
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, CAN_FilterTypeDef *sFilterConfig);
+
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_Stop(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, CAN_TxHeaderTypeDef *pHeader, uint8_t aData[], uint32_t *pTxMailbox);
+HAL_StatusTypeDef HAL_CAN_AbortTxRequest(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes);
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(CAN_HandleTypeDef *hcan);
+uint32_t HAL_CAN_IsTxMessagePending(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes);
+uint32_t HAL_CAN_GetTxTimestamp(CAN_HandleTypeDef *hcan, uint32_t TxMailbox);
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader, uint8_t aData[]);
+uint32_t HAL_CAN_GetRxFifoFillLevel(CAN_HandleTypeDef *hcan, uint32_t RxFifo);
+
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t ActiveITs);
+HAL_StatusTypeDef HAL_CAN_DeactivateNotification(CAN_HandleTypeDef *hcan, uint32_t InactiveITs);
+void HAL_CAN_IRQHandler(CAN_HandleTypeDef *hcan);
+
+void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan);
+
+HAL_CAN_StateTypeDef HAL_CAN_GetState(CAN_HandleTypeDef *hcan);
+uint32_t HAL_CAN_GetError(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan);
+
+/* --- Mock extensions ------------------------------------------------------
+   Same bus model as the FDCAN emulation: every started controller receives
+   the frames of the others, `mock_can_inject` plays an external node and
+   `mock_can_bus_run` arbitrates pending mailboxes when auto transmission is
+   disabled. */
+
+typedef void (*mock_can_bus_hook_t)(CAN_TypeDef *src, const CAN_TxMailBox_TypeDef *mailbox);
+
+void mock_can_reset(void);
+void mock_can_set_auto_transmit(uint32_t enable);
+uint32_t mock_can_bus_run(uint32_t frames);
+void mock_can_bus_hook(mock_can_bus_hook_t hook);
+void mock_can_inject(CAN_TxHeaderTypeDef *pHeader, const uint8_t aData[]);
+void mock_can_inject_bus_off(CAN_HandleTypeDef *hcan);
+uint64_t mock_can_bus_frames(void);
+uint32_t mock_can_get_flag(CAN_HandleTypeDef *hcan, uint32_t flag);
+void mock_can_clear_flag(CAN_HandleTypeDef *hcan, uint32_t flag);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
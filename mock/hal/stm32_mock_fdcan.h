@@ -0,0 +1,645 @@
+/*!
+	@file   stm32_mock_fdcan.h
+	@brief  Host-side emulation of the STM32 FDCAN peripheral & HAL driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+
+	The emulated peripheral follows the G4/L5/U5 FDCAN flavour: fixed message
+	RAM with 28 standard & 8 extended filters, 3-element RX FIFO0/1, 3-element
+	TX event FIFO and 3 TX buffers. Register, element & HAL constant layouts
+	match the STM32Cube headers so that the driver builds unmodified.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef STM32_MOCK_FDCAN_H_
+#define STM32_MOCK_FDCAN_H_
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "stm32_mock_hal.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* --- Peripheral registers ------------------------------------------------ */
+
+typedef struct
+{
+	__IO uint32_t CREL;
+	__IO uint32_t ENDN;
+	uint32_t RESERVED1;
+	__IO uint32_t DBTP;
+	__IO uint32_t TEST;
+	__IO uint32_t RWD;
+	__IO uint32_t CCCR;
+	__IO uint32_t NBTP;
+	__IO uint32_t TSCC;
+	__IO uint32_t TSCV;
+	__IO uint32_t TOCC;
+	__IO uint32_t TOCV;
+	uint32_t RESERVED2[4];
+	__IO uint32_t ECR;
+	__IO uint32_t PSR;
+	__IO uint32_t TDCR;
+	uint32_t RESERVED3;
+	__IO uint32_t IR;
+	__IO uint32_t IE;
+	__IO uint32_t ILS;
+	__IO uint32_t ILE;
+	uint32_t RESERVED4[8];
+	__IO uint32_t RXGFC;
+	__IO uint32_t XIDAM;
+	__IO uint32_t HPMS;
+	uint32_t RESERVED5;
+	__IO uint32_t RXF0S;
+	__IO uint32_t RXF0A;
+	__IO uint32_t RXF1S;
+	__IO uint32_t RXF1A;
+	uint32_t RESERVED6[8];
+	__IO uint32_t TXBC;
+	__IO uint32_t TXFQS;
+	__IO uint32_t TXBRP;
+	__IO uint32_t TXBAR;
+	__IO uint32_t TXBCR;
+	__IO uint32_t TXBTO;
+	__IO uint32_t TXBCF;
+	__IO uint32_t TXBTIE;
+	__IO uint32_t TXBCIE;
+	__IO uint32_t TXEFS;
+	__IO uint32_t TXEFA;
+}FDCAN_GlobalTypeDef;
+
+#define STM32G4				/* Family the emulated FDCAN follows */
+
+#define MOCK_FDCAN_INSTANCES		3U
+
+extern FDCAN_GlobalTypeDef mock_fdcan_regs[MOCK_FDCAN_INSTANCES];
+
+#define FDCAN1				(&mock_fdcan_regs[0])
+#define FDCAN2				(&mock_fdcan_regs[1])
+#define FDCAN3				(&mock_fdcan_regs[2])
+
+#define FDCAN_CCCR_INIT			(0x1UL << 0)
+#define FDCAN_CCCR_CCE			(0x1UL << 1)
+#define FDCAN_CCCR_ASM			(0x1UL << 2)
+#define FDCAN_CCCR_MON			(0x1UL << 5)
+#define FDCAN_CCCR_DAR			(0x1UL << 6)
+#define FDCAN_CCCR_TEST			(0x1UL << 7)
+#define FDCAN_CCCR_FDOE			(0x1UL << 8)
+#define FDCAN_CCCR_BRSE			(0x1UL << 9)
+#define FDCAN_CCCR_TXP			(0x1UL << 14)
+
+#define FDCAN_TEST_LBCK			(0x1UL << 4)
+
+#define FDCAN_NBTP_NTSEG2_Pos		(0U)
+#define FDCAN_NBTP_NTSEG1_Pos		(8U)
+#define FDCAN_NBTP_NBRP_Pos		(16U)
+#define FDCAN_NBTP_NSJW_Pos		(25U)
+#define FDCAN_DBTP_DSJW_Pos		(0U)
+#define FDCAN_DBTP_DTSEG2_Pos		(4U)
+#define FDCAN_DBTP_DTSEG1_Pos		(8U)
+#define FDCAN_DBTP_DBRP_Pos		(16U)
+#define FDCAN_DBTP_TDC			(0x1UL << 23)
+
+#define FDCAN_TSCC_TSS_Pos		(0U)
+#define FDCAN_TSCC_TSS			(0x3UL << FDCAN_TSCC_TSS_Pos)
+#define FDCAN_TSCC_TCP_Pos		(16U)
+#define FDCAN_TSCC_TCP			(0xFUL << FDCAN_TSCC_TCP_Pos)
+#define FDCAN_TSCV_TSC			(0xFFFFUL)
+
+#define FDCAN_TOCC_ETOC			(0x1UL << 0)
+#define FDCAN_TOCC_TOS_Pos		(1U)
+#define FDCAN_TOCC_TOS			(0x3UL << FDCAN_TOCC_TOS_Pos)
+#define FDCAN_TOCC_TOP_Pos		(16U)
+#define FDCAN_TOCC_TOP			(0xFFFFUL << FDCAN_TOCC_TOP_Pos)
+#define FDCAN_TOCV_TOC			(0xFFFFUL)
+
+#define FDCAN_ECR_TEC			(0xFFUL << 0)
+#define FDCAN_ECR_REC_Pos		(8U)
+#define FDCAN_ECR_REC			(0x7FUL << FDCAN_ECR_REC_Pos)
+
+#define FDCAN_PSR_LEC			(0x7UL << 0)
+#define FDCAN_PSR_ACT			(0x3UL << 3)
+#define FDCAN_PSR_EP			(0x1UL << 5)
+#define FDCAN_PSR_EW			(0x1UL << 6)
+#define FDCAN_PSR_BO			(0x1UL << 7)
+#define FDCAN_PSR_TDCV_Pos		(16U)
+
+#define FDCAN_TDCR_TDCF_Pos		(0U)
+#define FDCAN_TDCR_TDCO_Pos		(8U)
+
+#define FDCAN_IR_RF0N			(0x1UL << 0)
+#define FDCAN_IR_RF0F			(0x1UL << 1)
+#define FDCAN_IR_RF0L			(0x1UL << 2)
+#define FDCAN_IR_RF1N			(0x1UL << 3)
+#define FDCAN_IR_RF1F			(0x1UL << 4)
+#define FDCAN_IR_RF1L			(0x1UL << 5)
+#define FDCAN_IR_HPM			(0x1UL << 6)
+#define FDCAN_IR_TC			(0x1UL << 7)
+#define FDCAN_IR_TCF			(0x1UL << 8)
+#define FDCAN_IR_TFE			(0x1UL << 9)
+#define FDCAN_IR_TEFN			(0x1UL << 10)
+#define FDCAN_IR_TEFF			(0x1UL << 11)
+#define FDCAN_IR_TEFL			(0x1UL << 12)
+#define FDCAN_IR_TSW			(0x1UL << 13)
+#define FDCAN_IR_MRAF			(0x1UL << 14)
+#define FDCAN_IR_TOO			(0x1UL << 15)
+#define FDCAN_IR_ELO			(0x1UL << 16)
+#define FDCAN_IR_EP			(0x1UL << 17)
+#define FDCAN_IR_EW			(0x1UL << 18)
+#define FDCAN_IR_BO			(0x1UL << 19)
+#define FDCAN_IR_WDI			(0x1UL << 20)
+#define FDCAN_IR_PEA			(0x1UL << 21)
+#define FDCAN_IR_PED			(0x1UL << 22)
+#define FDCAN_IR_ARA			(0x1UL << 23)
+
+#define FDCAN_ILS_RXFIFO0		(0x1UL << 0)
+#define FDCAN_ILS_RXFIFO1		(0x1UL << 1)
+#define FDCAN_ILS_SMSG			(0x1UL << 2)
+#define FDCAN_ILS_TFERR			(0x1UL << 3)
+#define FDCAN_ILS_MISC			(0x1UL << 4)
+#define FDCAN_ILS_BERR			(0x1UL << 5)
+#define FDCAN_ILS_PERR			(0x1UL << 6)
+#define FDCAN_ILE_EINT0			(0x1UL << 0)
+#define FDCAN_ILE_EINT1			(0x1UL << 1)
+
+#define FDCAN_RXGFC_RRFE		(0x1UL << 0)
+#define FDCAN_RXGFC_RRFS		(0x1UL << 1)
+#define FDCAN_RXGFC_ANFE_Pos		(2U)
+#define FDCAN_RXGFC_ANFE		(0x3UL << FDCAN_RXGFC_ANFE_Pos)
+#define FDCAN_RXGFC_ANFS_Pos		(4U)
+#define FDCAN_RXGFC_ANFS		(0x3UL << FDCAN_RXGFC_ANFS_Pos)
+#define FDCAN_RXGFC_F1OM		(0x1UL << 8)
+#define FDCAN_RXGFC_F0OM		(0x1UL << 9)
+#define FDCAN_RXGFC_LSS_Pos		(16U)
+#define FDCAN_RXGFC_LSS			(0x1FUL << FDCAN_RXGFC_LSS_Pos)
+#define FDCAN_RXGFC_LSE_Pos		(24U)
+#define FDCAN_RXGFC_LSE			(0xFUL << FDCAN_RXGFC_LSE_Pos)
+
+#define FDCAN_RXF0S_F0FL_Pos		(0U)
+#define FDCAN_RXF0S_F0FL		(0xFUL << FDCAN_RXF0S_F0FL_Pos)
+#define FDCAN_RXF0S_F0GI_Pos		(8U)
+#define FDCAN_RXF0S_F0GI		(0x3UL << FDCAN_RXF0S_F0GI_Pos)
+#define FDCAN_RXF0S_F0PI_Pos		(16U)
+#define FDCAN_RXF0S_F0PI		(0x3UL << FDCAN_RXF0S_F0PI_Pos)
+#define FDCAN_RXF0S_F0F			(0x1UL << 24)
+#define FDCAN_RXF0S_RF0L		(0x1UL << 25)
+#define FDCAN_RXF0A_F0AI		(0x7UL << 0)
+
+#define FDCAN_RXF1S_F1FL_Pos		(0U)
+#define FDCAN_RXF1S_F1FL		(0xFUL << FDCAN_RXF1S_F1FL_Pos)
+#define FDCAN_RXF1S_F1GI_Pos		(8U)
+#define FDCAN_RXF1S_F1GI		(0x3UL << FDCAN_RXF1S_F1GI_Pos)
+#define FDCAN_RXF1S_F1PI_Pos		(16U)
+#define FDCAN_RXF1S_F1PI		(0x3UL << FDCAN_RXF1S_F1PI_Pos)
+#define FDCAN_RXF1S_F1F			(0x1UL << 24)
+#define FDCAN_RXF1S_RF1L		(0x1UL << 25)
+#define FDCAN_RXF1A_F1AI		(0x7UL << 0)
+
+#define FDCAN_TXBC_TFQM			(0x1UL << 24)
+
+#define FDCAN_TXFQS_TFFL_Pos		(0U)
+#define FDCAN_TXFQS_TFFL		(0x7UL << FDCAN_TXFQS_TFFL_Pos)
+#define FDCAN_TXFQS_TFGI_Pos		(8U)
+#define FDCAN_TXFQS_TFGI		(0x3UL << FDCAN_TXFQS_TFGI_Pos)
+#define FDCAN_TXFQS_TFQPI_Pos		(16U)
+#define FDCAN_TXFQS_TFQPI		(0x3UL << FDCAN_TXFQS_TFQPI_Pos)
+#define FDCAN_TXFQS_TFQF		(0x1UL << 21)
+
+#define FDCAN_TXEFS_EFFL_Pos		(0U)
+#define FDCAN_TXEFS_EFFL		(0x7UL << FDCAN_TXEFS_EFFL_Pos)
+#define FDCAN_TXEFS_EFGI_Pos		(8U)
+#define FDCAN_TXEFS_EFGI		(0x3UL << FDCAN_TXEFS_EFGI_Pos)
+#define FDCAN_TXEFS_EFPI_Pos		(16U)
+#define FDCAN_TXEFS_EFPI		(0x3UL << FDCAN_TXEFS_EFPI_Pos)
+#define FDCAN_TXEFS_EFF			(0x1UL << 24)
+#define FDCAN_TXEFS_TEFL		(0x1UL << 25)
+#define FDCAN_TXEFA_EFAI		(0x3UL << 0)
+
+/* --- Message RAM (words, per instance) ----------------------------------- */
+
+#define SRAMCAN_FLS_NBR			(28U)
+#define SRAMCAN_FLE_NBR			(8U)
+#define SRAMCAN_RF0_NBR			(3U)
+#define SRAMCAN_RF1_NBR			(3U)
+#define SRAMCAN_TEF_NBR			(3U)
+#define SRAMCAN_TFQ_NBR			(3U)
+
+#define SRAMCAN_FLS_SIZE		(1U)
+#define SRAMCAN_FLE_SIZE		(2U)
+#define SRAMCAN_RF0_SIZE		(18U)
+#define SRAMCAN_RF1_SIZE		(18U)
+#define SRAMCAN_TEF_SIZE		(2U)
+#define SRAMCAN_TFQ_SIZE		(18U)
+
+#define SRAMCAN_FLSSA			(0U)
+#define SRAMCAN_FLESA			(SRAMCAN_FLSSA + (SRAMCAN_FLS_NBR * SRAMCAN_FLS_SIZE))
+#define SRAMCAN_RF0SA			(SRAMCAN_FLESA + (SRAMCAN_FLE_NBR * SRAMCAN_FLE_SIZE))
+#define SRAMCAN_RF1SA			(SRAMCAN_RF0SA + (SRAMCAN_RF0_NBR * SRAMCAN_RF0_SIZE))
+#define SRAMCAN_TEFSA			(SRAMCAN_RF1SA + (SRAMCAN_RF1_NBR * SRAMCAN_RF1_SIZE))
+#define SRAMCAN_TFQSA			(SRAMCAN_TEFSA + (SRAMCAN_TEF_NBR * SRAMCAN_TEF_SIZE))
+#define SRAMCAN_SIZE			(SRAMCAN_TFQSA + (SRAMCAN_TFQ_NBR * SRAMCAN_TFQ_SIZE))
+
+extern uint32_t mock_fdcan_sram[MOCK_FDCAN_INSTANCES][SRAMCAN_SIZE];
+
+/* --- HAL definitions ----------------------------------------------------- */
+
+typedef enum
+{
+	HAL_FDCAN_STATE_RESET      = 0x00U,
+	HAL_FDCAN_STATE_READY      = 0x01U,
+	HAL_FDCAN_STATE_BUSY       = 0x02U,
+	HAL_FDCAN_STATE_ERROR      = 0x03U
+}HAL_FDCAN_StateTypeDef;
+
+typedef struct
+{
+	uint32_t ClockDivider;
+	uint32_t FrameFormat;
+	uint32_t Mode;
+	FunctionalState AutoRetransmission;
+	FunctionalState TransmitPause;
+	FunctionalState ProtocolException;
+	uint32_t NominalPrescaler;
+	uint32_t NominalSyncJumpWidth;
+	uint32_t NominalTimeSeg1;
+	uint32_t NominalTimeSeg2;
+	uint32_t DataPrescaler;
+	uint32_t DataSyncJumpWidth;
+	uint32_t DataTimeSeg1;
+	uint32_t DataTimeSeg2;
+	uint32_t StdFiltersNbr;
+	uint32_t ExtFiltersNbr;
+	uint32_t TxFifoQueueMode;
+}FDCAN_InitTypeDef;
+
+typedef struct
+{
+	uint32_t IdType;
+	uint32_t FilterIndex;
+	uint32_t FilterType;
+	uint32_t FilterConfig;
+	uint32_t FilterID1;
+	uint32_t FilterID2;
+}FDCAN_FilterTypeDef;
+
+typedef struct
+{
+	uint32_t Identifier;
+	uint32_t IdType;
+	uint32_t TxFrameType;
+	uint32_t DataLength;
+	uint32_t ErrorStateIndicator;
+	uint32_t BitRateSwitch;
+	uint32_t FDFormat;
+	uint32_t TxEventFifoControl;
+	uint32_t MessageMarker;
+}FDCAN_TxHeaderTypeDef;
+
+typedef struct
+{
+	uint32_t Identifier;
+	uint32_t IdType;
+	uint32_t RxFrameType;
+	uint32_t DataLength;
+	uint32_t ErrorStateIndicator;
+	uint32_t BitRateSwitch;
+	uint32_t FDFormat;
+	uint32_t RxTimestamp;
+	uint32_t FilterIndex;
+	uint32_t IsFilterMatchingFrame;
+}FDCAN_RxHeaderTypeDef;
+
+typedef struct
+{
+	uint32_t Identifier;
+	uint32_t IdType;
+	uint32_t TxFrameType;
+	uint32_t DataLength;
+	uint32_t ErrorStateIndicator;
+	uint32_t BitRateSwitch;
+	uint32_t FDFormat;
+	uint32_t TxTimestamp;
+	uint32_t MessageMarker;
+	uint32_t EventType;
+}FDCAN_TxEventFifoTypeDef;
+
+typedef struct
+{
+	uint32_t LastErrorCode;
+	uint32_t DataLastErrorCode;
+	uint32_t Activity;
+	uint32_t ErrorPassive;
+	uint32_t Warning;
+	uint32_t BusOff;
+	uint32_t RxESIflag;
+	uint32_t RxBRSflag;
+	uint32_t RxFDFflag;
+	uint32_t ProtocolException;
+	uint32_t TDCvalue;
+}FDCAN_ProtocolStatusTypeDef;
+
+typedef struct
+{
+	uint32_t TxErrorCnt;
+	uint32_t RxErrorCnt;
+	uint32_t RxErrorPassive;
+	uint32_t ErrorLogging;
+}FDCAN_ErrorCountersTypeDef;
+
+/* Addresses are kept pointer wide so the host build can hold them */
+typedef struct
+{
+	uintptr_t StandardFilterSA;
+	uintptr_t ExtendedFilterSA;
+	uintptr_t RxFIFO0SA;
+	uintptr_t RxFIFO1SA;
+	uintptr_t TxEventFIFOSA;
+	uintptr_t TxFIFOQSA;
+}FDCAN_MsgRamAddressTypeDef;
+
+typedef struct __FDCAN_HandleTypeDef
+{
+	FDCAN_GlobalTypeDef *Instance;
+	FDCAN_InitTypeDef Init;
+	FDCAN_MsgRamAddressTypeDef msgRam;
+	uint32_t LatestTxFifoQRequest;
+	__IO HAL_FDCAN_StateTypeDef State;
+	HAL_LockTypeDef Lock;
+	__IO uint32_t ErrorCode;
+}FDCAN_HandleTypeDef;
+
+#define HAL_FDCAN_ERROR_NONE			(0x00000000U)
+#define HAL_FDCAN_ERROR_TIMEOUT			(0x00000001U)
+#define HAL_FDCAN_ERROR_NOT_INITIALIZED		(0x00000002U)
+#define HAL_FDCAN_ERROR_NOT_READY		(0x00000004U)
+#define HAL_FDCAN_ERROR_NOT_STARTED		(0x00000008U)
+#define HAL_FDCAN_ERROR_NOT_SUPPORTED		(0x00000010U)
+#define HAL_FDCAN_ERROR_PARAM			(0x00000020U)
+#define HAL_FDCAN_ERROR_PENDING			(0x00000040U)
+#define HAL_FDCAN_ERROR_RAM_ACCESS		(0x00000080U)
+#define HAL_FDCAN_ERROR_FIFO_EMPTY		(0x00000100U)
+#define HAL_FDCAN_ERROR_FIFO_FULL		(0x00000200U)
+
+#define FDCAN_FRAME_CLASSIC			((uint32_t)0x00000000U)
+#define FDCAN_FRAME_FD_NO_BRS			((uint32_t)FDCAN_CCCR_FDOE)
+#define FDCAN_FRAME_FD_BRS			((uint32_t)(FDCAN_CCCR_FDOE | FDCAN_CCCR_BRSE))
+
+#define FDCAN_MODE_NORMAL			((uint32_t)0x00000000U)
+#define FDCAN_MODE_RESTRICTED_OPERATION		((uint32_t)0x00000001U)
+#define FDCAN_MODE_BUS_MONITORING		((uint32_t)0x00000002U)
+#define FDCAN_MODE_INTERNAL_LOOPBACK		((uint32_t)0x00000003U)
+#define FDCAN_MODE_EXTERNAL_LOOPBACK		((uint32_t)0x00000004U)
+
+#define FDCAN_CLOCK_DIV1			((uint32_t)0x00000000U)
+
+#define FDCAN_TX_FIFO_OPERATION			((uint32_t)0x00000000U)
+#define FDCAN_TX_QUEUE_OPERATION		((uint32_t)FDCAN_TXBC_TFQM)
+
+#define FDCAN_STANDARD_ID			((uint32_t)0x00000000U)
+#define FDCAN_EXTENDED_ID			((uint32_t)0x40000000U)
+
+#define FDCAN_DATA_FRAME			((uint32_t)0x00000000U)
+#define FDCAN_REMOTE_FRAME			((uint32_t)0x20000000U)
+
+#define FDCAN_DLC_BYTES_0			((uint32_t)0x00000000U)
+#define FDCAN_DLC_BYTES_1			((uint32_t)0x00010000U)
+#define FDCAN_DLC_BYTES_2			((uint32_t)0x00020000U)
+#define FDCAN_DLC_BYTES_3			((uint32_t)0x00030000U)
+#define FDCAN_DLC_BYTES_4			((uint32_t)0x00040000U)
+#define FDCAN_DLC_BYTES_5			((uint32_t)0x00050000U)
+#define FDCAN_DLC_BYTES_6			((uint32_t)0x00060000U)
+#define FDCAN_DLC_BYTES_7			((uint32_t)0x00070000U)
+#define FDCAN_DLC_BYTES_8			((uint32_t)0x00080000U)
+#define FDCAN_DLC_BYTES_12			((uint32_t)0x00090000U)
+#define FDCAN_DLC_BYTES_16			((uint32_t)0x000A0000U)
+#define FDCAN_DLC_BYTES_20			((uint32_t)0x000B0000U)
+#define FDCAN_DLC_BYTES_24			((uint32_t)0x000C0000U)
+#define FDCAN_DLC_BYTES_32			((uint32_t)0x000D0000U)
+#define FDCAN_DLC_BYTES_48			((uint32_t)0x000E0000U)
+#define FDCAN_DLC_BYTES_64			((uint32_t)0x000F0000U)
+
+#define FDCAN_ESI_ACTIVE			((uint32_t)0x00000000U)
+#define FDCAN_ESI_PASSIVE			((uint32_t)0x80000000U)
+
+#define FDCAN_BRS_OFF				((uint32_t)0x00000000U)
+#define FDCAN_BRS_ON				((uint32_t)0x00100000U)
+
+#define FDCAN_CLASSIC_CAN			((uint32_t)0x00000000U)
+#define FDCAN_FD_CAN				((uint32_t)0x00200000U)
+
+#define FDCAN_NO_TX_EVENTS			((uint32_t)0x00000000U)
+#define FDCAN_STORE_TX_EVENTS			((uint32_t)0x00800000U)
+
+#define FDCAN_TX_EVENT				((uint32_t)0x00400000U)
+#define FDCAN_TX_IN_SPITE_OF_ABORT		((uint32_t)0x00800000U)
+
+#define FDCAN_FILTER_RANGE			((uint32_t)0x00000000U)
+#define FDCAN_FILTER_DUAL			((uint32_t)0x00000001U)
+#define FDCAN_FILTER_MASK			((uint32_t)0x00000002U)
+#define FDCAN_FILTER_RANGE_NO_EIDM		((uint32_t)0x00000003U)
+
+#define FDCAN_FILTER_DISABLE			((uint32_t)0x00000000U)
+#define FDCAN_FILTER_TO_RXFIFO0			((uint32_t)0x00000001U)
+#define FDCAN_FILTER_TO_RXFIFO1			((uint32_t)0x00000002U)
+#define FDCAN_FILTER_REJECT			((uint32_t)0x00000003U)
+#define FDCAN_FILTER_HP				((uint32_t)0x00000004U)
+#define FDCAN_FILTER_TO_RXFIFO0_HP		((uint32_t)0x00000005U)
+#define FDCAN_FILTER_TO_RXFIFO1_HP		((uint32_t)0x00000006U)
+
+#define FDCAN_ACCEPT_IN_RX_FIFO0		((uint32_t)0x00000000U)
+#define FDCAN_ACCEPT_IN_RX_FIFO1		((uint32_t)0x00000001U)
+#define FDCAN_REJECT				((uint32_t)0x00000002U)
+
+#define FDCAN_FILTER_REMOTE			((uint32_t)0x00000000U)
+#define FDCAN_REJECT_REMOTE			((uint32_t)0x00000001U)
+
+#define FDCAN_RX_FIFO0				((uint32_t)0x00000040U)
+#define FDCAN_RX_FIFO1				((uint32_t)0x00000041U)
+
+#define FDCAN_RX_FIFO_BLOCKING			((uint32_t)0x00000000U)
+#define FDCAN_RX_FIFO_OVERWRITE			((uint32_t)0x00000001U)
+
+#define FDCAN_TX_BUFFER0			((uint32_t)0x00000001U)
+#define FDCAN_TX_BUFFER1			((uint32_t)0x00000002U)
+#define FDCAN_TX_BUFFER2			((uint32_t)0x00000004U)
+
+#define FDCAN_TIMESTAMP_PRESC_1			((uint32_t)0x00000000U)
+#define FDCAN_TIMESTAMP_PRESC_16		((uint32_t)0x000F0000U)
+#define FDCAN_TIMESTAMP_INTERNAL		((uint32_t)0x00000001U)
+#define FDCAN_TIMESTAMP_EXTERNAL		((uint32_t)0x00000002U)
+
+#define FDCAN_TIMEOUT_CONTINUOUS		((uint32_t)0x00000000U)
+#define FDCAN_TIMEOUT_TX_EVENT_FIFO		((uint32_t)0x00000002U)
+#define FDCAN_TIMEOUT_RX_FIFO0			((uint32_t)0x00000004U)
+#define FDCAN_TIMEOUT_RX_FIFO1			((uint32_t)0x00000006U)
+
+#define FDCAN_INTERRUPT_LINE0			((uint32_t)0x00000001U)
+#define FDCAN_INTERRUPT_LINE1			((uint32_t)0x00000002U)
+
+#define FDCAN_IT_GROUP_RX_FIFO0			FDCAN_ILS_RXFIFO0
+#define FDCAN_IT_GROUP_RX_FIFO1			FDCAN_ILS_RXFIFO1
+#define FDCAN_IT_GROUP_SMSG			FDCAN_ILS_SMSG
+#define FDCAN_IT_GROUP_TX_FIFO_ERROR		FDCAN_ILS_TFERR
+#define FDCAN_IT_GROUP_MISC			FDCAN_ILS_MISC
+#define FDCAN_IT_GROUP_BIT_LINE_ERROR		FDCAN_ILS_BERR
+#define FDCAN_IT_GROUP_PROTOCOL_ERROR		FDCAN_ILS_PERR
+
+#define FDCAN_IT_RX_FIFO0_NEW_MESSAGE		FDCAN_IR_RF0N
+#define FDCAN_IT_RX_FIFO0_FULL			FDCAN_IR_RF0F
+#define FDCAN_IT_RX_FIFO0_MESSAGE_LOST		FDCAN_IR_RF0L
+#define FDCAN_IT_RX_FIFO1_NEW_MESSAGE		FDCAN_IR_RF1N
+#define FDCAN_IT_RX_FIFO1_FULL			FDCAN_IR_RF1F
+#define FDCAN_IT_RX_FIFO1_MESSAGE_LOST		FDCAN_IR_RF1L
+#define FDCAN_IT_RX_HIGH_PRIORITY_MSG		FDCAN_IR_HPM
+#define FDCAN_IT_TX_COMPLETE			FDCAN_IR_TC
+#define FDCAN_IT_TX_ABORT_COMPLETE		FDCAN_IR_TCF
+#define FDCAN_IT_TX_FIFO_EMPTY			FDCAN_IR_TFE
+#define FDCAN_IT_TX_EVT_FIFO_NEW_DATA		FDCAN_IR_TEFN
+#define FDCAN_IT_TX_EVT_FIFO_FULL		FDCAN_IR_TEFF
+#define FDCAN_IT_TX_EVT_FIFO_ELT_LOST		FDCAN_IR_TEFL
+#define FDCAN_IT_TIMESTAMP_WRAPAROUND		FDCAN_IR_TSW
+#define FDCAN_IT_RAM_ACCESS_FAILURE		FDCAN_IR_MRAF
+#define FDCAN_IT_TIMEOUT_OCCURRED		FDCAN_IR_TOO
+#define FDCAN_IT_ERROR_LOGGING_OVERFLOW		FDCAN_IR_ELO
+#define FDCAN_IT_ERROR_PASSIVE			FDCAN_IR_EP
+#define FDCAN_IT_ERROR_WARNING			FDCAN_IR_EW
+#define FDCAN_IT_BUS_OFF			FDCAN_IR_BO
+#define FDCAN_IT_RAM_WATCHDOG			FDCAN_IR_WDI
+#define FDCAN_IT_ARB_PROTOCOL_ERROR		FDCAN_IR_PEA
+#define FDCAN_IT_DATA_PROTOCOL_ERROR		FDCAN_IR_PED
+#define FDCAN_IT_RESERVED_ADDRESS_ACCESS	FDCAN_IR_ARA
+
+#define FDCAN_FLAG_RX_FIFO0_NEW_MESSAGE		FDCAN_IR_RF0N
+#define FDCAN_FLAG_RX_FIFO0_FULL		FDCAN_IR_RF0F
+#define FDCAN_FLAG_RX_FIFO0_MESSAGE_LOST	FDCAN_IR_RF0L
+#define FDCAN_FLAG_RX_FIFO1_NEW_MESSAGE		FDCAN_IR_RF1N
+#define FDCAN_FLAG_RX_FIFO1_FULL		FDCAN_IR_RF1F
+#define FDCAN_FLAG_RX_FIFO1_MESSAGE_LOST	FDCAN_IR_RF1L
+#define FDCAN_FLAG_TX_COMPLETE			FDCAN_IR_TC
+#define FDCAN_FLAG_TX_ABORT_COMPLETE		FDCAN_IR_TCF
+#define FDCAN_FLAG_TX_FIFO_EMPTY		FDCAN_IR_TFE
+#define FDCAN_FLAG_TX_EVT_FIFO_NEW_DATA		FDCAN_IR_TEFN
+#define FDCAN_FLAG_TIMESTAMP_WRAPAROUND		FDCAN_IR_TSW
+#define FDCAN_FLAG_TIMEOUT_OCCURRED		FDCAN_IR_TOO
+#define FDCAN_FLAG_ERROR_PASSIVE		FDCAN_IR_EP
+#define FDCAN_FLAG_ERROR_WARNING		FDCAN_IR_EW
+#define FDCAN_FLAG_BUS_OFF			FDCAN_IR_BO
+
+/* Interrupt flags are write-1-to-clear, which plain host memory cannot model */
+#define __HAL_FDCAN_CLEAR_FLAG(__HANDLE__, __FLAG__)		mock_fdcan_clear_flag((__HANDLE__), (__FLAG__))
+#define __HAL_FDCAN_GET_FLAG(__HANDLE__, __FLAG__)		(((__HANDLE__)->Instance->IR & (__FLAG__)) != 0U)
+#define __HAL_FDCAN_ENABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->IE |= (__INTERRUPT__))
+#define __HAL_FDCAN_DISABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->IE &= ~(__INTERRUPT__))
+#define __HAL_FDCAN_GET_IT_SOURCE(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->IE & (__INTERRUPT__))
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+HAL_StatusTypeDef HAL_FDCAN_Init(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_DeInit(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_MspInit(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_MspDeInit(FDCAN_HandleTypeDef *hfdcan);
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigFilter(FDCAN_HandleTypeDef *hfdcan, FDCAN_FilterTypeDef *sFilterConfig);
+HAL_StatusTypeDef HAL_FDCAN_ConfigGlobalFilter(FDCAN_HandleTypeDef *hfdcan, uint32_t NonMatchingStd, uint32_t NonMatchingExt, uint32_t RejectRemoteStd, uint32_t RejectRemoteExt);
+HAL_StatusTypeDef HAL_FDCAN_ConfigRxFifoOverwrite(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo, uint32_t OperationMode);
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimestampCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimestampPrescaler);
+HAL_StatusTypeDef HAL_FDCAN_EnableTimestampCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimestampOperation);
+HAL_StatusTypeDef HAL_FDCAN_DisableTimestampCounter(FDCAN_HandleTypeDef *hfdcan);
+uint16_t HAL_FDCAN_GetTimestampCounter(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimeoutCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimeoutOperation, uint32_t TimeoutPeriod);
+HAL_StatusTypeDef HAL_FDCAN_EnableTimeoutCounter(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_DisableTimeoutCounter(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_ResetTimeoutCounter(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_ConfigTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan, uint32_t TdcOffset, uint32_t TdcFilter);
+HAL_StatusTypeDef HAL_FDCAN_EnableTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_DisableTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_ConfigInterruptLines(FDCAN_HandleTypeDef *hfdcan, uint32_t ITList, uint32_t InterruptLine);
+
+HAL_StatusTypeDef HAL_FDCAN_Start(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_Stop(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_AddMessageToTxFifoQ(FDCAN_HandleTypeDef *hfdcan, FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData);
+uint32_t HAL_FDCAN_GetLatestTxFifoQRequestBuffer(FDCAN_HandleTypeDef *hfdcan);
+HAL_StatusTypeDef HAL_FDCAN_AbortTxRequest(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndex);
+HAL_StatusTypeDef HAL_FDCAN_GetRxMessage(FDCAN_HandleTypeDef *hfdcan, uint32_t RxLocation, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData);
+HAL_StatusTypeDef HAL_FDCAN_GetTxEvent(FDCAN_HandleTypeDef *hfdcan, FDCAN_TxEventFifoTypeDef *pTxEvent);
+HAL_StatusTypeDef HAL_FDCAN_GetProtocolStatus(FDCAN_HandleTypeDef *hfdcan, FDCAN_ProtocolStatusTypeDef *ProtocolStatus);
+HAL_StatusTypeDef HAL_FDCAN_GetErrorCounters(FDCAN_HandleTypeDef *hfdcan, FDCAN_ErrorCountersTypeDef *ErrorCounters);
+uint32_t HAL_FDCAN_IsTxBufferMessagePending(FDCAN_HandleTypeDef *hfdcan, uint32_t TxBufferIndex);
+uint32_t HAL_FDCAN_GetRxFifoFillLevel(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo);
+uint32_t HAL_FDCAN_GetTxFifoFreeLevel(FDCAN_HandleTypeDef *hfdcan);
+
+HAL_StatusTypeDef HAL_FDCAN_ActivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t ActiveITs, uint32_t BufferIndexes);
+HAL_StatusTypeDef HAL_FDCAN_DeactivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t InactiveITs);
+void HAL_FDCAN_IRQHandler(FDCAN_HandleTypeDef *hfdcan);
+
+void HAL_FDCAN_TxEventFifoCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t TxEventFifoITs);
+void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs);
+void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo1ITs);
+void HAL_FDCAN_TxFifoEmptyCallback(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes);
+void HAL_FDCAN_TxBufferAbortCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes);
+void HAL_FDCAN_TimestampWraparoundCallback(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_TimeoutOccurredCallback(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_HighPriorityMessageCallback(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_ErrorCallback(FDCAN_HandleTypeDef *hfdcan);
+void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs);
+
+HAL_FDCAN_StateTypeDef HAL_FDCAN_GetState(FDCAN_HandleTypeDef *hfdcan);
+uint32_t HAL_FDCAN_GetError(FDCAN_HandleTypeDef *hfdcan);
+
+/* --- Mock extensions ------------------------------------------------------
+   All started instances share one virtual bus. Frames sent by an instance are
+   received by every other started instance (and by itself in loopback mode),
+   frames injected with `mock_fdcan_inject` come from a virtual external node.
+   With auto transmission enabled every TX request leaves the controller as
+   soon as it is added, otherwise `mock_fdcan_bus_run` arbitrates pending
+   requests one frame at a time. Bus time is counted in MOCK_FDCAN_KERNEL_HZ
+   clocks from the sender's NBTP/DBTP, the data phase of BRS frames at the
+   data bit rate; `mock_fdcan_bus_idle` lets time pass with no frame on it. */
+
+#define MOCK_FDCAN_KERNEL_HZ		(160000000U)
+
+typedef void (*mock_fdcan_bus_hook_t)(FDCAN_GlobalTypeDef *src, const uint32_t *element);
+
+void mock_fdcan_clear_flag(FDCAN_HandleTypeDef *hfdcan, uint32_t flags);
+void mock_fdcan_reset(void);
+void mock_fdcan_set_auto_transmit(uint32_t enable);
+uint32_t mock_fdcan_bus_run(uint32_t frames);
+void mock_fdcan_bus_hook(mock_fdcan_bus_hook_t hook);
+void mock_fdcan_inject(FDCAN_TxHeaderTypeDef *pTxHeader, const uint8_t *pTxData);
+void mock_fdcan_inject_bus_off(FDCAN_HandleTypeDef *hfdcan);
+void mock_fdcan_bus_idle(uint32_t bits);
+uint64_t mock_fdcan_bus_frames(void);
+uint64_t mock_fdcan_bus_clocks(void);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,154 @@
+/*!
+	@file   stm32_mock_hal.h
+	@brief  Host-side replacement of the STM32Cube HAL core & CMSIS intrinsics
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef STM32_MOCK_HAL_H_
+#define STM32_MOCK_HAL_H_
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+#define __IO	volatile
+#define __weak	__attribute__((weak))
+
+#define SET_BIT(REG, BIT)	((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)	((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)	((REG) & (BIT))
+
+#define STM32_MOCK_HAL
+
+#define __NVIC_PRIO_BITS	4U
+#define MOCK_IRQ_PRIORITY	5U	/* NVIC priority of every emulated CAN interrupt */
+
+typedef enum
+{
+	HAL_OK       = 0x00U,
+	HAL_ERROR    = 0x01U,
+	HAL_BUSY     = 0x02U,
+	HAL_TIMEOUT  = 0x03U
+}HAL_StatusTypeDef;
+
+typedef enum
+{
+	HAL_UNLOCKED = 0x00U,
+	HAL_LOCKED   = 0x01U
+}HAL_LockTypeDef;
+
+typedef enum
+{
+	RESET = 0U,
+	SET = !RESET
+}FlagStatus, ITStatus;
+
+typedef enum
+{
+	DISABLE = 0U,
+	ENABLE = !DISABLE
+}FunctionalState;
+
+/* --- Interrupt controller emulation -------------------------------------- */
+
+typedef void (*mock_irq_service_t)(void);
+
+#define MOCK_IRQ_LINES		128U
+
+/* Lines of the emulated peripherals, numbered as on the G4 (FDCAN) and F4
+   (bxCAN). Their priorities are only stored: every emulated interrupt is
+   taken at MOCK_IRQ_PRIORITY. */
+typedef enum
+{
+	CAN1_TX_IRQn      = 19,
+	CAN1_RX0_IRQn     = 20,
+	CAN1_RX1_IRQn     = 21,
+	CAN1_SCE_IRQn     = 22,
+	CAN2_TX_IRQn      = 63,
+	CAN2_RX0_IRQn     = 64,
+	CAN2_RX1_IRQn     = 65,
+	CAN2_SCE_IRQn     = 66,
+	FDCAN1_IT0_IRQn   = 21,
+	FDCAN1_IT1_IRQn   = 22,
+	FDCAN2_IT0_IRQn   = 86,
+	FDCAN2_IT1_IRQn   = 87,
+	FDCAN3_IT0_IRQn   = 88,
+	FDCAN3_IT1_IRQn   = 89
+}IRQn_Type;
+
+/* --- Hardware semaphore emulation ---------------------------------------- */
+
+#define __HAL_HSEM_SEMID_TO_MASK(__SEMID__)	(1UL << (__SEMID__))
+
+/******************************************************************************
+* Declaration | Public Functions
+******************************************************************************/
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+uint32_t mock_cycles(void);
+
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+uint32_t __get_BASEPRI(void);
+void __set_BASEPRI(uint32_t basepri);
+void __set_BASEPRI_MAX(uint32_t basepri);
+void __DSB(void);
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type IRQn);
+
+#define __NOP()	do{}while(0)
+#define __DMB()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __ISB()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define __CLZ(x)	((uint8_t)((x) == 0U ? 32U : (uint32_t)__builtin_clz(x)))
+
+void mock_irq_attach(mock_irq_service_t sync, mock_irq_service_t service);
+void mock_irq_pend(void);
+uint32_t mock_irq_in_isr(void);
+void mock_irq_bind(void);
+void mock_irq_core(uint32_t core);
+
+HAL_StatusTypeDef HAL_HSEM_FastTake(uint32_t SemID);
+void HAL_HSEM_Release(uint32_t SemID, uint32_t ProcessID);
+void HAL_HSEM_ActivateNotification(uint32_t SemMask);
+void HAL_HSEM_DeactivateNotification(uint32_t SemMask);
+void HAL_HSEM_FreeCallback(uint32_t SemMask);
+uint32_t mock_hsem_irq(uint32_t SemMask);
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,988 @@
+/*!
+	@file   stm32_mock_can.c
+	@brief  Host-side emulation of the STM32 bxCAN peripheral & HAL driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Federico Carnevale, Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define MOCK_CAN_IRQ_REENTRY_MAX	64U
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <string.h>
+#include "stm32_mock_can.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+typedef struct
+{
+	CAN_HandleTypeDef *handle;
+	CAN_FIFOMailBox_TypeDef rx[2][MOCK_CAN_RX_FIFO_DEPTH];
+	uint32_t rx_get[2];
+	uint32_t rx_fill[2];
+	uint32_t tx_seq[3];
+	uint32_t tx_lost;		/* Pending mailboxes a frame went out ahead of, ALST once aborted */
+	uint32_t seq;
+	uint32_t timer;
+}mock_can_t;
+
+CAN_TypeDef mock_can_regs[MOCK_CAN_INSTANCES];
+
+static mock_can_t mock_can[MOCK_CAN_INSTANCES];
+static uint32_t mock_can_auto_transmit = 1;
+static uint64_t mock_can_frames = 0;
+static mock_can_bus_hook_t mock_can_hook = NULL;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static uint32_t mock_can_index(CAN_TypeDef *instance);
+static uint32_t mock_can_started(uint32_t idx);
+static void mock_can_code_update(uint32_t idx);
+static uint32_t mock_can_filter_match(uint32_t idx, uint32_t rir, uint32_t *fifo, uint32_t *fmi);
+static void mock_can_receive(uint32_t idx, const CAN_TxMailBox_TypeDef *mailbox);
+static void mock_can_bus_put(int32_t src, const CAN_TxMailBox_TypeDef *mailbox);
+static uint32_t mock_can_next_tx(uint32_t idx);
+static void mock_can_transmit(uint32_t idx, uint32_t mailbox);
+static void mock_can_transmit_pending(void);
+static uint32_t mock_can_irq_pending(uint32_t idx);
+static void mock_can_sync(void);
+static void mock_can_service(void);
+static volatile uint32_t* mock_can_flag_reg(CAN_HandleTypeDef *hcan, uint32_t flag);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static uint32_t mock_can_index(CAN_TypeDef *instance)
+{
+	return (uint32_t)(instance - &mock_can_regs[0]);
+}
+
+static uint32_t mock_can_started(uint32_t idx)
+{
+	return mock_can[idx].handle != NULL
+		&& (mock_can_regs[idx].MCR & CAN_MCR_INRQ) == 0
+		&& (mock_can_regs[idx].ESR & CAN_ESR_BOFF) == 0;
+}
+
+static void mock_can_code_update(uint32_t idx)
+{
+	CAN_TypeDef *regs = &mock_can_regs[idx];
+	mock_can_t *p = &mock_can[idx];
+	uint32_t code = 0;
+
+	if((regs->TSR & CAN_TSR_TME) != 0)
+	{
+		while((regs->TSR & (CAN_TSR_TME0 << code)) == 0)
+			code++;
+	}
+	else
+	{
+		/* all pending, point to the mailbox that would go out last */
+		for(uint32_t i=1;i<3;i++)
+		{
+			uint32_t a = (regs->sTxMailBox[i].TIR >> 3);
+			uint32_t b = (regs->sTxMailBox[code].TIR >> 3);
+			if((regs->MCR & CAN_MCR_TXFP) != 0 ? p->tx_seq[i] > p->tx_seq[code] : a >= b)
+				code = i;
+		}
+	}
+	regs->TSR = (regs->TSR & ~CAN_TSR_CODE) | (code << CAN_TSR_CODE_Pos);
+}
+
+/* Banks are scanned in ascending order and the first hit wins, the silicon
+   ranks 32-bit over 16-bit and list over mask first. */
+static uint32_t mock_can_filter_match(uint32_t idx, uint32_t rir, uint32_t *fifo, uint32_t *fmi)
+{
+	CAN_TypeDef *master = &mock_can_regs[0];
+	uint32_t start_bank = (master->FMR & CAN_FMR_CAN2SB) >> CAN_FMR_CAN2SB_Pos;
+	uint32_t first = idx == 0 ? 0 : start_bank;
+	uint32_t last = idx == 0 ? start_bank : MOCK_CAN_FILTER_BANKS;
+	uint32_t number[2] = {0, 0};
+	uint32_t r32 = rir & ~0x1U;
+	uint32_t r16 = ((rir >> 21) << 5) | (((rir & CAN_RI0R_RTR) != 0) << 4) | (((rir & CAN_RI0R_IDE) != 0) << 3) | ((rir >> 18) & 0x7U);
+
+	for(uint32_t bank=first;bank<last && bank<MOCK_CAN_FILTER_BANKS;bank++)
+	{
+		uint32_t bit = 1U << bank;
+		uint32_t f = (master->FFA1R & bit) != 0 ? 1 : 0;
+		uint32_t list = (master->FM1R & bit) != 0;
+		uint32_t scale32 = (master->FS1R & bit) != 0;
+		uint32_t fr1 = master->sFilterRegister[bank].FR1;
+		uint32_t fr2 = master->sFilterRegister[bank].FR2;
+		uint32_t active = (master->FA1R & bit) != 0;
+
+		if(scale32 && !list)
+		{
+			if(active && (r32 & fr2) == (fr1 & fr2))
+				goto mock_can_filter_match_hit;
+			number[f] += 1;
+		}
+		else if(scale32 && list)
+		{
+			if(active && ((r32 & ~0x1U) == (fr1 & ~0x1U)))
+				goto mock_can_filter_match_hit;
+			if(active && ((r32 & ~0x1U) == (fr2 & ~0x1U)))
+			{
+				number[f] += 1;
+				goto mock_can_filter_match_hit;
+			}
+			number[f] += 2;
+		}
+		else if(!list)
+		{
+			if(active && (r16 & (fr1 >> 16)) == (fr1 & (fr1 >> 16) & 0xFFFFU))
+				goto mock_can_filter_match_hit;
+			if(active && (r16 & (fr2 >> 16)) == (fr2 & (fr2 >> 16) & 0xFFFFU))
+			{
+				number[f] += 1;
+				goto mock_can_filter_match_hit;
+			}
+			number[f] += 2;
+		}
+		else
+		{
+			uint32_t ids[4] = {fr1 & 0xFFFFU, fr1 >> 16, fr2 & 0xFFFFU, fr2 >> 16};
+			for(uint32_t k=0;k<4;k++)
+			{
+				if(active && r16 == ids[k])
+				{
+					number[f] += k;
+					goto mock_can_filter_match_hit;
+				}
+			}
+			number[f] += 4;
+		}
+		continue;
+
+		mock_can_filter_match_hit:
+		*fifo = f;
+		*fmi = number[f];
+		return 1;
+	}
+	return 0;
+}
+
+static void mock_can_receive(uint32_t idx, const CAN_TxMailBox_TypeDef *mailbox)
+{
+	CAN_TypeDef *regs = &mock_can_regs[idx];
+	mock_can_t *p = &mock_can[idx];
+	uint32_t fifo;
+	uint32_t fmi;
+	uint32_t slot;
+	CAN_FIFOMailBox_TypeDef *dst;
+
+	if(!mock_can_filter_match(idx, mailbox->TIR & ~CAN_TI0R_TXRQ, &fifo, &fmi))
+		return;
+
+	if(p->rx_fill[fifo] == MOCK_CAN_RX_FIFO_DEPTH)
+	{
+		if(fifo == 0)
+			regs->RF0R |= CAN_RF0R_FOVR0;
+		else
+			regs->RF1R |= CAN_RF1R_FOVR1;
+		if((regs->MCR & CAN_MCR_RFLM) != 0)
+			return;
+		slot = (p->rx_get[fifo] + MOCK_CAN_RX_FIFO_DEPTH - 1) % MOCK_CAN_RX_FIFO_DEPTH;
+	}
+	else
+	{
+		slot = (p->rx_get[fifo] + p->rx_fill[fifo]) % MOCK_CAN_RX_FIFO_DEPTH;
+		p->rx_fill[fifo]++;
+	}
+
+	dst = &p->rx[fifo][slot];
+	dst->RIR = mailbox->TIR & ~CAN_TI0R_TXRQ;
+	dst->RDTR = (mailbox->TDTR & CAN_TDT0R_DLC) | (fmi << CAN_RDT0R_FMI_Pos);
+	if((regs->MCR & CAN_MCR_TTCM) != 0)
+		dst->RDTR |= (p->timer & 0xFFFFU) << CAN_RDT0R_TIME_Pos;
+	dst->RDLR = mailbox->TDLR;
+	dst->RDHR = mailbox->TDHR;
+
+	regs->sFIFOMailBox[fifo] = p->rx[fifo][p->rx_get[fifo]];
+	if(fifo == 0)
+		regs->RF0R = (regs->RF0R & ~(CAN_RF0R_FMP0 | CAN_RF0R_FULL0)) | p->rx_fill[0] | (p->rx_fill[0] == MOCK_CAN_RX_FIFO_DEPTH ? CAN_RF0R_FULL0 : 0);
+	else
+		regs->RF1R = (regs->RF1R & ~(CAN_RF1R_FMP1 | CAN_RF1R_FULL1)) | p->rx_fill[1] | (p->rx_fill[1] == MOCK_CAN_RX_FIFO_DEPTH ? CAN_RF1R_FULL1 : 0);
+}
+
+static void mock_can_bus_put(int32_t src, const CAN_TxMailBox_TypeDef *mailbox)
+{
+	uint32_t bits = ((mailbox->TIR & CAN_TI0R_IDE) != 0 ? 67U : 47U) + (mailbox->TDTR & CAN_TDT0R_DLC)*8U;
+
+	for(uint32_t i=0;i<MOCK_CAN_INSTANCES;i++)
+	{
+		uint32_t loopback;
+
+		if(!mock_can_started(i))
+			continue;
+		mock_can[i].timer += bits;
+		for(uint32_t k=0;k<3;k++)
+			if((mock_can_regs[i].sTxMailBox[k].TIR & CAN_TI0R_TXRQ) != 0)
+				mock_can[i].tx_lost |= 1U << k;
+		loopback = (mock_can[i].handle->Init.Mode & CAN_MODE_LOOPBACK) != 0;
+		if((int32_t)i == src ? loopback : !loopback)
+			mock_can_receive(i, mailbox);
+	}
+
+	mock_can_frames++;
+	if(mock_can_hook != NULL)
+		mock_can_hook(src >= 0 ? &mock_can_regs[src] : NULL, mailbox);
+}
+
+static uint32_t mock_can_next_tx(uint32_t idx)
+{
+	CAN_TypeDef *regs = &mock_can_regs[idx];
+	mock_can_t *p = &mock_can[idx];
+	uint32_t best = 0xFF;
+
+	for(uint32_t i=0;i<3;i++)
+	{
+		if((regs->sTxMailBox[i].TIR & CAN_TI0R_TXRQ) == 0)
+			continue;
+		if(best == 0xFF)
+			best = i;
+		else if((regs->MCR & CAN_MCR_TXFP) != 0)
+			best = p->tx_seq[i] < p->tx_seq[best] ? i : best;
+		else
+			best = (regs->sTxMailBox[i].TIR >> 3) < (regs->sTxMailBox[best].TIR >> 3) ? i : best;
+	}
+	return best;
+}
+
+static void mock_can_transmit(uint32_t idx, uint32_t mailbox)
+{
+	CAN_TypeDef *regs = &mock_can_regs[idx];
+	CAN_TxMailBox_TypeDef *mb = &regs->sTxMailBox[mailbox];
+	CAN_TxMailBox_TypeDef frame = *mb;
+
+	mb->TIR &= ~CAN_TI0R_TXRQ;
+	if((regs->MCR & CAN_MCR_TTCM) != 0)
+		mb->TDTR = (mb->TDTR & 0xFFFFU) | ((mock_can[idx].timer & 0xFFFFU) << CAN_TDT0R_TIME_Pos);
+	regs->TSR |= (CAN_TSR_RQCP0 | CAN_TSR_TXOK0) << (8U * mailbox);
+	regs->TSR |= CAN_TSR_TME0 << mailbox;
+	mock_can_code_update(idx);
+
+	mock_can_bus_put((int32_t)idx, &frame);
+}
+
+static void mock_can_transmit_pending(void)
+{
+	uint32_t mailbox;
+
+	if(mock_can_auto_transmit == 0)
+		return;
+
+	for(uint32_t i=0;i<MOCK_CAN_INSTANCES;i++)
+	{
+		if(!mock_can_started(i))
+			continue;
+		while((mailbox = mock_can_next_tx(i)) != 0xFF)
+			mock_can_transmit(i, mailbox);
+	}
+}
+
+static uint32_t mock_can_irq_pending(uint32_t idx)
+{
+	CAN_TypeDef *regs = &mock_can_regs[idx];
+	uint32_t ier = regs->IER;
+
+	if(mock_can[idx].handle == NULL)
+		return 0;
+
+	return ((ier & CAN_IER_TMEIE) && (regs->TSR & (CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2)))
+		|| ((ier & CAN_IER_FMPIE0) && (regs->RF0R & CAN_RF0R_FMP0))
+		|| ((ier & CAN_IER_FFIE0) && (regs->RF0R & CAN_RF0R_FULL0))
+		|| ((ier & CAN_IER_FOVIE0) && (regs->RF0R & CAN_RF0R_FOVR0))
+		|| ((ier & CAN_IER_FMPIE1) && (regs->RF1R & CAN_RF1R_FMP1))
+		|| ((ier & CAN_IER_FFIE1) && (regs->RF1R & CAN_RF1R_FULL1))
+		|| ((ier & CAN_IER_FOVIE1) && (regs->RF1R & CAN_RF1R_FOVR1))
+		|| ((ier & CAN_IER_ERRIE) && (regs->MSR & CAN_MSR_ERRI));
+}
+
+static void mock_can_sync(void)
+{
+	for(uint32_t i=0;i<MOCK_CAN_INSTANCES;i++)
+	{
+		CAN_TypeDef *regs = &mock_can_regs[i];
+
+		if(mock_can[i].handle == NULL)
+			continue;
+
+		if((regs->ESR & CAN_ESR_BOFF) != 0 && (regs->MCR & CAN_MCR_ABOM) != 0 && (regs->MSR & CAN_MSR_ERRI) == 0)
+			regs->ESR &= ~(CAN_ESR_BOFF | CAN_ESR_EPVF | CAN_ESR_EWGF | CAN_ESR_TEC | CAN_ESR_REC);
+	}
+	mock_can_transmit_pending();
+}
+
+static void mock_can_service(void)
+{
+	mock_can_sync();
+	for(uint32_t i=0;i<MOCK_CAN_INSTANCES;i++)
+	{
+		uint32_t guard = 0;
+
+		/* RX pending interrupts are level triggered */
+		while(mock_can_irq_pending(i) && guard++ < MOCK_CAN_IRQ_REENTRY_MAX)
+			HAL_CAN_IRQHandler(mock_can[i].handle);
+	}
+}
+
+/* Flags as the HAL encodes them: register in the upper byte, bit below */
+static volatile uint32_t* mock_can_flag_reg(CAN_HandleTypeDef *hcan, uint32_t flag)
+{
+	switch(flag >> 8)
+	{
+	case 1U:
+		return &hcan->Instance->TSR;
+	case 2U:
+		return &hcan->Instance->RF0R;
+	case 3U:
+		return &hcan->Instance->MSR;
+	case 4U:
+		return &hcan->Instance->RF1R;
+	default:
+		return &hcan->Instance->ESR;
+	}
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan)
+{
+	CAN_TypeDef *regs;
+	uint32_t idx;
+
+	if(hcan == NULL || hcan->Instance == NULL)
+		return HAL_ERROR;
+
+	mock_irq_attach(mock_can_sync, mock_can_service);
+
+	if(hcan->State == HAL_CAN_STATE_RESET)
+		HAL_CAN_MspInit(hcan);
+
+	regs = hcan->Instance;
+	idx = mock_can_index(regs);
+	memset(&mock_can[idx], 0, sizeof(mock_can[idx]));
+	mock_can[idx].handle = hcan;
+
+	regs->MCR = CAN_MCR_INRQ;
+	regs->MSR = CAN_MSR_INAK;
+	regs->TSR = CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2;
+	regs->RF0R = 0;
+	regs->RF1R = 0;
+	regs->IER = 0;
+	regs->ESR = 0;
+	memset((void*)regs->sTxMailBox, 0, sizeof(regs->sTxMailBox));
+	memset((void*)regs->sFIFOMailBox, 0, sizeof(regs->sFIFOMailBox));
+	if(idx == 0 && (regs->FMR & CAN_FMR_CAN2SB) == 0 && regs->FA1R == 0)
+		regs->FMR = 14U << CAN_FMR_CAN2SB_Pos;
+
+	if(hcan->Init.TimeTriggeredMode == ENABLE)
+		regs->MCR |= CAN_MCR_TTCM;
+	if(hcan->Init.AutoBusOff == ENABLE)
+		regs->MCR |= CAN_MCR_ABOM;
+	if(hcan->Init.AutoWakeUp == ENABLE)
+		regs->MCR |= CAN_MCR_AWUM;
+	if(hcan->Init.AutoRetransmission == DISABLE)
+		regs->MCR |= CAN_MCR_NART;
+	if(hcan->Init.ReceiveFifoLocked == ENABLE)
+		regs->MCR |= CAN_MCR_RFLM;
+	if(hcan->Init.TransmitFifoPriority == ENABLE)
+		regs->MCR |= CAN_MCR_TXFP;
+
+	regs->BTR = hcan->Init.Mode | hcan->Init.SyncJumpWidth | hcan->Init.TimeSeg1 | hcan->Init.TimeSeg2 | (hcan->Init.Prescaler - 1U);
+
+	hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+	hcan->State = HAL_CAN_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_DeInit(CAN_HandleTypeDef *hcan)
+{
+	if(hcan == NULL || hcan->Instance == NULL)
+		return HAL_ERROR;
+
+	(void)HAL_CAN_Stop(hcan);
+	hcan->Instance->IER = 0;
+	HAL_CAN_MspDeInit(hcan);
+	hcan->Instance->MCR |= CAN_MCR_RESET;
+	hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+	hcan->State = HAL_CAN_STATE_RESET;
+	return HAL_OK;
+}
+
+__weak void HAL_CAN_MspInit(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_MspDeInit(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+HAL_StatusTypeDef HAL_CAN_ConfigFilter(CAN_HandleTypeDef *hcan, CAN_FilterTypeDef *sFilterConfig)
+{
+	CAN_TypeDef *can_ip = CAN1;
+	uint32_t bit;
+
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	if(sFilterConfig->FilterBank >= MOCK_CAN_FILTER_BANKS || sFilterConfig->SlaveStartFilterBank > MOCK_CAN_FILTER_BANKS)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+	}
+
+	bit = 1U << (sFilterConfig->FilterBank & 0x1FU);
+	can_ip->FMR |= CAN_FMR_FINIT;
+	can_ip->FMR = (can_ip->FMR & ~CAN_FMR_CAN2SB) | (sFilterConfig->SlaveStartFilterBank << CAN_FMR_CAN2SB_Pos);
+	can_ip->FA1R &= ~bit;
+
+	if(sFilterConfig->FilterScale == CAN_FILTERSCALE_16BIT)
+	{
+		can_ip->FS1R &= ~bit;
+		can_ip->sFilterRegister[sFilterConfig->FilterBank].FR1 = ((0x0000FFFFU & sFilterConfig->FilterMaskIdLow) << 16U) | (0x0000FFFFU & sFilterConfig->FilterIdLow);
+		can_ip->sFilterRegister[sFilterConfig->FilterBank].FR2 = ((0x0000FFFFU & sFilterConfig->FilterMaskIdHigh) << 16U) | (0x0000FFFFU & sFilterConfig->FilterIdHigh);
+	}
+	else
+	{
+		can_ip->FS1R |= bit;
+		can_ip->sFilterRegister[sFilterConfig->FilterBank].FR1 = ((0x0000FFFFU & sFilterConfig->FilterIdHigh) << 16U) | (0x0000FFFFU & sFilterConfig->FilterIdLow);
+		can_ip->sFilterRegister[sFilterConfig->FilterBank].FR2 = ((0x0000FFFFU & sFilterConfig->FilterMaskIdHigh) << 16U) | (0x0000FFFFU & sFilterConfig->FilterMaskIdLow);
+	}
+
+	if(sFilterConfig->FilterMode == CAN_FILTERMODE_IDMASK)
+		can_ip->FM1R &= ~bit;
+	else
+		can_ip->FM1R |= bit;
+
+	if(sFilterConfig->FilterFIFOAssignment == CAN_FILTER_FIFO0)
+		can_ip->FFA1R &= ~bit;
+	else
+		can_ip->FFA1R |= bit;
+
+	if(sFilterConfig->FilterActivation == CAN_FILTER_ENABLE)
+		can_ip->FA1R |= bit;
+
+	can_ip->FMR &= ~CAN_FMR_FINIT;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan)
+{
+	if(hcan->State != HAL_CAN_STATE_READY)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hcan->State = HAL_CAN_STATE_LISTENING;
+	hcan->Instance->MCR &= ~CAN_MCR_INRQ;
+	hcan->Instance->MSR &= ~CAN_MSR_INAK;
+	hcan->Instance->ESR &= ~(CAN_ESR_BOFF | CAN_ESR_EPVF | CAN_ESR_EWGF | CAN_ESR_TEC | CAN_ESR_REC);
+	hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+	mock_can_sync();
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Stop(CAN_HandleTypeDef *hcan)
+{
+	CAN_TypeDef *regs = hcan->Instance;
+
+	if(hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+	regs->MCR |= CAN_MCR_INRQ;
+	regs->MSR |= CAN_MSR_INAK;
+	for(uint32_t i=0;i<3;i++)
+		regs->sTxMailBox[i].TIR &= ~CAN_TI0R_TXRQ;
+	regs->TSR |= CAN_TSR_TME;
+	mock_can_code_update(mock_can_index(regs));
+	hcan->State = HAL_CAN_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_AddTxMessage(CAN_HandleTypeDef *hcan, CAN_TxHeaderTypeDef *pHeader, uint8_t aData[], uint32_t *pTxMailbox)
+{
+	CAN_TypeDef *regs = hcan->Instance;
+	uint32_t idx = mock_can_index(regs);
+	uint32_t mailbox;
+	CAN_TxMailBox_TypeDef *mb;
+
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	if((regs->TSR & CAN_TSR_TME) == 0)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+	}
+
+	mailbox = (regs->TSR & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos;
+	*pTxMailbox = 1U << mailbox;
+	mb = &regs->sTxMailBox[mailbox];
+
+	if(pHeader->IDE == CAN_ID_STD)
+		mb->TIR = (pHeader->StdId << CAN_TI0R_STID_Pos) | pHeader->RTR;
+	else
+		mb->TIR = (pHeader->ExtId << CAN_TI0R_EXID_Pos) | pHeader->IDE | pHeader->RTR;
+	mb->TDTR = pHeader->DLC & CAN_TDT0R_DLC;
+	if(pHeader->TransmitGlobalTime == ENABLE)
+		mb->TDTR |= CAN_TDT0R_TGT;
+	mb->TDHR = ((uint32_t)aData[7] << 24) | ((uint32_t)aData[6] << 16) | ((uint32_t)aData[5] << 8) | (uint32_t)aData[4];
+	mb->TDLR = ((uint32_t)aData[3] << 24) | ((uint32_t)aData[2] << 16) | ((uint32_t)aData[1] << 8) | (uint32_t)aData[0];
+
+	regs->TSR &= ~(CAN_TSR_TME0 << mailbox);
+	regs->TSR &= ~((CAN_TSR_TXOK0 | CAN_TSR_ALST0 | CAN_TSR_TERR0) << (8U * mailbox));
+	mock_can[idx].tx_seq[mailbox] = ++mock_can[idx].seq;
+	mock_can[idx].tx_lost &= ~(1U << mailbox);
+	mb->TIR |= CAN_TI0R_TXRQ;
+	mock_can_code_update(idx);
+
+	mock_can_sync();
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_AbortTxRequest(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes)
+{
+	CAN_TypeDef *regs = hcan->Instance;
+	mock_can_t *p = &mock_can[mock_can_index(regs)];
+
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+
+	/* A mailbox that already lost arbitration completes with ALST, not as an
+	   abort, like the hardware does */
+	for(uint32_t i=0;i<3;i++)
+	{
+		if((TxMailboxes & (1U << i)) == 0 || (regs->sTxMailBox[i].TIR & CAN_TI0R_TXRQ) == 0)
+			continue;
+		regs->sTxMailBox[i].TIR &= ~CAN_TI0R_TXRQ;
+		regs->TSR &= ~(CAN_TSR_TXOK0 << (8U * i));
+		regs->TSR |= (CAN_TSR_RQCP0 << (8U * i)) | (CAN_TSR_TME0 << i);
+		if((p->tx_lost & (1U << i)) != 0)
+			regs->TSR |= CAN_TSR_ALST0 << (8U * i);
+		p->tx_lost &= ~(1U << i);
+	}
+	mock_can_code_update(mock_can_index(regs));
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetTxMailboxesFreeLevel(CAN_HandleTypeDef *hcan)
+{
+	uint32_t tsr = hcan->Instance->TSR;
+
+	return ((tsr & CAN_TSR_TME0) != 0) + ((tsr & CAN_TSR_TME1) != 0) + ((tsr & CAN_TSR_TME2) != 0);
+}
+
+uint32_t HAL_CAN_IsTxMessagePending(CAN_HandleTypeDef *hcan, uint32_t TxMailboxes)
+{
+	return (hcan->Instance->TSR & (TxMailboxes << CAN_TSR_TME_Pos)) != (TxMailboxes << CAN_TSR_TME_Pos) ? 1U : 0U;
+}
+
+uint32_t HAL_CAN_GetTxTimestamp(CAN_HandleTypeDef *hcan, uint32_t TxMailbox)
+{
+	uint32_t mailbox = TxMailbox == CAN_TX_MAILBOX0 ? 0 : (TxMailbox == CAN_TX_MAILBOX1 ? 1 : 2);
+
+	return (hcan->Instance->sTxMailBox[mailbox].TDTR >> CAN_TDT0R_TIME_Pos) & 0xFFFFU;
+}
+
+HAL_StatusTypeDef HAL_CAN_GetRxMessage(CAN_HandleTypeDef *hcan, uint32_t RxFifo, CAN_RxHeaderTypeDef *pHeader, uint8_t aData[])
+{
+	CAN_TypeDef *regs = hcan->Instance;
+	mock_can_t *p = &mock_can[mock_can_index(regs)];
+	CAN_FIFOMailBox_TypeDef *mb = &regs->sFIFOMailBox[RxFifo];
+
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	if(p->rx_fill[RxFifo] == 0)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_PARAM;
+		return HAL_ERROR;
+	}
+
+	pHeader->IDE = mb->RIR & CAN_RI0R_IDE;
+	if(pHeader->IDE == CAN_ID_STD)
+		pHeader->StdId = (mb->RIR & CAN_RI0R_STID) >> CAN_TI0R_STID_Pos;
+	else
+		pHeader->ExtId = ((CAN_RI0R_EXID | CAN_RI0R_STID) & mb->RIR) >> CAN_RI0R_EXID_Pos;
+	pHeader->RTR = mb->RIR & CAN_RI0R_RTR;
+	pHeader->DLC = mb->RDTR & CAN_RDT0R_DLC;
+	pHeader->FilterMatchIndex = (mb->RDTR & CAN_RDT0R_FMI) >> CAN_RDT0R_FMI_Pos;
+	pHeader->Timestamp = (mb->RDTR & CAN_RDT0R_TIME) >> CAN_RDT0R_TIME_Pos;
+
+	aData[0] = (uint8_t)(mb->RDLR);
+	aData[1] = (uint8_t)(mb->RDLR >> 8);
+	aData[2] = (uint8_t)(mb->RDLR >> 16);
+	aData[3] = (uint8_t)(mb->RDLR >> 24);
+	aData[4] = (uint8_t)(mb->RDHR);
+	aData[5] = (uint8_t)(mb->RDHR >> 8);
+	aData[6] = (uint8_t)(mb->RDHR >> 16);
+	aData[7] = (uint8_t)(mb->RDHR >> 24);
+
+	/* Release the output mailbox */
+	p->rx_get[RxFifo] = (p->rx_get[RxFifo] + 1) % MOCK_CAN_RX_FIFO_DEPTH;
+	p->rx_fill[RxFifo]--;
+	*mb = p->rx[RxFifo][p->rx_get[RxFifo]];
+	if(RxFifo == CAN_RX_FIFO0)
+		regs->RF0R = (regs->RF0R & ~(CAN_RF0R_FMP0 | CAN_RF0R_FULL0)) | p->rx_fill[0];
+	else
+		regs->RF1R = (regs->RF1R & ~(CAN_RF1R_FMP1 | CAN_RF1R_FULL1)) | p->rx_fill[1];
+	return HAL_OK;
+}
+
+uint32_t HAL_CAN_GetRxFifoFillLevel(CAN_HandleTypeDef *hcan, uint32_t RxFifo)
+{
+	if(RxFifo == CAN_RX_FIFO0)
+		return hcan->Instance->RF0R & CAN_RF0R_FMP0;
+	return hcan->Instance->RF1R & CAN_RF1R_FMP1;
+}
+
+HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t ActiveITs)
+{
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	hcan->Instance->IER |= ActiveITs;
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_DeactivateNotification(CAN_HandleTypeDef *hcan, uint32_t InactiveITs)
+{
+	if(hcan->State != HAL_CAN_STATE_READY && hcan->State != HAL_CAN_STATE_LISTENING)
+	{
+		hcan->ErrorCode |= HAL_CAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	hcan->Instance->IER &= ~InactiveITs;
+	return HAL_OK;
+}
+
+void HAL_CAN_IRQHandler(CAN_HandleTypeDef *hcan)
+{
+	CAN_TypeDef *regs = hcan->Instance;
+	uint32_t errorcode = HAL_CAN_ERROR_NONE;
+	uint32_t ier = regs->IER;
+	uint32_t tsr = regs->TSR;
+
+	if((ier & CAN_IT_TX_MAILBOX_EMPTY) != 0)
+	{
+		if((tsr & CAN_TSR_RQCP0) != 0)
+		{
+			regs->TSR &= ~(CAN_TSR_RQCP0 | CAN_TSR_TXOK0 | CAN_TSR_ALST0 | CAN_TSR_TERR0);
+			if((tsr & CAN_TSR_TXOK0) != 0)
+				HAL_CAN_TxMailbox0CompleteCallback(hcan);
+			else if((tsr & CAN_TSR_ALST0) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_ALST0;
+			else if((tsr & CAN_TSR_TERR0) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_TERR0;
+			else
+				HAL_CAN_TxMailbox0AbortCallback(hcan);
+		}
+		if((tsr & CAN_TSR_RQCP1) != 0)
+		{
+			regs->TSR &= ~(CAN_TSR_RQCP1 | CAN_TSR_TXOK1 | CAN_TSR_ALST1 | CAN_TSR_TERR1);
+			if((tsr & CAN_TSR_TXOK1) != 0)
+				HAL_CAN_TxMailbox1CompleteCallback(hcan);
+			else if((tsr & CAN_TSR_ALST1) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_ALST1;
+			else if((tsr & CAN_TSR_TERR1) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_TERR1;
+			else
+				HAL_CAN_TxMailbox1AbortCallback(hcan);
+		}
+		if((tsr & CAN_TSR_RQCP2) != 0)
+		{
+			regs->TSR &= ~(CAN_TSR_RQCP2 | CAN_TSR_TXOK2 | CAN_TSR_ALST2 | CAN_TSR_TERR2);
+			if((tsr & CAN_TSR_TXOK2) != 0)
+				HAL_CAN_TxMailbox2CompleteCallback(hcan);
+			else if((tsr & CAN_TSR_ALST2) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_ALST2;
+			else if((tsr & CAN_TSR_TERR2) != 0)
+				errorcode |= HAL_CAN_ERROR_TX_TERR2;
+			else
+				HAL_CAN_TxMailbox2AbortCallback(hcan);
+		}
+	}
+
+	if((ier & CAN_IT_RX_FIFO0_OVERRUN) != 0 && (regs->RF0R & CAN_RF0R_FOVR0) != 0)
+	{
+		errorcode |= HAL_CAN_ERROR_RX_FOV0;
+		regs->RF0R &= ~CAN_RF0R_FOVR0;
+	}
+	if((ier & CAN_IT_RX_FIFO0_FULL) != 0 && (regs->RF0R & CAN_RF0R_FULL0) != 0)
+	{
+		regs->RF0R &= ~CAN_RF0R_FULL0;
+		HAL_CAN_RxFifo0FullCallback(hcan);
+	}
+	if((ier & CAN_IT_RX_FIFO0_MSG_PENDING) != 0 && (regs->RF0R & CAN_RF0R_FMP0) != 0)
+		HAL_CAN_RxFifo0MsgPendingCallback(hcan);
+
+	if((ier & CAN_IT_RX_FIFO1_OVERRUN) != 0 && (regs->RF1R & CAN_RF1R_FOVR1) != 0)
+	{
+		errorcode |= HAL_CAN_ERROR_RX_FOV1;
+		regs->RF1R &= ~CAN_RF1R_FOVR1;
+	}
+	if((ier & CAN_IT_RX_FIFO1_FULL) != 0 && (regs->RF1R & CAN_RF1R_FULL1) != 0)
+	{
+		regs->RF1R &= ~CAN_RF1R_FULL1;
+		HAL_CAN_RxFifo1FullCallback(hcan);
+	}
+	if((ier & CAN_IT_RX_FIFO1_MSG_PENDING) != 0 && (regs->RF1R & CAN_RF1R_FMP1) != 0)
+		HAL_CAN_RxFifo1MsgPendingCallback(hcan);
+
+	if((ier & CAN_IT_ERROR) != 0 && (regs->MSR & CAN_MSR_ERRI) != 0)
+	{
+		uint32_t esr = regs->ESR;
+		if((ier & CAN_IT_ERROR_WARNING) != 0 && (esr & CAN_ESR_EWGF) != 0)
+			errorcode |= HAL_CAN_ERROR_EWG;
+		if((ier & CAN_IT_ERROR_PASSIVE) != 0 && (esr & CAN_ESR_EPVF) != 0)
+			errorcode |= HAL_CAN_ERROR_EPV;
+		if((ier & CAN_IT_BUSOFF) != 0 && (esr & CAN_ESR_BOFF) != 0)
+			errorcode |= HAL_CAN_ERROR_BOF;
+		regs->MSR &= ~CAN_MSR_ERRI;
+	}
+
+	if(errorcode != HAL_CAN_ERROR_NONE)
+	{
+		hcan->ErrorCode |= errorcode;
+		HAL_CAN_ErrorCallback(hcan);
+	}
+}
+
+__weak void HAL_CAN_TxMailbox0CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_TxMailbox1CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_TxMailbox2CompleteCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_TxMailbox0AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_TxMailbox1AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_TxMailbox2AbortCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_RxFifo0MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	CAN_RxHeaderTypeDef header;
+	uint8_t data[8];
+
+	/* nobody listens, drop it so the level triggered request goes away */
+	while(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO0, &header, data) == HAL_OK);
+}
+
+__weak void HAL_CAN_RxFifo0FullCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_RxFifo1MsgPendingCallback(CAN_HandleTypeDef *hcan)
+{
+	CAN_RxHeaderTypeDef header;
+	uint8_t data[8];
+
+	while(HAL_CAN_GetRxMessage(hcan, CAN_RX_FIFO1, &header, data) == HAL_OK);
+}
+
+__weak void HAL_CAN_RxFifo1FullCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+__weak void HAL_CAN_ErrorCallback(CAN_HandleTypeDef *hcan)
+{
+	(void)hcan;
+}
+
+HAL_CAN_StateTypeDef HAL_CAN_GetState(CAN_HandleTypeDef *hcan)
+{
+	return hcan->State;
+}
+
+uint32_t HAL_CAN_GetError(CAN_HandleTypeDef *hcan)
+{
+	return hcan->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_CAN_ResetError(CAN_HandleTypeDef *hcan)
+{
+	hcan->ErrorCode = HAL_CAN_ERROR_NONE;
+	return HAL_OK;
+}
+
+/* --- Mock extensions ----------------------------------------------------- */
+
+void mock_can_reset(void)
+{
+	memset(mock_can_regs, 0, sizeof(mock_can_regs));
+	memset(mock_can, 0, sizeof(mock_can));
+	mock_can_auto_transmit = 1;
+	mock_can_frames = 0;
+	mock_can_hook = NULL;
+}
+
+void mock_can_set_auto_transmit(uint32_t enable)
+{
+	mock_can_auto_transmit = enable;
+	mock_can_sync();
+	mock_irq_pend();
+}
+
+uint32_t mock_can_bus_run(uint32_t frames)
+{
+	uint32_t sent = 0;
+
+	while(sent < frames)
+	{
+		uint32_t best_idx = 0xFF;
+		uint32_t best_mailbox = 0xFF;
+		uint32_t best_prio = 0xFFFFFFFFU;
+
+		/* Bus arbitration across all controllers, lowest identifier wins */
+		for(uint32_t i=0;i<MOCK_CAN_INSTANCES;i++)
+		{
+			uint32_t mailbox;
+			uint32_t prio;
+
+			if(!mock_can_started(i))
+				continue;
+			if((mailbox = mock_can_next_tx(i)) == 0xFF)
+				continue;
+			prio = mock_can_regs[i].sTxMailBox[mailbox].TIR >> 3;
+			if(prio < best_prio)
+			{
+				best_prio = prio;
+				best_idx = i;
+				best_mailbox = mailbox;
+			}
+		}
+		if(best_idx == 0xFF)
+			break;
+		mock_can_transmit(best_idx, best_mailbox);
+		sent++;
+		mock_irq_pend();
+	}
+	return sent;
+}
+
+void mock_can_bus_hook(mock_can_bus_hook_t hook)
+{
+	mock_can_hook = hook;
+}
+
+void mock_can_inject(CAN_TxHeaderTypeDef *pHeader, const uint8_t aData[])
+{
+	CAN_TxMailBox_TypeDef mailbox;
+
+	if(pHeader->IDE == CAN_ID_STD)
+		mailbox.TIR = (pHeader->StdId << CAN_TI0R_STID_Pos) | pHeader->RTR;
+	else
+		mailbox.TIR = (pHeader->ExtId << CAN_TI0R_EXID_Pos) | pHeader->IDE | pHeader->RTR;
+	mailbox.TDTR = pHeader->DLC & CAN_TDT0R_DLC;
+	mailbox.TDHR = ((uint32_t)aData[7] << 24) | ((uint32_t)aData[6] << 16) | ((uint32_t)aData[5] << 8) | (uint32_t)aData[4];
+	mailbox.TDLR = ((uint32_t)aData[3] << 24) | ((uint32_t)aData[2] << 16) | ((uint32_t)aData[1] << 8) | (uint32_t)aData[0];
+
+	mock_can_bus_put(-1, &mailbox);
+	mock_irq_pend();
+}
+
+void mock_can_inject_bus_off(CAN_HandleTypeDef *hcan)
+{
+	CAN_TypeDef *regs = hcan->Instance;
+
+	regs->ESR |= CAN_ESR_BOFF | CAN_ESR_EPVF | CAN_ESR_EWGF | CAN_ESR_TEC;
+	for(uint32_t i=0;i<3;i++)
+		regs->sTxMailBox[i].TIR &= ~CAN_TI0R_TXRQ;
+	regs->TSR |= CAN_TSR_TME;
+	mock_can_code_update(mock_can_index(regs));
+	if((regs->IER & (CAN_IER_BOFIE | CAN_IER_EPVIE | CAN_IER_EWGIE)) != 0)
+		regs->MSR |= CAN_MSR_ERRI;
+	mock_irq_pend();
+}
+
+uint64_t mock_can_bus_frames(void)
+{
+	return mock_can_frames;
+}
+
+uint32_t mock_can_get_flag(CAN_HandleTypeDef *hcan, uint32_t flag)
+{
+	return (*mock_can_flag_reg(hcan, flag) & (1U << (flag & 0x1FU))) != 0U;
+}
+
+void mock_can_clear_flag(CAN_HandleTypeDef *hcan, uint32_t flag)
+{
+	*mock_can_flag_reg(hcan, flag) &= ~(1U << (flag & 0x1FU));
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
@@ -0,0 +1,1461 @@
+/*!
+	@file   stm32_mock_fdcan.c
+	@brief  Host-side emulation of the STM32 FDCAN peripheral & HAL driver
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define MOCK_FDCAN_REG_IDLE		(0xFFFFFFFFU)
+
+#define MOCK_FDCAN_ELEMENT_XTD		(0x1UL << 30)
+#define MOCK_FDCAN_ELEMENT_RTR		(0x1UL << 29)
+#define MOCK_FDCAN_ELEMENT_ESI		(0x1UL << 31)
+#define MOCK_FDCAN_ELEMENT_STDID	(0x7FFUL << 18)
+#define MOCK_FDCAN_ELEMENT_EXTID	(0x1FFFFFFFUL)
+#define MOCK_FDCAN_ELEMENT_DLC		(0xFUL << 16)
+#define MOCK_FDCAN_ELEMENT_BRS		(0x1UL << 20)
+#define MOCK_FDCAN_ELEMENT_FDF		(0x1UL << 21)
+#define MOCK_FDCAN_ELEMENT_EFC		(0x1UL << 23)
+#define MOCK_FDCAN_ELEMENT_TS		(0xFFFFUL)
+
+#define MOCK_FDCAN_IR_TX_EVENT		(FDCAN_IR_TEFL | FDCAN_IR_TEFF | FDCAN_IR_TEFN)
+#define MOCK_FDCAN_IR_RX_FIFO0		(FDCAN_IR_RF0L | FDCAN_IR_RF0F | FDCAN_IR_RF0N)
+#define MOCK_FDCAN_IR_RX_FIFO1		(FDCAN_IR_RF1L | FDCAN_IR_RF1F | FDCAN_IR_RF1N)
+#define MOCK_FDCAN_IR_ERROR		(FDCAN_IR_ELO | FDCAN_IR_WDI | FDCAN_IR_PEA | FDCAN_IR_PED | FDCAN_IR_ARA | FDCAN_IR_MRAF)
+#define MOCK_FDCAN_IR_ERROR_STATUS	(FDCAN_IR_EP | FDCAN_IR_EW | FDCAN_IR_BO)
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <string.h>
+#include "stm32_mock_fdcan.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+typedef struct
+{
+	FDCAN_HandleTypeDef *handle;
+	uint32_t rx_get[2];
+	uint32_t rx_fill[2];
+	uint32_t tef_get;
+	uint32_t tef_fill;
+	uint32_t tx_get;
+	uint32_t ts_prescaler_cnt;
+}mock_fdcan_t;
+
+FDCAN_GlobalTypeDef mock_fdcan_regs[MOCK_FDCAN_INSTANCES];
+uint32_t mock_fdcan_sram[MOCK_FDCAN_INSTANCES][SRAMCAN_SIZE];
+
+static mock_fdcan_t mock_fdcan[MOCK_FDCAN_INSTANCES];
+static uint32_t mock_fdcan_auto_transmit = 1;
+static uint64_t mock_fdcan_frames = 0;
+static uint64_t mock_fdcan_clocks = 0;
+static mock_fdcan_bus_hook_t mock_fdcan_hook = NULL;
+
+static const uint8_t mock_fdcan_dlc_bytes[16] = {0,1,2,3,4,5,6,7,8,12,16,20,24,32,48,64};
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static uint32_t mock_fdcan_index(FDCAN_GlobalTypeDef *instance);
+static uint32_t* mock_fdcan_ram(FDCAN_GlobalTypeDef *instance);
+static uint32_t mock_fdcan_started(FDCAN_GlobalTypeDef *instance);
+static void mock_fdcan_status_update(uint32_t idx);
+static uint32_t mock_fdcan_bit_clocks(FDCAN_GlobalTypeDef *regs, uint32_t data);
+static void mock_fdcan_bits_elapsed(uint32_t idx, uint32_t bits);
+static void mock_fdcan_receive(uint32_t idx, const uint32_t *element);
+static void mock_fdcan_bus_put(int32_t src, const uint32_t *element);
+static uint32_t mock_fdcan_next_tx(uint32_t idx);
+static void mock_fdcan_transmit(uint32_t idx, uint32_t buffer);
+static void mock_fdcan_transmit_pending(void);
+static void mock_fdcan_sync(void);
+static void mock_fdcan_service(void);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static uint32_t mock_fdcan_index(FDCAN_GlobalTypeDef *instance)
+{
+	return (uint32_t)(instance - &mock_fdcan_regs[0]);
+}
+
+static uint32_t* mock_fdcan_ram(FDCAN_GlobalTypeDef *instance)
+{
+	return mock_fdcan_sram[mock_fdcan_index(instance)];
+}
+
+static uint32_t mock_fdcan_started(FDCAN_GlobalTypeDef *instance)
+{
+	return (instance->CCCR & FDCAN_CCCR_INIT) == 0 && mock_fdcan[mock_fdcan_index(instance)].handle != NULL;
+}
+
+static void mock_fdcan_status_update(uint32_t idx)
+{
+	FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[idx];
+	mock_fdcan_t *p = &mock_fdcan[idx];
+	uint32_t pending = (uint32_t)__builtin_popcount(regs->TXBRP & 0x7U);
+	uint32_t put;
+
+	regs->RXF0S = (regs->RXF0S & FDCAN_RXF0S_RF0L)
+				| (p->rx_fill[0] << FDCAN_RXF0S_F0FL_Pos)
+				| (p->rx_get[0] << FDCAN_RXF0S_F0GI_Pos)
+				| (((p->rx_get[0] + p->rx_fill[0]) % SRAMCAN_RF0_NBR) << FDCAN_RXF0S_F0PI_Pos)
+				| (p->rx_fill[0] == SRAMCAN_RF0_NBR ? FDCAN_RXF0S_F0F : 0);
+	regs->RXF1S = (regs->RXF1S & FDCAN_RXF1S_RF1L)
+				| (p->rx_fill[1] << FDCAN_RXF1S_F1FL_Pos)
+				| (p->rx_get[1] << FDCAN_RXF1S_F1GI_Pos)
+				| (((p->rx_get[1] + p->rx_fill[1]) % SRAMCAN_RF1_NBR) << FDCAN_RXF1S_F1PI_Pos)
+				| (p->rx_fill[1] == SRAMCAN_RF1_NBR ? FDCAN_RXF1S_F1F : 0);
+	regs->TXEFS = (regs->TXEFS & FDCAN_TXEFS_TEFL)
+				| (p->tef_fill << FDCAN_TXEFS_EFFL_Pos)
+				| (p->tef_get << FDCAN_TXEFS_EFGI_Pos)
+				| (((p->tef_get + p->tef_fill) % SRAMCAN_TEF_NBR) << FDCAN_TXEFS_EFPI_Pos)
+				| (p->tef_fill == SRAMCAN_TEF_NBR ? FDCAN_TXEFS_EFF : 0);
+
+	if((regs->TXBC & FDCAN_TXBC_TFQM) == 0)
+	{
+		put = (p->tx_get + pending) % SRAMCAN_TFQ_NBR;
+	}
+	else
+	{
+		for(put=0;put<SRAMCAN_TFQ_NBR;put++)
+			if((regs->TXBRP & (1U << put)) == 0)
+				break;
+		put = put % SRAMCAN_TFQ_NBR;
+	}
+
+	regs->TXFQS = ((SRAMCAN_TFQ_NBR - pending) << FDCAN_TXFQS_TFFL_Pos)
+				| (p->tx_get << FDCAN_TXFQS_TFGI_Pos)
+				| (put << FDCAN_TXFQS_TFQPI_Pos)
+				| (pending == SRAMCAN_TFQ_NBR ? FDCAN_TXFQS_TFQF : 0);
+}
+
+/* Kernel clocks per nominal or data phase bit, 1 sync + seg1 + seg2 quanta */
+static uint32_t mock_fdcan_bit_clocks(FDCAN_GlobalTypeDef *regs, uint32_t data)
+{
+	if(data)
+		return (((regs->DBTP >> FDCAN_DBTP_DBRP_Pos) & 0x1FU) + 1U)
+			* (3U + ((regs->DBTP >> FDCAN_DBTP_DTSEG1_Pos) & 0x1FU) + ((regs->DBTP >> FDCAN_DBTP_DTSEG2_Pos) & 0xFU));
+	return (((regs->NBTP >> FDCAN_NBTP_NBRP_Pos) & 0x1FFU) + 1U)
+		* (3U + ((regs->NBTP >> FDCAN_NBTP_NTSEG1_Pos) & 0xFFU) + ((regs->NBTP >> FDCAN_NBTP_NTSEG2_Pos) & 0x7FU));
+}
+
+static void mock_fdcan_bits_elapsed(uint32_t idx, uint32_t bits)
+{
+	FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[idx];
+	mock_fdcan_t *p = &mock_fdcan[idx];
+	uint32_t prescaler = ((regs->TSCC & FDCAN_TSCC_TCP) >> FDCAN_TSCC_TCP_Pos) + 1U;
+	uint32_t ticks;
+	uint32_t tsc;
+
+	if((regs->TSCC & FDCAN_TSCC_TSS) != FDCAN_TIMESTAMP_INTERNAL)
+		return;
+
+	p->ts_prescaler_cnt += bits;
+	ticks = p->ts_prescaler_cnt / prescaler;
+	p->ts_prescaler_cnt %= prescaler;
+	if(ticks == 0)
+		return;
+
+	tsc = (regs->TSCV & FDCAN_TSCV_TSC) + ticks;
+	if(tsc > FDCAN_TSCV_TSC)
+		regs->IR |= FDCAN_IR_TSW;
+	regs->TSCV = tsc & FDCAN_TSCV_TSC;
+
+	if((regs->TOCC & FDCAN_TOCC_ETOC) != 0)
+	{
+		uint32_t tos = regs->TOCC & FDCAN_TOCC_TOS;
+		uint32_t running = tos == FDCAN_TIMEOUT_CONTINUOUS
+					|| (tos == FDCAN_TIMEOUT_RX_FIFO0 && p->rx_fill[0] != 0)
+					|| (tos == FDCAN_TIMEOUT_RX_FIFO1 && p->rx_fill[1] != 0)
+					|| (tos == FDCAN_TIMEOUT_TX_EVENT_FIFO && p->tef_fill != 0);
+		uint32_t toc = regs->TOCV & FDCAN_TOCV_TOC;
+
+		if(running && toc != 0)
+		{
+			toc = toc > ticks ? toc - ticks : 0;
+			regs->TOCV = toc;
+			if(toc == 0)
+			{
+				regs->IR |= FDCAN_IR_TOO;
+				if(tos == FDCAN_TIMEOUT_CONTINUOUS)
+					regs->TOCV = (regs->TOCC & FDCAN_TOCC_TOP) >> FDCAN_TOCC_TOP_Pos;
+			}
+		}
+	}
+}
+
+static void mock_fdcan_receive(uint32_t idx, const uint32_t *element)
+{
+	FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[idx];
+	mock_fdcan_t *p = &mock_fdcan[idx];
+	uint32_t *ram = mock_fdcan_sram[idx];
+	uint32_t xtd = (element[0] & MOCK_FDCAN_ELEMENT_XTD) != 0;
+	uint32_t rtr = (element[0] & MOCK_FDCAN_ELEMENT_RTR) != 0;
+	uint32_t id = xtd ? (element[0] & MOCK_FDCAN_ELEMENT_EXTID) : ((element[0] & MOCK_FDCAN_ELEMENT_STDID) >> 18);
+	uint32_t fifo = 0xFF;
+	uint32_t fidx = 0;
+	uint32_t anmf = 0;
+	uint32_t slot;
+	uint32_t *dst;
+
+	if((element[1] & MOCK_FDCAN_ELEMENT_FDF) != 0 && (regs->CCCR & FDCAN_CCCR_FDOE) == 0)
+		return;
+
+	if(rtr && (regs->RXGFC & (xtd ? FDCAN_RXGFC_RRFE : FDCAN_RXGFC_RRFS)) != 0)
+		return;
+
+	if(xtd == 0)
+	{
+		uint32_t cnt = (regs->RXGFC & FDCAN_RXGFC_LSS) >> FDCAN_RXGFC_LSS_Pos;
+		for(uint32_t i=0;i<cnt && fifo == 0xFF;i++)
+		{
+			uint32_t s0 = ram[SRAMCAN_FLSSA + i];
+			uint32_t sft = (s0 >> 30) & 0x3U;
+			uint32_t sfec = (s0 >> 27) & 0x7U;
+			uint32_t id1 = (s0 >> 16) & 0x7FFU;
+			uint32_t id2 = s0 & 0x7FFU;
+			uint32_t match = 0;
+
+			if(sfec == FDCAN_FILTER_DISABLE)
+				continue;
+			if(sft == FDCAN_FILTER_RANGE)
+				match = id >= id1 && id <= id2;
+			else if(sft == FDCAN_FILTER_DUAL)
+				match = id == id1 || id == id2;
+			else if(sft == FDCAN_FILTER_MASK)
+				match = (id & id2) == (id1 & id2);
+			if(!match)
+				continue;
+
+			fidx = i;
+			if(sfec == FDCAN_FILTER_REJECT)
+				return;
+			fifo = (sfec == FDCAN_FILTER_TO_RXFIFO1 || sfec == FDCAN_FILTER_TO_RXFIFO1_HP) ? 1 : 0;
+			if(sfec == FDCAN_FILTER_HP)
+				return;
+		}
+		if(fifo == 0xFF)
+		{
+			uint32_t anfs = (regs->RXGFC & FDCAN_RXGFC_ANFS) >> FDCAN_RXGFC_ANFS_Pos;
+			if(anfs >= FDCAN_REJECT)
+				return;
+			fifo = anfs;
+			anmf = 1;
+		}
+	}
+	else
+	{
+		uint32_t cnt = (regs->RXGFC & FDCAN_RXGFC_LSE) >> FDCAN_RXGFC_LSE_Pos;
+		uint32_t mid = id & regs->XIDAM;
+		for(uint32_t i=0;i<cnt && fifo == 0xFF;i++)
+		{
+			uint32_t f0 = ram[SRAMCAN_FLESA + i*SRAMCAN_FLE_SIZE];
+			uint32_t f1 = ram[SRAMCAN_FLESA + i*SRAMCAN_FLE_SIZE + 1];
+			uint32_t eft = (f1 >> 30) & 0x3U;
+			uint32_t efec = (f0 >> 29) & 0x7U;
+			uint32_t id1 = f0 & MOCK_FDCAN_ELEMENT_EXTID;
+			uint32_t id2 = f1 & MOCK_FDCAN_ELEMENT_EXTID;
+			uint32_t match = 0;
+
+			if(efec == FDCAN_FILTER_DISABLE)
+				continue;
+			if(eft == FDCAN_FILTER_RANGE)
+				match = mid >= id1 && mid <= id2;
+			else if(eft == FDCAN_FILTER_RANGE_NO_EIDM)
+				match = id >= id1 && id <= id2;
+			else if(eft == FDCAN_FILTER_DUAL)
+				match = mid == id1 || mid == id2;
+			else if(eft == FDCAN_FILTER_MASK)
+				match = (mid & id2) == (id1 & id2);
+			if(!match)
+				continue;
+
+			fidx = i;
+			if(efec == FDCAN_FILTER_REJECT)
+				return;
+			fifo = (efec == FDCAN_FILTER_TO_RXFIFO1 || efec == FDCAN_FILTER_TO_RXFIFO1_HP) ? 1 : 0;
+			if(efec == FDCAN_FILTER_HP)
+				return;
+		}
+		if(fifo == 0xFF)
+		{
+			uint32_t anfe = (regs->RXGFC & FDCAN_RXGFC_ANFE) >> FDCAN_RXGFC_ANFE_Pos;
+			if(anfe >= FDCAN_REJECT)
+				return;
+			fifo = anfe;
+			anmf = 1;
+		}
+	}
+
+	if(p->rx_fill[fifo] == SRAMCAN_RF0_NBR)
+	{
+		if((regs->RXGFC & (fifo == 0 ? FDCAN_RXGFC_F0OM : FDCAN_RXGFC_F1OM)) == 0)
+		{
+			regs->IR |= fifo == 0 ? FDCAN_IR_RF0L : FDCAN_IR_RF1L;
+			if(fifo == 0)
+				regs->RXF0S |= FDCAN_RXF0S_RF0L;
+			else
+				regs->RXF1S |= FDCAN_RXF1S_RF1L;
+			return;
+		}
+		p->rx_get[fifo] = (p->rx_get[fifo] + 1) % SRAMCAN_RF0_NBR;
+		p->rx_fill[fifo]--;
+	}
+
+	slot = (p->rx_get[fifo] + p->rx_fill[fifo]) % SRAMCAN_RF0_NBR;
+	dst = &ram[(fifo == 0 ? SRAMCAN_RF0SA : SRAMCAN_RF1SA) + slot*SRAMCAN_RF0_SIZE];
+	dst[0] = element[0];
+	dst[1] = (element[1] & (MOCK_FDCAN_ELEMENT_DLC | MOCK_FDCAN_ELEMENT_BRS | MOCK_FDCAN_ELEMENT_FDF))
+			| (regs->TSCV & FDCAN_TSCV_TSC)
+			| ((fidx & 0x7FU) << 24)
+			| (anmf << 31);
+	memcpy(&dst[2], &element[2], 64);
+	p->rx_fill[fifo]++;
+
+	if(fifo == 0)
+	{
+		regs->IR |= FDCAN_IR_RF0N | (p->rx_fill[0] == SRAMCAN_RF0_NBR ? FDCAN_IR_RF0F : 0);
+		if((regs->TOCC & FDCAN_TOCC_TOS) == FDCAN_TIMEOUT_RX_FIFO0 && p->rx_fill[0] == 1)
+			regs->TOCV = (regs->TOCC & FDCAN_TOCC_TOP) >> FDCAN_TOCC_TOP_Pos;
+	}
+	else
+	{
+		regs->IR |= FDCAN_IR_RF1N | (p->rx_fill[1] == SRAMCAN_RF1_NBR ? FDCAN_IR_RF1F : 0);
+		if((regs->TOCC & FDCAN_TOCC_TOS) == FDCAN_TIMEOUT_RX_FIFO1 && p->rx_fill[1] == 1)
+			regs->TOCV = (regs->TOCC & FDCAN_TOCC_TOP) >> FDCAN_TOCC_TOP_Pos;
+	}
+	mock_fdcan_status_update(idx);
+}
+
+static void mock_fdcan_bus_put(int32_t src, const uint32_t *element)
+{
+	uint32_t xtd = (element[0] & MOCK_FDCAN_ELEMENT_XTD) != 0;
+	uint32_t bytes = mock_fdcan_dlc_bytes[(element[1] & MOCK_FDCAN_ELEMENT_DLC) >> 16];
+	uint32_t bits = (xtd ? 67U : 47U) + bytes*8U;
+	uint32_t data_bits = 0;
+	uint32_t nominal_clocks;
+	uint32_t data_clocks;
+	uint32_t internal = 0;
+	FDCAN_GlobalTypeDef *timing = &mock_fdcan_regs[src >= 0 ? (uint32_t)src : 0U];
+
+	if(src >= 0)
+		internal = (mock_fdcan_regs[src].TEST & FDCAN_TEST_LBCK) != 0 && (mock_fdcan_regs[src].CCCR & FDCAN_CCCR_MON) != 0;
+
+	/* FD: arbitration up to BRS and the ACK/EOF/IFS tail at the nominal rate,
+	   ESI, DLC, data, stuff count and CRC at the data rate when BRS is set.
+	   Stuff bits are not modelled. */
+	if((element[1] & MOCK_FDCAN_ELEMENT_FDF) != 0)
+	{
+		data_bits = 5U + bytes*8U + 4U + (bytes > 16U ? 21U : 17U);
+		bits = (xtd ? 36U : 17U) + 13U;
+		if((element[1] & MOCK_FDCAN_ELEMENT_BRS) == 0)
+		{
+			bits += data_bits;
+			data_bits = 0;
+		}
+	}
+	nominal_clocks = mock_fdcan_bit_clocks(timing, 0);
+	data_clocks = data_bits*mock_fdcan_bit_clocks(timing, 1);
+	mock_fdcan_clocks += (uint64_t)bits*nominal_clocks + data_clocks;
+	bits += (data_clocks + nominal_clocks/2U)/nominal_clocks;
+
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+	{
+		if(!mock_fdcan_started(&mock_fdcan_regs[i]))
+			continue;
+		mock_fdcan_bits_elapsed(i, bits);
+		if((int32_t)i == src)
+		{
+			if((mock_fdcan_regs[i].TEST & FDCAN_TEST_LBCK) != 0)
+				mock_fdcan_receive(i, element);
+			continue;
+		}
+		if(internal || ((mock_fdcan_regs[i].CCCR & FDCAN_CCCR_MON) != 0 && (mock_fdcan_regs[i].TEST & FDCAN_TEST_LBCK) != 0))
+			continue;
+		mock_fdcan_receive(i, element);
+	}
+
+	mock_fdcan_frames++;
+	if(mock_fdcan_hook != NULL)
+		mock_fdcan_hook(src >= 0 ? &mock_fdcan_regs[src] : NULL, element);
+}
+
+static uint32_t mock_fdcan_next_tx(uint32_t idx)
+{
+	FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[idx];
+	uint32_t *ram = mock_fdcan_sram[idx];
+	uint32_t best = 0xFF;
+	uint32_t best_prio = 0xFFFFFFFFU;
+
+	if((regs->TXBRP & 0x7U) == 0)
+		return 0xFF;
+
+	if((regs->TXBC & FDCAN_TXBC_TFQM) == 0)
+		return mock_fdcan[idx].tx_get;
+
+	for(uint32_t i=0;i<SRAMCAN_TFQ_NBR;i++)
+	{
+		uint32_t t0;
+		uint32_t prio;
+
+		if((regs->TXBRP & (1U << i)) == 0)
+			continue;
+		t0 = ram[SRAMCAN_TFQSA + i*SRAMCAN_TFQ_SIZE];
+		prio = t0 & MOCK_FDCAN_ELEMENT_EXTID;
+		if(prio < best_prio)
+		{
+			best_prio = prio;
+			best = i;
+		}
+	}
+	return best;
+}
+
+static void mock_fdcan_transmit(uint32_t idx, uint32_t buffer)
+{
+	FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[idx];
+	mock_fdcan_t *p = &mock_fdcan[idx];
+	uint32_t *ram = mock_fdcan_sram[idx];
+	uint32_t *element = &ram[SRAMCAN_TFQSA + buffer*SRAMCAN_TFQ_SIZE];
+	uint32_t frame[SRAMCAN_TFQ_SIZE];
+
+	memcpy(frame, element, sizeof(frame));
+	if((regs->CCCR & FDCAN_CCCR_BRSE) == 0)
+		frame[1] &= ~MOCK_FDCAN_ELEMENT_BRS;
+
+	regs->TXBRP &= ~(1U << buffer);
+	regs->TXBTO |= 1U << buffer;
+	if((regs->TXBC & FDCAN_TXBC_TFQM) == 0)
+		p->tx_get = (p->tx_get + 1) % SRAMCAN_TFQ_NBR;
+
+	mock_fdcan_bus_put((int32_t)idx, frame);
+
+	if((regs->TXBTIE & (1U << buffer)) != 0)
+		regs->IR |= FDCAN_IR_TC;
+	if((regs->TXBRP & 0x7U) == 0)
+		regs->IR |= FDCAN_IR_TFE;
+
+	if((frame[1] & MOCK_FDCAN_ELEMENT_EFC) != 0)
+	{
+		if(p->tef_fill == SRAMCAN_TEF_NBR)
+		{
+			regs->IR |= FDCAN_IR_TEFL;
+			regs->TXEFS |= FDCAN_TXEFS_TEFL;
+		}
+		else
+		{
+			uint32_t slot = (p->tef_get + p->tef_fill) % SRAMCAN_TEF_NBR;
+			uint32_t *ev = &ram[SRAMCAN_TEFSA + slot*SRAMCAN_TEF_SIZE];
+			ev[0] = frame[0];
+			ev[1] = (frame[1] & (0xFFUL << 24 | MOCK_FDCAN_ELEMENT_FDF | MOCK_FDCAN_ELEMENT_BRS | MOCK_FDCAN_ELEMENT_DLC))
+				| FDCAN_TX_EVENT
+				| (regs->TSCV & FDCAN_TSCV_TSC);
+			p->tef_fill++;
+			regs->IR |= FDCAN_IR_TEFN | (p->tef_fill == SRAMCAN_TEF_NBR ? FDCAN_IR_TEFF : 0);
+		}
+	}
+	mock_fdcan_status_update(idx);
+}
+
+static void mock_fdcan_transmit_pending(void)
+{
+	uint32_t buffer;
+
+	if(mock_fdcan_auto_transmit == 0)
+		return;
+
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+	{
+		if(!mock_fdcan_started(&mock_fdcan_regs[i]))
+			continue;
+		while((buffer = mock_fdcan_next_tx(i)) != 0xFF)
+			mock_fdcan_transmit(i, buffer);
+	}
+}
+
+static void mock_fdcan_sync(void)
+{
+	uint32_t raised = 0;
+	uint32_t ir[MOCK_FDCAN_INSTANCES];
+
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+		ir[i] = mock_fdcan_regs[i].IR;
+
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+	{
+		FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[i];
+		mock_fdcan_t *p = &mock_fdcan[i];
+
+		if(p->handle == NULL)
+			continue;
+
+		if(regs->RXF0A != MOCK_FDCAN_REG_IDLE)
+		{
+			uint32_t ack = regs->RXF0A & FDCAN_RXF0A_F0AI;
+			uint32_t n = (ack + SRAMCAN_RF0_NBR - p->rx_get[0]) % SRAMCAN_RF0_NBR + 1;
+			if(n <= p->rx_fill[0])
+			{
+				p->rx_fill[0] -= n;
+				p->rx_get[0] = (ack + 1) % SRAMCAN_RF0_NBR;
+			}
+			regs->RXF0A = MOCK_FDCAN_REG_IDLE;
+		}
+		if(regs->RXF1A != MOCK_FDCAN_REG_IDLE)
+		{
+			uint32_t ack = regs->RXF1A & FDCAN_RXF1A_F1AI;
+			uint32_t n = (ack + SRAMCAN_RF1_NBR - p->rx_get[1]) % SRAMCAN_RF1_NBR + 1;
+			if(n <= p->rx_fill[1])
+			{
+				p->rx_fill[1] -= n;
+				p->rx_get[1] = (ack + 1) % SRAMCAN_RF1_NBR;
+			}
+			regs->RXF1A = MOCK_FDCAN_REG_IDLE;
+		}
+		if(regs->TXEFA != MOCK_FDCAN_REG_IDLE)
+		{
+			uint32_t ack = regs->TXEFA & FDCAN_TXEFA_EFAI;
+			uint32_t n = (ack + SRAMCAN_TEF_NBR - p->tef_get) % SRAMCAN_TEF_NBR + 1;
+			if(n <= p->tef_fill)
+			{
+				p->tef_fill -= n;
+				p->tef_get = (ack + 1) % SRAMCAN_TEF_NBR;
+			}
+			regs->TXEFA = MOCK_FDCAN_REG_IDLE;
+		}
+		if(regs->TXBCR != 0)
+		{
+			uint32_t cancel = regs->TXBCR & regs->TXBRP & 0x7U;
+			regs->TXBRP &= ~cancel;
+			regs->TXBCF |= cancel;
+			if((regs->TXBCIE & cancel) != 0)
+				regs->IR |= FDCAN_IR_TCF;
+			if((regs->TXBC & FDCAN_TXBC_TFQM) == 0)
+			{
+				while(cancel != 0 && (cancel & (1U << p->tx_get)) != 0)
+				{
+					cancel &= ~(1U << p->tx_get);
+					p->tx_get = (p->tx_get + 1) % SRAMCAN_TFQ_NBR;
+				}
+			}
+			regs->TXBCR = 0;
+		}
+		if(regs->TXBAR != 0)
+		{
+			regs->TXBRP |= regs->TXBAR & 0x7U;
+			regs->TXBTO &= ~(regs->TXBAR & 0x7U);
+			regs->TXBCF &= ~(regs->TXBAR & 0x7U);
+			regs->TXBAR = 0;
+		}
+		/* Bus-off recovery sequence: 128 x 11 recessive bits once INIT is cleared */
+		if((regs->CCCR & FDCAN_CCCR_INIT) == 0 && (regs->PSR & FDCAN_PSR_BO) != 0)
+		{
+			regs->PSR &= ~(FDCAN_PSR_BO | FDCAN_PSR_EP | FDCAN_PSR_EW);
+			regs->ECR = 0;
+			mock_fdcan_bits_elapsed(i, 128U*11U);
+		}
+		mock_fdcan_status_update(i);
+	}
+	mock_fdcan_transmit_pending();
+
+	/* Register writes from the driver (TXBAR, acknowledges) may raise flags */
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+		raised |= (mock_fdcan_regs[i].IR & ~ir[i]) & mock_fdcan_regs[i].IE;
+	if(raised != 0)
+		mock_irq_pend();
+}
+
+static void mock_fdcan_service(void)
+{
+	mock_fdcan_sync();
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+	{
+		FDCAN_GlobalTypeDef *regs = &mock_fdcan_regs[i];
+
+		if(mock_fdcan[i].handle == NULL)
+			continue;
+		if((regs->IR & regs->IE) != 0 && (regs->ILE & (FDCAN_ILE_EINT0 | FDCAN_ILE_EINT1)) != 0)
+			HAL_FDCAN_IRQHandler(mock_fdcan[i].handle);
+	}
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+HAL_StatusTypeDef HAL_FDCAN_Init(FDCAN_HandleTypeDef *hfdcan)
+{
+	FDCAN_GlobalTypeDef *regs;
+	uint32_t idx;
+	uintptr_t base;
+
+	if(hfdcan == NULL || hfdcan->Instance == NULL)
+		return HAL_ERROR;
+
+	mock_irq_attach(mock_fdcan_sync, mock_fdcan_service);
+
+	if(hfdcan->State == HAL_FDCAN_STATE_RESET)
+	{
+		hfdcan->Lock = HAL_UNLOCKED;
+		HAL_FDCAN_MspInit(hfdcan);
+	}
+
+	regs = hfdcan->Instance;
+	idx = mock_fdcan_index(regs);
+	memset((void*)regs, 0, sizeof(*regs));
+	memset(&mock_fdcan[idx], 0, sizeof(mock_fdcan[idx]));
+	memset(mock_fdcan_sram[idx], 0, sizeof(mock_fdcan_sram[idx]));
+	mock_fdcan[idx].handle = hfdcan;
+
+	regs->CREL = 0x32141218U;
+	regs->ENDN = 0x87654321U;
+	regs->CCCR = FDCAN_CCCR_INIT | FDCAN_CCCR_CCE;
+	regs->XIDAM = MOCK_FDCAN_ELEMENT_EXTID;
+	regs->RXF0A = MOCK_FDCAN_REG_IDLE;
+	regs->RXF1A = MOCK_FDCAN_REG_IDLE;
+	regs->TXEFA = MOCK_FDCAN_REG_IDLE;
+
+	if(hfdcan->Init.AutoRetransmission == DISABLE)
+		regs->CCCR |= FDCAN_CCCR_DAR;
+	if(hfdcan->Init.TransmitPause == ENABLE)
+		regs->CCCR |= FDCAN_CCCR_TXP;
+	regs->CCCR |= hfdcan->Init.FrameFormat;
+
+	switch(hfdcan->Init.Mode)
+	{
+	case FDCAN_MODE_RESTRICTED_OPERATION:
+		regs->CCCR |= FDCAN_CCCR_ASM;
+		break;
+	case FDCAN_MODE_BUS_MONITORING:
+		regs->CCCR |= FDCAN_CCCR_MON;
+		break;
+	case FDCAN_MODE_INTERNAL_LOOPBACK:
+		regs->CCCR |= FDCAN_CCCR_TEST | FDCAN_CCCR_MON;
+		regs->TEST |= FDCAN_TEST_LBCK;
+		break;
+	case FDCAN_MODE_EXTERNAL_LOOPBACK:
+		regs->CCCR |= FDCAN_CCCR_TEST;
+		regs->TEST |= FDCAN_TEST_LBCK;
+		break;
+	default:
+		break;
+	}
+
+	regs->NBTP = ((hfdcan->Init.NominalSyncJumpWidth - 1U) << FDCAN_NBTP_NSJW_Pos)
+				| ((hfdcan->Init.NominalTimeSeg1 - 1U) << FDCAN_NBTP_NTSEG1_Pos)
+				| ((hfdcan->Init.NominalTimeSeg2 - 1U) << FDCAN_NBTP_NTSEG2_Pos)
+				| ((hfdcan->Init.NominalPrescaler - 1U) << FDCAN_NBTP_NBRP_Pos);
+	if(hfdcan->Init.FrameFormat == FDCAN_FRAME_FD_BRS)
+		regs->DBTP = ((hfdcan->Init.DataSyncJumpWidth - 1U) << FDCAN_DBTP_DSJW_Pos)
+					| ((hfdcan->Init.DataTimeSeg1 - 1U) << FDCAN_DBTP_DTSEG1_Pos)
+					| ((hfdcan->Init.DataTimeSeg2 - 1U) << FDCAN_DBTP_DTSEG2_Pos)
+					| ((hfdcan->Init.DataPrescaler - 1U) << FDCAN_DBTP_DBRP_Pos);
+
+	regs->TXBC = hfdcan->Init.TxFifoQueueMode;
+	regs->RXGFC = (hfdcan->Init.StdFiltersNbr << FDCAN_RXGFC_LSS_Pos) | (hfdcan->Init.ExtFiltersNbr << FDCAN_RXGFC_LSE_Pos);
+
+	base = (uintptr_t)mock_fdcan_sram[idx];
+	hfdcan->msgRam.StandardFilterSA = base + SRAMCAN_FLSSA*4U;
+	hfdcan->msgRam.ExtendedFilterSA = base + SRAMCAN_FLESA*4U;
+	hfdcan->msgRam.RxFIFO0SA = base + SRAMCAN_RF0SA*4U;
+	hfdcan->msgRam.RxFIFO1SA = base + SRAMCAN_RF1SA*4U;
+	hfdcan->msgRam.TxEventFIFOSA = base + SRAMCAN_TEFSA*4U;
+	hfdcan->msgRam.TxFIFOQSA = base + SRAMCAN_TFQSA*4U;
+
+	mock_fdcan_status_update(idx);
+	hfdcan->LatestTxFifoQRequest = 0U;
+	hfdcan->ErrorCode = HAL_FDCAN_ERROR_NONE;
+	hfdcan->State = HAL_FDCAN_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DeInit(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan == NULL || hfdcan->Instance == NULL)
+		return HAL_ERROR;
+
+	(void)HAL_FDCAN_Stop(hfdcan);
+	hfdcan->Instance->IE = 0;
+	hfdcan->Instance->ILE = 0;
+	hfdcan->Instance->IR = 0;
+	HAL_FDCAN_MspDeInit(hfdcan);
+	hfdcan->ErrorCode = HAL_FDCAN_ERROR_NONE;
+	hfdcan->State = HAL_FDCAN_STATE_RESET;
+	return HAL_OK;
+}
+
+__weak void HAL_FDCAN_MspInit(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_MspDeInit(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigFilter(FDCAN_HandleTypeDef *hfdcan, FDCAN_FilterTypeDef *sFilterConfig)
+{
+	uint32_t *ram;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_READY && hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+
+	ram = mock_fdcan_ram(hfdcan->Instance);
+	if(sFilterConfig->IdType == FDCAN_STANDARD_ID)
+	{
+		if(sFilterConfig->FilterIndex >= SRAMCAN_FLS_NBR || sFilterConfig->FilterID1 > 0x7FFU || sFilterConfig->FilterID2 > 0x7FFU)
+		{
+			hfdcan->ErrorCode |= HAL_FDCAN_ERROR_PARAM;
+			return HAL_ERROR;
+		}
+		ram[SRAMCAN_FLSSA + sFilterConfig->FilterIndex] = (sFilterConfig->FilterType << 30U)
+								| (sFilterConfig->FilterConfig << 27U)
+								| (sFilterConfig->FilterID1 << 16U)
+								| sFilterConfig->FilterID2;
+	}
+	else
+	{
+		if(sFilterConfig->FilterIndex >= SRAMCAN_FLE_NBR || sFilterConfig->FilterID1 > MOCK_FDCAN_ELEMENT_EXTID || sFilterConfig->FilterID2 > MOCK_FDCAN_ELEMENT_EXTID)
+		{
+			hfdcan->ErrorCode |= HAL_FDCAN_ERROR_PARAM;
+			return HAL_ERROR;
+		}
+		ram[SRAMCAN_FLESA + sFilterConfig->FilterIndex*SRAMCAN_FLE_SIZE] = (sFilterConfig->FilterConfig << 29U) | sFilterConfig->FilterID1;
+		ram[SRAMCAN_FLESA + sFilterConfig->FilterIndex*SRAMCAN_FLE_SIZE + 1] = (sFilterConfig->FilterType << 30U) | sFilterConfig->FilterID2;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigGlobalFilter(FDCAN_HandleTypeDef *hfdcan, uint32_t NonMatchingStd, uint32_t NonMatchingExt, uint32_t RejectRemoteStd, uint32_t RejectRemoteExt)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->RXGFC = (hfdcan->Instance->RXGFC & ~(FDCAN_RXGFC_ANFS | FDCAN_RXGFC_ANFE | FDCAN_RXGFC_RRFS | FDCAN_RXGFC_RRFE))
+				| (NonMatchingStd << FDCAN_RXGFC_ANFS_Pos)
+				| (NonMatchingExt << FDCAN_RXGFC_ANFE_Pos)
+				| (RejectRemoteStd != 0 ? FDCAN_RXGFC_RRFS : 0)
+				| (RejectRemoteExt != 0 ? FDCAN_RXGFC_RRFE : 0);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigRxFifoOverwrite(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo, uint32_t OperationMode)
+{
+	uint32_t bit = RxFifo == FDCAN_RX_FIFO0 ? FDCAN_RXGFC_F0OM : FDCAN_RXGFC_F1OM;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	if(OperationMode == FDCAN_RX_FIFO_OVERWRITE)
+		hfdcan->Instance->RXGFC |= bit;
+	else
+		hfdcan->Instance->RXGFC &= ~bit;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimestampCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimestampPrescaler)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TSCC = (hfdcan->Instance->TSCC & ~FDCAN_TSCC_TCP) | (TimestampPrescaler & FDCAN_TSCC_TCP);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTimestampCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimestampOperation)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TSCC = (hfdcan->Instance->TSCC & ~FDCAN_TSCC_TSS) | (TimestampOperation & FDCAN_TSCC_TSS);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DisableTimestampCounter(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TSCC &= ~FDCAN_TSCC_TSS;
+	return HAL_OK;
+}
+
+uint16_t HAL_FDCAN_GetTimestampCounter(FDCAN_HandleTypeDef *hfdcan)
+{
+	return (uint16_t)(hfdcan->Instance->TSCV & FDCAN_TSCV_TSC);
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTimeoutCounter(FDCAN_HandleTypeDef *hfdcan, uint32_t TimeoutOperation, uint32_t TimeoutPeriod)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TOCC = (hfdcan->Instance->TOCC & ~(FDCAN_TOCC_TOP | FDCAN_TOCC_TOS))
+				| TimeoutOperation
+				| ((TimeoutPeriod - 1U) << FDCAN_TOCC_TOP_Pos);
+	hfdcan->Instance->TOCV = TimeoutPeriod - 1U;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTimeoutCounter(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TOCC |= FDCAN_TOCC_ETOC;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DisableTimeoutCounter(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TOCC &= ~FDCAN_TOCC_ETOC;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ResetTimeoutCounter(FDCAN_HandleTypeDef *hfdcan)
+{
+	if((hfdcan->Instance->TOCC & FDCAN_TOCC_TOS) != FDCAN_TIMEOUT_CONTINUOUS)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_SUPPORTED;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TOCV = (hfdcan->Instance->TOCC & FDCAN_TOCC_TOP) >> FDCAN_TOCC_TOP_Pos;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan, uint32_t TdcOffset, uint32_t TdcFilter)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TDCR = (TdcFilter << FDCAN_TDCR_TDCF_Pos) | (TdcOffset << FDCAN_TDCR_TDCO_Pos);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_EnableTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->DBTP |= FDCAN_DBTP_TDC;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DisableTxDelayCompensation(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->DBTP &= ~FDCAN_DBTP_TDC;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ConfigInterruptLines(FDCAN_HandleTypeDef *hfdcan, uint32_t ITList, uint32_t InterruptLine)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY && hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	if(InterruptLine == FDCAN_INTERRUPT_LINE0)
+		hfdcan->Instance->ILS &= ~ITList;
+	else
+		hfdcan->Instance->ILS |= ITList;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_Start(FDCAN_HandleTypeDef *hfdcan)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_READY;
+		return HAL_ERROR;
+	}
+	hfdcan->State = HAL_FDCAN_STATE_BUSY;
+	hfdcan->Instance->CCCR &= ~(FDCAN_CCCR_INIT | FDCAN_CCCR_CCE);
+	hfdcan->ErrorCode = HAL_FDCAN_ERROR_NONE;
+	mock_fdcan_sync();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_Stop(FDCAN_HandleTypeDef *hfdcan)
+{
+	uint32_t idx;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+	idx = mock_fdcan_index(hfdcan->Instance);
+	hfdcan->Instance->CCCR |= FDCAN_CCCR_INIT | FDCAN_CCCR_CCE;
+	hfdcan->Instance->TXBRP = 0;
+	mock_fdcan[idx].tx_get = 0;
+	mock_fdcan_status_update(idx);
+	hfdcan->LatestTxFifoQRequest = 0U;
+	hfdcan->State = HAL_FDCAN_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_AddMessageToTxFifoQ(FDCAN_HandleTypeDef *hfdcan, FDCAN_TxHeaderTypeDef *pTxHeader, uint8_t *pTxData)
+{
+	uint32_t *ram;
+	uint32_t *element;
+	uint32_t put;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+
+	mock_fdcan_sync();
+	if((hfdcan->Instance->TXFQS & FDCAN_TXFQS_TFQF) != 0)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_FIFO_FULL;
+		return HAL_ERROR;
+	}
+
+	put = (hfdcan->Instance->TXFQS & FDCAN_TXFQS_TFQPI) >> FDCAN_TXFQS_TFQPI_Pos;
+	ram = mock_fdcan_ram(hfdcan->Instance);
+	element = &ram[SRAMCAN_TFQSA + put*SRAMCAN_TFQ_SIZE];
+
+	if(pTxHeader->IdType == FDCAN_STANDARD_ID)
+		element[0] = pTxHeader->ErrorStateIndicator | FDCAN_STANDARD_ID | pTxHeader->TxFrameType | (pTxHeader->Identifier << 18U);
+	else
+		element[0] = pTxHeader->ErrorStateIndicator | FDCAN_EXTENDED_ID | pTxHeader->TxFrameType | pTxHeader->Identifier;
+	element[1] = (pTxHeader->MessageMarker << 24U)
+				| pTxHeader->TxEventFifoControl
+				| pTxHeader->FDFormat
+				| pTxHeader->BitRateSwitch
+				| pTxHeader->DataLength;
+	memset(&element[2], 0, 64);
+	memcpy(&element[2], pTxData, mock_fdcan_dlc_bytes[(pTxHeader->DataLength >> 16U) & 0xFU]);
+
+	hfdcan->Instance->TXBAR = 1U << put;
+	hfdcan->LatestTxFifoQRequest = 1U << put;
+	mock_fdcan_sync();
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+uint32_t HAL_FDCAN_GetLatestTxFifoQRequestBuffer(FDCAN_HandleTypeDef *hfdcan)
+{
+	return hfdcan->LatestTxFifoQRequest;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_AbortTxRequest(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndex)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->TXBCR = BufferIndex;
+	mock_fdcan_sync();
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetRxMessage(FDCAN_HandleTypeDef *hfdcan, uint32_t RxLocation, FDCAN_RxHeaderTypeDef *pRxHeader, uint8_t *pRxData)
+{
+	uint32_t *ram;
+	uint32_t *element;
+	uint32_t get;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+
+	mock_fdcan_sync();
+	ram = mock_fdcan_ram(hfdcan->Instance);
+	if(RxLocation == FDCAN_RX_FIFO0)
+	{
+		if((hfdcan->Instance->RXF0S & FDCAN_RXF0S_F0FL) == 0)
+		{
+			hfdcan->ErrorCode |= HAL_FDCAN_ERROR_FIFO_EMPTY;
+			return HAL_ERROR;
+		}
+		get = (hfdcan->Instance->RXF0S & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+		element = &ram[SRAMCAN_RF0SA + get*SRAMCAN_RF0_SIZE];
+	}
+	else
+	{
+		if((hfdcan->Instance->RXF1S & FDCAN_RXF1S_F1FL) == 0)
+		{
+			hfdcan->ErrorCode |= HAL_FDCAN_ERROR_FIFO_EMPTY;
+			return HAL_ERROR;
+		}
+		get = (hfdcan->Instance->RXF1S & FDCAN_RXF1S_F1GI) >> FDCAN_RXF1S_F1GI_Pos;
+		element = &ram[SRAMCAN_RF1SA + get*SRAMCAN_RF1_SIZE];
+	}
+
+	pRxHeader->IdType = element[0] & MOCK_FDCAN_ELEMENT_XTD;
+	if(pRxHeader->IdType == FDCAN_STANDARD_ID)
+		pRxHeader->Identifier = (element[0] & MOCK_FDCAN_ELEMENT_STDID) >> 18U;
+	else
+		pRxHeader->Identifier = element[0] & MOCK_FDCAN_ELEMENT_EXTID;
+	pRxHeader->RxFrameType = element[0] & MOCK_FDCAN_ELEMENT_RTR;
+	pRxHeader->ErrorStateIndicator = element[0] & MOCK_FDCAN_ELEMENT_ESI;
+	pRxHeader->RxTimestamp = element[1] & MOCK_FDCAN_ELEMENT_TS;
+	pRxHeader->DataLength = element[1] & MOCK_FDCAN_ELEMENT_DLC;
+	pRxHeader->BitRateSwitch = element[1] & MOCK_FDCAN_ELEMENT_BRS;
+	pRxHeader->FDFormat = element[1] & MOCK_FDCAN_ELEMENT_FDF;
+	pRxHeader->FilterIndex = (element[1] >> 24U) & 0x7FU;
+	pRxHeader->IsFilterMatchingFrame = element[1] >> 31U;
+	memcpy(pRxData, &element[2], mock_fdcan_dlc_bytes[pRxHeader->DataLength >> 16U]);
+
+	if(RxLocation == FDCAN_RX_FIFO0)
+		hfdcan->Instance->RXF0A = get;
+	else
+		hfdcan->Instance->RXF1A = get;
+	mock_fdcan_sync();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetTxEvent(FDCAN_HandleTypeDef *hfdcan, FDCAN_TxEventFifoTypeDef *pTxEvent)
+{
+	uint32_t *ram;
+	uint32_t *element;
+	uint32_t get;
+
+	if(hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_STARTED;
+		return HAL_ERROR;
+	}
+
+	mock_fdcan_sync();
+	if((hfdcan->Instance->TXEFS & FDCAN_TXEFS_EFFL) == 0)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_FIFO_EMPTY;
+		return HAL_ERROR;
+	}
+
+	ram = mock_fdcan_ram(hfdcan->Instance);
+	get = (hfdcan->Instance->TXEFS & FDCAN_TXEFS_EFGI) >> FDCAN_TXEFS_EFGI_Pos;
+	element = &ram[SRAMCAN_TEFSA + get*SRAMCAN_TEF_SIZE];
+
+	pTxEvent->IdType = element[0] & MOCK_FDCAN_ELEMENT_XTD;
+	if(pTxEvent->IdType == FDCAN_STANDARD_ID)
+		pTxEvent->Identifier = (element[0] & MOCK_FDCAN_ELEMENT_STDID) >> 18U;
+	else
+		pTxEvent->Identifier = element[0] & MOCK_FDCAN_ELEMENT_EXTID;
+	pTxEvent->TxFrameType = element[0] & MOCK_FDCAN_ELEMENT_RTR;
+	pTxEvent->ErrorStateIndicator = element[0] & MOCK_FDCAN_ELEMENT_ESI;
+	pTxEvent->TxTimestamp = element[1] & MOCK_FDCAN_ELEMENT_TS;
+	pTxEvent->DataLength = element[1] & MOCK_FDCAN_ELEMENT_DLC;
+	pTxEvent->BitRateSwitch = element[1] & MOCK_FDCAN_ELEMENT_BRS;
+	pTxEvent->FDFormat = element[1] & MOCK_FDCAN_ELEMENT_FDF;
+	pTxEvent->EventType = element[1] & (0x3UL << 22);
+	pTxEvent->MessageMarker = element[1] >> 24U;
+
+	hfdcan->Instance->TXEFA = get;
+	mock_fdcan_sync();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetProtocolStatus(FDCAN_HandleTypeDef *hfdcan, FDCAN_ProtocolStatusTypeDef *ProtocolStatus)
+{
+	uint32_t psr;
+
+	mock_fdcan_sync();
+	psr = hfdcan->Instance->PSR;
+
+	ProtocolStatus->LastErrorCode = psr & FDCAN_PSR_LEC;
+	ProtocolStatus->DataLastErrorCode = 0;
+	ProtocolStatus->Activity = psr & FDCAN_PSR_ACT;
+	ProtocolStatus->ErrorPassive = (psr & FDCAN_PSR_EP) != 0;
+	ProtocolStatus->Warning = (psr & FDCAN_PSR_EW) != 0;
+	ProtocolStatus->BusOff = (psr & FDCAN_PSR_BO) != 0;
+	ProtocolStatus->RxESIflag = 0;
+	ProtocolStatus->RxBRSflag = 0;
+	ProtocolStatus->RxFDFflag = 0;
+	ProtocolStatus->ProtocolException = 0;
+	ProtocolStatus->TDCvalue = (psr >> FDCAN_PSR_TDCV_Pos) & 0x7FU;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_GetErrorCounters(FDCAN_HandleTypeDef *hfdcan, FDCAN_ErrorCountersTypeDef *ErrorCounters)
+{
+	uint32_t ecr = hfdcan->Instance->ECR;
+
+	ErrorCounters->TxErrorCnt = ecr & FDCAN_ECR_TEC;
+	ErrorCounters->RxErrorCnt = (ecr & FDCAN_ECR_REC) >> FDCAN_ECR_REC_Pos;
+	ErrorCounters->RxErrorPassive = 0;
+	ErrorCounters->ErrorLogging = 0;
+	return HAL_OK;
+}
+
+uint32_t HAL_FDCAN_IsTxBufferMessagePending(FDCAN_HandleTypeDef *hfdcan, uint32_t TxBufferIndex)
+{
+	mock_fdcan_sync();
+	return (hfdcan->Instance->TXBRP & TxBufferIndex) != 0 ? 1U : 0U;
+}
+
+uint32_t HAL_FDCAN_GetRxFifoFillLevel(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo)
+{
+	mock_fdcan_sync();
+	if(RxFifo == FDCAN_RX_FIFO0)
+		return hfdcan->Instance->RXF0S & FDCAN_RXF0S_F0FL;
+	return hfdcan->Instance->RXF1S & FDCAN_RXF1S_F1FL;
+}
+
+uint32_t HAL_FDCAN_GetTxFifoFreeLevel(FDCAN_HandleTypeDef *hfdcan)
+{
+	mock_fdcan_sync();
+	return hfdcan->Instance->TXFQS & FDCAN_TXFQS_TFFL;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_ActivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t ActiveITs, uint32_t BufferIndexes)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY && hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->ILE |= FDCAN_ILE_EINT0 | FDCAN_ILE_EINT1;
+	if((ActiveITs & FDCAN_IT_TX_COMPLETE) != 0)
+		hfdcan->Instance->TXBTIE |= BufferIndexes;
+	if((ActiveITs & FDCAN_IT_TX_ABORT_COMPLETE) != 0)
+		hfdcan->Instance->TXBCIE |= BufferIndexes;
+	hfdcan->Instance->IE |= ActiveITs;
+	mock_irq_pend();
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FDCAN_DeactivateNotification(FDCAN_HandleTypeDef *hfdcan, uint32_t InactiveITs)
+{
+	if(hfdcan->State != HAL_FDCAN_STATE_READY && hfdcan->State != HAL_FDCAN_STATE_BUSY)
+	{
+		hfdcan->ErrorCode |= HAL_FDCAN_ERROR_NOT_INITIALIZED;
+		return HAL_ERROR;
+	}
+	hfdcan->Instance->IE &= ~InactiveITs;
+	if((InactiveITs & FDCAN_IT_TX_COMPLETE) != 0)
+		hfdcan->Instance->TXBTIE = 0;
+	if((InactiveITs & FDCAN_IT_TX_ABORT_COMPLETE) != 0)
+		hfdcan->Instance->TXBCIE = 0;
+	return HAL_OK;
+}
+
+void HAL_FDCAN_IRQHandler(FDCAN_HandleTypeDef *hfdcan)
+{
+	FDCAN_GlobalTypeDef *regs = hfdcan->Instance;
+	uint32_t ir = regs->IR & regs->IE;
+	uint32_t its;
+
+	if((ir & FDCAN_IR_HPM) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_HPM);
+		HAL_FDCAN_HighPriorityMessageCallback(hfdcan);
+	}
+	if((ir & FDCAN_IR_TCF) != 0)
+	{
+		its = regs->TXBCF & regs->TXBCIE;
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_TCF);
+		HAL_FDCAN_TxBufferAbortCallback(hfdcan, its);
+	}
+	if((its = ir & MOCK_FDCAN_IR_TX_EVENT) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, its);
+		HAL_FDCAN_TxEventFifoCallback(hfdcan, its);
+	}
+	if((its = ir & MOCK_FDCAN_IR_RX_FIFO0) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, its);
+		HAL_FDCAN_RxFifo0Callback(hfdcan, its);
+	}
+	if((its = ir & MOCK_FDCAN_IR_RX_FIFO1) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, its);
+		HAL_FDCAN_RxFifo1Callback(hfdcan, its);
+	}
+	if((ir & FDCAN_IR_TFE) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_TFE);
+		HAL_FDCAN_TxFifoEmptyCallback(hfdcan);
+	}
+	if((ir & FDCAN_IR_TC) != 0)
+	{
+		its = regs->TXBTO & regs->TXBTIE;
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_TC);
+		HAL_FDCAN_TxBufferCompleteCallback(hfdcan, its);
+	}
+	if((ir & FDCAN_IR_TSW) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_TSW);
+		HAL_FDCAN_TimestampWraparoundCallback(hfdcan);
+	}
+	if((ir & FDCAN_IR_TOO) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, FDCAN_IR_TOO);
+		HAL_FDCAN_TimeoutOccurredCallback(hfdcan);
+	}
+	if((its = ir & MOCK_FDCAN_IR_ERROR_STATUS) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, its);
+		HAL_FDCAN_ErrorStatusCallback(hfdcan, its);
+	}
+	if((its = ir & MOCK_FDCAN_IR_ERROR) != 0)
+	{
+		__HAL_FDCAN_CLEAR_FLAG(hfdcan, its);
+		hfdcan->ErrorCode |= its;
+		HAL_FDCAN_ErrorCallback(hfdcan);
+	}
+}
+
+__weak void HAL_FDCAN_TxEventFifoCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t TxEventFifoITs)
+{
+	(void)hfdcan;
+	(void)TxEventFifoITs;
+}
+
+__weak void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+{
+	(void)hfdcan;
+	(void)RxFifo0ITs;
+}
+
+__weak void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo1ITs)
+{
+	(void)hfdcan;
+	(void)RxFifo1ITs;
+}
+
+__weak void HAL_FDCAN_TxFifoEmptyCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes)
+{
+	(void)hfdcan;
+	(void)BufferIndexes;
+}
+
+__weak void HAL_FDCAN_TxBufferAbortCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t BufferIndexes)
+{
+	(void)hfdcan;
+	(void)BufferIndexes;
+}
+
+__weak void HAL_FDCAN_TimestampWraparoundCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_TimeoutOccurredCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_HighPriorityMessageCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_ErrorCallback(FDCAN_HandleTypeDef *hfdcan)
+{
+	(void)hfdcan;
+}
+
+__weak void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs)
+{
+	(void)hfdcan;
+	(void)ErrorStatusITs;
+}
+
+HAL_FDCAN_StateTypeDef HAL_FDCAN_GetState(FDCAN_HandleTypeDef *hfdcan)
+{
+	return hfdcan->State;
+}
+
+uint32_t HAL_FDCAN_GetError(FDCAN_HandleTypeDef *hfdcan)
+{
+	return hfdcan->ErrorCode;
+}
+
+/* --- Mock extensions ----------------------------------------------------- */
+
+void mock_fdcan_clear_flag(FDCAN_HandleTypeDef *hfdcan, uint32_t flags)
+{
+	hfdcan->Instance->IR &= ~flags;
+}
+
+void mock_fdcan_reset(void)
+{
+	memset(mock_fdcan_regs, 0, sizeof(mock_fdcan_regs));
+	memset(mock_fdcan_sram, 0, sizeof(mock_fdcan_sram));
+	memset(mock_fdcan, 0, sizeof(mock_fdcan));
+	mock_fdcan_auto_transmit = 1;
+	mock_fdcan_frames = 0;
+	mock_fdcan_clocks = 0;
+	mock_fdcan_hook = NULL;
+}
+
+void mock_fdcan_set_auto_transmit(uint32_t enable)
+{
+	mock_fdcan_auto_transmit = enable;
+	mock_fdcan_sync();
+	mock_irq_pend();
+}
+
+uint32_t mock_fdcan_bus_run(uint32_t frames)
+{
+	uint32_t sent = 0;
+
+	mock_fdcan_sync();
+	while(sent < frames)
+	{
+		uint32_t best_idx = 0xFF;
+		uint32_t best_buffer = 0xFF;
+		uint32_t best_prio = 0xFFFFFFFFU;
+
+		/* Bus arbitration across all controllers, lowest identifier wins */
+		for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+		{
+			uint32_t buffer;
+			uint32_t t0;
+			uint32_t prio;
+
+			if(!mock_fdcan_started(&mock_fdcan_regs[i]))
+				continue;
+			if((buffer = mock_fdcan_next_tx(i)) == 0xFF)
+				continue;
+			t0 = mock_fdcan_sram[i][SRAMCAN_TFQSA + buffer*SRAMCAN_TFQ_SIZE];
+			prio = t0 & MOCK_FDCAN_ELEMENT_EXTID;
+			if(prio < best_prio)
+			{
+				best_prio = prio;
+				best_idx = i;
+				best_buffer = buffer;
+			}
+		}
+		if(best_idx == 0xFF)
+			break;
+		mock_fdcan_transmit(best_idx, best_buffer);
+		sent++;
+		mock_irq_pend();
+		mock_fdcan_sync();
+	}
+	return sent;
+}
+
+void mock_fdcan_bus_hook(mock_fdcan_bus_hook_t hook)
+{
+	mock_fdcan_hook = hook;
+}
+
+void mock_fdcan_inject(FDCAN_TxHeaderTypeDef *pTxHeader, const uint8_t *pTxData)
+{
+	uint32_t element[SRAMCAN_TFQ_SIZE] = {0};
+
+	if(pTxHeader->IdType == FDCAN_STANDARD_ID)
+		element[0] = pTxHeader->ErrorStateIndicator | FDCAN_STANDARD_ID | pTxHeader->TxFrameType | (pTxHeader->Identifier << 18U);
+	else
+		element[0] = pTxHeader->ErrorStateIndicator | FDCAN_EXTENDED_ID | pTxHeader->TxFrameType | pTxHeader->Identifier;
+	element[1] = pTxHeader->FDFormat | pTxHeader->BitRateSwitch | pTxHeader->DataLength;
+	memcpy(&element[2], pTxData, mock_fdcan_dlc_bytes[(pTxHeader->DataLength >> 16U) & 0xFU]);
+
+	mock_fdcan_sync();
+	mock_fdcan_bus_put(-1, element);
+	mock_irq_pend();
+}
+
+void mock_fdcan_inject_bus_off(FDCAN_HandleTypeDef *hfdcan)
+{
+	FDCAN_GlobalTypeDef *regs = hfdcan->Instance;
+
+	regs->ECR = 0xFFU;
+	regs->PSR |= FDCAN_PSR_BO | FDCAN_PSR_EP | FDCAN_PSR_EW;
+	regs->CCCR |= FDCAN_CCCR_INIT;
+	regs->TXBRP = 0;
+	mock_fdcan[mock_fdcan_index(regs)].tx_get = 0;
+	mock_fdcan_status_update(mock_fdcan_index(regs));
+	regs->IR |= FDCAN_IR_BO;
+	mock_irq_pend();
+}
+
+/* Timestamp and timeout counters move on by `bits` nominal bit times */
+void mock_fdcan_bus_idle(uint32_t bits)
+{
+	mock_fdcan_sync();
+	for(uint32_t i=0;i<MOCK_FDCAN_INSTANCES;i++)
+		if(mock_fdcan_started(&mock_fdcan_regs[i]))
+			mock_fdcan_bits_elapsed(i, bits);
+	mock_fdcan_clocks += (uint64_t)bits*mock_fdcan_bit_clocks(&mock_fdcan_regs[0], 0);
+	mock_irq_pend();
+}
+
+uint64_t mock_fdcan_bus_frames(void)
+{
+	return mock_fdcan_frames;
+}
+
+uint64_t mock_fdcan_bus_clocks(void)
+{
+	return mock_fdcan_clocks;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
@@ -0,0 +1,287 @@
+/*!
+	@file   stm32_mock_hal.c
+	@brief  Host-side replacement of the STM32Cube HAL core & CMSIS intrinsics
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L
+
+#define MOCK_IRQ_SERVICES_MAX	4
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <pthread.h>
+#include <time.h>
+#include "stm32_mock_hal.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+static mock_irq_service_t mock_irq_syncs[MOCK_IRQ_SERVICES_MAX];
+static mock_irq_service_t mock_irq_services[MOCK_IRQ_SERVICES_MAX];
+static uint32_t mock_irq_services_cnt = 0;
+
+/* PRIMASK, pending and active state of the emulated NVIC. The driver runs
+   single threaded on the host, the ISR is entered synchronously whenever a
+   peripheral raises a request while interrupts are unmasked. The masks are
+   per core: threads playing tasks share core 0's, a thread playing the other
+   core of a dual-core part masks its own after mock_irq_core(1). */
+typedef struct
+{
+	volatile uint32_t primask;
+	volatile uint32_t basepri;
+}mock_nvic_t;
+
+static mock_nvic_t mock_nvic[2];
+static __thread mock_nvic_t *mock_nvic_self = &mock_nvic[0];
+static volatile uint32_t mock_irq_pending = 0;
+static uint8_t mock_nvic_prio[MOCK_IRQ_LINES];	/* Priority + 1, 0: MOCK_IRQ_PRIORITY */
+static volatile uint32_t mock_irq_active = 0;
+
+/* Host threads standing in for tasks: once bound, only the thread playing
+   the core's interrupt context enters the ISR, the others leave it pending. */
+static volatile uint32_t mock_irq_bound = 0;
+static pthread_t mock_irq_thread;
+
+/* Hardware semaphores, shared by the threads standing in for the two cores
+   of a dual-core part. A free sets its status bit whether notified or not,
+   like the raw HSEM interrupt status. */
+static volatile uint32_t mock_hsem_taken = 0;
+static volatile uint32_t mock_hsem_armed = 0;
+static volatile uint32_t mock_hsem_freed = 0;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void mock_irq_run(void);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static void mock_irq_run(void)
+{
+	if(mock_nvic_self != &mock_nvic[0])
+		return;
+	if(mock_nvic[0].primask != 0 || mock_irq_active != 0)
+		return;
+	if(mock_nvic[0].basepri != 0 && mock_nvic[0].basepri <= (MOCK_IRQ_PRIORITY << (8U - __NVIC_PRIO_BITS)))
+		return;
+	if(mock_irq_bound != 0 && !pthread_equal(pthread_self(), mock_irq_thread))
+		return;
+
+	mock_irq_active = 1;
+	while(mock_irq_pending != 0)
+	{
+		mock_irq_pending = 0;
+		for(register uint32_t i=0;i<mock_irq_services_cnt;i++)
+			mock_irq_services[i]();
+	}
+	mock_irq_active = 0;
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+uint32_t HAL_GetTick(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000U + ts.tv_nsec / 1000000U);
+}
+
+void HAL_Delay(uint32_t delay)
+{
+	uint32_t start = HAL_GetTick();
+	while((HAL_GetTick() - start) < delay);
+}
+
+/* Stands in for the DWT cycle counter, one cycle per nanosecond */
+uint32_t mock_cycles(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000000000U + ts.tv_nsec);
+}
+
+void __disable_irq(void)
+{
+	mock_nvic_self->primask = 1;
+}
+
+void __enable_irq(void)
+{
+	mock_nvic_self->primask = 0;
+	mock_irq_run();
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return mock_nvic_self->primask;
+}
+
+void __set_PRIMASK(uint32_t primask)
+{
+	if(primask != 0)
+		__disable_irq();
+	else
+		__enable_irq();
+}
+
+uint32_t __get_BASEPRI(void)
+{
+	return mock_nvic_self->basepri;
+}
+
+void __set_BASEPRI(uint32_t basepri)
+{
+	mock_nvic_self->basepri = basepri & 0xFFU;
+	mock_irq_run();
+}
+
+/* Only ever raises the masking level, as on the core */
+void __set_BASEPRI_MAX(uint32_t basepri)
+{
+	basepri &= 0xFFU;
+	if(basepri != 0 && (mock_nvic_self->basepri == 0 || basepri < mock_nvic_self->basepri))
+		mock_nvic_self->basepri = basepri;
+}
+
+void __DSB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(register uint32_t i=0;i<mock_irq_services_cnt;i++)
+		if(mock_irq_syncs[i] != NULL)
+			mock_irq_syncs[i]();
+	mock_irq_run();
+}
+
+void mock_irq_attach(mock_irq_service_t sync, mock_irq_service_t service)
+{
+	for(register uint32_t i=0;i<mock_irq_services_cnt;i++)
+		if(mock_irq_services[i] == service)
+			return;
+	if(mock_irq_services_cnt == MOCK_IRQ_SERVICES_MAX)
+		return;
+
+	mock_irq_syncs[mock_irq_services_cnt] = sync;
+	mock_irq_services[mock_irq_services_cnt] = service;
+	mock_irq_services_cnt++;
+}
+
+void mock_irq_pend(void)
+{
+	mock_irq_pending = 1;
+	mock_irq_run();
+}
+
+uint32_t mock_irq_in_isr(void)
+{
+	return mock_irq_active;
+}
+
+void mock_irq_bind(void)
+{
+	mock_irq_thread = pthread_self();
+	mock_irq_bound = 1;
+}
+
+/* The calling thread plays `core` from now on: 0 is the one the emulated
+   peripherals interrupt, 1 only has its masks of its own */
+void mock_irq_core(uint32_t core)
+{
+	mock_nvic_self = &mock_nvic[core != 0];
+}
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+	if((uint32_t)IRQn < MOCK_IRQ_LINES)
+		mock_nvic_prio[IRQn] = (uint8_t)((priority & ((1U << __NVIC_PRIO_BITS) - 1U)) + 1U);
+}
+
+uint32_t NVIC_GetPriority(IRQn_Type IRQn)
+{
+	if((uint32_t)IRQn >= MOCK_IRQ_LINES || mock_nvic_prio[IRQn] == 0)
+		return MOCK_IRQ_PRIORITY;
+	return mock_nvic_prio[IRQn] - 1U;
+}
+
+HAL_StatusTypeDef HAL_HSEM_FastTake(uint32_t SemID)
+{
+	uint32_t mask = __HAL_HSEM_SEMID_TO_MASK(SemID);
+
+	if((__atomic_fetch_or(&mock_hsem_taken, mask, __ATOMIC_ACQ_REL) & mask) != 0)
+		return HAL_ERROR;
+	return HAL_OK;
+}
+
+void HAL_HSEM_Release(uint32_t SemID, uint32_t ProcessID)
+{
+	uint32_t mask = __HAL_HSEM_SEMID_TO_MASK(SemID);
+
+	(void)ProcessID;
+	__atomic_fetch_and(&mock_hsem_taken, ~mask, __ATOMIC_ACQ_REL);
+	__atomic_fetch_or(&mock_hsem_freed, mask, __ATOMIC_ACQ_REL);
+}
+
+void HAL_HSEM_ActivateNotification(uint32_t SemMask)
+{
+	__atomic_fetch_or(&mock_hsem_armed, SemMask, __ATOMIC_ACQ_REL);
+}
+
+void HAL_HSEM_DeactivateNotification(uint32_t SemMask)
+{
+	__atomic_fetch_and(&mock_hsem_armed, ~SemMask, __ATOMIC_ACQ_REL);
+}
+
+__weak void HAL_HSEM_FreeCallback(uint32_t SemMask)
+{
+	(void)SemMask;
+}
+
+/* Polled by the thread playing the core that armed `SemMask`: takes the
+   notified frees, disarms them like HAL_HSEM_IRQHandler and runs the free
+   callback. Returns the semaphores it handled. */
+uint32_t mock_hsem_irq(uint32_t SemMask)
+{
+	uint32_t pending = __atomic_load_n(&mock_hsem_freed, __ATOMIC_ACQUIRE) & __atomic_load_n(&mock_hsem_armed, __ATOMIC_ACQUIRE) & SemMask;
+
+	if(pending == 0)
+		return 0;
+	__atomic_fetch_and(&mock_hsem_armed, ~pending, __ATOMIC_ACQ_REL);
+	__atomic_fetch_and(&mock_hsem_freed, ~pending, __ATOMIC_ACQ_REL);
+	HAL_HSEM_FreeCallback(pending);
+	return pending;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
@@ -0,0 +1,513 @@
+/*!
+	@file   test_can.c
+	@brief  Host checks of the bxCAN driver against the emulated peripheral
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define TEST_BULK_ID		0x700U
+#define TEST_BULK_FRAMES	64U
+#define TEST_URGENT_ID		0x010U
+#define TEST_URGENT_EVERY	8U
+#define TEST_LOG_SIZE		8U
+#define TEST_RECOVERY_ID	0x126U
+#define TEST_TP_REQUEST_ID	0x7E0U
+#define TEST_TP_RESPONSE_ID	0x7E8U
+#define TEST_TP_SESSIONS	4U
+#define TEST_TP_SIZE		100U
+#define TEST_FILTER_EXACT	40U
+#define TEST_FILTER_EXTRA	30U
+#define TEST_FILTER_EXT		3U
+#define TEST_RCU_ID		0x1C0U
+#define TEST_RCU_NODES		8U
+#define TEST_RCU_HITS		200000U
+#define TEST_RCU_CYCLES		20000U
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "test_common.h"
+#include <pthread.h>
+#include "drv_canbus.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* Both interfaces on one emulated bus, neither one hears its own frames */
+static canbus_t test_bus_a =
+{
+	.mx_init = MX_CAN1_Init,
+	.hcan = &hcan1,
+	.filters = NULL,
+	.filters_cnt = 0,
+	.callbacks = NULL
+};
+
+static canbus_t test_bus_b =
+{
+	.mx_init = MX_CAN2_Init,
+	.hcan = &hcan2,
+	.filters = NULL,
+	.filters_cnt = 0,
+	.callbacks = NULL
+};
+
+static uint32_t test_bulk_seen[TEST_BULK_FRAMES];
+static uint32_t test_bulk_stray = 0;
+static uint64_t test_urgent_queued = 0;
+static uint64_t test_urgent_wait_max = 0;
+static uint32_t test_urgent_cnt = 0;
+static uint32_t test_log[TEST_LOG_SIZE];
+static uint32_t test_log_cnt = 0;
+
+/* ECU A and B answer the same request id on their own interface, each
+   tester sits on the other interface */
+enum
+{
+	TEST_TP_ECU_A = 0,
+	TEST_TP_ECU_B,
+	TEST_TP_TESTER_A,
+	TEST_TP_TESTER_B
+};
+
+static canbus_isotp_t test_tp[TEST_TP_SESSIONS];
+static uint8_t test_tp_rx[TEST_TP_SESSIONS][TEST_TP_SIZE * 2U];
+static uint8_t test_tp_tx[TEST_TP_SESSIONS][TEST_TP_SIZE];
+static uint32_t test_tp_rx_cnt[TEST_TP_SESSIONS];
+static uint32_t test_tp_rx_len[TEST_TP_SESSIONS];
+static uint32_t test_tp_tx_cnt[TEST_TP_SESSIONS];
+static uint32_t test_tp_errors = 0;
+
+static uint32_t test_filter_hits[2];
+
+static canbus_callback_t test_rcu_nodes[TEST_RCU_NODES];
+static volatile uint32_t test_rcu_stop = 0;
+static volatile uint32_t test_rcu_cycles = 0;
+static volatile uint32_t test_rcu_failed = 0;
+static volatile uint64_t test_rcu_hits = 0;
+static volatile uint64_t test_rcu_stale = 0;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void test_setup(void);
+static void test_bus_hook(CAN_TypeDef *src, const CAN_TxMailBox_TypeDef *mailbox);
+static void test_tp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status);
+static void test_tp_tx_done(canbus_isotp_t *tp, i_status status);
+static void test_filter_callback_a(canbus_frame_t *frame);
+static void test_filter_callback_b(canbus_frame_t *frame);
+static void test_filter_sweep(canbus_t *from);
+static void test_rcu_callback(canbus_frame_t *frame);
+static void test_rcu_stale_callback(canbus_frame_t *frame);
+static void *test_rcu_writer(void *arg);
+static void test_preemption(void);
+static void test_recovery(void);
+static void test_irq_priority(void);
+static void test_isotp(void);
+static void test_filters(void);
+static void test_rcu(void);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static void test_setup(void)
+{
+	mock_can_reset();
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_OK);
+	TEST_CHECK(canbus_initialize(&test_bus_b) == I_OK);
+}
+
+/* Logs the ids in bus order, bulk frames numbered in their first byte */
+static void test_bus_hook(CAN_TypeDef *src, const CAN_TxMailBox_TypeDef *mailbox)
+{
+	uint32_t id = mailbox->TIR >> CAN_TI0R_STID_Pos;
+	uint32_t seq = mailbox->TDLR & 0xFFU;
+	uint64_t wait;
+
+	(void)src;
+	if(test_log_cnt < TEST_LOG_SIZE)
+		test_log[test_log_cnt] = id;
+	test_log_cnt++;
+	if(id == TEST_BULK_ID)
+	{
+		if(seq < TEST_BULK_FRAMES)
+			test_bulk_seen[seq]++;
+		else
+			test_bulk_stray++;
+	}
+	else if(id == TEST_URGENT_ID)
+	{
+		wait = mock_can_bus_frames() - test_urgent_queued - 1U;
+		test_urgent_wait_max = wait > test_urgent_wait_max ? wait : test_urgent_wait_max;
+		test_urgent_cnt++;
+	}
+}
+
+static void test_tp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status)
+{
+	uint32_t i = (uint32_t)(tp - test_tp);
+
+	if(status != I_OK)
+		test_tp_errors++;
+	test_tp_rx_cnt[i]++;
+	test_tp_rx_len[i] = len;
+}
+
+static void test_tp_tx_done(canbus_isotp_t *tp, i_status status)
+{
+	if(status != I_OK)
+		test_tp_errors++;
+	test_tp_tx_cnt[tp - test_tp]++;
+}
+
+static void test_filter_callback_a(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_filter_hits[0]++;
+}
+
+static void test_filter_callback_b(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_filter_hits[1]++;
+}
+
+/* Every standard id and the extended ones of the test, sent by `from` */
+static void test_filter_sweep(canbus_t *from)
+{
+	canbus_frame_t frame = {.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+
+	test_filter_hits[0] = 0;
+	test_filter_hits[1] = 0;
+	for(frame.id=0;frame.id<0x800U;frame.id++)
+		TEST_CHECK(canbus_send(from, &frame) == I_OK);
+	frame.id_type = CBUS_ID_T_EXTENDED;
+	for(uint32_t i=0;i<=TEST_FILTER_EXT;i++)
+	{
+		frame.id = 0x18FF0000U + i * 0x101U;
+		TEST_CHECK(canbus_send(from, &frame) == I_OK);
+	}
+}
+
+/* Slow enough for the writer to get ahead of the dispatch on the chain */
+static void test_rcu_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	for(volatile uint32_t k=0;k<64U;k++);
+	test_rcu_hits++;
+}
+
+/* Set on nodes the driver handed back: a dispatch must never get here */
+static void test_rcu_stale_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_rcu_stale++;
+}
+
+/* Plays the task adding and removing callbacks while the main thread takes
+   the RX interrupts */
+static void *test_rcu_writer(void *arg)
+{
+	canbus_callback_t *node;
+
+	(void)arg;
+	for(uint32_t i=0;!test_rcu_stop;i++)
+	{
+		node = &test_rcu_nodes[i % TEST_RCU_NODES];
+		if(canbus_callback_exists(&test_bus_a, node) == I_EXISTS)
+		{
+			if(canbus_callback_remove(&test_bus_a, node) != I_OK)
+				test_rcu_failed++;
+			continue;
+		}
+		while(canbus_callback_reclaim(&test_bus_a) != I_OK);
+		/* Unreachable now, poison it for a while before reusing it */
+		node->callback = test_rcu_stale_callback;
+		for(volatile uint32_t k=0;k<32U;k++);
+		if(canbus_callback_register(&test_bus_a, node, TEST_RCU_ID, 0, CBUS_ID_T_STANDARD, test_rcu_callback, CBUS_CB_ISR) != I_OK)
+			test_rcu_failed++;
+		test_rcu_cycles++;
+	}
+	for(uint32_t i=0;i<TEST_RCU_NODES;i++)
+		(void)canbus_callback_remove(&test_bus_a, &test_rcu_nodes[i]);
+	return NULL;
+}
+
+/* Mailboxes and queue full of bulk frames, the bus paced one frame at a
+   time so the pending mailboxes keep losing arbitration: every urgent frame
+   goes out next, and the bulk frame it pushed out of its mailbox, aborted or
+   lost, still goes out exactly once */
+static void test_preemption(void)
+{
+	canbus_frame_t bulk = {.id = TEST_BULK_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	canbus_frame_t urgent = {.id = TEST_URGENT_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 2};
+	static const uint32_t order[] = {TEST_BULK_ID, TEST_URGENT_ID, TEST_BULK_ID - 1U, TEST_BULK_ID + 1U, TEST_BULK_ID + 2U};
+	uint32_t start;
+
+	test_setup();
+	mock_can_set_auto_transmit(0);
+	mock_can_bus_hook(test_bus_hook);
+	for(uint32_t i=0;i<TEST_BULK_FRAMES;i++)
+	{
+		bulk.dt[0] = (uint8_t)i;
+		while(canbus_send(&test_bus_a, &bulk) == I_FULL)
+			mock_can_bus_run(1);
+		if((i % TEST_URGENT_EVERY) == TEST_URGENT_EVERY - 1U)
+		{
+			test_urgent_queued = mock_can_bus_frames();
+			while(canbus_send(&test_bus_a, &urgent) == I_FULL)
+			{
+				mock_can_bus_run(1);
+				test_urgent_queued = mock_can_bus_frames();
+			}
+			mock_can_bus_run(1);
+		}
+	}
+	start = HAL_GetTick();
+	while(mock_can_bus_run(0xFFFFFFFFU) != 0 && HAL_GetTick() - start < TEST_TIMEOUT_MS);
+
+	TEST_CHECK(test_urgent_cnt == TEST_BULK_FRAMES / TEST_URGENT_EVERY);
+	TEST_CHECK(test_urgent_wait_max == 0);
+	TEST_CHECK(test_bulk_stray == 0);
+	for(uint32_t i=0;i<TEST_BULK_FRAMES;i++)
+		TEST_CHECK(test_bulk_seen[i] == 1U);
+	TEST_CHECK(test_bus_a.tx_queue.mailbox_abort == 0);
+
+	/* 0x701 and 0x702 lose arbitration against 0x700, 0x6FF takes the free
+	   mailbox: the urgent frame aborts 0x702, which completes with ALST and
+	   has to go back into the queue */
+	test_log_cnt = 0;
+	bulk.dt[0] = 0xFFU;
+	for(uint32_t i=0;i<3U;i++)
+	{
+		bulk.id = TEST_BULK_ID + 2U - i;
+		TEST_CHECK(canbus_send(&test_bus_a, &bulk) == I_OK);
+	}
+	TEST_CHECK(mock_can_bus_run(1) == 1U);
+	bulk.id = TEST_BULK_ID - 1U;
+	TEST_CHECK(canbus_send(&test_bus_a, &bulk) == I_OK);
+	TEST_CHECK(canbus_send(&test_bus_a, &urgent) == I_OK);
+	start = HAL_GetTick();
+	while(mock_can_bus_run(0xFFFFFFFFU) != 0 && HAL_GetTick() - start < TEST_TIMEOUT_MS);
+	mock_can_bus_hook(NULL);
+	mock_can_set_auto_transmit(1);
+
+	TEST_CHECK(test_log_cnt == sizeof(order) / sizeof(order[0]));
+	for(uint32_t i=0;i<sizeof(order) / sizeof(order[0]);i++)
+		TEST_CHECK(test_log[i] == order[i]);
+	TEST_CHECK(test_bus_a.tx_queue.mailbox_abort == 0 && test_bus_a.tx_queue.count == 0);
+}
+
+/* Bus-off: a frame sent meanwhile waits in the queue, the interface comes
+   back after the backoff and the 128 x 11 recessive bits and sends it */
+static void test_recovery(void)
+{
+	canbus_frame_t frame = {.id = TEST_RECOVERY_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	canbus_stats_t stats;
+	uint64_t frames;
+	uint32_t start;
+
+	test_setup();
+	frames = mock_can_bus_frames();
+	for(uint32_t i=0;i<2U;i++)
+	{
+		mock_can_inject_bus_off(test_bus_a.hcan);
+		TEST_CHECK(test_bus_a.recovery.state != CBUS_RC_IDLE);
+		TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+		TEST_CHECK(mock_can_bus_frames() - frames == i);
+
+		start = HAL_GetTick();
+		while(test_bus_a.recovery.state != CBUS_RC_IDLE && HAL_GetTick() - start < TEST_TIMEOUT_MS)
+			canbus_recover_if_needs(&test_bus_a);
+		TEST_CHECK(test_bus_a.recovery.state == CBUS_RC_IDLE);
+		TEST_CHECK((test_bus_a.hcan->Instance->ESR & CAN_ESR_BOFF) == 0);
+		TEST_CHECK(mock_can_bus_frames() - frames == i + 1U);
+	}
+
+	TEST_CHECK(canbus_stats_snapshot(&test_bus_a, &stats) == I_OK);
+	TEST_CHECK(stats.bus_off == 2U);
+	TEST_CHECK(stats.recovery_ticks[1] >= CANBUS_RECOVERY_BACKOFF_MIN);
+	TEST_CHECK(test_bus_a.recovery.backoff <= CANBUS_RECOVERY_BACKOFF_MAX);
+	TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+	TEST_CHECK(mock_can_bus_frames() - frames == 3U);
+}
+
+/* The locks mask up to CANBUS_IRQ_PRIORITY: no line of the interface may
+   be more urgent, a less urgent one is fine */
+static void test_irq_priority(void)
+{
+	mock_can_reset();
+	NVIC_SetPriority(CAN1_RX1_IRQn, CANBUS_IRQ_PRIORITY - 1U);
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_INVALID);
+	NVIC_SetPriority(CAN1_RX1_IRQn, CANBUS_IRQ_PRIORITY);
+	NVIC_SetPriority(CAN1_RX0_IRQn, CANBUS_IRQ_PRIORITY + 2U);
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_OK);
+	NVIC_SetPriority(CAN2_SCE_IRQn, CANBUS_IRQ_PRIORITY - 1U);
+	TEST_CHECK(canbus_initialize(&test_bus_b) == I_INVALID);
+}
+
+/* Two multi-frame requests at once on the same request id, one per
+   interface: each reaches the session of the interface it came in on */
+static void test_isotp(void)
+{
+	static const uint32_t bus[TEST_TP_SESSIONS] = {0, 1, 0, 1};
+	static const uint32_t tx_id[TEST_TP_SESSIONS] = {TEST_TP_RESPONSE_ID, TEST_TP_RESPONSE_ID + 1U, TEST_TP_REQUEST_ID, TEST_TP_REQUEST_ID};
+	static const uint32_t rx_id[TEST_TP_SESSIONS] = {TEST_TP_REQUEST_ID, TEST_TP_REQUEST_ID, TEST_TP_RESPONSE_ID + 1U, TEST_TP_RESPONSE_ID};
+	canbus_isotp_t dup;
+	uint32_t start;
+
+	test_setup();
+	for(uint32_t i=0;i<TEST_TP_SESSIONS;i++)
+	{
+		for(uint32_t k=0;k<TEST_TP_SIZE;k++)
+			test_tp_tx[i][k] = (uint8_t)(k * 3U + i * 64U);
+		test_tp[i] = (canbus_isotp_t){.canbus = bus[i] == 0 ? &test_bus_a : &test_bus_b, .tx_id = tx_id[i], .rx_id = rx_id[i],
+			.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .block_size = 4, .st_min = 0,
+			.rx_buf = test_tp_rx[i], .rx_size = sizeof(test_tp_rx[i]), .rx_done = test_tp_rx_done, .tx_done = test_tp_tx_done};
+		TEST_CHECK(canbus_isotp_open(&test_tp[i], CBUS_CB_ISR) == I_OK);
+	}
+
+	dup = (canbus_isotp_t){.canbus = &test_bus_a, .tx_id = TEST_TP_RESPONSE_ID + 2U, .rx_id = TEST_TP_REQUEST_ID,
+		.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .rx_buf = test_tp_rx[TEST_TP_ECU_A],
+		.rx_size = sizeof(test_tp_rx[TEST_TP_ECU_A])};
+	TEST_CHECK(canbus_isotp_open(&dup, CBUS_CB_ISR) == I_EXISTS);
+
+	TEST_CHECK(canbus_isotp_send(&test_tp[TEST_TP_TESTER_B], test_tp_tx[TEST_TP_TESTER_B], TEST_TP_SIZE) == I_OK);
+	TEST_CHECK(canbus_isotp_send(&test_tp[TEST_TP_TESTER_A], test_tp_tx[TEST_TP_TESTER_A], TEST_TP_SIZE) == I_OK);
+	start = HAL_GetTick();
+	while((test_tp_tx_cnt[TEST_TP_TESTER_A] == 0 || test_tp_tx_cnt[TEST_TP_TESTER_B] == 0) && test_tp_errors == 0
+		&& HAL_GetTick() - start < TEST_TIMEOUT_MS)
+		(void)canbus_isotp_process();
+
+	TEST_CHECK(test_tp_errors == 0);
+	TEST_CHECK(test_tp_tx_cnt[TEST_TP_TESTER_A] == 1U && test_tp_tx_cnt[TEST_TP_TESTER_B] == 1U);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_ECU_A] == 1U && test_tp_rx_len[TEST_TP_ECU_A] == TEST_TP_SIZE);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_ECU_B] == 1U && test_tp_rx_len[TEST_TP_ECU_B] == TEST_TP_SIZE);
+	TEST_CHECK(memcmp(test_tp_rx[TEST_TP_ECU_A], test_tp_tx[TEST_TP_TESTER_B], TEST_TP_SIZE) == 0);
+	TEST_CHECK(memcmp(test_tp_rx[TEST_TP_ECU_B], test_tp_tx[TEST_TP_TESTER_A], TEST_TP_SIZE) == 0);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_TESTER_A] == 0 && test_tp_rx_cnt[TEST_TP_TESTER_B] == 0);
+
+	for(uint32_t i=0;i<TEST_TP_SESSIONS;i++)
+		TEST_CHECK(canbus_isotp_close(&test_tp[i]) == I_OK);
+	TEST_CHECK(canbus_callback_reclaim(&test_bus_a) == I_OK);
+	TEST_CHECK(canbus_isotp_open(&dup, CBUS_CB_ISR) == I_OK);
+	TEST_CHECK(canbus_isotp_close(&dup) == I_OK);
+}
+
+/* Callbacks added to both interfaces in turn: each gets the banks of its own
+   list, one to one while they fit, merged once they do not, and lets every
+   id it has a callback for through */
+static void test_filters(void)
+{
+	canbus_filter_report_t *report = &test_bus_a.filter_report;
+
+	test_setup();
+	for(uint32_t i=0;i<TEST_FILTER_EXACT;i++)
+	{
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x100U + i * 7U, 0, CBUS_ID_T_STANDARD, test_filter_callback_a) == I_OK);
+		TEST_CHECK(canbus_callback_add(&test_bus_b, 0x104U + i * 7U, 0, CBUS_ID_T_STANDARD, test_filter_callback_b) == I_OK);
+	}
+	for(uint32_t i=0;i<TEST_FILTER_EXT;i++)
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x18FF0000U + i * 0x101U, 0, CBUS_ID_T_EXTENDED, test_filter_callback_a) == I_OK);
+	TEST_CHECK(canbus_callback_add_ex(&test_bus_a, 0x600, 0x7F0, CBUS_ID_T_STANDARD, test_filter_callback_a, CBUS_CB_FIFO1) == I_OK);
+
+	/* Four exact standard ids a bank, two extended ones, the mask alone */
+	TEST_CHECK(report->banks == TEST_FILTER_EXACT / 4U + (TEST_FILTER_EXT + 1U) / 2U + 1U);
+	TEST_CHECK(report->ratio == 1000U);
+	TEST_CHECK(test_bus_b.filter_report.banks == TEST_FILTER_EXACT / 4U);
+	test_filter_sweep(&test_bus_b);
+	TEST_CHECK(test_filter_hits[0] == TEST_FILTER_EXACT + 16U + TEST_FILTER_EXT);
+	test_filter_sweep(&test_bus_a);
+	TEST_CHECK(test_filter_hits[1] == TEST_FILTER_EXACT);
+
+	/* More exact ids than the banks of the interface hold */
+	for(uint32_t i=0;i<TEST_FILTER_EXTRA;i++)
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x300U + i * 11U, 0, CBUS_ID_T_STANDARD, test_filter_callback_a) == I_OK);
+	TEST_CHECK(report->banks <= CANBUS_FILTERS_SLAVE_START);
+	TEST_CHECK(report->ratio > 1000U);
+	test_filter_sweep(&test_bus_b);
+	TEST_CHECK(test_filter_hits[0] == TEST_FILTER_EXACT + TEST_FILTER_EXTRA + 16U + TEST_FILTER_EXT);
+	TEST_CHECK(test_bus_b.filter_report.banks == TEST_FILTER_EXACT / 4U);
+}
+
+/* A second thread adds and removes callbacks on one id while its frames
+   keep arriving: no dispatch ever lands on a node the driver handed back */
+static void test_rcu(void)
+{
+	CAN_TxHeaderTypeDef header =
+	{
+		.StdId = TEST_RCU_ID,
+		.IDE = CAN_ID_STD,
+		.RTR = CAN_RTR_DATA,
+		.DLC = 8,
+		.TransmitGlobalTime = DISABLE
+	};
+	uint8_t data[8] = {0};
+	pthread_t writer;
+	uint32_t start;
+
+	test_setup();
+	mock_irq_bind();
+	TEST_CHECK(pthread_create(&writer, NULL, test_rcu_writer, NULL) == 0);
+	start = HAL_GetTick();
+	while((test_rcu_hits < TEST_RCU_HITS || test_rcu_cycles < TEST_RCU_CYCLES) && HAL_GetTick() - start < 10U * TEST_TIMEOUT_MS)
+		mock_can_inject(&header, data);
+	test_rcu_stop = 1;
+	pthread_join(writer, NULL);
+
+	TEST_CHECK(test_rcu_hits >= TEST_RCU_HITS);
+	TEST_CHECK(test_rcu_cycles >= TEST_RCU_CYCLES);
+	TEST_CHECK(test_rcu_stale == 0);
+	TEST_CHECK(test_rcu_failed == 0);
+	TEST_CHECK(canbus_callback_reclaim(&test_bus_a) == I_OK);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const test_case_t cases[] =
+	{
+		{"preemption", test_preemption},
+		{"recovery", test_recovery},
+		{"irq_priority", test_irq_priority},
+		{"isotp", test_isotp},
+		{"filters", test_filters},
+		{"rcu", test_rcu}
+	};
+
+	return test_main(argc, argv, cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
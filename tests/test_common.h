@@ -0,0 +1,93 @@
+/*!
+	@file   test_common.h
+	@brief  Check & case selection helpers shared by the host tests
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#ifndef TEST_COMMON_H_
+#define TEST_COMMON_H_
+
+#define TEST_TIMEOUT_MS		1000U
+
+/* Reports the failed condition and lets the case run on */
+#define TEST_CHECK(cond)	do{ if(!(cond)) test_fail(__FILE__, __LINE__, #cond); }while(0)
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+typedef struct
+{
+	const char *name;
+	void (*run)(void);
+}test_case_t;
+
+static uint32_t test_failures = 0;
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+static inline void test_fail(const char *file, int line, const char *cond)
+{
+	printf("%s:%d: check failed: %s\n", file, line, cond);
+	test_failures++;
+}
+
+/* Runs the case named on the command line, one per process: the emulated
+   peripherals and the driver state start from reset for each of them */
+static inline int test_main(int argc, char **argv, const test_case_t *cases, uint32_t cnt)
+{
+	if(argc < 2)
+	{
+		printf("usage: %s <case>\n", argv[0]);
+		return 2;
+	}
+	for(uint32_t i=0;i<cnt;i++)
+	{
+		if(strcmp(argv[1], cases[i].name) != 0)
+			continue;
+		cases[i].run();
+		printf("%s: %s, %" PRIu32 " failed checks\n", cases[i].name, test_failures == 0 ? "passed" : "FAILED", test_failures);
+		return test_failures == 0 ? 0 : 1;
+	}
+	printf("unknown case %s\n", argv[1]);
+	return 2;
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/
+#endif
@@ -0,0 +1,696 @@
+/*!
+	@file   test_fdcan.c
+	@brief  Host checks of the FDCAN driver against the emulated peripheral
+	@t.odo	-
+	---------------------------------------------------------------------------
+
+
+	MIT License
+	Copyright (c) 2022 Ioannis Deligiannis
+
+	Permission is hereby granted, free of charge, to any person obtaining a copy
+	of this software and associated documentation files (the "Software"), to deal
+	in the Software without restriction, including without limitation the rights
+	to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+	copies of the Software, and to permit persons to whom the Software is
+	furnished to do so, subject to the following conditions:
+	The above copyright notice and this permission notice shall be included in all
+	copies or substantial portions of the Software.
+	THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+	IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+	FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+	AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+	LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+	OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+	SOFTWARE.
+*/
+/******************************************************************************
+* Preprocessor Definitions & Macros
+******************************************************************************/
+
+#define TEST_RECOVERY_ID	0x126U
+#define TEST_TP_REQUEST_ID	0x7E0U
+#define TEST_TP_RESPONSE_ID	0x7E8U
+#define TEST_TP_SESSIONS	4U
+#define TEST_TP_SIZE		100U
+#define TEST_XCORE_RX_ID	0x1D0U
+#define TEST_XCORE_TX_ID	0x1D8U
+#define TEST_XCORE_FRAMES	8U
+#define TEST_CYCLIC_ID		0x340U
+#define TEST_CYCLIC_MSGS	8U
+#define TEST_CYCLIC_TICKS	1000U
+#define TEST_CYCLIC_SENDS	8U
+#define TEST_FILTER_EXACT	40U
+#define TEST_FILTER_EXTRA	30U
+#define TEST_FILTER_EXT		3U
+#define TEST_RCU_ID		0x1C0U
+#define TEST_RCU_NODES		8U
+#define TEST_RCU_HITS		200000U
+#define TEST_RCU_CYCLES		20000U
+#define TEST_PAD_ID		0x2A0U
+#define TEST_PAD_FRAMES		6U
+
+/******************************************************************************
+* Includes
+******************************************************************************/
+
+#include "test_common.h"
+#include <pthread.h>
+#include "drv_canbus.h"
+
+/******************************************************************************
+* Enumerations, structures & Variables
+******************************************************************************/
+
+/* Both interfaces on one emulated bus, neither one hears its own frames */
+static canbus_t test_bus_a =
+{
+	.mx_init = MX_FDCAN1_Init,
+	.hcan = &hfdcan1,
+	.filters = NULL,
+	.filters_cnt = 0,
+	.callbacks = NULL
+};
+
+static canbus_t test_bus_b =
+{
+	.mx_init = MX_FDCAN2_Init,
+	.hcan = &hfdcan2,
+	.filters = NULL,
+	.filters_cnt = 0,
+	.callbacks = NULL
+};
+
+/* ECU A and B answer the same request id on their own interface, each
+   tester sits on the other interface */
+enum
+{
+	TEST_TP_ECU_A = 0,
+	TEST_TP_ECU_B,
+	TEST_TP_TESTER_A,
+	TEST_TP_TESTER_B
+};
+
+static canbus_isotp_t test_tp[TEST_TP_SESSIONS];
+static uint8_t test_tp_rx[TEST_TP_SESSIONS][TEST_TP_SIZE * 2U];
+static uint8_t test_tp_tx[TEST_TP_SESSIONS][TEST_TP_SIZE];
+static uint32_t test_tp_rx_cnt[TEST_TP_SESSIONS];
+static uint32_t test_tp_rx_len[TEST_TP_SESSIONS];
+static uint32_t test_tp_tx_cnt[TEST_TP_SESSIONS];
+static uint32_t test_tp_errors = 0;
+
+/* One channel per interface, the "other core" side driven from the same
+   thread after mock_irq_core(1) */
+static canbus_xcore_shared_t test_xc_shm[3];
+static canbus_xcore_t test_xc_owner[2] =
+{
+	{.shm = &test_xc_shm[0], .canbus = &test_bus_a},
+	{.shm = &test_xc_shm[1], .canbus = &test_bus_b}
+};
+static canbus_xcore_t test_xc_remote[2] =
+{
+	{.shm = &test_xc_shm[0], .canbus = NULL},
+	{.shm = &test_xc_shm[1], .canbus = NULL}
+};
+static canbus_xcore_t test_xc_dup = {.shm = &test_xc_shm[2], .canbus = &test_bus_a};
+static uint32_t test_xc_received[2];
+static uint32_t test_xc_disorder[2];
+static uint32_t test_xc_sent = 0;
+
+static uint32_t test_cyclic_now = 0;
+static uint32_t test_cyclic_cnt = 0;
+static uint32_t test_cyclic_ticks[TEST_CYCLIC_SENDS];
+static uint8_t test_cyclic_data[TEST_CYCLIC_SENDS][8];
+
+static uint32_t test_filter_hits[2];
+
+static uint32_t test_pad_cnt = 0;
+static uint32_t test_pad_dirty = 0;
+
+static canbus_callback_t test_rcu_nodes[TEST_RCU_NODES];
+static volatile uint32_t test_rcu_stop = 0;
+static volatile uint32_t test_rcu_cycles = 0;
+static volatile uint32_t test_rcu_failed = 0;
+static volatile uint64_t test_rcu_hits = 0;
+static volatile uint64_t test_rcu_stale = 0;
+
+/******************************************************************************
+* Declaration | Static Functions
+******************************************************************************/
+
+static void test_setup(void);
+static void test_tp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status);
+static void test_tp_tx_done(canbus_isotp_t *tp, i_status status);
+static void test_xcore_received(uint32_t channel, canbus_frame_t *frame);
+static void test_xcore_callback_a(canbus_frame_t *frame);
+static void test_xcore_callback_b(canbus_frame_t *frame);
+static void test_xcore_sent(canbus_frame_t *frame);
+static void test_cyclic_callback(canbus_frame_t *frame);
+static void test_cyclic_run(uint32_t until);
+static void test_filter_callback_a(canbus_frame_t *frame);
+static void test_filter_callback_b(canbus_frame_t *frame);
+static void test_filter_sweep(canbus_t *from);
+static void test_pad_callback(canbus_frame_t *frame);
+static void test_rcu_callback(canbus_frame_t *frame);
+static void test_rcu_stale_callback(canbus_frame_t *frame);
+static void *test_rcu_writer(void *arg);
+static void test_recovery(void);
+static void test_irq_priority(void);
+static void test_isotp(void);
+static void test_xcore(void);
+static void test_cyclic(void);
+static void test_filters(void);
+static void test_rcu(void);
+static void test_padding(void);
+
+/******************************************************************************
+* Definition  | Static Functions
+******************************************************************************/
+
+static void test_setup(void)
+{
+	mock_fdcan_reset();
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_OK);
+	TEST_CHECK(canbus_initialize(&test_bus_b) == I_OK);
+}
+
+static void test_tp_rx_done(canbus_isotp_t *tp, uint32_t len, i_status status)
+{
+	uint32_t i = (uint32_t)(tp - test_tp);
+
+	if(status != I_OK)
+		test_tp_errors++;
+	test_tp_rx_cnt[i]++;
+	test_tp_rx_len[i] = len;
+}
+
+static void test_tp_tx_done(canbus_isotp_t *tp, i_status status)
+{
+	if(status != I_OK)
+		test_tp_errors++;
+	test_tp_tx_cnt[tp - test_tp]++;
+}
+
+static void test_xcore_received(uint32_t channel, canbus_frame_t *frame)
+{
+	uint32_t seq;
+
+	memcpy(&seq, frame->dt, sizeof(seq));
+	if(seq != test_xc_received[channel])
+		test_xc_disorder[channel]++;
+	test_xc_received[channel]++;
+}
+
+static void test_xcore_callback_a(canbus_frame_t *frame)
+{
+	test_xcore_received(0, frame);
+}
+
+static void test_xcore_callback_b(canbus_frame_t *frame)
+{
+	test_xcore_received(1, frame);
+}
+
+static void test_xcore_sent(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_xc_sent++;
+}
+
+static void test_cyclic_callback(canbus_frame_t *frame)
+{
+	if(frame->id != TEST_CYCLIC_ID)
+		return;
+	if(test_cyclic_cnt < TEST_CYCLIC_SENDS)
+	{
+		test_cyclic_ticks[test_cyclic_cnt] = test_cyclic_now;
+		memcpy(test_cyclic_data[test_cyclic_cnt], frame->dt, 8);
+	}
+	test_cyclic_cnt++;
+}
+
+/* Timer interrupt stand-in, as fast as it goes: the schedule is counted in
+   ticks only */
+static void test_cyclic_run(uint32_t until)
+{
+	while(test_cyclic_now < until)
+	{
+		test_cyclic_now++;
+		(void)canbus_cyclic_tick();
+	}
+}
+
+static void test_filter_callback_a(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_filter_hits[0]++;
+}
+
+static void test_filter_callback_b(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_filter_hits[1]++;
+}
+
+/* Every standard id and the extended ones of the test, sent by `from` */
+static void test_filter_sweep(canbus_t *from)
+{
+	canbus_frame_t frame = {.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+
+	test_filter_hits[0] = 0;
+	test_filter_hits[1] = 0;
+	for(frame.id=0;frame.id<0x800U;frame.id++)
+		TEST_CHECK(canbus_send(from, &frame) == I_OK);
+	frame.id_type = CBUS_ID_T_EXTENDED;
+	for(uint32_t i=0;i<=TEST_FILTER_EXT;i++)
+	{
+		frame.id = 0x18FF0000U + i * 0x101U;
+		TEST_CHECK(canbus_send(from, &frame) == I_OK);
+	}
+}
+
+/* 13 bytes sent go out as 16, the last 3 must be zeros */
+static void test_pad_callback(canbus_frame_t *frame)
+{
+	if(frame->dlc != 16U || frame->dt[12] != 0x5AU || frame->dt[13] != 0 || frame->dt[14] != 0 || frame->dt[15] != 0)
+		test_pad_dirty++;
+	test_pad_cnt++;
+}
+
+/* Slow enough for the writer to get ahead of the dispatch on the chain */
+static void test_rcu_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	for(volatile uint32_t k=0;k<64U;k++);
+	test_rcu_hits++;
+}
+
+/* Set on nodes the driver handed back: a dispatch must never get here */
+static void test_rcu_stale_callback(canbus_frame_t *frame)
+{
+	(void)frame;
+	test_rcu_stale++;
+}
+
+/* Plays the task adding and removing callbacks while the main thread takes
+   the RX interrupts */
+static void *test_rcu_writer(void *arg)
+{
+	canbus_callback_t *node;
+
+	(void)arg;
+	for(uint32_t i=0;!test_rcu_stop;i++)
+	{
+		node = &test_rcu_nodes[i % TEST_RCU_NODES];
+		if(canbus_callback_exists(&test_bus_a, node) == I_EXISTS)
+		{
+			if(canbus_callback_remove(&test_bus_a, node) != I_OK)
+				test_rcu_failed++;
+			continue;
+		}
+		while(canbus_callback_reclaim(&test_bus_a) != I_OK);
+		/* Unreachable now, poison it for a while before reusing it */
+		node->callback = test_rcu_stale_callback;
+		for(volatile uint32_t k=0;k<32U;k++);
+		if(canbus_callback_register(&test_bus_a, node, TEST_RCU_ID, 0, CBUS_ID_T_STANDARD, test_rcu_callback, CBUS_CB_ISR) != I_OK)
+			test_rcu_failed++;
+		test_rcu_cycles++;
+	}
+	for(uint32_t i=0;i<TEST_RCU_NODES;i++)
+		(void)canbus_callback_remove(&test_bus_a, &test_rcu_nodes[i]);
+	return NULL;
+}
+
+/* Bus-off: a frame sent meanwhile waits in the queue, the interface comes
+   back after the backoff and the 128 x 11 recessive bits and sends it */
+static void test_recovery(void)
+{
+	canbus_frame_t frame = {.id = TEST_RECOVERY_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_FD, .dlc = 8};
+	canbus_stats_t stats;
+	uint64_t frames;
+	uint32_t start;
+
+	test_setup();
+	frames = mock_fdcan_bus_frames();
+	for(uint32_t i=0;i<2U;i++)
+	{
+		mock_fdcan_inject_bus_off(test_bus_a.hcan);
+		TEST_CHECK(test_bus_a.recovery.state != CBUS_RC_IDLE);
+		TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+		TEST_CHECK(mock_fdcan_bus_frames() - frames == i);
+
+		start = HAL_GetTick();
+		while(test_bus_a.recovery.state != CBUS_RC_IDLE && HAL_GetTick() - start < TEST_TIMEOUT_MS)
+			canbus_recover_if_needs(&test_bus_a);
+		TEST_CHECK(test_bus_a.recovery.state == CBUS_RC_IDLE);
+		TEST_CHECK((test_bus_a.hcan->Instance->PSR & FDCAN_PSR_BO) == 0);
+		TEST_CHECK((test_bus_a.hcan->Instance->CCCR & FDCAN_CCCR_INIT) == 0);
+		TEST_CHECK(mock_fdcan_bus_frames() - frames == i + 1U);
+	}
+
+	TEST_CHECK(canbus_stats_snapshot(&test_bus_a, &stats) == I_OK);
+	TEST_CHECK(stats.bus_off == 2U);
+	TEST_CHECK(stats.recovery_ticks[1] >= CANBUS_RECOVERY_BACKOFF_MIN);
+	TEST_CHECK(test_bus_a.recovery.backoff <= CANBUS_RECOVERY_BACKOFF_MAX);
+	TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+	TEST_CHECK(mock_fdcan_bus_frames() - frames == 3U);
+}
+
+/* The locks mask up to CANBUS_IRQ_PRIORITY: no line of the interface may
+   be more urgent, a less urgent one is fine */
+static void test_irq_priority(void)
+{
+	mock_fdcan_reset();
+	NVIC_SetPriority(FDCAN1_IT1_IRQn, CANBUS_IRQ_PRIORITY - 1U);
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_INVALID);
+	NVIC_SetPriority(FDCAN1_IT1_IRQn, CANBUS_IRQ_PRIORITY);
+	NVIC_SetPriority(FDCAN1_IT0_IRQn, CANBUS_IRQ_PRIORITY + 2U);
+	TEST_CHECK(canbus_initialize(&test_bus_a) == I_OK);
+	NVIC_SetPriority(FDCAN2_IT0_IRQn, CANBUS_IRQ_PRIORITY - 1U);
+	TEST_CHECK(canbus_initialize(&test_bus_b) == I_INVALID);
+}
+
+/* Two multi-frame requests at once on the same request id, one per
+   interface: each reaches the session of the interface it came in on */
+static void test_isotp(void)
+{
+	static const uint32_t bus[TEST_TP_SESSIONS] = {0, 1, 0, 1};
+	static const uint32_t tx_id[TEST_TP_SESSIONS] = {TEST_TP_RESPONSE_ID, TEST_TP_RESPONSE_ID + 1U, TEST_TP_REQUEST_ID, TEST_TP_REQUEST_ID};
+	static const uint32_t rx_id[TEST_TP_SESSIONS] = {TEST_TP_REQUEST_ID, TEST_TP_REQUEST_ID, TEST_TP_RESPONSE_ID + 1U, TEST_TP_RESPONSE_ID};
+	canbus_isotp_t dup;
+	uint32_t start;
+
+	test_setup();
+	for(uint32_t i=0;i<TEST_TP_SESSIONS;i++)
+	{
+		for(uint32_t k=0;k<TEST_TP_SIZE;k++)
+			test_tp_tx[i][k] = (uint8_t)(k * 3U + i * 64U);
+		test_tp[i] = (canbus_isotp_t){.canbus = bus[i] == 0 ? &test_bus_a : &test_bus_b, .tx_id = tx_id[i], .rx_id = rx_id[i],
+			.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .block_size = 4, .st_min = 0,
+			.rx_buf = test_tp_rx[i], .rx_size = sizeof(test_tp_rx[i]), .rx_done = test_tp_rx_done, .tx_done = test_tp_tx_done};
+		TEST_CHECK(canbus_isotp_open(&test_tp[i], CBUS_CB_ISR) == I_OK);
+	}
+
+	/* Same request id twice on one interface: the second one would never
+	   see a frame */
+	dup = (canbus_isotp_t){.canbus = &test_bus_a, .tx_id = TEST_TP_RESPONSE_ID + 2U, .rx_id = TEST_TP_REQUEST_ID,
+		.id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .rx_buf = test_tp_rx[TEST_TP_ECU_A],
+		.rx_size = sizeof(test_tp_rx[TEST_TP_ECU_A])};
+	TEST_CHECK(canbus_isotp_open(&dup, CBUS_CB_ISR) == I_EXISTS);
+
+	TEST_CHECK(canbus_isotp_send(&test_tp[TEST_TP_TESTER_B], test_tp_tx[TEST_TP_TESTER_B], TEST_TP_SIZE) == I_OK);
+	TEST_CHECK(canbus_isotp_send(&test_tp[TEST_TP_TESTER_A], test_tp_tx[TEST_TP_TESTER_A], TEST_TP_SIZE) == I_OK);
+	start = HAL_GetTick();
+	while((test_tp_tx_cnt[TEST_TP_TESTER_A] == 0 || test_tp_tx_cnt[TEST_TP_TESTER_B] == 0) && test_tp_errors == 0
+		&& HAL_GetTick() - start < TEST_TIMEOUT_MS)
+		(void)canbus_isotp_process();
+
+	TEST_CHECK(test_tp_errors == 0);
+	TEST_CHECK(test_tp_tx_cnt[TEST_TP_TESTER_A] == 1U && test_tp_tx_cnt[TEST_TP_TESTER_B] == 1U);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_ECU_A] == 1U && test_tp_rx_len[TEST_TP_ECU_A] == TEST_TP_SIZE);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_ECU_B] == 1U && test_tp_rx_len[TEST_TP_ECU_B] == TEST_TP_SIZE);
+	TEST_CHECK(memcmp(test_tp_rx[TEST_TP_ECU_A], test_tp_tx[TEST_TP_TESTER_B], TEST_TP_SIZE) == 0);
+	TEST_CHECK(memcmp(test_tp_rx[TEST_TP_ECU_B], test_tp_tx[TEST_TP_TESTER_A], TEST_TP_SIZE) == 0);
+	TEST_CHECK(test_tp_rx_cnt[TEST_TP_TESTER_A] == 0 && test_tp_rx_cnt[TEST_TP_TESTER_B] == 0);
+
+	for(uint32_t i=0;i<TEST_TP_SESSIONS;i++)
+		TEST_CHECK(canbus_isotp_close(&test_tp[i]) == I_OK);
+	TEST_CHECK(canbus_callback_reclaim(&test_bus_a) == I_OK);
+	TEST_CHECK(canbus_isotp_open(&dup, CBUS_CB_ISR) == I_OK);
+	TEST_CHECK(canbus_isotp_close(&dup) == I_OK);
+}
+
+/* Channels of both interfaces: each forwards only the frames its own
+   interface took in, in order, and sends what the other core queued */
+static void test_xcore(void)
+{
+	canbus_frame_t frame = {.id = TEST_XCORE_RX_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_STD, .dlc = 8};
+	uint32_t moved;
+
+	test_setup();
+	mock_irq_core(1);
+	TEST_CHECK(canbus_xcore_init(&test_xc_remote[0]) == I_WAIT);
+	mock_irq_core(0);
+	TEST_CHECK(canbus_xcore_init(&test_xc_owner[0]) == I_OK);
+	TEST_CHECK(canbus_xcore_init(&test_xc_owner[1]) == I_OK);
+	TEST_CHECK(canbus_xcore_init(&test_xc_dup) == I_EXISTS);
+	TEST_CHECK(canbus_xcore_init(&test_xc_owner[1]) == I_EXISTS);
+	TEST_CHECK(canbus_callback_add(&test_bus_b, TEST_XCORE_TX_ID, 0, CBUS_ID_T_STANDARD, test_xcore_sent) == I_OK);
+
+	mock_irq_core(1);
+	TEST_CHECK(canbus_xcore_init(&test_xc_remote[0]) == I_OK);
+	TEST_CHECK(canbus_xcore_init(&test_xc_remote[1]) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_add(&test_xc_remote[0], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD, test_xcore_callback_a) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_add(&test_xc_remote[0], TEST_XCORE_RX_ID, 0x7F0, CBUS_ID_T_STANDARD, test_xcore_callback_a) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_add(&test_xc_remote[1], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD, test_xcore_callback_b) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[0], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD) == I_WAIT);
+	mock_irq_core(0);
+	(void)canbus_xcore_process(&test_xc_owner[0]);
+	(void)canbus_xcore_process(&test_xc_owner[1]);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[0], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[0], TEST_XCORE_RX_ID, 0x7F0, CBUS_ID_T_STANDARD) == I_EXISTS);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[1], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD) == I_OK);
+
+	/* Sent by B, taken in by A only, and the other way round */
+	for(uint32_t i=0;i<TEST_XCORE_FRAMES;i++)
+	{
+		memcpy(frame.dt, &i, sizeof(i));
+		TEST_CHECK(canbus_send(&test_bus_b, &frame) == I_OK);
+		if(i < TEST_XCORE_FRAMES / 2U)
+			TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+	}
+	TEST_CHECK(test_xc_shm[0].rx.head == TEST_XCORE_FRAMES);
+	TEST_CHECK(test_xc_shm[1].rx.head == TEST_XCORE_FRAMES / 2U);
+
+	mock_irq_core(1);
+	TEST_CHECK(canbus_xcore_process(&test_xc_remote[0]) == TEST_XCORE_FRAMES);
+	TEST_CHECK(canbus_xcore_process(&test_xc_remote[1]) == TEST_XCORE_FRAMES / 2U);
+	TEST_CHECK(test_xc_received[0] == TEST_XCORE_FRAMES && test_xc_disorder[0] == 0);
+	TEST_CHECK(test_xc_received[1] == TEST_XCORE_FRAMES / 2U && test_xc_disorder[1] == 0);
+
+	/* Ring full: the owner drops and counts, never overwrites */
+	mock_irq_core(0);
+	for(uint32_t i=0;i<CANBUS_XCORE_RING_SIZE + 2U;i++)
+	{
+		moved = test_xc_received[0] + i;
+		memcpy(frame.dt, &moved, sizeof(moved));
+		TEST_CHECK(canbus_send(&test_bus_b, &frame) == I_OK);
+	}
+	TEST_CHECK(test_xc_shm[0].rx.dropped == 2U);
+	mock_irq_core(1);
+	TEST_CHECK(canbus_xcore_process(&test_xc_remote[0]) == CANBUS_XCORE_RING_SIZE);
+	TEST_CHECK(test_xc_disorder[0] == 0);
+
+	/* Other core -> owner -> bus */
+	frame.id = TEST_XCORE_TX_ID;
+	for(uint32_t i=0;i<CANBUS_XCORE_RING_SIZE;i++)
+		TEST_CHECK(canbus_xcore_send(&test_xc_remote[0], &frame) == I_OK);
+	TEST_CHECK(canbus_xcore_send(&test_xc_remote[0], &frame) == I_FULL);
+	mock_irq_core(0);
+	TEST_CHECK(canbus_xcore_process(&test_xc_owner[0]) == CANBUS_XCORE_RING_SIZE);
+	TEST_CHECK(test_xc_sent == CANBUS_XCORE_RING_SIZE);
+
+	/* Removed: the node goes back once the driver reclaimed it */
+	mock_irq_core(1);
+	TEST_CHECK(canbus_xcore_callback_remove(&test_xc_remote[0], TEST_XCORE_RX_ID, 0x7F0, CBUS_ID_T_STANDARD) == I_OK);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[0], TEST_XCORE_RX_ID, 0x7F0, CBUS_ID_T_STANDARD) == I_NOTEXISTS);
+	TEST_CHECK(canbus_xcore_callback_remove(&test_xc_remote[0], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD) == I_OK);
+	mock_irq_core(0);
+	for(uint32_t i=0;i<2U;i++)
+		(void)canbus_xcore_process(&test_xc_owner[0]);
+	TEST_CHECK(canbus_xcore_callback_status(&test_xc_remote[0], TEST_XCORE_RX_ID, 0, CBUS_ID_T_STANDARD) == I_NOTEXISTS);
+	moved = test_xc_shm[0].rx.head;
+	frame.id = TEST_XCORE_RX_ID;
+	TEST_CHECK(canbus_send(&test_bus_b, &frame) == I_OK);
+	TEST_CHECK(test_xc_shm[0].rx.head == moved);
+	TEST_CHECK(test_xc_shm[1].rx.head == TEST_XCORE_FRAMES / 2U);
+}
+
+/* Ticks counted from 0: a message goes out on the ticks equal to its
+   offset modulo its period, with the payload of the last updates */
+static void test_cyclic(void)
+{
+	static const uint32_t periods[TEST_CYCLIC_MSGS] = {10, 10, 20, 20, 50, 100, 100, 1000};
+	static canbus_tx_template_t templates[TEST_CYCLIC_MSGS];
+	canbus_cyclic_stats_t stats;
+	uint8_t first[8] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17};
+	uint8_t second[8] = {0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27};
+	uint8_t head[2] = {0x30, 0x31};
+	uint32_t expected = 0;
+	uint32_t peak = 0;
+	uint32_t sent = 0;
+	uint32_t cnt;
+
+	test_setup();
+	TEST_CHECK(canbus_callback_add(&test_bus_b, TEST_CYCLIC_ID, 0x7F0, CBUS_ID_T_STANDARD, test_cyclic_callback) == I_OK);
+	for(uint32_t i=0;i<TEST_CYCLIC_MSGS;i++)
+		TEST_CHECK(canbus_tx_template_init(&templates[i], CBUS_FR_FRM_STD, CBUS_ID_T_STANDARD, TEST_CYCLIC_ID + i, 8) == I_OK);
+
+	TEST_CHECK(canbus_cyclic_add(&test_bus_a, &templates[0], 10, 10) == I_INVALID);
+	TEST_CHECK(canbus_cyclic_add(&test_bus_a, &templates[0], 10, 3) == I_OK);
+	TEST_CHECK(canbus_cyclic_add(&test_bus_a, &templates[0], 10, 3) == I_EXISTS);
+	TEST_CHECK(canbus_cyclic_offset(&test_bus_a, &templates[0]) == 3U);
+	TEST_CHECK(canbus_cyclic_update(&test_bus_a, &templates[0], first, 8) == I_OK);
+	test_cyclic_run(12);
+	TEST_CHECK(canbus_cyclic_update(&test_bus_a, &templates[0], second, 8) == I_OK);
+	TEST_CHECK(canbus_cyclic_update(&test_bus_a, &templates[0], head, 2) == I_OK);
+	test_cyclic_run(33);
+
+	TEST_CHECK(test_cyclic_cnt == 4U);
+	TEST_CHECK(test_cyclic_ticks[0] == 3U && test_cyclic_ticks[1] == 13U && test_cyclic_ticks[2] == 23U && test_cyclic_ticks[3] == 33U);
+	TEST_CHECK(memcmp(test_cyclic_data[0], first, 8) == 0);
+	/* The short update keeps the tail of the one before it */
+	TEST_CHECK(memcmp(test_cyclic_data[1], head, 2) == 0 && memcmp(&test_cyclic_data[1][2], &second[2], 6) == 0);
+	TEST_CHECK(canbus_cyclic_stats(&test_bus_a, &templates[0], &stats) == I_OK);
+	TEST_CHECK(stats.sent == 4U && stats.full == 0 && stats.errors == 0 && stats.skipped == 0 && stats.late_max == 0);
+
+	TEST_CHECK(canbus_cyclic_remove(&test_bus_a, &templates[0]) == I_OK);
+	TEST_CHECK(canbus_cyclic_remove(&test_bus_a, &templates[0]) == I_NOTEXISTS);
+	test_cyclic_run(test_cyclic_now + 100U);
+	TEST_CHECK(test_cyclic_cnt == 4U);
+	TEST_CHECK(canbus_cyclic_offset(&test_bus_a, &templates[0]) == CANBUS_CYCLIC_AUTO);
+
+	/* Spread over the periods, never two frames on one tick */
+	for(uint32_t i=0;i<TEST_CYCLIC_MSGS;i++)
+	{
+		TEST_CHECK(canbus_cyclic_add(&test_bus_a, &templates[i], periods[i], CANBUS_CYCLIC_AUTO) == I_OK);
+		expected += TEST_CYCLIC_TICKS / periods[i];
+	}
+	for(uint32_t t=0;t<TEST_CYCLIC_TICKS;t++)
+	{
+		test_cyclic_now++;
+		cnt = canbus_cyclic_tick();
+		sent += cnt;
+		peak = cnt > peak ? cnt : peak;
+	}
+	TEST_CHECK(peak == 1U);
+	TEST_CHECK(sent == expected);
+	for(uint32_t i=0;i<TEST_CYCLIC_MSGS;i++)
+	{
+		TEST_CHECK(canbus_cyclic_offset(&test_bus_a, &templates[i]) < periods[i]);
+		TEST_CHECK(canbus_cyclic_stats(&test_bus_a, &templates[i], &stats) == I_OK);
+		TEST_CHECK(stats.sent == TEST_CYCLIC_TICKS / periods[i] && stats.full == 0 && stats.skipped == 0);
+		TEST_CHECK(canbus_cyclic_remove(&test_bus_a, &templates[i]) == I_OK);
+	}
+	TEST_CHECK(canbus_cyclic_tick() == 0);
+}
+
+/* Callbacks added to both interfaces in turn: each gets the elements of its
+   own list, one to one while they fit, merged once they do not, and lets
+   every id it has a callback for through */
+static void test_filters(void)
+{
+	canbus_filter_report_t *report = &test_bus_a.filter_report;
+
+	test_setup();
+	for(uint32_t i=0;i<TEST_FILTER_EXACT;i++)
+	{
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x100U + i * 7U, 0, CBUS_ID_T_STANDARD, test_filter_callback_a) == I_OK);
+		TEST_CHECK(canbus_callback_add(&test_bus_b, 0x104U + i * 7U, 0, CBUS_ID_T_STANDARD, test_filter_callback_b) == I_OK);
+	}
+	for(uint32_t i=0;i<TEST_FILTER_EXT;i++)
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x18FF0000U + i * 0x101U, 0, CBUS_ID_T_EXTENDED, test_filter_callback_a) == I_OK);
+	TEST_CHECK(canbus_callback_add_ex(&test_bus_a, 0x600, 0x7F0, CBUS_ID_T_STANDARD, test_filter_callback_a, CBUS_CB_FIFO1) == I_OK);
+
+	/* Dual-id elements, two exact ids each, plus the mask */
+	TEST_CHECK(report->std_cnt == TEST_FILTER_EXACT / 2U + 1U);
+	TEST_CHECK(report->ext_cnt == (TEST_FILTER_EXT + 1U) / 2U);
+	TEST_CHECK(report->ratio == 1000U);
+	TEST_CHECK(test_bus_b.filter_report.std_cnt == TEST_FILTER_EXACT / 2U);
+	TEST_CHECK(test_bus_b.filter_report.ext_cnt == 0);
+	test_filter_sweep(&test_bus_b);
+	TEST_CHECK(test_filter_hits[0] == TEST_FILTER_EXACT + 16U + TEST_FILTER_EXT);
+	test_filter_sweep(&test_bus_a);
+	TEST_CHECK(test_filter_hits[1] == TEST_FILTER_EXACT);
+
+	/* More exact ids than dual-id elements */
+	for(uint32_t i=0;i<TEST_FILTER_EXTRA;i++)
+		TEST_CHECK(canbus_callback_add(&test_bus_a, 0x300U + i * 11U, 0, CBUS_ID_T_STANDARD, test_filter_callback_a) == I_OK);
+	TEST_CHECK(report->std_cnt <= test_bus_a.hcan->Init.StdFiltersNbr);
+	TEST_CHECK(report->ext_cnt == (TEST_FILTER_EXT + 1U) / 2U);
+	TEST_CHECK(report->ratio > 1000U);
+	test_filter_sweep(&test_bus_b);
+	TEST_CHECK(test_filter_hits[0] == TEST_FILTER_EXACT + TEST_FILTER_EXTRA + 16U + TEST_FILTER_EXT);
+	TEST_CHECK(test_bus_b.filter_report.std_cnt == TEST_FILTER_EXACT / 2U);
+}
+
+/* A second thread adds and removes callbacks on one id while its frames
+   keep arriving: no dispatch ever lands on a node the driver handed back */
+static void test_rcu(void)
+{
+	FDCAN_TxHeaderTypeDef header =
+	{
+		.Identifier = TEST_RCU_ID,
+		.IdType = FDCAN_STANDARD_ID,
+		.TxFrameType = FDCAN_DATA_FRAME,
+		.DataLength = FDCAN_DLC_BYTES_8,
+		.ErrorStateIndicator = FDCAN_ESI_ACTIVE,
+		.BitRateSwitch = FDCAN_BRS_OFF,
+		.FDFormat = FDCAN_CLASSIC_CAN,
+		.TxEventFifoControl = FDCAN_NO_TX_EVENTS
+	};
+	uint8_t data[8] = {0};
+	pthread_t writer;
+	uint32_t start;
+
+	test_setup();
+	mock_irq_bind();
+	TEST_CHECK(pthread_create(&writer, NULL, test_rcu_writer, NULL) == 0);
+	start = HAL_GetTick();
+	while((test_rcu_hits < TEST_RCU_HITS || test_rcu_cycles < TEST_RCU_CYCLES) && HAL_GetTick() - start < 10U * TEST_TIMEOUT_MS)
+		mock_fdcan_inject(&header, data);
+	test_rcu_stop = 1;
+	pthread_join(writer, NULL);
+
+	TEST_CHECK(test_rcu_hits >= TEST_RCU_HITS);
+	TEST_CHECK(test_rcu_cycles >= TEST_RCU_CYCLES);
+	TEST_CHECK(test_rcu_stale == 0);
+	TEST_CHECK(test_rcu_failed == 0);
+	TEST_CHECK(canbus_callback_reclaim(&test_bus_a) == I_OK);
+}
+
+/* A dlc DataLength rounds up, sent straight to the FIFO and queued behind
+   a full one: the bytes past dlc go out as zeros, never what the caller's
+   buffer or the queue slot held */
+static void test_padding(void)
+{
+	canbus_frame_t frame = {.id = TEST_PAD_ID, .id_type = CBUS_ID_T_STANDARD, .fr_format = CBUS_FR_FRM_FD, .dlc = 13};
+
+	test_setup();
+	TEST_CHECK(canbus_callback_add(&test_bus_b, TEST_PAD_ID, 0, CBUS_ID_T_STANDARD, test_pad_callback) == I_OK);
+	memset(frame.dt, 0xA5, sizeof(frame.dt));
+	frame.dt[12] = 0x5AU;
+	mock_fdcan_set_auto_transmit(0);
+	for(uint32_t i=0;i<TEST_PAD_FRAMES;i++)
+		TEST_CHECK(canbus_send(&test_bus_a, &frame) == I_OK);
+	TEST_CHECK(test_bus_a.tx_queue.head != test_bus_a.tx_queue.tail);
+	while(mock_fdcan_bus_run(0xFFFFFFFFU) != 0);
+	mock_fdcan_set_auto_transmit(1);
+	TEST_CHECK(test_pad_cnt == TEST_PAD_FRAMES);
+	TEST_CHECK(test_pad_dirty == 0);
+}
+
+/******************************************************************************
+* Definition  | Public Functions
+******************************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const test_case_t cases[] =
+	{
+		{"recovery", test_recovery},
+		{"irq_priority", test_irq_priority},
+		{"isotp", test_isotp},
+		{"xcore", test_xcore},
+		{"cyclic", test_cyclic},
+		{"filters", test_filters},
+		{"rcu", test_rcu},
+		{"padding", test_padding}
+	};
+
+	return test_main(argc, argv, cases, sizeof(cases) / sizeof(cases[0]));
+}
+
+/******************************************************************************
+* EOF - NO CODE AFTER THIS LINE
+******************************************************************************/